@@ -61,6 +61,40 @@ class ServerCommand {
 		this.parse(msg, map);
 	}
 
+	// Parses the binary header of a tilebin: message, at @offset of @bytes, as
+	// laid out in wsd/TileDesc.hpp. Returns the text command it stands for,
+	// e.g. 'tile:', the command of its (first and only) tile and the offset of
+	// its image.
+	public static parseBinaryTile(
+		bytes: Uint8Array,
+		offset: number,
+		map: MapZoomInterface,
+	): { kind: string; command: ServerCommand; imageOffset: number } {
+		const view = new DataView(bytes.buffer, bytes.byteOffset + offset);
+		const kinds = ['tile:', 'delta:', 'update:'];
+		const kind = kinds[view.getUint8(1)];
+		const count = view.getUint16(2, true);
+		if (view.getUint8(0) !== 1 || kind === undefined || count !== 1)
+			throw new Error('Unexpected binary tile message');
+
+		const command = new ServerCommand('', map);
+		command.nviewid = view.getInt32(4, true).toString();
+		command.part = view.getInt32(8, true);
+		command.mode = view.getInt32(12, true);
+		command.width = view.getInt32(16, true);
+		command.height = view.getInt32(20, true);
+		command.tileWidth = view.getInt32(24, true);
+		command.tileHeight = view.getInt32(28, true);
+		command.x = view.getInt32(32, true);
+		command.y = view.getInt32(36, true);
+		const id = view.getInt32(44, true);
+		if (id >= 0) command.id = id.toString();
+		command.wireId = view.getUint32(52, true).toString();
+		command.setZoom(map);
+
+		return { kind: kind, command: command, imageOffset: offset + 32 + 28 };
+	}
+
 	public static getParameterValue(s: string): string | undefined {
 		const i = s.indexOf('=');
 		if (i === -1) return undefined;
@@ -180,6 +214,10 @@ class ServerCommand {
 				this.readonly = parseInt(tokens[i].substring(9));
 			}
 		}
+		this.setZoom(map);
+	}
+
+	private setZoom(map: MapZoomInterface): void {
 		if (this.tileWidth && this.tileHeight && map._docLayer) {
 			const defaultZoom = map.options.zoom;
 			const scale = this.tileWidth / map._docLayer.options.tileWidthTwips;
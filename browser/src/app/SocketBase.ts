@@ -332,6 +332,8 @@ class SocketBase {
 
 		msg += ' clientvisiblearea=' + window.makeClientVisibleArea();
 
+		msg += ' tileProtocol=binary';
+
 		this._doSend(msg);
 		for (let i = 0; i < this._msgQueue.length; i++) {
 			this._doSend(this._msgQueue[i]);
@@ -1856,7 +1856,9 @@ class TileManager {
 	}
 
 	public static onTileMsg(textMsg: string, img: any) {
-		const tileMsgObj: any = app.socket.parseServerCmd(textMsg);
+		// Binary tile headers come parsed already.
+		const tileMsgObj: any =
+			img && img.command ? img.command : app.socket.parseServerCmd(textMsg);
 		this.checkTileMsgObject(tileMsgObj);
 
 		if (app.map._debug.tileDataOn) {
@@ -284,6 +284,7 @@ app.definitions.Socket = class Socket extends SocketBase {
 			// of message types.
 			if (
 					e.data.startsWith('tile:') ||
+					e.data.startsWith('tilebin:') ||
 					e.data.startsWith('tilecombine:') ||
 					e.data.startsWith('delta:') ||
 					e.data.startsWith('renderfont:') ||
@@ -321,6 +322,14 @@ app.definitions.Socket = class Socket extends SocketBase {
 		if (isZstdSlideshowEnabled && (isSlideLayer || isSlideRenderComplete))
 			return;
 
+		// Binary tile headers stand for the text of tile:, delta: or update:.
+		if (e.textMsg === 'tilebin:' && e.imgBytes) {
+			var binaryTile = ServerCommand.parseBinaryTile(e.imgBytes, e.imgIndex, this._map);
+			e.textMsg = binaryTile.kind;
+			e.tileCommand = binaryTile.command;
+			e.imgIndex = binaryTile.imageOffset;
+		}
+
 		var isTile = e.textMsg.startsWith('tile:');
 		var isDelta = e.textMsg.startsWith('delta:');
 		if (!isTile && !isDelta &&
@@ -337,7 +346,7 @@ app.definitions.Socket = class Socket extends SocketBase {
 		{
 			// window.app.console.log('Passed through delta object');
 			e.image = { rawData: e.imgBytes.subarray(e.imgIndex),
-				    isKeyframe: isTile };
+				    isKeyframe: isTile, command: e.tileCommand };
 			e.imageIsComplete = true;
 			return;
 		}
@@ -347,7 +356,7 @@ app.definitions.Socket = class Socket extends SocketBase {
 		// lazy-loaded PNG slide previews
 		var img = this._extractImage(e);
 		if (isTile) {
-			e.image = { src: img };
+			e.image = { src: img, command: e.tileCommand };
 			e.imageIsComplete = true;
 			return;
 		}
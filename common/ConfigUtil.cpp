@@ -112,6 +112,9 @@ static const std::unordered_map<std::string, std::string> DefAppConfig = {
 #if !MOBILEAPP
     // { "logging.anonymize.anonymize_user_data", "false" }, // Do not set to fallback on filename/username.
     { "logging.anonymize.anonymization_salt", "82589933" },
+    { "logging.async.buffer_size", "262144" },
+    { "logging.async.overflow", "drop" },
+    { "logging.async[@enable]", "false" },
     { "logging.color", "true" },
     { "logging.disable_server_audit", "false" },
     { "logging.disabled_areas", "Socket,WebSocket,Admin,Pixel" },
@@ -152,6 +155,10 @@ static const std::unordered_map<std::string, std::string> DefAppConfig = {
     { "logging_ui_cmd.merge", "true" },
     { "logging_ui_cmd.merge_display_end_time", "false" },
 #endif
+    { "memory_pressure.recovery_secs", "60" },
+    { "memory_pressure.step_secs", "10" },
+    { "memory_pressure.threshold_percent", "10" },
+    { "memory_pressure[@enable]", "true" },
     { "mount_jail_tree", "true" },
     { "net.connection_timeout_secs", "30" },
     { "net.content_security_policy", "" },
@@ -171,6 +178,7 @@ static const std::unordered_map<std::string, std::string> DefAppConfig = {
     { "net.lok_allow.host[7]", R"(172\.2[0-9]\.[0-9]{1,3}\.[0-9]{1,3})" },
     { "net.lok_allow.host[8]", R"(::ffff:172\.2[0-9]\.[0-9]{1,3}\.[0-9]{1,3})" },
     { "net.lok_allow.host[9]", R"(172\.3[01]\.[0-9]{1,3}\.[0-9]{1,3})" },
+    { "net.poll_backend", "poll" },
     { "net.post_allow.host", R"(192\.168\.[0-9]{1,3}\.[0-9]{1,3})" },
     { "net.post_allow.host[10]", R"(::ffff:172\.3[01]\.[0-9]{1,3}\.[0-9]{1,3})" },
     { "net.post_allow.host[11]", R"(10\.[0-9]{1,3}\.[0-9]{1,3}\.[0-9]{1,3})" },
@@ -187,12 +195,16 @@ static const std::unordered_map<std::string, std::string> DefAppConfig = {
     { "net.proto", "all" },
     { "net.proxy_prefix", "false" },
     { "net.service_root", "" },
+    { "net.websocket_compression", "true" },
     { "num_prespawn_children", NUM_PRESPAWN_CHILDREN },
     { "overwrite_mode.enable", "false" },
     { "per_document.always_save_on_exit", "false" },
     { "per_document.autosave_duration_secs", "300" },
     { "per_document.background_autosave", "true" },
     { "per_document.background_manualsave", "true" },
+    { "per_document.batch_max_concurrent", "0" },
+    { "per_document.batch_max_per_client", "0" },
+    { "per_document.batch_max_queued", "1000" },
     { "per_document.batch_priority", "5" },
     { "per_document.bgsave_priority", "5" },
     { "per_document.bgsave_timeout_secs", "120" },
@@ -203,6 +215,7 @@ static const std::unordered_map<std::string, std::string> DefAppConfig = {
     { "per_document.cleanup.limit_dirty_mem_mb", "3072" },
     { "per_document.cleanup.lost_kit_grace_period_secs", "120" },
     { "per_document.cleanup[@enable]", "true" },
+    { "per_document.delta_cache_size_mb", "64" },
     { "per_document.idle_timeout_secs", "3600" },
     { "per_document.idlesave_duration_secs", "30" },
     { "per_document.limit_convert_secs", "100" },
@@ -217,10 +230,15 @@ static const std::unordered_map<std::string, std::string> DefAppConfig = {
     { "per_document.min_time_between_uploads_ms", "5000" },
     { "per_document.pdf_resolution_dpi", "96" },
     { "per_document.redlining_as_comments", "false" },
+    { "per_document.stream_tile_rendering", "false" },
     { "per_view.custom_os_info", "" },
     { "per_view.idle_timeout_secs", "900" },
     { "per_view.min_saved_message_timeout_secs", "6" },
     { "per_view.out_of_focus_timeout_secs", "300" },
+    { "prespawn.adaptive", "true" },
+    { "prespawn.max_children", "8" },
+    { "prespawn.max_memory_mb", "512" },
+    { "prespawn.percentile", "95" },
     { "product_name", APP_NAME },
     { "quarantine_files.expiry_min", "3000" },
     { "quarantine_files.limit_dir_size_mb", "250" },
@@ -271,11 +289,17 @@ static const std::unordered_map<std::string, std::string> DefAppConfig = {
     // { "storage.ssl.enable" - deliberately not set; for back-compat
     { "storage.ssl.key_file_path", "" },
     { "storage.wopi.alias_groups[@mode]", "first" },
+    { "storage.wopi.download_timeout_secs", "60" },
     { "storage.wopi.is_legacy_server", "false" },
+    { "storage.wopi.keepalive.enable", "true" },
+    { "storage.wopi.keepalive.idle_timeout_secs", "15" },
+    { "storage.wopi.keepalive.max_idle", "64" },
+    { "storage.wopi.keepalive.max_idle_per_host", "4" },
     { "storage.wopi.locking.refresh", "900" },
     { "storage.wopi.max_file_size", "0" },
     { "storage.wopi[@allow]", "true" },
     { "sys_template_path", "systemplate" },
+    { "tile_cache_size_mb", "0" },
     { "trace.filter.message", "" },
     { "trace.outgoing.record", "false" },
     { "trace.path", "" },
@@ -370,11 +394,13 @@ std::map<std::string, std::string> extractAll(const Poco::Util::AbstractConfigur
     map.erase("feature_lock.locked_hosts");
     map.erase("indirection_endpoint.geolocation_setup");
     map.erase("logging.anonymize");
+    map.erase("logging.async");
     map.erase("logging.file");
     map.erase("logging_ui_cmd.file");
     map.erase("net.lok_allow");
     map.erase("net.post_allow");
     map.erase("per_document.cleanup");
+    map.erase("prespawn");
     map.erase("ssl.hpkp");
     map.erase("ssl.hpkp.pins");
     map.erase("ssl.sts");
@@ -382,6 +408,7 @@ std::map<std::string, std::string> extractAll(const Poco::Util::AbstractConfigur
     map.erase("storage.ssl");
     map.erase("storage.wopi");
     map.erase("storage.wopi.alias_groups");
+    map.erase("storage.wopi.keepalive");
     map.erase("storage.wopi.locking");
     map.erase("trace.filter");
     map.erase("trace.outgoing");
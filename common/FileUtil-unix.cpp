@@ -25,6 +25,8 @@
 #include <unistd.h>
 
 #ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/vfs.h>
 #elif defined IOS
 #import <Foundation/Foundation.h>
@@ -46,6 +48,32 @@ namespace FileUtil
         return FileUtil::copy(source, newPath, /*log=*/true, /*throw_on_error=*/false);
     }
 
+    int64_t copyInKernel([[maybe_unused]] int from, [[maybe_unused]] int to,
+                         [[maybe_unused]] int64_t size)
+    {
+#if defined(__linux__) && !defined(__ANDROID__)
+        // On btrfs, xfs, etc. the copy shares the blocks of the original until written to.
+        if (::ioctl(to, FICLONE, from) == 0 && ::lseek(from, size, SEEK_SET) == size &&
+            ::lseek(to, size, SEEK_SET) == size)
+            return size;
+
+        int64_t copied = 0;
+        while (copied < size)
+        {
+            const ssize_t n = ::copy_file_range(from, nullptr, to, nullptr, size - copied, 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            copied += n;
+        }
+
+        return copied;
+#else
+        return 0;
+#endif
+    }
+
     std::string realpath(const char* path)
     {
         char* resolved = ::realpath(path, nullptr);
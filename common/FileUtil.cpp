@@ -83,9 +83,10 @@ namespace FileUtil
                 LOG_INF("Copying " << st.st_size << " bytes from " << anonymizeUrl(fromPath)
                                    << " to " << anonymizeUrl(toPath));
 
-            char buffer[64 * 1024];
+            // Anything left, or changed in size, is copied by hand.
+            off_t bytesIn = copyInKernel(from, to, st.st_size);
 
-            off_t bytesIn = 0;
+            char buffer[64 * 1024];
             do
             {
                 ssize_t n;
@@ -15,6 +15,7 @@
 
 #include <cerrno>
 #include <chrono>
+#include <cstdint>
 #include <fcntl.h>
 #include <fstream>
 #include <string>
@@ -176,6 +177,13 @@ namespace FileUtil
     /// Platform-dependent implementations.
     bool linkOrCopyFile(const std::string& source, const std::string& newPath);
 
+    /// Copy up to @size bytes of the open file @from to @to without reading them
+    /// into user-space, sharing the extents where the filesystem can (reflink).
+    /// Returns the number of bytes copied, and the files are positioned past them,
+    /// for the caller to copy on from, if short.
+    /// Platform-dependent implementations.
+    int64_t copyInKernel(int from, int to, int64_t size);
+
     /// Returns the system temporary directory.
     std::string getSysTempDirectoryPath();
 
@@ -20,17 +20,26 @@
 #include <Poco/Logger.h>
 #include <Poco/Version.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <sys/uio.h>
+#include <thread>
 #include <unistd.h>
 #include <unordered_map>
+#include <vector>
 
 namespace
 {
@@ -129,19 +138,19 @@ namespace Log
     public:
         static constexpr std::size_t BufferSize = 64 * 1024;
 
+#if WASMAPP
+        // In WASM, stdout works best.
+        static constexpr int LOG_FILE_FD = STDOUT_FILENO;
+#else
+        // By default, write to stderr.
+        static constexpr int LOG_FILE_FD = STDERR_FILENO;
+#endif
+
         void close() override { flush(); }
 
         /// Write the given buffer to stderr directly.
         static inline std::size_t writeRaw(const char* data, std::size_t count)
         {
-#if WASMAPP
-            // In WASM, stdout works best.
-            constexpr int LOG_FILE_FD = STDOUT_FILENO;
-#else
-            // By default, write to stderr.
-            constexpr int LOG_FILE_FD = STDERR_FILENO;
-#endif
-
             const char *ptr = data;
             while (count > 0)
             {
@@ -198,19 +207,6 @@ namespace Log
         }
     };
 
-    void preFork() { flush(); }
-
-    void postFork()
-    {
-        /// after forking we can end up with threads that
-        /// logged in the parent confusing our counting.
-        ThreadLocalBufferCount = 0;
-#ifndef NDEBUG
-        NextThreadIdIndex = 0;
-        memset(ThreadIdArray, 0, sizeof(ThreadIdArray));
-#endif // !NDEBUG
-    }
-
     class BufferedConsoleChannel : public ConsoleChannel
     {
         class ThreadLocalBuffer
@@ -389,6 +385,521 @@ namespace Log
         std::unordered_map<Poco::Message::Priority, std::string> _colorByPriority;
     };
 
+    /// The entries logged by one thread, on their way to the writer thread.
+    /// Lock-free, for a single producer and a single consumer.
+    class LogRing
+    {
+    public:
+        explicit LogRing(std::size_t capacity)
+            : _buffer(capacity)
+            , _head(0)
+            , _tail(0)
+            , _orphaned(false)
+        {
+        }
+
+        std::size_t capacity() const { return _buffer.size(); }
+
+        /// The bytes not yet consumed.
+        std::size_t used() const
+        {
+            return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+        }
+
+        /// Producer: appends the entry and a new-line, or nothing when they don't fit.
+        bool push(const char* data, std::size_t size)
+        {
+            const std::size_t capacity = _buffer.size();
+            const uint64_t head = _head.load(std::memory_order_relaxed);
+            const uint64_t tail = _tail.load(std::memory_order_acquire);
+            if (capacity - (head - tail) < size + 1)
+                return false;
+
+            const std::size_t pos = head % capacity;
+            const std::size_t first = std::min(size, capacity - pos);
+            memcpy(_buffer.data() + pos, data, first);
+            memcpy(_buffer.data(), data + first, size - first);
+            _buffer[(head + size) % capacity] = '\n';
+
+            _head.store(head + size + 1, std::memory_order_release);
+            return true;
+        }
+
+        /// Consumer: points @iov at the bytes not yet consumed, in at most two pieces.
+        /// Returns the number of pieces, and the bytes in @size.
+        int peek(struct iovec* iov, std::size_t& size)
+        {
+            const std::size_t capacity = _buffer.size();
+            const uint64_t tail = _tail.load(std::memory_order_relaxed);
+            size = _head.load(std::memory_order_acquire) - tail;
+            if (size == 0)
+                return 0;
+
+            const std::size_t pos = tail % capacity;
+            const std::size_t first = std::min(size, capacity - pos);
+            iov[0].iov_base = _buffer.data() + pos;
+            iov[0].iov_len = first;
+            if (first == size)
+                return 1;
+
+            iov[1].iov_base = _buffer.data();
+            iov[1].iov_len = size - first;
+            return 2;
+        }
+
+        /// Consumer: frees the @size bytes written.
+        void consume(std::size_t size)
+        {
+            _tail.store(_tail.load(std::memory_order_relaxed) + size, std::memory_order_release);
+        }
+
+        /// The producer thread has exited; it will push no more.
+        void orphan() { _orphaned.store(true, std::memory_order_release); }
+
+        /// True when nothing will ever be read from it again.
+        bool isDone() const { return _orphaned.load(std::memory_order_acquire) && used() == 0; }
+
+    private:
+        std::vector<char> _buffer;
+        alignas(64) std::atomic<uint64_t> _head; ///< Advanced by the producer.
+        alignas(64) std::atomic<uint64_t> _tail; ///< Advanced by the consumer.
+        std::atomic_bool _orphaned;
+    };
+
+    namespace
+    {
+    /// The ring of the current thread, and the fork generation it was registered at.
+    struct ThreadLogRing
+    {
+        std::shared_ptr<LogRing> ring;
+        uint32_t generation = 0;
+
+        ~ThreadLogRing()
+        {
+            if (ring)
+                ring->orphan();
+        }
+    };
+
+    thread_local ThreadLogRing OwnLogRing;
+    thread_local bool IsLogWriterThread = false;
+    } // namespace
+
+    /// Writes the entries of all the threads from a thread of its own, with writev(2).
+    /// Those logging then never wait for stderr, be it a slow disk, a pipe, or journald.
+    /// When the ring of a thread is full, its entry is dropped and counted, or the
+    /// thread waits for room, as configured.
+    /// Until allowed to start its thread, and in the child after forking, the entries
+    /// are written synchronously: ForKit and the Kit must be single-threaded to set up.
+    class AsyncLogWriter
+    {
+    public:
+        /// The writer wakes up at least this often, to write what has been logged.
+        static constexpr std::chrono::milliseconds FlushInterval{ 50 };
+
+        /// Over this, a full ring would wait too long for the writer, or take too long to write.
+        static constexpr std::size_t MaxRingSize = 64 * 1024 * 1024;
+
+        AsyncLogWriter(std::size_t ringSize, bool block)
+            : _ringSize(std::clamp(ringSize, ConsoleChannel::BufferSize, MaxRingSize))
+            , _block(block)
+            , _registry(std::make_unique<Registry>())
+            , _generation(1)
+            , _allowed(false)
+            , _running(false)
+            , _wake(false)
+            , _written(0)
+            , _dropped(0)
+            , _reportedDropped(0)
+            , _blocked(0)
+        {
+            // Don't lose what is still in the rings on exit.
+            std::atexit([]() { if (Instance) Instance->stop(); });
+        }
+
+        /// The writer of the process, if configured.
+        static AsyncLogWriter* Instance;
+
+        /// Queues the entry for the writer; false when it must be written synchronously.
+        bool log(const char* data, std::size_t size, bool urgent)
+        {
+            LogRing* ring = getRing();
+            if (!ring)
+                return false;
+
+            if (size >= ring->capacity())
+            {
+                // It will never fit, write it ourselves after what we queued before.
+                waitFor(*ring);
+                return false;
+            }
+
+            if (!ring->push(data, size))
+            {
+                if (!_block)
+                {
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+
+                _blocked.fetch_add(1, std::memory_order_relaxed);
+                do
+                {
+                    wake();
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    if (!_running.load(std::memory_order_acquire))
+                        return false;
+                } while (!ring->push(data, size));
+            }
+
+            if (urgent || ring->used() > ring->capacity() / 2)
+                wake();
+
+            return true;
+        }
+
+        /// From now on, the writer thread may be started.
+        void allow() { _allowed = true; }
+
+        /// Wakes up the writer, if the current thread has anything queued, and
+        /// waits for it to write everything, when @wait is set.
+        void flush(bool wait)
+        {
+            if (!_running.load(std::memory_order_acquire))
+            {
+                if (wait)
+                    halt();
+                return;
+            }
+
+            if (!wait)
+            {
+                if (OwnLogRing.ring && OwnLogRing.ring->used())
+                    wake();
+                return;
+            }
+
+            std::vector<std::shared_ptr<LogRing>> rings;
+            {
+                std::lock_guard<std::mutex> lock(_registry->mutex);
+                rings = _registry->rings;
+            }
+
+            for (const auto& ring : rings)
+            {
+                if (!waitFor(*ring))
+                    break;
+            }
+        }
+
+        /// Stops the writer thread for good, as we are exiting or shutting down,
+        /// and writes what is left. Later entries are written synchronously.
+        void stop()
+        {
+            // Before draining, lest an entry logged meanwhile starts the writer again.
+            _allowed = false;
+            halt();
+        }
+
+        /// In the child, there is no writer thread, and the other threads are gone.
+        void postFork()
+        {
+            // Deliberately leaked: their mutexes may have been held by threads that
+            // are no more, and the thread object is not ours to join.
+            Registry* inherited = _registry.release();
+            (void)inherited;
+            std::thread* thread = _thread.release();
+            (void)thread;
+
+            _registry = std::make_unique<Registry>();
+            ++_generation; // Each thread registers a new ring.
+            _allowed = false;
+            _running = false;
+        }
+
+        Log::AsyncStats getStats() const
+        {
+            Log::AsyncStats stats;
+            stats.enabled = true;
+            stats.bytesWritten = _written.load(std::memory_order_relaxed);
+            stats.dropped = _dropped.load(std::memory_order_relaxed);
+            stats.blocked = _blocked.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+    private:
+        /// Stops the writer thread, if running, and writes what is left.
+        /// It starts again on the next entry, if allowed.
+        void halt()
+        {
+            std::lock_guard<std::mutex> writerLock(_registry->writerMutex);
+            if (_thread)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(_registry->mutex);
+                    _registry->stop = true;
+                }
+
+                _registry->cv.notify_one();
+                _thread->join();
+                _thread.reset();
+                _running = false;
+            }
+
+            std::vector<std::shared_ptr<LogRing>> rings;
+            {
+                std::lock_guard<std::mutex> lock(_registry->mutex);
+                rings = _registry->rings;
+            }
+
+            drain(rings);
+        }
+
+        /// Returns the ring of the current thread, if the writer is running.
+        LogRing* getRing()
+        {
+            if (IsLogWriterThread || (!_running.load(std::memory_order_acquire) && !start()))
+                return nullptr;
+
+            ThreadLogRing& own = OwnLogRing;
+            if (!own.ring || own.generation != _generation)
+            {
+                own.ring = std::make_shared<LogRing>(_ringSize);
+                own.generation = _generation;
+
+                std::lock_guard<std::mutex> lock(_registry->mutex);
+                _registry->rings.push_back(own.ring);
+            }
+
+            return own.ring.get();
+        }
+
+        /// Starts the writer thread, if allowed.
+        bool start()
+        {
+            if (!_allowed)
+                return false;
+
+            std::lock_guard<std::mutex> writerLock(_registry->writerMutex);
+            if (_running)
+                return true;
+
+            try
+            {
+                _registry->stop = false;
+                _thread = std::make_unique<std::thread>([this]() { run(); });
+                _running = true;
+                return true;
+            }
+            catch (const std::exception&)
+            {
+                // Can't have threads; write synchronously.
+                _allowed = false;
+                return false;
+            }
+        }
+
+        void wake()
+        {
+            if (!_wake.exchange(true))
+                _registry->cv.notify_one();
+        }
+
+        /// Waits for the writer to write all of @ring, while it runs.
+        bool waitFor(const LogRing& ring)
+        {
+            while (ring.used())
+            {
+                if (!_running.load(std::memory_order_acquire))
+                    return false;
+
+                wake();
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+
+            return true;
+        }
+
+        void run()
+        {
+            IsLogWriterThread = true;
+            Util::setThreadName("log_writer");
+
+            std::vector<std::shared_ptr<LogRing>> rings;
+            bool stop = false;
+            while (!stop)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(_registry->mutex);
+                    _registry->cv.wait_for(lock, FlushInterval,
+                                           [this]() { return _wake || _registry->stop; });
+                    _wake = false;
+                    stop = _registry->stop;
+
+                    // Forget the rings of the threads that have exited, once written.
+                    auto& all = _registry->rings;
+                    all.erase(std::remove_if(all.begin(), all.end(),
+                                             [](const std::shared_ptr<LogRing>& ring)
+                                             { return ring->isDone(); }),
+                              all.end());
+                    rings = all;
+                }
+
+                drain(rings);
+
+                const uint64_t dropped = _dropped.load(std::memory_order_relaxed);
+                if (dropped != _reportedDropped)
+                {
+                    LOG_WRN("Dropped " << dropped - _reportedDropped << " log entries ("
+                                       << dropped << " in all), as they were logged faster "
+                                       << "than they could be written");
+                    _reportedDropped = dropped;
+                }
+            }
+        }
+
+        /// Writes all that is in @rings.
+        void drain(const std::vector<std::shared_ptr<LogRing>>& rings)
+        {
+            // Two pieces per ring, at most.
+            static constexpr std::size_t MaxBatch = 32;
+            struct iovec iov[MaxBatch * 2];
+            std::pair<LogRing*, std::size_t> batch[MaxBatch];
+
+            std::size_t pieces = 0;
+            std::size_t count = 0;
+            for (std::size_t i = 0; i <= rings.size(); ++i)
+            {
+                if (i < rings.size())
+                {
+                    std::size_t size = 0;
+                    const int got = rings[i]->peek(iov + pieces, size);
+                    if (got)
+                    {
+                        pieces += got;
+                        batch[count++] = { rings[i].get(), size };
+                    }
+                }
+
+                if (count && (count == MaxBatch || i == rings.size()))
+                {
+                    writeAll(iov, pieces);
+                    for (std::size_t j = 0; j < count; ++j)
+                    {
+                        batch[j].first->consume(batch[j].second);
+                        _written.fetch_add(batch[j].second, std::memory_order_relaxed);
+                    }
+
+                    pieces = 0;
+                    count = 0;
+                }
+            }
+        }
+
+        /// writev(2) all of @iov, resuming partial writes.
+        static void writeAll(struct iovec* iov, std::size_t count)
+        {
+            while (count > 0)
+            {
+                const ssize_t wrote = ::writev(ConsoleChannel::LOG_FILE_FD, iov, count);
+                if (wrote < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    break;
+                }
+
+                std::size_t left = wrote;
+                while (count > 0 && left >= iov->iov_len)
+                {
+                    left -= iov->iov_len;
+                    ++iov;
+                    --count;
+                }
+
+                if (count > 0)
+                {
+                    iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+                    iov->iov_len -= left;
+                }
+            }
+        }
+
+        /// What the writer shares with the producers; replaced in the child after forking.
+        struct Registry
+        {
+            std::mutex writerMutex; ///< Serializes starting and stopping the writer.
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::vector<std::shared_ptr<LogRing>> rings;
+            bool stop = false;
+        };
+
+        const std::size_t _ringSize;
+        const bool _block;
+        std::unique_ptr<Registry> _registry;
+        std::unique_ptr<std::thread> _thread;
+        uint32_t _generation;
+        std::atomic_bool _allowed;
+        std::atomic_bool _running;
+        std::atomic_bool _wake;
+        std::atomic<uint64_t> _written;
+        std::atomic<uint64_t> _dropped;
+        uint64_t _reportedDropped; ///< Only used by the writer thread.
+        std::atomic<uint64_t> _blocked;
+    };
+
+    AsyncLogWriter* AsyncLogWriter::Instance = nullptr;
+
+    /// Console channel that leaves the writing to the AsyncLogWriter.
+    class AsyncConsoleChannel : public ConsoleChannel
+    {
+    public:
+        void log(const Poco::Message& msg) override
+        {
+            const std::string& s = msg.getText();
+            if (!AsyncLogWriter::Instance ||
+                !AsyncLogWriter::Instance->log(s.data(), s.size(),
+                                               msg.getPriority() <= Message::PRIO_WARNING))
+            {
+                ConsoleChannel::log(s.data(), s.size());
+            }
+        }
+    };
+
+    void preFork()
+    {
+        flush();
+        if (AsyncLogWriter::Instance)
+            AsyncLogWriter::Instance->flush(/*wait=*/true);
+    }
+
+    void postFork()
+    {
+        /// after forking we can end up with threads that
+        /// logged in the parent confusing our counting.
+        ThreadLocalBufferCount = 0;
+#ifndef NDEBUG
+        NextThreadIdIndex = 0;
+        memset(ThreadIdArray, 0, sizeof(ThreadIdArray));
+#endif // !NDEBUG
+
+        if (AsyncLogWriter::Instance)
+            AsyncLogWriter::Instance->postFork();
+    }
+
+    void startAsync()
+    {
+        if (AsyncLogWriter::Instance)
+            AsyncLogWriter::Instance->allow();
+    }
+
+    AsyncStats getAsyncStats()
+    {
+        return AsyncLogWriter::Instance ? AsyncLogWriter::Instance->getStats() : AsyncStats();
+    }
+
     extern StaticHelper Static;
     extern StaticUIHelper StaticUILog;
 
@@ -593,11 +1104,17 @@ namespace Log
         // Configure the logger.
         AutoPtr<Channel> channel;
 
+        // Asynchronous console logging, the overflow policy being either drop or block.
+        const auto asyncIt = config.find("async");
+
         if (logToFile)
         {
             channel = static_cast<Poco::Channel*>(new Poco::FileChannel("coolwsd.log"));
             for (const auto& pair : config)
             {
+                if (pair.first.starts_with("async"))
+                    continue; // Not a FileChannel property.
+
                 channel->setProperty(pair.first, pair.second);
             }
         }
@@ -605,6 +1122,19 @@ namespace Log
         {
             channel = static_cast<Poco::Channel*>(new Log::ColorConsoleChannel());
         }
+        else if (asyncIt != config.end())
+        {
+            // Written by a thread of its own, once startAsync() allows it.
+            if (!AsyncLogWriter::Instance)
+            {
+                const auto sizeIt = config.find("async_buffer_size");
+                const std::size_t ringSize =
+                    sizeIt != config.end() ? std::strtoul(sizeIt->second.c_str(), nullptr, 10) : 0;
+                AsyncLogWriter::Instance = new AsyncLogWriter(ringSize, asyncIt->second == "block");
+            }
+
+            channel = static_cast<Poco::Channel*>(new Log::AsyncConsoleChannel());
+        }
         else
         {
             const auto it = config.find("flush");
@@ -785,10 +1315,18 @@ namespace Log
 
         flush();
 
+        if (AsyncLogWriter::Instance)
+            AsyncLogWriter::Instance->stop();
+
         ::fflush(nullptr); // Flush all open output streams.
     }
 
-    void flush() { BufferedConsoleChannel::flush(); }
+    void flush()
+    {
+        BufferedConsoleChannel::flush();
+        if (AsyncLogWriter::Instance)
+            AsyncLogWriter::Instance->flush(/*wait=*/false);
+    }
 
     void setThreadLocalLogLevel(const std::string& logLevel)
     {
@@ -14,6 +14,7 @@
 #include <cerrno>
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <iostream>
 #include <thread>
@@ -86,6 +87,21 @@ namespace Log
     /// Cleanup state after forking
     void postFork();
 
+    /// Start writing the console log from a thread of its own, if so configured.
+    /// Until then, and in the child after forking, logging is synchronous.
+    void startAsync();
+
+    /// The counters of the asynchronous console logging.
+    struct AsyncStats
+    {
+        bool enabled = false;
+        uint64_t bytesWritten = 0;
+        uint64_t dropped = 0; ///< Entries dropped, the ring of their thread being full.
+        uint64_t blocked = 0; ///< Entries that waited for room in the ring of their thread.
+    };
+
+    AsyncStats getAsyncStats();
+
     void setThreadLocalLogLevel(const std::string& logLevel);
 
     /// Generates log entry prefix. Example follows (without the vertical bars).
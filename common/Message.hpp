@@ -18,6 +18,7 @@
 #include <vector>
 #include <functional>
 
+#include "Common.hpp"
 #include "Protocol.hpp"
 #include "StringVector.hpp"
 #include "Log.hpp"
@@ -53,9 +54,26 @@ public:
         LOG_TRC("Message " << abbr());
     }
 
+    /// Construct a binary message of header followed by len bytes at offset of payload.
+    /// The payload is referenced, rather than copied, and must not be modified.
+    /// Note: header must include the full first-line.
+    Message(const std::string_view header, std::shared_ptr<const BlobData> payload,
+            const size_t offset, const size_t len, const enum Dir dir)
+        : Message(header, dir)
+    {
+        _payload = std::move(payload);
+        _payloadOffset = offset;
+        _payloadSize = len;
+    }
+
     size_t size() const { return _data.size(); }
     const std::vector<char>& data() const { return _data; }
 
+    /// The payload following data(), if any, which isn't part of size().
+    const std::shared_ptr<const BlobData>& payload() const { return _payload; }
+    size_t payloadOffset() const { return _payloadOffset; }
+    size_t payloadSize() const { return _payloadSize; }
+
     const StringVector& tokens() const { return _tokens; }
     const std::string& forwardToken() const { return _forwardToken; }
     std::string firstToken() const { return _tokens[0]; }
@@ -149,6 +167,7 @@ private:
     Type detectType() const
     {
         if (_tokens.equals(0, "tile:") ||
+            _tokens.equals(0, "tilebin:") ||
             _tokens.equals(0, "tilecombine:") ||
             _tokens.equals(0, "delta:") ||
             _tokens.equals(0, "renderfont:") ||
@@ -202,6 +221,9 @@ private:
     std::string _firstLine;
     const Type _type;
     uint32_t _hash;
+    std::shared_ptr<const BlobData> _payload;
+    size_t _payloadOffset = 0;
+    size_t _payloadSize = 0;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -59,7 +59,9 @@
 #include <fstream>
 
 #include "Log.hpp"
+#include "Simd.hpp"
 #include "TraceEvent.hpp"
+#include <kit/DeltaSimd.h>
 
 namespace Png
 {
@@ -89,6 +91,9 @@ extern "C"
 static void
 unpremultiply_bgra_data (png_structp /*png*/, png_row_infop row_info, png_bytep data)
 {
+    if (simd_unpremultiply(simd::getLevel(), data, row_info->rowbytes / 4, 1))
+        return;
+
     unsigned int i;
 
     for (i = 0; i < row_info->rowbytes; i += 4)
@@ -125,6 +130,9 @@ unpremultiply_bgra_data (png_structp /*png*/, png_row_infop row_info, png_bytep
 static void
 unpremultiply_rgba_data (png_structp /*png*/, png_row_infop row_info, png_bytep data)
 {
+    if (simd_unpremultiply(simd::getLevel(), data, row_info->rowbytes / 4, 0))
+        return;
+
     unsigned int i;
 
     for (i = 0; i < row_info->rowbytes; i += 4)
@@ -11,12 +11,14 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <memory>
 #include <queue>
 #include <thread>
 #include <condition_variable>
 #include <fstream>
+#include <map>
 #include <unordered_map>
 #include <vector>
 
@@ -64,14 +66,245 @@ namespace RenderTiles
         return nextId;
     }
 
+    typedef std::function<void(unsigned char* data, int offsetX, int offsetY, size_t pixmapWidth,
+                               size_t pixmapHeight, int pixelWidth, int pixelHeight,
+                               LibreOfficeKitTileMode mode)> BlendWatermarkFn;
+    typedef std::function<void(const char* buffer, size_t length)> OutputMessageFn;
+
+    /// Compress a tile at @offsetX, @offsetY of @pixmap into @data,
+    /// as a delta or keyframe, or as a PNG for previews.
+    /// Returns false on failure.
+    static bool encodeTile(DeltaGenerator& deltaGen, const TileCombined& tileCombined,
+                           const TileDesc& tile, const Util::Rectangle& tileRect,
+                           unsigned char* pixmap, int offsetX, int offsetY,
+                           size_t pixmapWidth, size_t pixmapHeight,
+                           CanonicalViewId canonicalViewId, TileWireId wireId,
+                           bool forceKeyframe, bool dumpTiles, LibreOfficeKitTileMode mode,
+                           std::vector<char>& data)
+    {
+        const int pixelWidth = tileCombined.getWidth();
+        const int pixelHeight = tileCombined.getHeight();
+
+        // FIXME: don't try to store & create deltas for read-only documents.
+        if (!tile.isPreview())
+        {
+            // Can we create a delta ?
+            assert(pixelWidth <= 256 && pixelHeight <= 256);
+            deltaGen.compressOrDelta(pixmap, offsetX, offsetY,
+                                     pixelWidth, pixelHeight,
+                                     pixmapWidth, pixmapHeight,
+                                     TileLocation(
+                                         tileRect.getLeft(),
+                                         tileRect.getTop(),
+                                         tileRect.getWidth(),
+                                         tileCombined.getPart(),
+                                         canonicalViewId,
+                                         tileCombined.getEditMode()
+                                         ),
+                                     data, wireId, forceKeyframe, dumpTiles, mode);
+            return true;
+        }
+
+        // FIXME: write our own trivial PNG encoding code using deflate.
+        if (!Png::encodeSubBufferToPNG(pixmap, offsetX, offsetY, pixelWidth, pixelHeight,
+                                       pixmapWidth, pixmapHeight, data, mode))
+        {
+            // FIXME: Return error.
+            // sendTextFrameAndLogError("error: cmd=tile kind=failure");
+            LOG_ERR("Failed to encode tile into PNG.");
+            return false;
+        }
+
+        return true;
+    }
+
+    /// Send @tileIds of @tiles, whose images are in @images, either
+    /// as a single binary message or as one binary message each.
+    /// Releases the images once sent.
+    static void sendRendered(const TileCombined& tileCombined, const std::vector<size_t>& tileIds,
+                             const std::vector<TileWireId>& wireIds,
+                             std::vector<std::vector<char>>& images,
+                             const OutputMessageFn& outputMessage)
+    {
+        const auto& tiles = tileCombined.getTiles();
+        if (tileCombined.getCombined())
+        {
+            TileCombinedBuilder renderedTiles;
+            size_t imagesSize = 0;
+            for (const size_t id : tileIds)
+            {
+                renderedTiles.pushRendered(tiles[id], wireIds[id], images[id].size());
+                imagesSize += images[id].size();
+            }
+
+            const std::string tileMsg = renderedTiles.serializeBinary(TileBinary::Kind::Tile);
+            LOG_TRC("Sending back " << tileIds.size() << " painted tiles of " << imagesSize
+                                    << " bytes for: " << renderedTiles.serialize());
+
+            std::vector<char> response;
+            response.reserve(tileMsg.size() + imagesSize);
+            response.insert(response.end(), tileMsg.begin(), tileMsg.end());
+            for (const size_t id : tileIds)
+            {
+                response.insert(response.end(), images[id].begin(), images[id].end());
+                std::vector<char>().swap(images[id]);
+            }
+
+            outputMessage(response.data(), response.size());
+        }
+        else
+        {
+            std::vector<char> response;
+            for (const size_t id : tileIds)
+            {
+                TileDesc tile = tiles[id];
+                tile.setWireId(wireIds[id]);
+                tile.setImgSize(images[id].size());
+                const std::string tileMsg = tile.serializeBinary(TileBinary::Kind::Tile);
+
+                response.clear();
+                response.reserve(tileMsg.size() + images[id].size());
+                response.insert(response.end(), tileMsg.begin(), tileMsg.end());
+                response.insert(response.end(), images[id].begin(), images[id].end());
+                std::vector<char>().swap(images[id]);
+
+                outputMessage(response.data(), response.size());
+            }
+        }
+    }
+
+    /// Paint the tiles a row at a time, so encoding a row overlaps
+    /// with painting the next, and send each tile as soon as it is
+    /// encoded, rather than waiting for the whole area.
+    static bool doRenderStreaming(
+        const std::shared_ptr<lok::Document>& document, DeltaGenerator& deltaGen,
+        TileCombined& tileCombined, ThreadPool& pngPool,
+        const BlendWatermarkFn& blendWatermark, const OutputMessageFn& outputMessage,
+        const Util::Rectangle& renderArea, const std::vector<Util::Rectangle>& tileRecs,
+        CanonicalViewId canonicalViewId, bool dumpTiles)
+    {
+        const auto& tiles = tileCombined.getTiles();
+        const int pixelWidth = tileCombined.getWidth();
+        const int pixelHeight = tileCombined.getHeight();
+        const size_t tilesByX = renderArea.getWidth() / tileCombined.getTileWidth();
+        const size_t bandWidth = tilesByX * pixelWidth;
+        const size_t bandHeight = pixelHeight;
+
+        // Tile indexes by row, top to bottom.
+        std::map<int, std::vector<size_t>> rows;
+        for (size_t i = 0; i < tileRecs.size(); ++i)
+            rows[tileRecs[i].getTop()].push_back(i);
+
+        const auto mode = static_cast<LibreOfficeKitTileMode>(document->getTileMode());
+        const auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::vector<char>> images(tiles.size());
+        std::vector<TileWireId> wireIds(tiles.size());
+
+        std::mutex readyMutex;
+        std::vector<size_t> ready; // Encoded, not yet sent.
+        size_t sentCount = 0;
+        bool firstSent = false;
+
+        const auto sendReady = [&]()
+        {
+            std::vector<size_t> toSend;
+            {
+                std::unique_lock<std::mutex> lock(readyMutex);
+                std::swap(ready, toSend);
+            }
+
+            if (!toSend.empty())
+            {
+                // Keep the original order within each message.
+                std::sort(toSend.begin(), toSend.end());
+                sendRendered(tileCombined, toSend, wireIds, images, outputMessage);
+                sentCount += toSend.size();
+                if (!firstSent)
+                {
+                    firstSent = true;
+                    LOG_DBG("First of " << tiles.size() << " streamed tiles sent after "
+                                        << std::chrono::duration_cast<std::chrono::microseconds>(
+                                               std::chrono::steady_clock::now() - start));
+                }
+            }
+        };
+
+        ThreadPool::Batch pngBatch(pngPool);
+
+        for (const auto& row : rows)
+        {
+            const int bandTop = row.first;
+            auto band = std::make_shared<RenderTiles::Buffer>(bandWidth, bandHeight);
+
+            LOG_TRC("Calling paintPartTile(" << (void*)band->data() << ") for row at " << bandTop);
+            document->paintPartTile(band->data(),
+                                    tileCombined.getPart(),
+                                    tileCombined.getEditMode(),
+                                    bandWidth, bandHeight,
+                                    renderArea.getLeft(), bandTop,
+                                    renderArea.getWidth(), tileCombined.getTileHeight());
+
+            for (const size_t tileIndex : row.second)
+            {
+                const Util::Rectangle& tileRect = tileRecs[tileIndex];
+                const size_t positionX = (tileRect.getLeft() - renderArea.getLeft()) / tileCombined.getTileWidth();
+                const int offsetX = positionX * pixelWidth;
+
+                blendWatermark(band->data(), offsetX, 0, bandWidth, bandHeight,
+                               pixelWidth, pixelHeight, mode);
+
+                const bool forceKeyframe = tiles[tileIndex].isForcedKeyFrame();
+                const TileWireId wireId = getCurrentWireId(true);
+                wireIds[tileIndex] = wireId;
+
+                pngBatch.pushWork([=, &deltaGen, &tileCombined, &tiles, &tileRecs, &images,
+                                   &readyMutex, &ready]()
+                    {
+                        std::vector<char> data;
+                        if (!encodeTile(deltaGen, tileCombined, tiles[tileIndex],
+                                        tileRecs[tileIndex], band->data(), offsetX, 0,
+                                        bandWidth, bandHeight, canonicalViewId, wireId,
+                                        forceKeyframe, dumpTiles, mode, data))
+                            return;
+
+                        LOG_TRC("Tile " << tileIndex << " is " << data.size() << " bytes.");
+                        images[tileIndex] = std::move(data);
+                        std::unique_lock<std::mutex> lock(readyMutex);
+                        ready.push_back(tileIndex);
+                    });
+            }
+
+            // Send whatever got encoded while we were painting.
+            sendReady();
+        }
+
+        pngBatch.wait();
+        sendReady();
+
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+        LOG_DBG("paintPartTile+comp streamed " << tileRecs.size() << " tiles in " << rows.size()
+                << " rows at (" << renderArea.getLeft() << ", " << renderArea.getTop()
+                << "), (" << renderArea.getWidth() << ", " << renderArea.getHeight() << ") "
+                << " took " << elapsed);
+
+        if (sentCount == 0)
+            return false;
+
+        return true;
+    }
+
+    /// Render the tiles of @tileCombined and send them via @outputMessage.
+    /// With @streaming, large areas are painted in bands and the tiles
+    /// are sent as they get encoded, see doRenderStreaming.
     bool doRender(
         const std::shared_ptr<lok::Document>& document, DeltaGenerator& deltaGen,
         TileCombined& tileCombined, ThreadPool& pngPool,
-        const std::function<void(unsigned char* data, int offsetX, int offsetY, size_t pixmapWidth,
-                                 size_t pixmapHeight, int pixelWidth, int pixelHeight,
-                                 LibreOfficeKitTileMode mode)>& blendWatermark,
-        const std::function<void(const char* buffer, size_t length)>& outputMessage,
-        [[maybe_unused]] unsigned mobileAppDocId, CanonicalViewId canonicalViewId, bool dumpTiles)
+        const BlendWatermarkFn& blendWatermark,
+        const OutputMessageFn& outputMessage,
+        [[maybe_unused]] unsigned mobileAppDocId, CanonicalViewId canonicalViewId, bool dumpTiles,
+        bool streaming = false)
     {
         const auto& tiles = tileCombined.getTiles();
 
@@ -116,6 +349,12 @@ namespace RenderTiles
                     << " (" << tilesByX << 'x' << tilesByY << " tiles to serve " << tiles.size() << " tiles: "
                     << (tiles.size() * 100)/(tilesByX * tilesByY) << "% in " << (tilesByX*tilesByY*0.25) << "MB");
 
+        // A single row gains nothing from streaming.
+        if (streaming && tilesByY > 1)
+            return doRenderStreaming(document, deltaGen, tileCombined, pngPool, blendWatermark,
+                                     outputMessage, renderArea, tileRecs, canonicalViewId,
+                                     dumpTiles);
+
         RenderTiles::Buffer pixmap(pixmapWidth, pixmapHeight);
 
         // Render the whole area
@@ -137,20 +376,20 @@ namespace RenderTiles
 
         const auto mode = static_cast<LibreOfficeKitTileMode>(document->getTileMode());
 
-        const size_t pixmapSize = 4 * pixmapWidth * pixmapHeight;
-        std::vector<char> output;
-        output.reserve(pixmapSize);
-
-        // Compress the area as tiles
-        TileCombinedBuilder renderedTiles;
-        std::vector<TileWireId> renderingIds;
-
-        size_t tileIndex = 0;
+        // Each tile is encoded into its own buffer, copied only into the message that sends it.
+        std::vector<std::vector<char>> images(tiles.size());
+        std::vector<TileWireId> wireIds(tiles.size());
 
         std::mutex pngMutex;
+        std::vector<size_t> rendered; // The tiles encoded successfully.
+
+        // Encoding starts as soon as each tile is queued, overlapping
+        // with the watermark blending of the following ones.
+        ThreadPool::Batch pngBatch(pngPool);
 
-        for (const Util::Rectangle& tileRect : tileRecs)
+        for (size_t tileIndex = 0; tileIndex < tileRecs.size(); ++tileIndex)
         {
+            const Util::Rectangle& tileRect = tileRecs[tileIndex];
             const size_t positionX = (tileRect.getLeft() - renderArea.getLeft()) / tileCombined.getTileWidth();
             const size_t positionY = (tileRect.getTop() - renderArea.getTop()) / tileCombined.getTileHeight();
 
@@ -164,69 +403,36 @@ namespace RenderTiles
                            mode);
 
             // FIXME: prettify this.
-            bool forceKeyframe = tiles[tileIndex].isForcedKeyFrame();
+            const bool forceKeyframe = tiles[tileIndex].isForcedKeyFrame();
 
             // FIXME: share the same wireId for all tiles concurrently rendered.
-            TileWireId wireId = getCurrentWireId(true);
-
-            bool skipCompress = false;
-            if (!skipCompress)
-            {
-                renderingIds.push_back(wireId);
-
-                LOG_TRC("Queued encoding of tile #" << tileIndex << " at (" << positionX << ',' << positionY << ") with " <<
-                        (forceKeyframe?"force keyframe" : "allow delta") << ", wireId: " << wireId);
-
-                // Queue to be executed later in parallel inside 'run'
-                pngPool.pushWork([=,&output,&pixmap,&tiles,&renderedTiles,
-                                  &pngMutex,&deltaGen]()
-                    {
-                        std::vector< char > data;
-                        data.reserve(pixmapWidth * pixmapHeight * 1);
-
-                        // FIXME: don't try to store & create deltas for read-only documents.
-                        if (!tiles[tileIndex].isPreview())
-                        {
-                            // Can we create a delta ?
-                            LOG_TRC("Compress new tile #" << tileIndex);
-                            assert(pixelWidth <= 256 && pixelHeight <= 256);
-                            deltaGen.compressOrDelta(pixmap.data(), offsetX, offsetY,
-                                                     pixelWidth, pixelHeight,
-                                                     pixmapWidth, pixmapHeight,
-                                                     TileLocation(
-                                                         tileRect.getLeft(),
-                                                         tileRect.getTop(),
-                                                         tileRect.getWidth(),
-                                                         tileCombined.getPart(),
-                                                         canonicalViewId,
-                                                         tileCombined.getEditMode()
-                                                         ),
-                                                     data, wireId, forceKeyframe, dumpTiles, mode);
-                        }
-                        else
-                        {
-                            // FIXME: write our own trivial PNG encoding code using deflate.
-                            LOG_TRC("Encode a new png for tile #" << tileIndex);
-                            if (!Png::encodeSubBufferToPNG(pixmap.data(), offsetX, offsetY, pixelWidth, pixelHeight,
-                                                           pixmapWidth, pixmapHeight, data, mode))
-                            {
-                                // FIXME: Return error.
-                                // sendTextFrameAndLogError("error: cmd=tile kind=failure");
-                                LOG_ERR("Failed to encode tile into PNG.");
-                                return;
-                            }
-                        }
-
-                        LOG_TRC("Tile " << tileIndex << " is " << data.size() << " bytes.");
-                        std::unique_lock<std::mutex> pngLock(pngMutex);
-                        output.insert(output.end(), data.begin(), data.end());
-                        renderedTiles.pushRendered(tiles[tileIndex], wireId, data.size());
-                    });
-            }
-            tileIndex++;
+            const TileWireId wireId = getCurrentWireId(true);
+            wireIds[tileIndex] = wireId;
+
+            LOG_TRC("Queued encoding of tile #" << tileIndex << " at (" << positionX << ',' << positionY << ") with " <<
+                    (forceKeyframe?"force keyframe" : "allow delta") << ", wireId: " << wireId);
+
+            // Queue to be executed in parallel, collected in 'wait'
+            pngBatch.pushWork([=,&pixmap,&tiles,&images,&rendered,
+                              &pngMutex,&deltaGen,&tileCombined]()
+                {
+                    std::vector<char> data;
+
+                    LOG_TRC("Encode new tile #" << tileIndex);
+                    if (!encodeTile(deltaGen, tileCombined, tiles[tileIndex], tileRect,
+                                    pixmap.data(), offsetX, offsetY,
+                                    pixmapWidth, pixmapHeight, canonicalViewId, wireId,
+                                    forceKeyframe, dumpTiles, mode, data))
+                        return;
+
+                    LOG_TRC("Tile " << tileIndex << " is " << data.size() << " bytes.");
+                    images[tileIndex] = std::move(data);
+                    std::unique_lock<std::mutex> pngLock(pngMutex);
+                    rendered.push_back(tileIndex);
+                });
         }
 
-        pngPool.run();
+        pngBatch.wait();
 
         duration = std::chrono::steady_clock::now() - start;
         const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(duration);
@@ -236,39 +442,13 @@ namespace RenderTiles
                 << renderArea.getHeight() << ") "
                 << " took " << elapsed << " (" << area / elapsed.count() << " MP/s).");
 
-        if (tileIndex == 0)
+        if (tileRecs.empty())
             return false;
 
-        std::string tileMsg;
-        if (tileCombined.getCombined())
-        {
-            tileMsg = renderedTiles.serialize("tilecombine:", "\n");
-
-            LOG_TRC("Sending back painted tiles for " << tileMsg << " of size " << output.size() << " bytes) for: " << tileMsg);
-
-            const size_t responseSize = tileMsg.size() + output.size();
-            std::unique_ptr<char[]> response(std::make_unique<char[]>(responseSize));
-            std::copy(tileMsg.begin(), tileMsg.end(), response.get());
-            std::copy(output.begin(), output.end(), response.get() + tileMsg.size());
-            outputMessage(response.get(), responseSize);
-        }
-        else
-        {
-            size_t outputOffset = 0;
-            for (const auto &i : renderedTiles.getTiles())
-            {
-                tileMsg = i.serialize("tile:", "\n");
-                const size_t responseSize = tileMsg.size() + i.getImgSize();
-                std::unique_ptr<char[]> response(std::make_unique<char[]>(responseSize));
-                std::copy(tileMsg.begin(), tileMsg.end(), response.get());
-                std::copy(output.begin() + outputOffset, output.begin() + outputOffset + i.getImgSize(), response.get() + tileMsg.size());
-                outputMessage(response.get(), responseSize);
-                outputOffset += i.getImgSize();
-            }
-        }
+        // Keep the original order of the tiles.
+        std::sort(rendered.begin(), rendered.end());
+        sendRendered(tileCombined, rendered, wireIds, images, outputMessage);
 
-        // Should we do this more frequently? and/or should we defer it?
-        deltaGen.rebalanceDeltas();
         return true;
     }
 }
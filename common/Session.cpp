@@ -49,6 +49,7 @@ Session::Session(const std::shared_ptr<ProtocolHandlerInterface>& protocol, cons
     , _haveDocPassword(false)
     , _isDocPasswordProtected(false)
     , _accessibilityState(false)
+    , _binaryTileHeaders(false)
     , _disableVerifyHost(false)
 {
 }
@@ -83,6 +84,23 @@ bool Session::sendBinaryFrame(const char *buffer, int length)
     return _protocol->sendBinaryMessage(buffer, length) >= length;
 }
 
+bool Session::sendSharedBinaryFrame(const std::string_view header,
+                                    const std::shared_ptr<const BlobData>& blob,
+                                    std::size_t offset, std::size_t len)
+{
+    if (!_protocol)
+    {
+        LOG_TRC("ERR - missing protocol " << getName() << ": Send: "
+                                          << std::to_string(header.size() + len)
+                                          << " binary bytes");
+        return false;
+    }
+
+    LOG_TRC("Send: " << std::to_string(header.size() + len) << " binary bytes");
+    return _protocol->sendSharedBinaryMessage(header, blob, offset, len) >=
+           static_cast<int>(header.size() + len);
+}
+
 void Session::parseDocOptions(const StringVector& tokens, int& part, std::string& timestamp)
 {
     // First token is the "load" command itself.
@@ -290,6 +308,11 @@ void Session::parseDocOptions(const StringVector& tokens, int& part, std::string
             _accessibilityState = value == "true";
             ++offset;
         }
+        else if (name == "tileProtocol")
+        {
+            _binaryTileHeaders = value == "binary";
+            ++offset;
+        }
         else if (name == "isAllowChangeComments")
         {
             _isAllowChangeComments = value == "true";
@@ -400,6 +423,18 @@ void Session::getIOStats(uint64_t &sent, uint64_t &recv)
     _protocol->getIOStats(sent, recv);
 }
 
+void Session::getCompressionStats(uint64_t& saved, uint64_t& timeUs)
+{
+    if (!_protocol)
+    {
+        saved = 0;
+        timeUs = 0;
+        return;
+    }
+
+    _protocol->getCompressionStats(saved, timeUs);
+}
+
 void Session::dumpState(std::ostream& os)
 {
     os << "\n\t\tid: " << _id
@@ -133,6 +133,11 @@ public:
     virtual bool sendBinaryFrame(const char* buffer, int length);
     virtual bool sendTextFrame(const char* buffer, int length);
 
+    /// Sends the header followed by len bytes at offset of blob, without copying the blob.
+    virtual bool sendSharedBinaryFrame(const std::string_view header,
+                                       const std::shared_ptr<const BlobData>& blob,
+                                       std::size_t offset, std::size_t len);
+
     /// Get notified that the underlying transports disconnected
     void onDisconnect() override { /* ignore */ }
 
@@ -198,6 +203,8 @@ public:
 
     void getIOStats(uint64_t &sent, uint64_t &recv);
 
+    void getCompressionStats(uint64_t& saved, uint64_t& timeUs);
+
     void setUserId(const std::string& userId) { _userId = userId; }
 
     const std::string& getUserId() const { return _userId; }
@@ -280,6 +287,9 @@ public:
 
     void setAccessibilityState(bool val) { _accessibilityState = val; }
 
+    /// Whether the client takes the binary headers of TileBinary for its tiles.
+    bool hasBinaryTileHeaders() const { return _binaryTileHeaders; }
+
     void disableSpellCheckIfReadOnly();
 
     const std::string& getDocTemplate() const { return _docTemplate; }
@@ -447,6 +457,9 @@ private:
     /// Specifies whether accessibility support is enabled for this session.
     bool _accessibilityState;
 
+    /// Whether the client asked for binary tile headers, rather than text.
+    bool _binaryTileHeaders;
+
     /// Specifies whether certification verification for the wopi server
     /// should be disabled in core
     bool _disableVerifyHost;
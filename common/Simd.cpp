@@ -12,6 +12,7 @@
 #include <config.h>
 
 #include <Simd.hpp>
+#include <kit/DeltaSimd.h>
 
 #if ENABLE_SIMD
 #  include <immintrin.h>
@@ -20,14 +21,30 @@
 namespace simd {
 
 bool HasAVX2 = false;
+bool HasAVX512 = false;
+bool HasNEON = false;
 
 bool init()
 {
 #if ENABLE_SIMD
     __builtin_cpu_init();
     HasAVX2 = __builtin_cpu_supports ("avx2");
+    HasAVX512 = HasAVX2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    HasNEON = true; // Mandatory on aarch64.
 #endif
-    return HasAVX2;
+    return HasAVX2 || HasNEON;
+}
+
+int getLevel()
+{
+    if (HasAVX512)
+        return SIMD_AVX512;
+    if (HasAVX2)
+        return SIMD_AVX2;
+    if (HasNEON)
+        return SIMD_NEON;
+    return SIMD_NONE;
 }
 
 };
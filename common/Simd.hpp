@@ -14,6 +14,11 @@
 namespace simd {
     bool init();
     extern bool HasAVX2;
+    extern bool HasAVX512; ///< Both AVX-512 F and BW.
+    extern bool HasNEON;
+
+    /// The best simd_Level (see kit/DeltaSimd.h) we have.
+    int getLevel();
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -11,38 +11,139 @@
 
 #pragma once
 
+#include <atomic>
 #include <cassert>
+#include <deque>
+#include <functional>
 #include <memory>
-#include <queue>
+#include <mutex>
 #include <thread>
 #include <condition_variable>
-#include <fstream>
-#include <unordered_map>
 #include <vector>
 
 #include <Util.hpp>
 
+/// A persistent, work-stealing thread pool.
+/// Each worker owns a deque of work; submitted work is spread
+/// over the deques and idle workers steal from their peers.
+/// Work is submitted via a Batch, which starts executing as soon
+/// as it is pushed, and can be waited on independently of any
+/// other Batch in flight, so several producers can share the pool.
 class ThreadPool
 {
     friend class WhiteBoxTests;
 
+public:
+    typedef std::function<void()> ThreadFn;
+
+    /// A group of work items submitted together, whose completion
+    /// can be awaited. The waiting thread helps executing queued
+    /// work rather than just sleeping.
+    class Batch
+    {
+        ThreadPool& _pool;
+        std::mutex _mutex;
+        std::condition_variable _complete;
+        size_t _pending; ///< Guarded by _mutex.
+
+    public:
+        explicit Batch(ThreadPool& pool)
+            : _pool(pool)
+            , _pending(0)
+        {
+        }
+
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+
+        /// Never leave work referencing us behind.
+        ~Batch() { wait(); }
+
+        /// Queue @fn for execution, which may start immediately.
+        void pushWork(ThreadFn fn)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                ++_pending;
+            }
+            _pool.enqueue(Work{ std::move(fn), this });
+        }
+
+        /// Returns the number of work items not yet completed.
+        size_t pending()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _pending;
+        }
+
+        /// Blocks until all the work pushed so far is done.
+        void wait()
+        {
+            while (pending() > 0 && _pool.runOne())
+            {
+                // Keep helping.
+            }
+
+            // Whatever is left is running in the workers.
+            std::unique_lock<std::mutex> lock(_mutex);
+            _complete.wait(lock, [this]() { return _pending == 0; });
+        }
+
+    private:
+        friend class ThreadPool;
+
+        /// Called by the pool once a work item of ours completed.
+        void done()
+        {
+            // Notify under the lock, so wait() can't return and
+            // destroy us before we are done with the mutex.
+            std::lock_guard<std::mutex> lock(_mutex);
+            assert(_pending > 0);
+            if (--_pending == 0)
+                _complete.notify_all();
+        }
+    };
+
+private:
+    struct Work
+    {
+        ThreadFn _fn;
+        Batch* _batch = nullptr;
+    };
+
+    /// The owner takes from the back, thieves from the front.
+    struct WorkQueue
+    {
+        std::mutex _mutex;
+        std::deque<Work> _work;
+    };
+
+    /// Protects _shutdown, and the sleeping of the workers.
     std::mutex _mutex;
     std::condition_variable _cond;
-    std::condition_variable _complete;
-    typedef std::function<void()> ThreadFn;
-    std::queue<ThreadFn> _work;
+    std::vector<std::unique_ptr<WorkQueue>> _queues;
     std::vector<std::thread> _threads;
-    size_t _working;
+    /// Work queued but not yet taken. Transiently negative,
+    /// since it is incremented after the work is queued.
+    std::atomic<int64_t> _queued;
+    std::atomic<size_t> _working;
+    std::atomic<size_t> _nextQueue;
+    std::atomic<uint64_t> _steals;
     int _maxConcurrency;
     bool _shutdown;
-    std::atomic<bool> _running;
+
+    /// The pool and queue index of the current thread, if it is a worker.
+    static inline thread_local const ThreadPool* CurrentPool = nullptr;
+    static inline thread_local size_t CurrentQueue = 0;
 
 public:
     ThreadPool()
-        : _working(0)
+        : _queued(0)
+        , _working(0)
+        , _nextQueue(0)
+        , _steals(0)
         , _maxConcurrency(2)
         , _shutdown(false)
-        , _running(false)
     {
 #if WASMAPP
         // Leave it at that.
@@ -55,6 +156,13 @@ public:
             _maxConcurrency = atoi(max);
 #endif
         LOG_TRC("PNG compression thread pool size " << _maxConcurrency);
+
+        // The thread waiting on a Batch is one of the workers.
+        // There is always at least one queue, to work without threads.
+        const size_t queueCount = std::max(_maxConcurrency - 1, 1);
+        for (size_t i = 0; i < queueCount; ++i)
+            _queues.emplace_back(std::make_unique<WorkQueue>());
+
         start();
     }
 
@@ -66,107 +174,147 @@ public:
     {
         {
             std::unique_lock<std::mutex> lock(_mutex);
-            assert(!_running);
-            assert(_working == 0);
             _shutdown = false;
         }
         for (int i = _threads.size(); i < _maxConcurrency - 1; ++i)
-            _threads.emplace_back(&ThreadPool::work, this);
+            _threads.emplace_back(&ThreadPool::work, this, i);
     }
 
+    /// Joins all the threads, eg. before forking.
+    /// Any work still queued is executed by the caller.
     void stop()
     {
         {
             std::unique_lock<std::mutex> lock(_mutex);
-            assert(_working == 0);
             _shutdown = true;
         }
         _cond.notify_all();
         for (auto& it : _threads)
             it.join();
         _threads.clear();
+
+        if (count() > 0)
+        {
+            LOG_WRN("Thread pool stopped with " << count() << " queued work items");
+            while (runOne())
+            {
+            }
+        }
+
+        assert(_working == 0);
     }
 
-    size_t count() const { return _work.size(); }
+    /// Returns the number of queued work items that haven't started yet.
+    size_t count() const { return std::max<int64_t>(_queued, 0); }
 
-    void pushWork(const ThreadFn& fn)
+    void dumpState(std::ostream& oss)
     {
-        std::unique_lock<std::mutex> lock(_mutex);
-        assert(!_running);
-        assert(!_shutdown);
-        assert(_working == 0);
-        _work.push(fn);
+        THREAD_UNSAFE_DUMP_BEGIN
+        oss << "\tthreadPool:"
+            << "\n\t\tshutdown: " << _shutdown << "\n\t\tworking: " << _working
+            << "\n\t\twork count: " << count() << "\n\t\tsteals: " << _steals
+            << "\n\t\tthread count " << _threads.size() << "\n";
+        THREAD_UNSAFE_DUMP_END
     }
 
-    void runOne(std::unique_lock<std::mutex>& lock)
+private:
+    void enqueue(Work work)
     {
-        assert(_running);
-        assert(!_work.empty());
+        // Workers keep to their own queue, others spread the load.
+        const size_t index = CurrentPool == this ? CurrentQueue : _nextQueue++ % _queues.size();
+        {
+            WorkQueue& queue = *_queues[index];
+            std::lock_guard<std::mutex> lock(queue._mutex);
+            queue._work.push_back(std::move(work));
+        }
 
-        ThreadFn fn = _work.front();
-        _work.pop();
-        _working++;
-        lock.unlock();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ++_queued;
+        }
+        _cond.notify_one();
+    }
+
+    /// Takes work from queue @index, or failing that, steals from the others.
+    bool takeWork(size_t index, Work& work)
+    {
+        const size_t size = _queues.size();
+        for (size_t i = 0; i < size; ++i)
+        {
+            WorkQueue& queue = *_queues[(index + i) % size];
+            std::lock_guard<std::mutex> lock(queue._mutex);
+            if (!queue._work.empty())
+            {
+                if (i == 0)
+                {
+                    work = std::move(queue._work.back());
+                    queue._work.pop_back();
+                }
+                else
+                {
+                    work = std::move(queue._work.front());
+                    queue._work.pop_front();
+                    ++_steals;
+                }
+
+                --_queued;
+                return true;
+            }
+        }
+
+        return false;
+    }
 
+    void execute(Work& work)
+    {
+        ++_working;
         try
         {
-            fn();
+            work._fn();
         }
         catch (...)
         {
             LOG_ERR("Exception in thread pool execution.");
         }
+        --_working;
 
-        lock.lock();
-        _working--;
-        if (_work.empty() && _working == 0)
-            _complete.notify_all();
+        work._batch->done();
     }
 
-    void run()
+    /// Executes one queued work item on the calling thread, if any.
+    bool runOne()
     {
-        std::unique_lock<std::mutex> lock(_mutex);
-        assert(!_running);
-        assert(_working == 0);
-
-        _running = true;
-
-        // Avoid notifying threads if we don't need to.
-        bool useThreads = _threads.size() > 1 && _work.size() > 1;
-        if (useThreads)
-            _cond.notify_all();
-
-        while (!_work.empty())
-            runOne(lock);
+        const size_t index = CurrentPool == this ? CurrentQueue : _nextQueue++ % _queues.size();
+        Work work;
+        if (!takeWork(index, work))
+            return false;
 
-        if (useThreads && (_working > 0 || !_work.empty()))
-            _complete.wait(lock, [this]() { return _working == 0 && _work.empty(); });
-
-        _running = false;
-
-        assert(_working == 0);
-        assert(_work.empty());
+        execute(work);
+        return true;
     }
 
-    void work()
+    void work(size_t index)
     {
         Util::setThreadName("ThreadPool::work");
-        std::unique_lock<std::mutex> lock(_mutex);
-        while (!_shutdown)
+        CurrentPool = this;
+        CurrentQueue = index;
+
+        for (;;)
         {
-            _cond.wait(lock);
-            while (!_shutdown && !_work.empty() && _running)
-                runOne(lock);
+            Work work;
+            if (takeWork(index, work))
+            {
+                execute(work);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this]() { return _shutdown || _queued > 0; });
+            if (_shutdown)
+                break;
         }
-    }
 
-    void dumpState(std::ostream& oss)
-    {
-        THREAD_UNSAFE_DUMP_BEGIN
-        oss << "\tthreadPool:"
-            << "\n\t\tshutdown: " << _shutdown << "\n\t\tworking: " << _working
-            << "\n\t\twork count: " << count() << "\n\t\tthread count " << _threads.size() << "\n";
-        THREAD_UNSAFE_DUMP_END
+        CurrentPool = nullptr;
     }
 };
 
@@ -12,17 +12,81 @@
 
 #include "TraceEvent.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <memory>
 #include <mutex>
 #include <sstream>
+#include <vector>
 
 
 std::atomic<bool> TraceEvent::recordingOn(false);
 
 thread_local int TraceEvent::threadLocalNesting = 0; // level of overlapped zones
 
+std::atomic<unsigned> TraceEvent::samplingRate(0);
+
 static std::mutex mutex;
 
+namespace
+{
+/// A sampled ProfileZone, formatted only when emitted.
+struct Sample
+{
+    int64_t startUs;
+    int64_t durationUs;
+    char name[48]; ///< Truncated, if need be.
+};
+
+/// The zones sampled by one thread, until emitted.
+struct SampleBuffer
+{
+    /// Beyond this, until emitted, the samples are dropped.
+    static constexpr std::size_t MaxSamples = 4096;
+
+    std::mutex mutex;
+    std::vector<Sample> samples;
+    uint64_t dropped = 0;
+    long tid = 0;
+    std::string threadName;
+    bool named = false; ///< Whether the name of the thread was emitted.
+    std::atomic<bool> exited{ false };
+};
+
+/// The buffers of all the threads that have sampled.
+struct SampleRegistry
+{
+    std::mutex mutex;
+    std::vector<std::shared_ptr<SampleBuffer>> buffers;
+};
+
+SampleRegistry* Samples = new SampleRegistry();
+
+/// Whether there might be anything to emit, so emitSamples() is cheap when there isn't.
+std::atomic<bool> SamplesPending(false);
+
+/// The buffer of this thread, to emit the rest of when it exits.
+struct ThreadSampleBuffer
+{
+    std::shared_ptr<SampleBuffer> buffer;
+
+    ~ThreadSampleBuffer()
+    {
+        if (buffer)
+        {
+            buffer->exited = true;
+            SamplesPending = true;
+        }
+    }
+};
+
+thread_local ThreadSampleBuffer OwnSamples;
+thread_local int SampleNesting = 0;
+thread_local unsigned SampleCount = 0;
+thread_local bool SampledTree = false;
+} // namespace
+
 void TraceEvent::emitInstantEvent(const std::string& name, const std::string& argsOrEmpty)
 {
     if (!recordingOn)
@@ -59,6 +123,147 @@ void TraceEvent::startRecording()
 
 void TraceEvent::stopRecording() { recordingOn = false; }
 
+void TraceEvent::setSampling(unsigned rate) { samplingRate = rate; }
+
+void TraceEvent::emitSamples()
+{
+    // Called on every iteration of the kit's loop; don't lock anything for nothing.
+    if (!SamplesPending.load(std::memory_order_relaxed) || !SamplesPending.exchange(false))
+        return;
+
+    std::vector<std::shared_ptr<SampleBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(Samples->mutex);
+        buffers = Samples->buffers;
+
+        // We emit what the exited threads left for the last time.
+        std::erase_if(Samples->buffers, [](const std::shared_ptr<SampleBuffer>& buffer)
+                      { return buffer->exited.load(); });
+    }
+
+    const std::string pid = std::to_string(Util::getProcessId());
+    std::string recordings;
+    std::vector<Sample> samples;
+    for (const auto& buffer : buffers)
+    {
+        uint64_t dropped;
+        {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            samples.swap(buffer->samples);
+            dropped = buffer->dropped;
+            buffer->dropped = 0;
+        }
+
+        if (samples.empty() && !dropped)
+            continue;
+
+        const std::string tid = std::to_string(buffer->tid);
+        if (!buffer->named && !buffer->threadName.empty())
+        {
+            recordings += "{\"name\":\"thread_name\",\"ph\":\"M\",\"args\":{\"name\":\"" +
+                          buffer->threadName + "\"},\"pid\":" + pid + ",\"tid\":" + tid + "},\n";
+            buffer->named = true;
+        }
+
+        for (const Sample& sample : samples)
+        {
+            recordings += "{\"name\":\"";
+            recordings += sample.name;
+            recordings += "\",\"cat\":\"sampled\",\"ph\":\"X\",\"ts\":" +
+                          std::to_string(sample.startUs) +
+                          ",\"dur\":" + std::to_string(sample.durationUs) + ",\"pid\":" + pid +
+                          ",\"tid\":" + tid + "},\n";
+        }
+
+        if (dropped)
+        {
+            recordings += "{\"name\":\"dropped samples\",\"ph\":\"i\",\"s\":\"t\",\"ts\":" +
+                          std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(
+                                             std::chrono::system_clock::now().time_since_epoch())
+                                             .count()) +
+                          ",\"pid\":" + pid + ",\"tid\":" + tid + ",\"args\":{\"count\":\"" +
+                          std::to_string(dropped) + "\"}},\n";
+        }
+
+        samples.clear();
+    }
+
+    if (!recordings.empty())
+        emitOneRecordingIfEnabled(recordings);
+}
+
+void TraceEvent::postFork()
+{
+    samplingRate = 0;
+    SamplesPending = false;
+
+    // Deliberately leaked: its mutexes may have been held by threads that are no more.
+    Samples = new SampleRegistry();
+    OwnSamples.buffer.reset();
+}
+
+void ProfileZone::beginSample()
+{
+    if (SampleNesting == 0)
+    {
+        // Sample whole trees of zones, to see where the time of the outermost goes.
+        const unsigned rate = samplingRate.load(std::memory_order_relaxed);
+        SampledTree = rate && ++SampleCount % rate == 0;
+    }
+
+    _sampleNesting = SampleNesting++;
+    if (SampledTree)
+    {
+        _sampled = true;
+        _createTime = std::chrono::system_clock::now();
+    }
+}
+
+void ProfileZone::endSample()
+{
+    if (SampleNesting > 0)
+        --SampleNesting;
+
+    _sampleNesting = -1;
+    if (!_sampled)
+        return;
+
+    _sampled = false;
+    const auto now = std::chrono::system_clock::now();
+
+    ThreadSampleBuffer& own = OwnSamples;
+    if (!own.buffer)
+    {
+        own.buffer = std::make_shared<SampleBuffer>();
+        own.buffer->tid = getThreadId();
+#ifndef TEST_TRACEEVENT_EXE
+        own.buffer->threadName = Util::getThreadName();
+#endif
+
+        std::lock_guard<std::mutex> lock(Samples->mutex);
+        Samples->buffers.push_back(own.buffer);
+    }
+
+    SampleBuffer& buffer = *own.buffer;
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    SamplesPending.store(true, std::memory_order_relaxed);
+    if (buffer.samples.size() >= SampleBuffer::MaxSamples)
+    {
+        ++buffer.dropped;
+        return;
+    }
+
+    Sample& sample = buffer.samples.emplace_back();
+    sample.startUs =
+        std::chrono::duration_cast<std::chrono::microseconds>(_createTime.time_since_epoch())
+            .count();
+    sample.durationUs =
+        std::chrono::duration_cast<std::chrono::microseconds>(now - _createTime).count();
+    const std::size_t size = std::min(name().size(), sizeof(sample.name) - 1);
+    memcpy(sample.name, name().data(), size);
+    sample.name[size] = '\0';
+}
+
 void ProfileZone::emitRecording()
 {
     if (!recordingOn)
@@ -108,6 +313,11 @@ void TraceEvent::emitOneRecording(const std::string &recording)
     std::cout << "  " << recording;
 }
 
+void TraceEvent::emitOneRecordingIfEnabled(const std::string &recording)
+{
+    std::cout << recording;
+}
+
 int main(int, char**)
 {
     std::cout << "[\n";
@@ -177,6 +387,19 @@ int main(int, char**)
     delete p1;
     delete p2;
 
+    TraceEvent::stopRecording();
+
+    // Every other tree of zones is sampled: expect "sampled outer" and "sampled inner" twice.
+    TraceEvent::setSampling(2);
+    for (auto n = 0; n < 4; n++)
+    {
+        ProfileZone outer("sampled outer");
+        ProfileZone inner("sampled inner");
+    }
+
+    TraceEvent::setSampling(0);
+    TraceEvent::emitSamples();
+
     // Add a dummy integer last in the array to avoid incorrect JSON syntax
     std::cout << "  0\n";
     std::cout << "]\n";
@@ -26,6 +26,12 @@
 // process they are written to the Trace Event log file as generated (as buffered by the C++
 // library). In the Kit process they are buffered and then sent to the WSD process for writing to
 // the same log file. In the TraceEvent test program they are written out to stdout.
+//
+// Besides recording everything, ProfileZones can be sampled: one in so many of the outermost
+// zones of each thread is kept, with all the zones nested in it, in a binary buffer of the
+// thread. Those are only turned into Trace Events, periodically, by emitSamples(), so sampling
+// can stay on in production. The timestamps are those of the system clock, as when recording,
+// so the Trace Events of all the processes line up.
 
 class TraceEvent
 {
@@ -38,6 +44,7 @@ private:
 protected:
     static std::atomic<bool> recordingOn; // True during recoding/emission
     thread_local static int threadLocalNesting; // For use only by the ProfileZone derived class
+    static std::atomic<unsigned> samplingRate; // One in so many zone trees is sampled, 0 for none
 
     /// Reset the pid when done recording.
     void reset() { _pid = -1; }
@@ -102,6 +109,18 @@ public:
         return recordingOn;
     }
 
+    /// Samples one in @rate of the outermost ProfileZones of each thread, with
+    /// those nested in them. 0 stops sampling.
+    static void setSampling(unsigned rate);
+    static unsigned getSampling() { return samplingRate; }
+
+    /// Emits the zones sampled so far, by all threads, as Trace Events,
+    /// through emitOneRecordingIfEnabled().
+    static void emitSamples();
+
+    /// In the child after forking: stops sampling, and forgets the other threads.
+    static void postFork();
+
     static void emitInstantEvent(const std::string& name)
     {
         emitInstantEvent(name, "");
@@ -157,12 +176,19 @@ class ProfileZone : public NamedEvent
 private:
     std::chrono::time_point<std::chrono::system_clock> _createTime;
     int _nesting;
+    int _sampleNesting; ///< -1 when not sampling.
+    bool _sampled;
 
     void emitRecording();
 
+    void beginSample();
+    void endSample();
+
     ProfileZone(std::string name, std::string args)
         : NamedEvent(std::move(name), std::move(args))
         , _nesting(-1)
+        , _sampleNesting(-1)
+        , _sampled(false)
     {
         if (recordingOn)
         {
@@ -171,6 +197,10 @@ private:
 
             _nesting = threadLocalNesting++;
         }
+        else if (samplingRate.load(std::memory_order_relaxed))
+        {
+            beginSample();
+        }
     }
 
     void emitIfRecording()
@@ -210,7 +240,12 @@ public:
     {
     }
 
-    ~ProfileZone() { emitIfRecording(); }
+    ~ProfileZone()
+    {
+        emitIfRecording();
+        if (_sampleNesting >= 0)
+            endSample();
+    }
 
     ProfileZone(const ProfileZone&) = delete;
     void operator=(const ProfileZone&) = delete;
@@ -219,6 +254,8 @@ public:
     {
         emitIfRecording();
         reset(); // So we don't re-emit on destruction.
+        if (_sampleNesting >= 0)
+            endSample();
     }
 };
 
@@ -25,6 +25,7 @@ size_t getTotalSystemMemoryKb() { return 0; }
 std::size_t getFromFile(const char*) { return 0; }
 std::size_t getCGroupMemLimit() { return 0; }
 std::size_t getCGroupMemSoftLimit() { return 0; }
+std::string getCGroupV2Path(const std::string&) { return std::string(); }
 size_t getMemoryUsagePSS(pid_t) { return 0; }
 size_t getMemoryUsageRSS(pid_t) { return 0; }
 size_t getCurrentThreadCount() { return 0; }
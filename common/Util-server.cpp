@@ -321,6 +321,18 @@ std::size_t getCGroupMemSoftLimit()
 #endif
 }
 
+std::string getCGroupV2Path(const std::string& key)
+{
+#ifdef __linux__
+    if (isCGroupV2())
+    {
+        const std::string cgroupPath = getCurrentCGroupPath();
+        return "/sys/fs/cgroup" + cgroupPath + (cgroupPath.ends_with('/') ? "" : "/") + key;
+    }
+#endif
+    return std::string();
+}
+
 std::pair<std::size_t, std::size_t> getPssAndDirtyFromSMaps(FILE* file)
 {
     std::size_t numPSSKb = 0;
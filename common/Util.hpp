@@ -324,6 +324,9 @@ namespace Util
     /// Returns the cgroup's soft memory limit, or 0 if not available in bytes
     std::size_t getCGroupMemSoftLimit();
 
+    /// Returns the path of the file @key of our cgroup, or empty if not on cgroup v2
+    std::string getCGroupV2Path(const std::string& key);
+
     /// Returns the process PSS in KB (works only when we have perms for /proc/pid/smaps).
     size_t getMemoryUsagePSS(pid_t pid);
 
@@ -23,8 +23,9 @@
 #include <cassert>
 #include <cstdint>
 #include <fstream>
+#include <list>
 #include <memory>
-#include <unordered_set>
+#include <unordered_map>
 #include <vector>
 #include <zlib.h>
 #include <zstd.h>
@@ -82,6 +83,7 @@ class DeltaGenerator {
     /// Bitmap row with a CRC for quick vertical shift detection
     class DeltaBitmapRow final {
         size_t _rleSize;
+        uint32_t _hash; ///< Fingerprint of the RLE data, if we have a fast one, or 0.
         uint64_t _rleMask[_rleMaskUnits];
         uint32_t *_rleData;
     public:
@@ -138,6 +140,7 @@ class DeltaGenerator {
 
         DeltaBitmapRow()
             : _rleSize(0)
+            , _hash(0)
             , _rleData(nullptr)
         {
             memset(_rleMask, 0, sizeof(_rleMask));
@@ -282,6 +285,10 @@ class DeltaGenerator {
             if (!done)
                 initPixRowCpu(from, scratch, &_rleSize, _rleMask, width);
 
+            // Makes shift detection cheap, comparing mostly unequal rows.
+            if (!simd_rowHash(simd::getLevel(), _rleMask, _rleMaskUnits, scratch, _rleSize, &_hash))
+                _hash = 0;
+
             if (_rleSize > 0)
             {
                 _rleData = (uint32_t *)malloc((size_t)_rleSize * 4);
@@ -293,7 +300,7 @@ class DeltaGenerator {
 
         bool identical(const DeltaBitmapRow &other) const
         {
-            if (_rleSize != other._rleSize)
+            if (_rleSize != other._rleSize || _hash != other._hash)
                 return false;
             if (memcmp(_rleMask, other._rleMask, sizeof(_rleMask)))
                 return false;
@@ -478,45 +485,61 @@ class DeltaGenerator {
         DeltaBitmapRow *_rows;
     };
 
-    struct DeltaHasher {
-        std::size_t operator()(const std::shared_ptr<DeltaData> &t) const
+    struct LocationHasher {
+        std::size_t operator()(const TileLocation& loc) const
         {
-            return t->_loc.hash();
+            return loc.hash();
         }
     };
 
-    struct DeltaCompare {
-        bool operator()(const std::shared_ptr<DeltaData> &a,
-                        const std::shared_ptr<DeltaData> &b) const
-        {
-            return a->_loc == b->_loc;
-        }
+    /// A cached tile, with the bytes it is accounted for.
+    struct CacheEntry {
+        std::shared_ptr<DeltaData> _data;
+        size_t _bytes;
     };
+    using LruList = std::list<CacheEntry>;
 
     std::mutex _deltaGuard;
-    /// The last several bitmap entries as a cache
-    std::unordered_set<std::shared_ptr<DeltaData>, DeltaHasher, DeltaCompare> _deltaEntries;
-    size_t _maxEntries;
+    /// The last bitmap entries as a cache, most recently used first.
+    LruList _lru;
+    std::unordered_map<TileLocation, LruList::iterator, LocationHasher> _deltaEntries;
+    size_t _totalBytes;
+    size_t _maxBytes;
+
+    /// Returns a compression context, reset for a new frame.
+    /// Allocating one per tile is costly, so each (pool) thread keeps its own.
+    static ZSTD_CCtx* getCompressor()
+    {
+        static thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> cctx(
+            ZSTD_createCCtx(), ZSTD_freeCCtx);
+        if (!cctx)
+            return nullptr;
+
+        ZSTD_CCtx_reset(cctx.get(), ZSTD_reset_session_and_parameters);
+        ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_compressionLevel, compressionLevel);
+        return cctx.get();
+    }
 
+    /// Evicts the least recently used entries until we fit the budget.
+    /// The most recent entry is always kept, however large.
     void rebalanceDeltasT(bool dropAll = false)
     {
         assert(!_deltaGuard.try_lock() && "Expected to have _deltaGuard lock taken");
 
-        if (_deltaEntries.size() > _maxEntries || dropAll)
-        {
-            size_t toRemove = _deltaEntries.size();
-            if (!dropAll)
-                toRemove -= (_maxEntries * 3 / 4);
-            std::vector<std::shared_ptr<DeltaData>> entries;
-            entries.insert(entries.end(), _deltaEntries.begin(), _deltaEntries.end());
-            std::sort(entries.begin(), entries.end(),
-                      [](const std::shared_ptr<DeltaData> &a,
-                         const std::shared_ptr<DeltaData> &b)
-                          {
-                              return a->getWid() < b->getWid();
-                          });
-            for (size_t i = 0; i < toRemove; ++i)
-                _deltaEntries.erase(entries[i]);
+        if (dropAll)
+        {
+            _deltaEntries.clear();
+            _lru.clear();
+            _totalBytes = 0;
+            return;
+        }
+
+        while (_totalBytes > _maxBytes && _lru.size() > 1)
+        {
+            const CacheEntry& oldest = _lru.back();
+            _totalBytes -= oldest._bytes;
+            _deltaEntries.erase(oldest._data->_loc);
+            _lru.pop_back();
         }
     }
 
@@ -626,50 +649,65 @@ class DeltaGenerator {
         // terminating this delta so we can detect the next one.
         output.push_back('t');
 
-        // FIXME: avoid allocation & make this more efficient.
-        size_t maxCompressed = ZSTD_COMPRESSBOUND(output.size());
-        std::unique_ptr<char, void (*)(void*)> compressed((char*)malloc(maxCompressed), free);
+        ZSTD_CCtx* cctx = getCompressor();
+        if (!cctx)
+        {
+            LOG_ERR("Failed to create a compression context");
+            return false;
+        }
+
+        // compress for speed, not size - and trust to deltas,
+        // directly into the output.
+        const size_t oldSize = outStream.size();
+        const size_t maxCompressed = ZSTD_COMPRESSBOUND(output.size());
+        outStream.resize(oldSize + 1 + maxCompressed);
+        outStream[oldSize] = 'D';
 
-        // compress for speed, not size - and trust to deltas.
-        size_t compSize = ZSTD_compress(compressed.get(), maxCompressed,
-                                        output.data(), output.size(),
-                                        compressionLevel);
+        size_t compSize = ZSTD_compress2(cctx, &outStream[oldSize + 1], maxCompressed,
+                                         output.data(), output.size());
         if (ZSTD_isError(compSize))
         {
             LOG_ERR("Failed to compress delta of size " << output.size() << " with " << ZSTD_getErrorName(compSize));
+            outStream.resize(oldSize);
             return false;
         }
 
         LOGA_TRC(Pixel, "Compressed delta of size " << output.size() << " to size " << compSize);
-        //                << HexUtil::dumpHex(std::string((char *)compressed.get(), compSize)));
+        //                << HexUtil::dumpHex(std::string(&outStream[oldSize + 1], compSize)));
 
-        // FIXME: should get zstd to drop it directly in-place really.
-        outStream.push_back('D');
-        size_t oldSize = outStream.size();
-        outStream.resize(oldSize + compSize);
-        memcpy(&outStream[oldSize], compressed.get(), compSize);
+        outStream.resize(oldSize + 1 + compSize);
 
         return true;
     }
 
   public:
-    DeltaGenerator()
-        : _maxEntries(0)
+    /// A reasonable cache for a handful of views of a large document.
+    static constexpr size_t DefaultMaxBytes = 64 * 1024 * 1024;
+
+    explicit DeltaGenerator(size_t maxBytes = DefaultMaxBytes)
+        : _totalBytes(0)
+        , _maxBytes(maxBytes)
     {}
 
-    /// Re-balances the cache size to fit the number of sessions
-    void rebalanceDeltas(ssize_t limit = -1)
+    /// Sets the memory budget of the cache, evicting what no longer fits.
+    void setMaxBytes(size_t maxBytes)
     {
         std::unique_lock<std::mutex> guard(_deltaGuard);
-        if (limit > 0)
-            _maxEntries = limit;
+        _maxBytes = maxBytes;
         rebalanceDeltasT();
     }
 
-    /// Adapts cache sizing to the number of sessions
-    void setSessionCount(size_t count)
+    size_t getMaxBytes()
+    {
+        std::unique_lock<std::mutex> guard(_deltaGuard);
+        return _maxBytes;
+    }
+
+    /// Returns the bytes used by the cached tiles.
+    size_t getUsedBytes()
     {
-        rebalanceDeltas(std::max(count, size_t(1)) * 96);
+        std::unique_lock<std::mutex> guard(_deltaGuard);
+        return _totalBytes;
     }
 
     void dropCache()
@@ -680,17 +718,16 @@ class DeltaGenerator {
 
     void dumpState(std::ostream& oss)
     {
-        oss << "\tdelta generator with " << _deltaEntries.size() << " entries vs. max "
-            << _maxEntries << '\n';
-        size_t totalSize = 0;
-        for (const auto& it : _deltaEntries)
+        std::unique_lock<std::mutex> guard(_deltaGuard);
+        oss << "\tdelta generator with " << _deltaEntries.size() << " entries, most recent first\n";
+        for (const CacheEntry& it : _lru)
         {
-            size_t size = it->sizeBytes();
-            oss << "\t\t" << it->_loc._size << ',' << it->_loc._part << ',' << it->_loc._left << ','
-                << it->_loc._top << " wid: " << it->getWid() << " size: " << size << '\n';
-            totalSize += size;
+            const TileLocation& loc = it._data->_loc;
+            oss << "\t\t" << loc._size << ',' << loc._part << ',' << loc._left << ','
+                << loc._top << " wid: " << it._data->getWid() << " size: " << it._bytes << '\n';
         }
-        oss << "\tdelta generator consumes " << totalSize << " bytes\n";
+        oss << "\tdelta generator consumes " << _totalBytes << " bytes vs. max " << _maxBytes
+            << " bytes\n";
     }
 
     /**
@@ -728,20 +765,32 @@ class DeltaGenerator {
         // and just do this as/when there is no entry.
         std::shared_ptr<DeltaData> update(std::make_shared<DeltaData>(
             wid, pixmap, startX, startY, width, height, loc, bufferWidth, bufferHeight));
+        const size_t updateBytes = update->sizeBytes();
         std::shared_ptr<DeltaData> cacheEntry;
 
         {
             // protect _deltaEntries
             std::unique_lock<std::mutex> guard(_deltaGuard);
 
-            auto it = _deltaEntries.find(update);
+            auto it = _deltaEntries.find(loc);
             if (it == _deltaEntries.end())
             {
-                _deltaEntries.insert(update);
+                _lru.push_front(CacheEntry{ update, updateBytes });
+                _deltaEntries.emplace(loc, _lru.begin());
+                _totalBytes += updateBytes;
+                rebalanceDeltasT();
                 rleData = std::move(update);
                 return false;
             }
-            cacheEntry = *it;
+
+            // Account for it as it will be, once replaced below.
+            const LruList::iterator entry = it->second;
+            _lru.splice(_lru.begin(), _lru, entry);
+            _totalBytes = _totalBytes - entry->_bytes + updateBytes;
+            entry->_bytes = updateBytes;
+            rebalanceDeltasT();
+
+            cacheEntry = entry->_data;
             cacheEntry->use();
         }
 
@@ -829,19 +878,20 @@ class DeltaGenerator {
             size_t rowSize = (size_t)width * 4 + spaceForBitmask + 2;
             size_t maxCompressed = ZSTD_COMPRESSBOUND(rowSize * height);
 
-            std::unique_ptr<char, void (*)(void*)> compressed((char*)malloc(maxCompressed), free);
-            if (!compressed)
+            ZSTD_CCtx* cctx = getCompressor();
+            if (!cctx)
             {
-                LOG_ERR("Failed to allocate buffer of size " << maxCompressed << " to compress into");
+                LOG_ERR("Failed to create a compression context");
                 return 0;
             }
 
-            ZSTD_CCtx *cctx = ZSTD_createCCtx();
-
-            ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, compressionLevel);
+            // Compress directly into the output.
+            const size_t oldSize = output.size();
+            output.resize(oldSize + 1 + maxCompressed);
+            output[oldSize] = 'Z';
 
             ZSTD_outBuffer outb;
-            outb.dst = compressed.get();
+            outb.dst = &output[oldSize + 1];
             outb.size = maxCompressed;
             outb.pos = 0;
 
@@ -865,22 +915,16 @@ class DeltaGenerator {
                 if (ZSTD_isError(compSize))
                 {
                     LOG_ERR("failed to compress image: " << compSize << " is: " << ZSTD_getErrorName(compSize));
-                    ZSTD_freeCCtx(cctx);
+                    output.resize(oldSize);
                     return 0;
                 }
             }
 
-            ZSTD_freeCCtx(cctx);
-
             size_t compSize = outb.pos;
             LOGA_TRC(Pixel, "Compressed image of size " << (width * height * 4) << " to size " << compSize);
-            //            << HexUtil::dumpHex(std::string((char *)compressed, compSize)));
+            //            << HexUtil::dumpHex(std::string(&output[oldSize + 1], compSize)));
 
-            // FIXME: get zstd to compress directly into this buffer.
-            output.push_back('Z');
-            size_t oldSize = output.size();
-            output.resize(oldSize + compSize);
-            memcpy(&output[oldSize], compressed.get(), compSize);
+            output.resize(oldSize + 1 + compSize);
         }
         else
         {
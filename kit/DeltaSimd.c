@@ -24,6 +24,16 @@
 
 #include "DeltaSimd.h"
 
+#if !ENABLE_SIMD && defined(__aarch64__) && defined(__ARM_NEON)
+#  define ENABLE_NEON 1
+#  include <arm_neon.h>
+#  if defined(__ARM_FEATURE_CRC32)
+#    include <arm_acle.h>
+#  endif
+#else
+#  define ENABLE_NEON 0
+#endif
+
 #if ENABLE_SIMD
 #  include <immintrin.h>
 
@@ -185,4 +195,424 @@ int simd_initPixRowSimd(const uint32_t *from, uint32_t *scratch, size_t *scratch
 #endif // ENABLE_SIMD
 }
 
+#if ENABLE_SIMD || ENABLE_NEON
+
+// Scalar unpremultiply of one pixel, for what doesn't fit in vectors; as in Png.hpp.
+static inline void unpremultiplyPixel(uint8_t *b, int swap)
+{
+    uint32_t pix;
+    memcpy(&pix, b, sizeof(pix));
+
+    const uint32_t alpha = pix >> 24;
+    const uint32_t c0 = swap ? (pix >> 16) & 0xff : pix & 0xff;
+    const uint32_t c1 = (pix >> 8) & 0xff;
+    const uint32_t c2 = swap ? pix & 0xff : (pix >> 16) & 0xff;
+    if (alpha == 255)
+    {
+        b[0] = c0;
+        b[1] = c1;
+        b[2] = c2;
+        b[3] = 255;
+    }
+    else if (alpha == 0)
+    {
+        b[0] = b[1] = b[2] = b[3] = 0;
+    }
+    else
+    {
+        b[0] = (c0 * 255 + alpha / 2) / alpha;
+        b[1] = (c1 * 255 + alpha / 2) / alpha;
+        b[2] = (c2 * 255 + alpha / 2) / alpha;
+        b[3] = alpha;
+    }
+}
+
+// Scalar blend of one pixel; as in Watermark.hpp.
+static inline void blendPixel(uint8_t *t, const uint8_t *f, int opaqueOnly, int slideShow)
+{
+    const int dim = slideShow && t[3] == 0;
+    if (opaqueOnly && t[3] != 255 && !dim)
+        return;
+
+    const uint32_t inv = 255 - f[3];
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        const uint32_t v = f[i] + (t[i] * inv) / 255;
+        t[i] = v > 255 ? 255 : v;
+    }
+
+    if (dim)
+        t[3] >>= 3;
+}
+
+// Unpremultiply the lanes in 'rest' (a bit per pixel) one by one, from the original 'orig'.
+static inline void unpremultiplyRest(uint8_t *p, const uint32_t *orig, uint32_t rest, int swap)
+{
+    while (rest)
+    {
+        const unsigned int j = __builtin_ctz(rest);
+        memcpy(p + j * 4, &orig[j], 4);
+        unpremultiplyPixel(p + j * 4, swap);
+        rest &= rest - 1;
+    }
+}
+
+#endif
+
+#if ENABLE_SIMD
+
+// Division by 255 of 16bit lanes, exact for products of two bytes.
+static inline __m256i div255AVX2(__m256i x)
+{
+    const __m256i one = _mm256_set1_epi16(1);
+    return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(x, one), _mm256_srli_epi16(x, 8)), 8);
+}
+
+static void unpremultiplyAVX2(uint8_t *data, size_t pixels, int swap)
+{
+    const __m256i alphaMask = _mm256_set1_epi32((int)0xff000000);
+    const __m256i swapMask = _mm256_setr_epi8(
+        2, 1, 0, 3,  6, 5, 4, 7,  10, 9, 8, 11,  14, 13, 12, 15,
+        2, 1, 0, 3,  6, 5, 4, 7,  10, 9, 8, 11,  14, 13, 12, 15);
+
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8)
+    {
+        uint8_t *p = data + i * 4;
+        const __m256i px = _mm256_loadu_si256((const __m256i_u*)p);
+        const __m256i alpha = _mm256_and_si256(px, alphaMask);
+        const __m256i opaque = _mm256_cmpeq_epi32(alpha, alphaMask);
+        const __m256i clear = _mm256_cmpeq_epi32(alpha, _mm256_setzero_si256());
+        const uint32_t opaqueBits = _mm256_movemask_ps(_mm256_castsi256_ps(opaque));
+        const uint32_t clearBits = _mm256_movemask_ps(_mm256_castsi256_ps(clear));
+
+        if (opaqueBits == 0xff && !swap)
+            continue; // Nothing to do.
+
+        // Opaque pixels are just swizzled, all others are cleared ...
+        const __m256i out = _mm256_and_si256(swap ? _mm256_shuffle_epi8(px, swapMask) : px, opaque);
+        uint32_t orig[8];
+        _mm256_storeu_si256((__m256i_u*)orig, px);
+        _mm256_storeu_si256((__m256i_u*)p, out);
+
+        // ... and the translucent ones done the slow way.
+        unpremultiplyRest(p, orig, ~(opaqueBits | clearBits) & 0xff, swap);
+    }
+
+    for (; i < pixels; ++i)
+        unpremultiplyPixel(data + i * 4, swap);
+}
+
+// Blend bytes widened to 16bit lanes, two pixels per 128bit lane.
+static inline __m256i blendWideAVX2(__m256i t, __m256i f)
+{
+    const __m256i alphaSpread = _mm256_setr_epi8(
+        6, 7, 6, 7, 6, 7, 6, 7,  14, 15, 14, 15, 14, 15, 14, 15,
+        6, 7, 6, 7, 6, 7, 6, 7,  14, 15, 14, 15, 14, 15, 14, 15);
+    const __m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(255), _mm256_shuffle_epi8(f, alphaSpread));
+    return _mm256_adds_epu16(f, div255AVX2(_mm256_mullo_epi16(t, inv)));
+}
+
+static void blendAVX2(uint8_t *to, const uint8_t *from, size_t pixels, int opaqueOnly, int slideShow)
+{
+    const __m256i alphaMask = _mm256_set1_epi32((int)0xff000000);
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8)
+    {
+        uint8_t *p = to + i * 4;
+        const __m256i t = _mm256_loadu_si256((const __m256i_u*)p);
+        const __m256i f = _mm256_loadu_si256((const __m256i_u*)(from + i * 4));
+
+        const __m256i alpha = _mm256_and_si256(t, alphaMask);
+        const __m256i dim = slideShow ? _mm256_cmpeq_epi32(alpha, zero) : zero;
+        const __m256i process = opaqueOnly
+            ? _mm256_or_si256(_mm256_cmpeq_epi32(alpha, alphaMask), dim)
+            : _mm256_cmpeq_epi32(zero, zero);
+        if (_mm256_testz_si256(process, process))
+            continue;
+
+        // unpack & pack are both per 128bit lane, so the order is preserved.
+        const __m256i lo = blendWideAVX2(_mm256_unpacklo_epi8(t, zero), _mm256_unpacklo_epi8(f, zero));
+        const __m256i hi = blendWideAVX2(_mm256_unpackhi_epi8(t, zero), _mm256_unpackhi_epi8(f, zero));
+        __m256i out = _mm256_packus_epi16(lo, hi);
+
+        const __m256i dimmed = _mm256_or_si256(_mm256_andnot_si256(alphaMask, out),
+                                               _mm256_slli_epi32(_mm256_srli_epi32(out, 27), 24));
+        out = _mm256_blendv_epi8(out, dimmed, dim);
+        out = _mm256_blendv_epi8(t, out, process);
+        _mm256_storeu_si256((__m256i_u*)p, out);
+    }
+
+    for (; i < pixels; ++i)
+        blendPixel(to + i * 4, from + i * 4, opaqueOnly, slideShow);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void unpremultiplyAVX512(uint8_t *data, size_t pixels, int swap)
+{
+    const __m512i alphaMask = _mm512_set1_epi32((int)0xff000000);
+    const __m512i swapMask = _mm512_broadcast_i32x4(
+        _mm_setr_epi8(2, 1, 0, 3,  6, 5, 4, 7,  10, 9, 8, 11,  14, 13, 12, 15));
+
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16)
+    {
+        uint8_t *p = data + i * 4;
+        const __m512i px = _mm512_loadu_si512(p);
+        const __mmask16 opaque = _mm512_cmpeq_epi32_mask(_mm512_and_si512(px, alphaMask), alphaMask);
+        const __mmask16 clear = _mm512_testn_epi32_mask(px, alphaMask);
+
+        if (opaque == 0xffff && !swap)
+            continue; // Nothing to do.
+
+        uint32_t orig[16];
+        _mm512_storeu_si512(orig, px);
+        _mm512_storeu_si512(p, _mm512_maskz_mov_epi32(opaque, swap ? _mm512_shuffle_epi8(px, swapMask) : px));
+
+        unpremultiplyRest(p, orig, ~(opaque | clear) & 0xffff, swap);
+    }
+
+    for (; i < pixels; ++i)
+        unpremultiplyPixel(data + i * 4, swap);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void blendAVX512(uint8_t *to, const uint8_t *from, size_t pixels, int opaqueOnly, int slideShow)
+{
+    const __m512i alphaMask = _mm512_set1_epi32((int)0xff000000);
+    const __m512i alphaSpread = _mm512_broadcast_i32x4(
+        _mm_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7,  14, 15, 14, 15, 14, 15, 14, 15));
+    const __m512i c255 = _mm512_set1_epi16(255);
+    const __m512i one = _mm512_set1_epi16(1);
+    const __m512i zero = _mm512_setzero_si512();
+
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16)
+    {
+        uint8_t *p = to + i * 4;
+        const __m512i t = _mm512_loadu_si512(p);
+        const __m512i f = _mm512_loadu_si512(from + i * 4);
+
+        const __mmask16 dim = slideShow ? _mm512_testn_epi32_mask(t, alphaMask) : 0;
+        const __mmask16 process = opaqueOnly
+            ? (_mm512_cmpeq_epi32_mask(_mm512_and_si512(t, alphaMask), alphaMask) | dim)
+            : 0xffff;
+        if (!process)
+            continue;
+
+        __m512i wide[2];
+        for (int h = 0; h < 2; ++h)
+        {
+            const __m512i tw = h ? _mm512_unpackhi_epi8(t, zero) : _mm512_unpacklo_epi8(t, zero);
+            const __m512i fw = h ? _mm512_unpackhi_epi8(f, zero) : _mm512_unpacklo_epi8(f, zero);
+            const __m512i inv = _mm512_sub_epi16(c255, _mm512_shuffle_epi8(fw, alphaSpread));
+            const __m512i x = _mm512_mullo_epi16(tw, inv);
+            const __m512i q = _mm512_srli_epi16(
+                _mm512_add_epi16(_mm512_add_epi16(x, one), _mm512_srli_epi16(x, 8)), 8);
+            wide[h] = _mm512_adds_epu16(fw, q);
+        }
+        __m512i out = _mm512_packus_epi16(wide[0], wide[1]);
+
+        const __m512i dimmed = _mm512_or_si512(_mm512_andnot_si512(alphaMask, out),
+                                               _mm512_slli_epi32(_mm512_srli_epi32(out, 27), 24));
+        out = _mm512_mask_mov_epi32(out, dim, dimmed);
+        out = _mm512_mask_mov_epi32(t, process, out);
+        _mm512_storeu_si512(p, out);
+    }
+
+    for (; i < pixels; ++i)
+        blendPixel(to + i * 4, from + i * 4, opaqueOnly, slideShow);
+}
+
+static uint64_t crc32cAppend(uint64_t crc, const uint8_t *p, size_t len)
+{
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = _mm_crc32_u64(crc, v);
+    }
+    for (; len >= 4; p += 4, len -= 4)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = _mm_crc32_u32((uint32_t)crc, v);
+    }
+    return crc;
+}
+
+#endif // ENABLE_SIMD
+
+#if ENABLE_NEON
+
+static void unpremultiplyNEON(uint8_t *data, size_t pixels, int swap)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16)
+    {
+        uint8_t *p = data + i * 4;
+        uint8x16x4_t px = vld4q_u8(p);
+        const uint8x16_t opaque = vceqq_u8(px.val[3], vdupq_n_u8(255));
+        const uint8x16_t clear = vceqq_u8(px.val[3], vdupq_n_u8(0));
+
+        if (vminvq_u8(opaque) == 0xff && !swap)
+            continue; // Nothing to do.
+
+        uint32_t orig[16];
+        memcpy(orig, p, sizeof(orig));
+
+        if (swap)
+        {
+            const uint8x16_t tmp = px.val[0];
+            px.val[0] = px.val[2];
+            px.val[2] = tmp;
+        }
+        for (int c = 0; c < 4; ++c)
+            px.val[c] = vandq_u8(px.val[c], opaque);
+        vst4q_u8(p, px);
+
+        const uint8x16_t rest = vmvnq_u8(vorrq_u8(opaque, clear));
+        if (vmaxvq_u8(rest))
+        {
+            uint8_t lanes[16];
+            vst1q_u8(lanes, rest);
+            uint32_t bits = 0;
+            for (unsigned int j = 0; j < 16; ++j)
+                bits |= (lanes[j] & 1u) << j;
+            unpremultiplyRest(p, orig, bits, swap);
+        }
+    }
+
+    for (; i < pixels; ++i)
+        unpremultiplyPixel(data + i * 4, swap);
+}
+
+static void blendNEON(uint8_t *to, const uint8_t *from, size_t pixels, int opaqueOnly, int slideShow)
+{
+    const uint16x8_t one = vdupq_n_u16(1);
+
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16)
+    {
+        uint8_t *p = to + i * 4;
+        const uint8x16x4_t t = vld4q_u8(p);
+        const uint8x16x4_t f = vld4q_u8(from + i * 4);
+
+        const uint8x16_t dim = slideShow ? vceqq_u8(t.val[3], vdupq_n_u8(0)) : vdupq_n_u8(0);
+        const uint8x16_t process = opaqueOnly
+            ? vorrq_u8(vceqq_u8(t.val[3], vdupq_n_u8(255)), dim)
+            : vdupq_n_u8(0xff);
+        if (!vmaxvq_u8(process))
+            continue;
+
+        const uint8x16_t inv = vmvnq_u8(f.val[3]);
+        uint8x16x4_t out;
+        for (int c = 0; c < 4; ++c)
+        {
+            uint16x8_t lo = vmull_u8(vget_low_u8(t.val[c]), vget_low_u8(inv));
+            uint16x8_t hi = vmull_high_u8(t.val[c], inv);
+            lo = vshrq_n_u16(vaddq_u16(vaddq_u16(lo, one), vshrq_n_u16(lo, 8)), 8);
+            hi = vshrq_n_u16(vaddq_u16(vaddq_u16(hi, one), vshrq_n_u16(hi, 8)), 8);
+            out.val[c] = vqaddq_u8(f.val[c], vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+        }
+
+        out.val[3] = vbslq_u8(dim, vshrq_n_u8(out.val[3], 3), out.val[3]);
+        for (int c = 0; c < 4; ++c)
+            out.val[c] = vbslq_u8(process, out.val[c], t.val[c]);
+        vst4q_u8(p, out);
+    }
+
+    for (; i < pixels; ++i)
+        blendPixel(to + i * 4, from + i * 4, opaqueOnly, slideShow);
+}
+
+#if defined(__ARM_FEATURE_CRC32)
+static uint64_t crc32cAppend(uint64_t crc, const uint8_t *p, size_t len)
+{
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = __crc32cd((uint32_t)crc, v);
+    }
+    for (; len >= 4; p += 4, len -= 4)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = __crc32cw((uint32_t)crc, v);
+    }
+    return crc;
+}
+#endif
+
+#endif // ENABLE_NEON
+
+int simd_unpremultiply(int level, uint8_t *data, size_t pixels, int swap)
+{
+#if ENABLE_SIMD
+    if (level == SIMD_AVX512)
+    {
+        unpremultiplyAVX512(data, pixels, swap);
+        return 1;
+    }
+    if (level == SIMD_AVX2)
+    {
+        unpremultiplyAVX2(data, pixels, swap);
+        return 1;
+    }
+#elif ENABLE_NEON
+    if (level == SIMD_NEON)
+    {
+        unpremultiplyNEON(data, pixels, swap);
+        return 1;
+    }
+#endif
+    (void)level; (void)data; (void)pixels; (void)swap;
+    return 0;
+}
+
+int simd_rowHash(int level, const uint64_t *rleMask, size_t maskUnits,
+                 const uint32_t *data, size_t dataLen, uint32_t *hash)
+{
+#if ENABLE_SIMD || (ENABLE_NEON && defined(__ARM_FEATURE_CRC32))
+    if (level != SIMD_NONE)
+    {
+        uint64_t crc = 0xffffffff;
+        crc = crc32cAppend(crc, (const uint8_t *)rleMask, maskUnits * sizeof(uint64_t));
+        crc = crc32cAppend(crc, (const uint8_t *)data, dataLen * sizeof(uint32_t));
+        *hash = ~(uint32_t)crc;
+        return 1;
+    }
+#endif
+    (void)level; (void)rleMask; (void)maskUnits; (void)data; (void)dataLen; (void)hash;
+    return 0;
+}
+
+int simd_blendPremultiplied(int level, uint8_t *to, const uint8_t *from, size_t pixels,
+                            int opaqueOnly, int slideShow)
+{
+#if ENABLE_SIMD
+    if (level == SIMD_AVX512)
+    {
+        blendAVX512(to, from, pixels, opaqueOnly, slideShow);
+        return 1;
+    }
+    if (level == SIMD_AVX2)
+    {
+        blendAVX2(to, from, pixels, opaqueOnly, slideShow);
+        return 1;
+    }
+#elif ENABLE_NEON
+    if (level == SIMD_NEON)
+    {
+        blendNEON(to, from, pixels, opaqueOnly, slideShow);
+        return 1;
+    }
+#endif
+    (void)level; (void)to; (void)from; (void)pixels; (void)opaqueOnly; (void)slideShow;
+    return 0;
+}
+
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -18,10 +18,35 @@
 extern "C" {
 #endif
 
+/// Instruction set levels for the kernels below, see simd::getLevel().
+enum simd_Level
+{
+    SIMD_NONE = 0,
+    SIMD_NEON = 1,
+    SIMD_AVX2 = 2,
+    SIMD_AVX512 = 3
+};
+
 void simd_deltaInit(void);
 
 int simd_initPixRowSimd(const uint32_t *from, uint32_t *scratch, size_t *scratchLen, uint64_t *rleMask);
 
+// The kernels below return 0 when there is no implementation for the given
+// level, in which case the caller must fall back to its own code.
+
+/// Unpremultiply 'pixels' pixels in place, swapping to RGBA if 'swap' is set.
+int simd_unpremultiply(int level, uint8_t *data, size_t pixels, int swap);
+
+/// CRC32C fingerprint of a row's RLE mask and pixel data, for fast inequality checks.
+int simd_rowHash(int level, const uint64_t *rleMask, size_t maskUnits,
+                 const uint32_t *data, size_t dataLen, uint32_t *hash);
+
+/// Blend premultiplied 'from' pixels over 'to'. With 'opaqueOnly' only opaque
+/// destination pixels are blended, and with 'slideShow' transparent ones too,
+/// but with their resulting alpha dimmed to an eighth.
+int simd_blendPremultiplied(int level, uint8_t *to, const uint8_t *from, size_t pixels,
+                            int opaqueOnly, int slideShow);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
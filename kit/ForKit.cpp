@@ -185,6 +185,11 @@ protected:
             setenv("COOL_LOGLEVEL", tokens[1].c_str(), 1);
             Log::setLevel(tokens[1]);
         }
+        else if (tokens.size() == 2 && tokens.equals(0, "tracesampling"))
+        {
+            // Only for the new children; we have nothing worth sampling.
+            setenv("COOL_TRACE_SAMPLING", tokens[1].c_str(), 1);
+        }
         else if (tokens.size() == 3 && tokens.equals(0, "setconfig"))
         {
             // Currently only rlimit entries are supported.
@@ -848,6 +853,15 @@ int forkit_main(int argc, char** argv)
     {
         logProperties["path"] = std::string(logFilename);
     }
+    const char* logAsync = std::getenv("COOL_LOGASYNC");
+    if (logAsync && !logToFile)
+    {
+        // Only started once we may have threads.
+        logProperties["async"] = logAsync;
+        const char* logAsyncBufferSize = std::getenv("COOL_LOGASYNC_BUFFER_SIZE");
+        if (logAsyncBufferSize)
+            logProperties["async_buffer_size"] = logAsyncBufferSize;
+    }
     const bool logToFileUICmd = std::getenv("COOL_LOGFILE_UICMD");
     const char* logFilenameUICmd = std::getenv("COOL_LOGFILENAME_UICMD");
     std::map<std::string, std::string> logPropertiesUICmd;
@@ -1025,6 +1039,10 @@ int forkit_main(int argc, char** argv)
     // Make dev/[u]random point to the writable devices in tmp/dev/.
     JailUtil::SysTemplate::setupRandomDeviceLinks(sysTemplate);
 
+    // Spare the kits walking the templates, if they are to link or copy them.
+    if (!JailUtil::isBindMountingEnabled())
+        preloadJailManifests(sysTemplate, loTemplate);
+
     if (!Util::isKitInProcess())
     {
         // Parse the configuration.
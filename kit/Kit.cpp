@@ -47,6 +47,7 @@
 #include <utime.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <sysexits.h>
 
@@ -58,12 +59,14 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #define LOK_USE_UNSTABLE_API
 #include <LibreOfficeKit/LibreOfficeKitInit.h>
@@ -153,6 +156,10 @@ int getCurrentThreadCount()
 _LibreOfficeKit* loKitPtr = nullptr;
 
 static bool EnableWebsocketURP = false;
+/// Paint large tile requests in bands and send tiles as soon as encoded.
+static bool StreamTileRendering = false;
+/// The memory budget of the tile delta cache of each document.
+static std::size_t DeltaCacheBytes = DeltaGenerator::DefaultMaxBytes;
 #if !MOBILEAPP
 static int URPStartCount = 0;
 #endif
@@ -301,13 +308,40 @@ namespace
     };
     LinkOrCopyType linkOrCopyType;
     std::string sourceForLinkOrCopy;
-    Poco::Path destinationForLinkOrCopy;
     bool forceInitialCopy; // some stackable file-systems have very slow first hard link creation
     std::string linkableForLinkOrCopy; // Place to stash copies that we can hard-link from
     std::chrono::time_point<std::chrono::steady_clock> linkOrCopyStartTime;
-    bool linkOrCopyVerboseLogging = false;
-    unsigned linkOrCopyFileCount = 0; // Track to help quantify the link-or-copy performance.
+    std::atomic<bool> linkOrCopyVerboseLogging = false;
+    std::atomic<unsigned> linkOrCopyFileCount = 0; // Track to help quantify the link-or-copy performance.
     constexpr unsigned SlowLinkOrCopyLimitInSecs = 2; // After this many seconds, start spamming the logs.
+    constexpr std::size_t LinkOrCopyFilesPerWork = 64; // Files linked or copied by a worker in one go.
+
+    /// What a jail gets of a template, relative to it.
+    struct JailManifest
+    {
+        struct Directory
+        {
+            std::string path;
+            time_t atime;
+            time_t mtime;
+        };
+
+        struct Symlink
+        {
+            std::string path;
+            std::string target;
+        };
+
+        std::vector<Directory> directories; ///< Parents first.
+        std::vector<std::string> files;
+        std::vector<Symlink> symlinks;
+        bool complete = false; ///< False if the walk failed, to walk again.
+    };
+
+    /// The manifests by template and type. Those walked in forkit are
+    /// inherited by the kits it forks, which then only have to populate.
+    std::map<std::pair<std::string, LinkOrCopyType>, JailManifest> jailManifests;
+    JailManifest* manifestForLinkOrCopy = nullptr; // The one nftw is walking for.
 
     bool detectSlowStackingFileSystem([[maybe_unused]] const std::string& directory)
     {
@@ -435,7 +469,7 @@ namespace
         // else always copy before linking to linkable/
 
         // incrementally build our 'linkable/' copy nearby
-        static bool canChown = true; // only if we can get permissions right
+        static std::atomic<bool> canChown = true; // only if we can get permissions right
         if ((forceInitialCopy || errno == EXDEV) && canChown)
         {
             // then copy somewhere closer and hard link from there
@@ -471,12 +505,11 @@ namespace
                     << ". Cannot create linkable copy.");
         }
 
-        static bool warned = false;
-        if (!warned)
+        static std::atomic<bool> warned = false;
+        if (!warned.exchange(true))
         {
             LOG_ERR("link(\"" << fpath << "\", \"" << newPath.c_str() << "\") failed: " << strerror(errno)
                     << ". Very slow copying path triggered.");
-            warned = true;
         } else
             LOG_TRC("link(\"" << fpath << "\", \"" << newPath.c_str() << "\") failed: " << strerror(errno)
                     << ". Will copy.");
@@ -487,10 +520,10 @@ namespace
         }
     }
 
-    int linkOrCopyFunction(const char *fpath,
-                           const struct stat* sb,
-                           int typeflag,
-                           struct FTW* /*ftwbuf*/)
+    int addToManifestFunction(const char *fpath,
+                              const struct stat* sb,
+                              int typeflag,
+                              struct FTW* /*ftwbuf*/)
     {
         if (strcmp(fpath, sourceForLinkOrCopy.c_str()) == 0)
         {
@@ -498,56 +531,25 @@ namespace
             return FTW_CONTINUE;
         }
 
-        if (!linkOrCopyVerboseLogging)
-        {
-            const auto durationInSecs = std::chrono::duration_cast<std::chrono::seconds>(
-                std::chrono::steady_clock::now() - linkOrCopyStartTime);
-            if (durationInSecs.count() > SlowLinkOrCopyLimitInSecs)
-            {
-                LOG_WRN("Linking/copying files from "
-                        << sourceForLinkOrCopy << " to " << destinationForLinkOrCopy.toString()
-                        << " is taking too much time. Enabling verbose link/copy logging.");
-                linkOrCopyVerboseLogging = true;
-            }
-        }
-
         assert(fpath[sourceForLinkOrCopy.size()] == '/');
         const char* relativeOldPath = fpath + sourceForLinkOrCopy.size() + 1;
-        const Poco::Path newPath(destinationForLinkOrCopy, Poco::Path(relativeOldPath));
 
         switch (typeflag)
         {
         case FTW_F:
         case FTW_SLN:
-            Poco::File(newPath.parent()).createDirectories();
-
             if (shouldLinkFile(relativeOldPath))
-                linkOrCopyFile(fpath, newPath.toString());
+                manifestForLinkOrCopy->files.emplace_back(relativeOldPath);
             break;
         case FTW_D:
+            if (!shouldCopyDir(relativeOldPath))
             {
-                struct stat st;
-                if (stat(fpath, &st) == -1)
-                {
-                    LOG_SYS("nftw: stat(\"" << fpath << "\") failed");
-                    return FTW_STOP;
-                }
-                if (!shouldCopyDir(relativeOldPath))
-                {
-                    LOG_TRC("nftw: Skipping redundant path: " << relativeOldPath);
-                    return FTW_SKIP_SUBTREE;
-                }
-
-                Poco::File(newPath).createDirectories();
-                struct utimbuf ut;
-                ut.actime = st.st_atime;
-                ut.modtime = st.st_mtime;
-                if (utime(newPath.toString().c_str(), &ut) == -1)
-                {
-                    LOG_SYS("nftw: utime(\"" << newPath.toString() << "\") failed");
-                    return FTW_STOP;
-                }
+                LOG_TRC("nftw: Skipping redundant path: " << relativeOldPath);
+                return FTW_SKIP_SUBTREE;
             }
+
+            manifestForLinkOrCopy->directories.push_back(
+                { relativeOldPath, sb->st_atime, sb->st_mtime });
             break;
         case FTW_SL:
             {
@@ -562,13 +564,7 @@ namespace
                 }
                 target_data[written] = '\0';
 
-                Poco::File(newPath.parent()).createDirectories();
-                if (symlink(target_data, newPath.toString().c_str()) == -1)
-                {
-                    LOG_SYS("nftw: symlink(\"" << target_data << "\", \"" << newPath.toString()
-                                               << "\") failed");
-                    return FTW_STOP;
-                }
+                manifestForLinkOrCopy->symlinks.push_back({ relativeOldPath, target_data });
             }
             break;
             case FTW_DNR:
@@ -586,8 +582,8 @@ namespace
         return FTW_CONTINUE;
     }
 
-    void linkOrCopy(const std::string& source, const Poco::Path& destination, const std::string& linkable,
-                    LinkOrCopyType type)
+    /// The real path of the template @source, without a trailing slash.
+    std::string resolveTemplate(const std::string& source)
     {
         std::string resolved = FileUtil::realpath(source);
         if (resolved != source)
@@ -596,36 +592,156 @@ namespace
                                                     << source << "].");
         }
 
-        LOG_INF("linkOrCopy " << linkOrCopyTypeString(type) << " from [" << resolved << "] to ["
-                              << destination.toString() << "].");
+        if (resolved.size() > 1 && resolved.back() == '/')
+            resolved.pop_back();
+
+        return resolved;
+    }
+
+    /// Returns the manifest of the template at the real path @source,
+    /// walking it the first time.
+    const JailManifest& getJailManifest(const std::string& source, LinkOrCopyType type)
+    {
+        JailManifest& manifest = jailManifests[{ source, type }];
+        if (manifest.complete)
+            return manifest;
+
+        const auto startTime = std::chrono::steady_clock::now();
 
+        manifest = JailManifest();
         linkOrCopyType = type;
-        sourceForLinkOrCopy = resolved;
-        if (sourceForLinkOrCopy.back() == '/')
-            sourceForLinkOrCopy.pop_back();
-        destinationForLinkOrCopy = destination;
+        sourceForLinkOrCopy = source;
+        manifestForLinkOrCopy = &manifest;
+        if (nftw(source.c_str(), addToManifestFunction, 10, FTW_ACTIONRETVAL|FTW_PHYS) == -1)
+            LOG_ERR("linkOrCopy: nftw() failed for '" << source << '\'');
+        else
+            manifest.complete = true;
+        manifestForLinkOrCopy = nullptr;
+
+        LOG_INF("Walked " << linkOrCopyTypeString(type) << " template [" << source << "] with "
+                          << manifest.directories.size() << " directories, "
+                          << manifest.files.size() << " files and " << manifest.symlinks.size()
+                          << " symlinks in "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(
+                                 std::chrono::steady_clock::now() - startTime));
+        return manifest;
+    }
+
+    void linkOrCopyFiles(const std::string& source, const std::string& destination,
+                         const std::vector<std::string>& files, std::size_t begin, std::size_t end)
+    {
+        if (!linkOrCopyVerboseLogging)
+        {
+            const auto durationInSecs = std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::steady_clock::now() - linkOrCopyStartTime);
+            if (durationInSecs.count() > SlowLinkOrCopyLimitInSecs &&
+                !linkOrCopyVerboseLogging.exchange(true))
+            {
+                LOG_WRN("Linking/copying files from "
+                        << source << " to " << destination
+                        << " is taking too much time. Enabling verbose link/copy logging.");
+            }
+        }
+
+        for (std::size_t i = begin; i < end; ++i)
+            linkOrCopyFile((source + '/' + files[i]).c_str(), destination + files[i]);
+    }
+
+    void linkOrCopy(const std::string& source, const Poco::Path& destination, const std::string& linkable,
+                    LinkOrCopyType type)
+    {
+        const std::string resolved = resolveTemplate(source);
+
+        std::string destinationPath = destination.toString();
+        if (destinationPath.back() != '/')
+            destinationPath += '/';
+
+        LOG_INF("linkOrCopy " << linkOrCopyTypeString(type) << " from [" << resolved << "] to ["
+                              << destinationPath << "].");
+
+        linkOrCopyStartTime = std::chrono::steady_clock::now();
+        const JailManifest& manifest = getJailManifest(resolved, type);
+
+        // Parents come first.
+        const auto directoriesStartTime = std::chrono::steady_clock::now();
+        Poco::File(destinationPath).createDirectories();
+
         linkableForLinkOrCopy = linkable;
         linkOrCopyFileCount = 0;
-        linkOrCopyStartTime = std::chrono::steady_clock::now();
-        forceInitialCopy = detectSlowStackingFileSystem(destination.toString());
+        forceInitialCopy = detectSlowStackingFileSystem(destinationPath);
 
-        if (nftw(resolved.c_str(), linkOrCopyFunction, 10, FTW_ACTIONRETVAL|FTW_PHYS) == -1)
+        for (const JailManifest::Directory& directory : manifest.directories)
         {
-            LOG_ERR("linkOrCopy: nftw() failed for '" << resolved << '\'');
+            const std::string path = destinationPath + directory.path;
+            if (::mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IRWXO) == -1 && errno != EEXIST)
+            {
+                LOG_SYS("linkOrCopy: mkdir(\"" << path << "\") failed");
+                return;
+            }
         }
 
-        if (linkOrCopyVerboseLogging)
+        // Linking, let alone copying, waits on the disk: keep several going.
+        const auto filesStartTime = std::chrono::steady_clock::now();
+        std::size_t threads = 0;
         {
-            linkOrCopyVerboseLogging = false;
-            const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                std::chrono::steady_clock::now() - linkOrCopyStartTime).count();
-            const double seconds = (ms + 1) / 1000.; // At least 1ms to avoid div-by-zero.
-            const auto rate = linkOrCopyFileCount / seconds;
-            LOG_INF("Linking/Copying of " << linkOrCopyFileCount << " files from " << resolved
-                                          << " to " << destinationForLinkOrCopy.toString()
-                                          << " finished in " << seconds << " seconds, or " << rate
-                                          << " files / second.");
+            ThreadPool pool;
+            threads = pool.getThreadCount();
+            ThreadPool::Batch batch(pool);
+            const std::vector<std::string>& files = manifest.files;
+            for (std::size_t i = 0; i < files.size(); i += LinkOrCopyFilesPerWork)
+            {
+                batch.pushWork(
+                    [&, i]()
+                    {
+                        linkOrCopyFiles(resolved, destinationPath, files, i,
+                                        std::min(i + LinkOrCopyFilesPerWork, files.size()));
+                    });
+            }
+            batch.wait();
+        }
+
+        const auto symlinksStartTime = std::chrono::steady_clock::now();
+        for (const JailManifest::Symlink& symlink : manifest.symlinks)
+        {
+            const std::string path = destinationPath + symlink.path;
+            if (::symlink(symlink.target.c_str(), path.c_str()) == -1)
+            {
+                LOG_SYS("linkOrCopy: symlink(\"" << symlink.target << "\", \"" << path
+                                                 << "\") failed");
+                return;
+            }
         }
+
+        // Now that they are filled.
+        for (const JailManifest::Directory& directory : manifest.directories)
+        {
+            const std::string path = destinationPath + directory.path;
+            struct utimbuf ut;
+            ut.actime = directory.atime;
+            ut.modtime = directory.mtime;
+            if (utime(path.c_str(), &ut) == -1)
+            {
+                LOG_SYS("linkOrCopy: utime(\"" << path << "\") failed");
+                return;
+            }
+        }
+
+        const auto endTime = std::chrono::steady_clock::now();
+        const auto ms = [](std::chrono::steady_clock::duration duration)
+        { return std::chrono::duration_cast<std::chrono::milliseconds>(duration); };
+        const double seconds = (ms(symlinksStartTime - filesStartTime).count() + 1) / 1000.; // At least 1ms to avoid div-by-zero.
+        LOG_INF("Linking/Copying of " << linkOrCopyFileCount << " files from " << resolved << " to "
+                                      << destinationPath << " finished in "
+                                      << ms(endTime - linkOrCopyStartTime) << ": manifest in "
+                                      << ms(directoriesStartTime - linkOrCopyStartTime)
+                                      << ", directories in "
+                                      << ms(filesStartTime - directoriesStartTime)
+                                      << ", files in " << ms(symlinksStartTime - filesStartTime)
+                                      << " with " << threads << " threads, or "
+                                      << linkOrCopyFileCount / seconds
+                                      << " files / second, symlinks and times in "
+                                      << ms(endTime - symlinksStartTime) << '.');
+        linkOrCopyVerboseLogging = false;
     }
 
 #if CODE_COVERAGE
@@ -788,10 +904,12 @@ Document::Document(const std::shared_ptr<lok::Office>& loKit, const std::string&
     , _isDocPasswordProtected(false)
     , _docPasswordType(DocumentPasswordType::ToView)
     , _stop(false)
-    , _deltaGen(new DeltaGenerator())
+    , _deltaGen(new DeltaGenerator(DeltaCacheBytes))
     , _editorId(-1)
     , _editorChangeWarning(false)
     , _lastMemTrimTime(std::chrono::steady_clock::now())
+    , _lastDeltaCacheBytes(0)
+    , _lastDeltaCacheReportTime(_lastMemTrimTime)
     , _mobileAppDocId(mobileAppDocId)
     , _duringLoad(0)
     , _bgSavesOngoing(0)
@@ -890,7 +1008,6 @@ bool Document::createSession(const std::string& sessionId)
         if (!Util::isMobileApp())
             UnitKit::get().postKitSessionCreated(session.get());
         _sessions.emplace(sessionId, session);
-        _deltaGen->setSessionCount(_sessions.size());
 
         const int viewId = session->getViewId();
         _lastUpdatedAt[viewId] = std::chrono::steady_clock::now();
@@ -1027,7 +1144,8 @@ void Document::renderTiles(TileCombined &tileCombined)
 
     if (!RenderTiles::doRender(_loKitDocument, *_deltaGen, tileCombined, _deltaPool,
                                blenderFunc, postMessageFunc, _mobileAppDocId,
-                               session->getCanonicalViewId(), session->getDumpTiles()))
+                               session->getCanonicalViewId(), session->getDumpTiles(),
+                               StreamTileRendering))
     {
         LOG_DBG("All tiles skipped, not producing empty tilecombine: message");
         return;
@@ -1129,6 +1247,34 @@ void Document::trimAfterInactivity()
     }
 }
 
+void Document::setMemoryPressure(MemoryPressure::Level level)
+{
+    LOG_DBG("Memory pressure is now " << level);
+
+    // Without deltas, we send keyframes: bandwidth over memory.
+    _deltaGen->setMaxBytes(level >= MemoryPressure::Level::ShrinkCaches ? DeltaCacheBytes / 4
+                                                                        : DeltaCacheBytes);
+
+    if (level >= MemoryPressure::Level::TrimKits)
+        trimIfInactive();
+}
+
+void Document::reportDeltaCacheUsage()
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (now - _lastDeltaCacheReportTime < std::chrono::seconds(5))
+        return;
+
+    const std::size_t used = _deltaGen->getUsedBytes();
+    if (used == _lastDeltaCacheBytes)
+        return;
+
+    _lastDeltaCacheBytes = used;
+    _lastDeltaCacheReportTime = now;
+    sendTextFrame("deltacache: used=" + std::to_string(used) +
+                  " max=" + std::to_string(_deltaGen->getMaxBytes()));
+}
+
 /* static */ void Document::GlobalCallback(const int type, const char* p, void* data)
 {
     if (SigUtil::getTerminationFlag())
@@ -1570,6 +1716,7 @@ bool Document::forkToSave(const std::function<void()>& childSave, int viewId)
     if (!pid) // Child
     {
         Log::postFork();
+        TraceEvent::postFork();
 
         // sort out thread local variables to get logging right from
         // as early as possible.
@@ -2287,8 +2434,6 @@ bool Document::forwardToChild(const std::string_view prefix, const std::vector<c
                 LOG_DBG("Have " << count << " child" << (count == 1 ? "" : "ren") <<
                         " after removing ChildSession [" << sessionId << "].");
 
-                _deltaGen->setSessionCount(count);
-
                 _sessionUserInfo[session->getViewId()].setDisconnected();
 
                 // No longer needed, and allow session dtor to take it.
@@ -2843,6 +2988,9 @@ static std::vector<std::string> traceEventRecords[2];
 
 void flushTraceEventRecordings()
 {
+    // Queues them as recordings, if any.
+    TraceEvent::emitSamples();
+
     std::unique_lock<std::mutex> lock(traceEventLock);
 
     for (size_t n = 0; n < 2; ++n)
@@ -2881,7 +3029,8 @@ static void addRecording(const std::string &recording, bool force)
         configChecked = true;
     }
 
-    if (configChecked && !traceEventsEnabled)
+    // Sampling is switched on at run-time, trace_event or not.
+    if (configChecked && !traceEventsEnabled && !(force && TraceEvent::getSampling()))
         return;
 
     // catch if this gets called in the ForKit process & skip.
@@ -3077,6 +3226,9 @@ int KitSocketPoll::kitPoll(int timeoutMicroS)
     {
         flushTraceEventRecordings();
 
+        if (_document)
+            _document->reportDeltaCacheUsage();
+
         if (_document && _document->purgeSessions() == 0)
         {
             LOG_INF("Last session discarded. Setting TerminationFlag");
@@ -3349,6 +3501,15 @@ void lokit_main(
     {
         logProperties["path"] = std::string(logFilename);
     }
+    const char* logAsync = std::getenv("COOL_LOGASYNC");
+    if (logAsync && !logToFile)
+    {
+        // Only started once we may have threads.
+        logProperties["async"] = logAsync;
+        const char* logAsyncBufferSize = std::getenv("COOL_LOGASYNC_BUFFER_SIZE");
+        if (logAsyncBufferSize)
+            logProperties["async_buffer_size"] = logAsyncBufferSize;
+    }
     const bool logToFileUICmd = std::getenv("COOL_LOGFILE_UICMD");
     const char* logFilenameUICmd = std::getenv("COOL_LOGFILENAME_UICMD");
     std::map<std::string, std::string> logPropertiesUICmd;
@@ -3372,6 +3533,9 @@ void lokit_main(
     }
     const std::string LogDisabledAreas = logDisabledAreas ? logDisabledAreas : "";
 
+    if (const char* traceSampling = std::getenv("COOL_TRACE_SAMPLING"))
+        TraceEvent::setSampling(std::strtoul(traceSampling, nullptr, 10));
+
     if (const char* anonymizationSalt = std::getenv("COOL_ANONYMIZATION_SALT"))
     {
         const auto salt = std::stoull(anonymizationSalt);
@@ -3383,6 +3547,13 @@ void lokit_main(
     const char* enableWebsocketURP = std::getenv("ENABLE_WEBSOCKET_URP");
     EnableWebsocketURP = enableWebsocketURP && std::string(enableWebsocketURP) == "true";
 
+    const char* streamTileRendering = std::getenv("COOL_STREAM_TILE_RENDERING");
+    StreamTileRendering = streamTileRendering && std::string(streamTileRendering) == "true";
+
+    const char* deltaCacheSize = std::getenv("COOL_DELTA_CACHE_SIZE_MB");
+    if (deltaCacheSize && std::atoi(deltaCacheSize) > 0)
+        DeltaCacheBytes = static_cast<std::size_t>(std::atoi(deltaCacheSize)) * 1024 * 1024;
+
     assert(!childRoot.empty());
     assert(!sysTemplate.empty());
     assert(!loTemplate.empty());
@@ -4004,6 +4175,9 @@ void lokit_main(
             Log::setLevel(LogLevel);
         }
         Log::setDisabledAreas(LogDisabledAreas);
+
+        // Done with the jail, we may write the log from a thread of its own.
+        Log::startAsync();
 #endif
 
 #ifndef IOS
@@ -4204,6 +4378,14 @@ bool startURP(const std::shared_ptr<lok::Office>& LOKit, void** ppURPContext)
     return true;
 }
 
+#if !defined(BUILDING_TESTS) && !MOBILEAPP
+void preloadJailManifests(const std::string& sysTemplate, const std::string& loTemplate)
+{
+    getJailManifest(resolveTemplate(sysTemplate), LinkOrCopyType::All);
+    getJailManifest(resolveTemplate(loTemplate), LinkOrCopyType::LO);
+}
+#endif
+
 /// Initializes LibreOfficeKit for cross-fork re-use.
 bool globalPreinit(const std::string &loTemplate)
 {
@@ -22,6 +22,7 @@
 #include <kit/KitQueue.hpp>
 #include <kit/LogUI.hpp>
 
+#include <wsd/MemoryPressure.hpp>
 #include <wsd/TileDesc.hpp>
 
 #include "Socket.hpp"
@@ -52,6 +53,12 @@ void runKitLoopInAThread();
 #endif
 
 bool globalPreinit(const std::string& loTemplate);
+
+#if !MOBILEAPP
+/// Walks the templates the jails are linked or copied from, once for all
+/// the kits to be forked, when they cannot be bind-mounted.
+void preloadJailManifests(const std::string& sysTemplate, const std::string& loTemplate);
+#endif
 /// Wrapper around private Document::ViewCallback().
 void documentViewCallback(int type, const char* p, void* data);
 
@@ -254,6 +261,12 @@ public:
     void trimIfInactive();
     void trimAfterInactivity();
 
+    /// Sheds memory as far as the system pressure @level tells.
+    void setMemoryPressure(MemoryPressure::Level level);
+
+    /// Tell the admin how much memory the delta cache uses, when it changes.
+    void reportDeltaCacheUsage();
+
     // LibreOfficeKit callback entry points
     static void GlobalCallback(int type, const char* p, void* data);
     static void ViewCallback(int type, const char* p, void* data);
@@ -507,6 +520,10 @@ private:
     /// The timestamp of the last memory trimming.
     std::chrono::steady_clock::time_point _lastMemTrimTime;
 
+    /// The last reported delta cache usage, and when.
+    std::size_t _lastDeltaCacheBytes;
+    std::chrono::steady_clock::time_point _lastDeltaCacheReportTime;
+
     std::map<int, std::chrono::steady_clock::time_point> _lastUpdatedAt;
     std::map<int, int> _speedCount;
     /// For showing disconnected user info in the doc repair dialog.
@@ -14,6 +14,7 @@
 #include "KitQueue.hpp"
 
 #include <climits>
+#include <cstdlib>
 #include <cstring>
 #include <algorithm>
 #include <string>
@@ -131,170 +132,312 @@ std::string extractUnoCommand(const std::string& command)
     return command;
 }
 
-/// Extract rectangle from the invalidation callback payload
-bool extractRectangle(const StringVector& tokens, int& x, int& y, int& w, int& h, int& part, int& mode)
+/// Whether the callback is about the cursor etc. of the view in its viewId.
+bool isViewCallback(int type)
 {
-    x = 0;
-    y = 0;
-    w = INT_MAX;
-    h = INT_MAX;
-    part = 0;
-    mode = 0;
-
-    if (tokens.size() < 2)
-        return false;
+    return type == LOK_CALLBACK_INVALIDATE_VIEW_CURSOR || type == LOK_CALLBACK_CELL_VIEW_CURSOR ||
+           type == LOK_CALLBACK_VIEW_CURSOR_VISIBLE;
+}
 
-    if (tokens.equals(0, "EMPTY,"))
+/// Extract the area from the invalidation callback payload, which is
+/// "x, y, w, h, part[, mode]", or "EMPTY, part[, mode]" for all of the part.
+/// As ever, EMPTY invalidates all the modes of the part, as mode 0.
+bool extractArea(KitQueue::Callback& callback)
+{
+    const char* p = callback._payload.c_str();
+    const bool empty = COOLProtocol::matchPrefix("EMPTY,", callback._payload);
+    if (empty)
+        p += sizeof("EMPTY,") - 1;
+
+    int values[6];
+    std::size_t count = 0;
+    while (count < std::size(values))
     {
-        part = std::atoi(tokens[1].c_str());
-        return true;
+        char* end = nullptr;
+        const long value = std::strtol(p, &end, 10);
+        if (end == p)
+            break;
+
+        values[count++] = static_cast<int>(value);
+        for (p = end; *p == ',' || *p == ' '; ++p)
+        {
+        }
     }
 
-    if (tokens.size() < 5)
-        return false;
+    if (empty)
+    {
+        if (count < 1)
+            return false;
 
-    x = std::atoi(tokens[0].c_str());
-    y = std::atoi(tokens[1].c_str());
-    w = std::atoi(tokens[2].c_str());
-    h = std::atoi(tokens[3].c_str());
-    part = std::atoi(tokens[4].c_str());
+        callback._x = 0;
+        callback._y = 0;
+        callback._w = INT_MAX;
+        callback._h = INT_MAX;
+        callback._part = values[0];
+        callback._mode = 0;
+    }
+    else
+    {
+        if (count < 5)
+            return false;
 
-    if (tokens.size() == 6)
-        mode = std::atoi(tokens[5].c_str());
+        callback._x = values[0];
+        callback._y = values[1];
+        callback._w = values[2];
+        callback._h = values[3];
+        callback._part = values[4];
+        callback._mode = count > 5 ? values[5] : 0;
+    }
 
+    callback._isArea = true;
     return true;
 }
 
+/// Invalidations merge only when the result is small.
+constexpr int ReasonableSizeX = 4 * 3840; // 4x tile at 100% zoom
+constexpr int ReasonableSizeY = 2 * 3840; // 2x tile at 100% zoom
+
+/// The height of the rows queued invalidations are indexed by, a tile at 100% zoom.
+constexpr int IndexRowHeight = 3840;
+/// Taller invalidations are indexed apart, rather than in each of their rows.
+constexpr int MaxIndexedRows = 16;
+
+/// The index row of the twip @y.
+int indexRow(std::int64_t y)
+{
+    const std::int64_t row = (y >= 0 ? y : y - IndexRowHeight + 1) / IndexRowHeight;
+    return static_cast<int>(std::clamp<std::int64_t>(row, INT_MIN, INT_MAX));
+}
+
+/// The first and last index rows of the invalidation.
+std::pair<int, int> indexRows(const KitQueue::Callback& callback)
+{
+    const std::int64_t bottom = static_cast<std::int64_t>(callback._y) + std::max(callback._h, 1) - 1;
+    return { indexRow(callback._y), indexRow(bottom) };
+}
+
+/// Parses the fields of the payload that we compare queued callbacks by.
+void parseCallback(KitQueue::Callback& callback)
+{
+    switch (callback._type)
+    {
+        case LOK_CALLBACK_INVALIDATE_TILES:
+            extractArea(callback);
+            break;
+
+        case LOK_CALLBACK_STATE_CHANGED:
+        {
+            // Only states with a value are superseded by later ones.
+            const std::size_t equalPos = callback._payload.find('=');
+            if (equalPos != std::string::npos &&
+                COOLProtocol::matchPrefix(".uno:", callback._payload))
+                callback._key = callback._payload.substr(0, equalPos);
+        }
+        break;
+
+        default:
+            if (isViewCallback(callback._type))
+                callback._key = extractViewId(callback._payload);
+            break;
+    }
+}
+
 }
 
 void KitQueue::putCallback(int view, int type, const std::string &payload)
 {
-    if (!elideDuplicateCallback(view, type, payload))
-        _callbacks.emplace_back(view, type, payload);
+    Callback callback(view, type, payload);
+    parseCallback(callback);
+    if (!elideDuplicateCallback(callback))
+        queueCallback(std::move(callback));
 }
 
-bool KitQueue::elideDuplicateCallback(int view, int type, const std::string &payload)
+void KitQueue::queueCallback(Callback&& callback)
 {
-    const auto callbackType = static_cast<LibreOfficeKitCallbackType>(type);
+    callback._seq = _nextSeq++;
+    indexInvalidation(callback);
+    _callbacks.emplace_back(std::move(callback));
+}
 
-    // Nothing to combine in this case:
-    if (_callbacks.size() == 0)
+void KitQueue::eraseCallback(std::size_t index)
+{
+    unindexInvalidation(_callbacks[index]);
+    _callbacks.erase(_callbacks.begin() + index);
+}
+
+std::size_t KitQueue::findCallback(std::uint64_t seq) const
+{
+    // The queue is in the order of _seq, with gaps where callbacks were erased.
+    const auto it = std::lower_bound(_callbacks.begin(), _callbacks.end(), seq,
+                                     [](const Callback& callback, std::uint64_t value)
+                                     { return callback._seq < value; });
+    assert(it != _callbacks.end() && it->_seq == seq);
+    return it - _callbacks.begin();
+}
+
+void KitQueue::indexInvalidation(const Callback& callback)
+{
+    if (!callback._isArea)
+        return;
+
+    InvalidationIndex& index = _invalidations[{ callback._view, callback._part, callback._mode }];
+    ++index._count;
+
+    const auto [firstRow, lastRow] = indexRows(callback);
+    if (static_cast<std::int64_t>(lastRow) - firstRow >= MaxIndexedRows)
+    {
+        index._tall.insert(callback._seq);
+        return;
+    }
+
+    for (int row = firstRow; row <= lastRow; ++row)
+        index._rows[row].insert(callback._seq);
+}
+
+void KitQueue::unindexInvalidation(const Callback& callback)
+{
+    if (!callback._isArea)
+        return;
+
+    const auto it = _invalidations.find({ callback._view, callback._part, callback._mode });
+    assert(it != _invalidations.end() && it->second._count > 0);
+    if (it == _invalidations.end())
+        return;
+
+    InvalidationIndex& index = it->second;
+    if (--index._count == 0)
+    {
+        _invalidations.erase(it);
+        return;
+    }
+
+    const auto [firstRow, lastRow] = indexRows(callback);
+    if (static_cast<std::int64_t>(lastRow) - firstRow >= MaxIndexedRows)
+    {
+        index._tall.erase(callback._seq);
+        return;
+    }
+
+    for (int row = firstRow; row <= lastRow; ++row)
+    {
+        const auto rowIt = index._rows.find(row);
+        assert(rowIt != index._rows.end());
+        if (rowIt == index._rows.end())
+            continue;
+
+        rowIt->second.erase(callback._seq);
+        if (rowIt->second.empty())
+            index._rows.erase(rowIt);
+    }
+}
+
+bool KitQueue::mergeInvalidation(Callback& callback)
+{
+    const auto index = _invalidations.find({ callback._view, callback._part, callback._mode });
+    if (index == _invalidations.end())
         return false;
 
-    switch (callbackType)
+    int& msgX = callback._x;
+    int& msgY = callback._y;
+    int& msgW = callback._w;
+    int& msgH = callback._h;
+    bool performedMerge = false;
+
+    // Joins are only reasonably small, so whatever we merge with stays
+    // within a reasonable size of the original area: only look at the rows
+    // around it (with one more on each side for the edges), in queue order.
+    const int firstRow = indexRow(static_cast<std::int64_t>(msgY) - ReasonableSizeY) - 1;
+    const int lastRow =
+        indexRow(static_cast<std::int64_t>(msgY) + msgH + ReasonableSizeY) + 1;
+    std::vector<std::uint64_t> candidates(index->second._tall.begin(),
+                                          index->second._tall.end());
+    for (auto rowIt = index->second._rows.lower_bound(firstRow);
+         rowIt != index->second._rows.end() && rowIt->first <= lastRow; ++rowIt)
     {
-        case LOK_CALLBACK_INVALIDATE_TILES: // invalidation
+        candidates.insert(candidates.end(), rowIt->second.begin(), rowIt->second.end());
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    for (const std::uint64_t seq : candidates)
+    {
+        const std::size_t i = findCallback(seq);
+        const Callback& it = _callbacks[i];
+
+        // the invalidation in the queue is fully covered by the payload,
+        // just remove it
+        if (msgX <= it._x && it._x + it._w <= msgX + msgW && msgY <= it._y &&
+            it._y + it._h <= msgY + msgH)
         {
-            StringVector tokens = StringVector::tokenize(payload);
+            LOG_TRC("Removing smaller invalidation: "
+                    << it._payload << " -> " << ' ' << msgX << ' ' << msgY << ' ' << msgW << ' '
+                    << msgH << ' ' << callback._part << ' ' << callback._mode);
 
-            int msgX, msgY, msgW, msgH, msgPart, msgMode;
-            if (!extractRectangle(tokens, msgX, msgY, msgW, msgH, msgPart, msgMode))
-                return false;
+            // remove from the queue
+            eraseCallback(i);
+            continue;
+        }
 
-            bool performedMerge = false;
+        // the invalidation just intersects, join those (if the result is
+        // small)
+        if (TileDesc::rectanglesIntersect(msgX, msgY, msgW, msgH, it._x, it._y, it._w, it._h))
+        {
+            const int joinX = std::min(msgX, it._x);
+            const int joinY = std::min(msgY, it._y);
+            const int joinW = std::max(msgX + msgW, it._x + it._w) - joinX;
+            const int joinH = std::max(msgY + msgH, it._y + it._h) - joinY;
 
-            // we always travel the entire queue
-            std::size_t i = 0;
-            while (i < _callbacks.size())
-            {
-                auto& it = _callbacks[i];
+            if (joinW > ReasonableSizeX || joinH > ReasonableSizeY)
+                continue;
 
-                if (it._type != type || it._view != view)
-                {
-                    ++i;
-                    continue;
-                }
-                StringVector queuedTokens = StringVector::tokenize(it._payload);
+            LOG_TRC("Merging invalidations: "
+                    << it << " and " << msgX << ' ' << msgY << ' ' << msgW << ' ' << msgH
+                    << ' ' << callback._part << ' ' << callback._mode << " -> " << joinX << ' '
+                    << joinY << ' ' << joinW << ' ' << joinH << ' ' << callback._part << ' '
+                    << callback._mode);
 
-                int queuedX, queuedY, queuedW, queuedH, queuedPart, queuedMode;
+            msgX = joinX;
+            msgY = joinY;
+            msgW = joinW;
+            msgH = joinH;
+            performedMerge = true;
 
-                if (!extractRectangle(queuedTokens, queuedX, queuedY, queuedW, queuedH, queuedPart, queuedMode))
-                {
-                    ++i;
-                    continue;
-                }
+            // remove from the queue
+            eraseCallback(i);
+        }
+    }
 
-                if (msgPart != queuedPart)
-                {
-                    ++i;
-                    continue;
-                }
+    if (!performedMerge)
+        return false;
 
-                if (msgMode != queuedMode)
-                {
-                    ++i;
-                    continue;
-                }
-
-                // the invalidation in the queue is fully covered by the payload,
-                // just remove it
-                if (msgX <= queuedX && queuedX + queuedW <= msgX + msgW && msgY <= queuedY
-                    && queuedY + queuedH <= msgY + msgH)
-                {
-                    LOG_TRC("Removing smaller invalidation: "
-                            << it._payload << " -> " << ' ' << msgX << ' ' << msgY << ' '
-                            << msgW << ' ' << msgH << ' ' << msgPart << ' ' << msgMode);
-
-                    // remove from the queue
-                    _callbacks.erase(_callbacks.begin() + i);
-                    continue;
-                }
-
-                // the invalidation just intersects, join those (if the result is
-                // small)
-                if (TileDesc::rectanglesIntersect(msgX, msgY, msgW, msgH, queuedX, queuedY, queuedW,
-                                                  queuedH))
-                {
-                    int joinX = std::min(msgX, queuedX);
-                    int joinY = std::min(msgY, queuedY);
-                    int joinW = std::max(msgX + msgW, queuedX + queuedW) - joinX;
-                    int joinH = std::max(msgY + msgH, queuedY + queuedH) - joinY;
-
-                    const int reasonableSizeX = 4 * 3840; // 4x tile at 100% zoom
-                    const int reasonableSizeY = 2 * 3840; // 2x tile at 100% zoom
-                    if (joinW > reasonableSizeX || joinH > reasonableSizeY)
-                    {
-                        ++i;
-                        continue;
-                    }
-
-                    LOG_TRC("Merging invalidations: "
-                            << Callback::toString(view, type, payload) << " and "
-                            << tokens[0] << ' ' << tokens[1] << ' ' << tokens[2] << ' '
-                            << msgX << ' ' << msgY << ' ' << msgW << ' ' << msgH << ' '
-                            << msgPart << ' ' << msgMode << " -> "
-                            << tokens[0] << ' ' << tokens[1] << ' ' << tokens[2] << ' '
-                            << joinX << ' ' << joinY << ' ' << joinW << ' ' << joinH << ' '
-                            << msgPart << ' ' << msgMode);
-
-                    msgX = joinX;
-                    msgY = joinY;
-                    msgW = joinW;
-                    msgH = joinH;
-                    performedMerge = true;
-
-                    // remove from the queue
-                    _callbacks.erase(_callbacks.begin() + i);
-                    continue;
-                }
+    callback._payload = std::to_string(msgX) + ", " + std::to_string(msgY) + ", " +
+                        std::to_string(msgW) + ", " + std::to_string(msgH) + ", " +
+                        std::to_string(callback._part);
+    if (callback._mode)
+        callback._payload += ", " + std::to_string(callback._mode);
 
-                ++i;
-            }
+    LOG_TRC("Merge result: " << callback._payload);
 
-            if (performedMerge)
-            {
-                std::string newPayload =
-                    std::to_string(msgX) + ", " + std::to_string(msgY) + ", " +
-                    std::to_string(msgW) + ", " + std::to_string(msgH) + ", " +
-                    tokens.cat(' ', 4); // part etc. ...
+    queueCallback(std::move(callback));
+    return true; // elide the original - use this instead
+}
 
-                LOG_TRC("Merge result: " << newPayload);
+bool KitQueue::elideDuplicateCallback(Callback& callback)
+{
+    const int view = callback._view;
+    const int type = callback._type;
+    const std::string& payload = callback._payload;
+    const auto callbackType = static_cast<LibreOfficeKitCallbackType>(type);
 
-                _callbacks.emplace_back(view, type, newPayload);
-                return true; // elide the original - use this instead
-            }
-        }
-        break;
+    // Nothing to combine in this case:
+    if (_callbacks.size() == 0)
+        return false;
+
+    switch (callbackType)
+    {
+        case LOK_CALLBACK_INVALIDATE_TILES: // invalidation
+            return callback._isArea && mergeInvalidation(callback);
 
         case LOK_CALLBACK_STATE_CHANGED: // state changed
         {
@@ -308,22 +451,15 @@ bool KitQueue::elideDuplicateCallback(int view, int type, const std::string &pay
                 return false;
 
             // remove obsolete states of the same .uno: command
-            size_t unoCommandLen = unoCommand.size();
             for (size_t i = 0; i < _callbacks.size(); ++i)
             {
-                Callback& it = _callbacks[i];
-                if (it._type != type || it._view != view)
-                    continue;
-
-                size_t payloadLen = it._payload.size();
-                if (payloadLen < unoCommandLen + 1 ||
-                    unoCommand.compare(0, unoCommandLen, it._payload) != 0 ||
-                    it._payload[unoCommandLen] != '=')
+                const Callback& it = _callbacks[i];
+                if (it._type != type || it._view != view || it._key != unoCommand)
                     continue;
 
                 LOG_TRC("Remove obsolete uno command: " << it << " -> "
                         << Callback::toString(view, type, payload));
-                _callbacks.erase(_callbacks.begin() + i);
+                eraseCallback(i);
                 break;
             }
         }
@@ -338,41 +474,20 @@ bool KitQueue::elideDuplicateCallback(int view, int type, const std::string &pay
         case LOK_CALLBACK_CELL_VIEW_CURSOR: // the view cell cursor has moved
         case LOK_CALLBACK_VIEW_CURSOR_VISIBLE: // the view cursor visibility has changed
         {
-            const bool isViewCallback = (callbackType == LOK_CALLBACK_INVALIDATE_VIEW_CURSOR ||
-                                         callbackType == LOK_CALLBACK_CELL_VIEW_CURSOR ||
-                                         callbackType == LOK_CALLBACK_VIEW_CURSOR_VISIBLE);
-
-            const std::string viewId
-                = (isViewCallback ? extractViewId(payload) : std::string());
-
+            // View callbacks are additionally about the view in their
+            // payload (otherwise we'd merge them all views into one);
+            // the viewId was parsed into the key.
             for (std::size_t i = 0; i < _callbacks.size(); ++i)
             {
                 const auto& it = _callbacks[i];
 
-                if (it._type != type || it._view != view)
+                if (it._type != type || it._view != view || it._key != callback._key)
                     continue;
 
-                if (!isViewCallback)
-                {
-                    LOG_TRC("Remove obsolete callback: " << it <<  " -> "
-                            << Callback::toString(view, type, payload));
-                    _callbacks.erase(_callbacks.begin() + i);
-                    break;
-                }
-                else if (isViewCallback)
-                {
-                    // we additionally need to ensure that the payload is about
-                    // the same viewid (otherwise we'd merge them all views into
-                    // one)
-                    const std::string queuedViewId = extractViewId(it._payload);
-                    if (viewId == queuedViewId)
-                    {
-                        LOG_TRC("Remove obsolete view callback: " << it << " -> "
-                                << Callback::toString(view, type, payload));
-                        _callbacks.erase(_callbacks.begin() + i);
-                        break;
-                    }
-                }
+                LOG_TRC("Remove obsolete " << (isViewCallback(type) ? "view callback: " : "callback: ")
+                        << it << " -> " << Callback::toString(view, type, payload));
+                eraseCallback(i);
+                break;
             }
         }
         break;
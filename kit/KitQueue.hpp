@@ -13,7 +13,12 @@
 
 #include <wsd/TileDesc.hpp>
 
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <set>
 #include <string>
+#include <tuple>
 #include <vector>
 
 class TilePrioritizer
@@ -63,7 +68,18 @@ public:
         int _type;
         std::string _payload;
 
-        Callback() : _view(-1), _type(-1) { }
+        /// Parsed from the payload once, when queued, so that
+        /// later callbacks can be compared with it cheaply.
+        /// The invalidated area of LOK_CALLBACK_INVALIDATE_TILES.
+        bool _isArea;
+        int _x, _y, _w, _h;
+        int _part, _mode;
+        /// The .uno: command of a state change, or the viewId of a view callback.
+        std::string _key;
+        /// Increases along the queue, to find indexed invalidations in it.
+        std::uint64_t _seq;
+
+        Callback() : Callback(-1, -1, std::string()) { }
         Callback(const Callback&) = default;
         Callback(Callback&&) = default;
         Callback& operator=(const Callback&) = default;
@@ -72,6 +88,14 @@ public:
             : _view(view)
             , _type(type)
             , _payload(std::move(payload))
+            , _isArea(false)
+            , _x(0)
+            , _y(0)
+            , _w(0)
+            , _h(0)
+            , _part(0)
+            , _mode(0)
+            , _seq(0)
         {
         }
 
@@ -81,9 +105,6 @@ public:
     /// Queue a LibreOfficeKit callback for later emission
     void putCallback(int view, int type, const std::string &message);
 
-    /// Work back over the queue to simplify & return false if we should not queue.
-    bool elideDuplicateCallback(int view, int type, const std::string &message);
-
     /// Obtain the next message.
     /// timeoutMs can be 0 to signify infinity.
     /// Returns an empty payload on timeout.
@@ -104,8 +125,9 @@ public:
     Callback getCallback()
     {
         assert(_callbacks.size() > 0);
-        Callback front = _callbacks.front();
-        _callbacks.erase(_callbacks.begin());
+        Callback front = std::move(_callbacks.front());
+        _callbacks.pop_front();
+        unindexInvalidation(front);
         return front;
     }
 
@@ -114,7 +136,8 @@ public:
         if (_callbacks.size() == 0)
             return false;
         callback = std::move(_callbacks.front());
-        _callbacks.erase(_callbacks.begin());
+        _callbacks.pop_front();
+        unindexInvalidation(callback);
         return true;
     }
 
@@ -139,6 +162,7 @@ public:
     {
         _queue.clear();
         _callbacks.clear();
+        _invalidations.clear();
     }
 
     void dumpState(std::ostream& oss);
@@ -169,6 +193,28 @@ private:
     /// @return New message to put into the queue.  If empty, use what was in callbackMsg.
     std::string removeCallbackDuplicate(const std::string& callbackMsg);
 
+    /// Work back over the queue to simplify & return false if we should not queue.
+    bool elideDuplicateCallback(Callback& callback);
+
+    /// Merges the invalidation with the queued ones it overlaps, or makes
+    /// them redundant. Returns true if the callback was queued already.
+    bool mergeInvalidation(Callback& callback);
+
+    /// Appends the callback to the queue.
+    void queueCallback(Callback&& callback);
+
+    /// Erases the callback at @index from the queue.
+    void eraseCallback(std::size_t index);
+
+    /// Returns the index in the queue of the callback numbered @seq.
+    std::size_t findCallback(std::uint64_t seq) const;
+
+    /// Adds the invalidation, entering the queue, to the index.
+    void indexInvalidation(const Callback& callback);
+
+    /// Drops the callback, leaving the queue, from the invalidation index.
+    void unindexInvalidation(const Callback& callback);
+
     std::vector<TileDesc>* getTileQueue(CanonicalViewId viewid);
     std::vector<TileDesc>& ensureTileQueue(CanonicalViewId viewid);
     TileCombined popTileQueue(std::vector<TileDesc>& tileQueue, TilePrioritizer::Priority &priority);
@@ -182,7 +228,26 @@ private:
     std::vector<viewTileQueue> _tileQueues;
 
     /// Queue of callbacks from Kit to send out to coolwsd
-    std::vector<Callback> _callbacks;
+    std::deque<Callback> _callbacks;
+
+    /// The view, part and mode of invalidations, which only merge with their own kind.
+    using InvalidationKey = std::tuple<int, int, int>;
+
+    /// The queued invalidations of a kind, by the tile rows they touch,
+    /// so that a new one is only compared with those around it.
+    struct InvalidationIndex
+    {
+        /// The number of queued invalidations of this kind.
+        std::size_t _count = 0;
+        /// The _seq of the invalidations touching each row.
+        std::map<int, std::set<std::uint64_t>> _rows;
+        /// Those too tall to enter in each of their rows, like EMPTY.
+        std::set<std::uint64_t> _tall;
+    };
+    std::map<InvalidationKey, InvalidationIndex> _invalidations;
+
+    /// The _seq of the next queued callback.
+    std::uint64_t _nextSeq = 0;
 };
 
 inline std::ostream& operator<<(std::ostream& os, const KitQueue::Callback &c)
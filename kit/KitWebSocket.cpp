@@ -167,6 +167,29 @@ void KitWebSocketHandler::handleMessage(const std::vector<char>& data)
     {
         Log::setLevel(tokens[1]);
     }
+    else if (tokens.size() == 2 && tokens.equals(0, "tracesampling"))
+    {
+        uint32_t rate = 0;
+        if (COOLProtocol::stringToUInt32(tokens[1], rate))
+        {
+            LOG_INF("Sampling one in " << rate << " ProfileZones");
+            TraceEvent::setSampling(rate);
+        }
+    }
+    else if (tokens.size() == 2 && tokens.equals(0, "memorypressure"))
+    {
+        uint32_t level = 0;
+        if (COOLProtocol::stringToUInt32(tokens[1], level) &&
+            level < MemoryPressure::LevelMax)
+        {
+            if (_document)
+                _document->setMemoryPressure(static_cast<MemoryPressure::Level>(level));
+        }
+        else
+        {
+            LOG_ERR("Invalid memory pressure: " << message);
+        }
+    }
     else if constexpr (!Util::isFuzzing())
     {
         LOG_ERR("Bad or unknown token [" << tokens[0] << ']');
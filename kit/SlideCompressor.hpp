@@ -17,9 +17,11 @@
 
 #include "ThreadPool.hpp"
 
-/// Do slide compression work in a thread pool
+/// Do slide compression work in a thread pool, overlapping
+/// the compression of each layer with rendering the next one.
 class SlideCompressor {
     ThreadPool &_pool;
+    ThreadPool::Batch _batch;
 
     struct SlideItem {
         std::vector<char> _output;
@@ -27,17 +29,19 @@ class SlideCompressor {
     std::vector<std::shared_ptr<SlideItem>> _items;
 public:
     SlideCompressor(ThreadPool &pool) :
-        _pool(pool)
+        _pool(pool),
+        _batch(pool)
     {
     }
 
-    /// workFn generates is passed a buffer to generate its output into
+    /// workFn generates is passed a buffer to generate its output into,
+    /// and starts running in the pool right away.
     void pushWork(std::function<void(std::vector<char>&)> workFn)
     {
         auto item = std::make_shared<SlideItem>();
         _items.push_back(item);
-        _pool.pushWork([item = std::move(item), workFn = std::move(workFn)]
-                       { workFn(item->_output); });
+        _batch.pushWork([item = std::move(item), workFn = std::move(workFn)]
+                        { workFn(item->_output); });
     }
 
     /// sendFunc is called in the same order after all items are compressed
@@ -46,7 +50,7 @@ public:
         LOG_TRC("Compressing " << _items.size() << " layers with " << _pool.getThreadCount() << " threads");
 
         if (_items.size() > 0)
-            _pool.run();
+            _batch.wait();
 
         for (auto &it : _items)
         {
@@ -27,5 +27,8 @@ TilePrioritizer::Priority ChildSession::getTilePriority(const TileDesc &) const
 ChildSession::~ChildSession() {}
 
 int simd_initPixRowSimd(const uint32_t *, uint32_t *, size_t *, uint64_t *) { return 0; }
+int simd_unpremultiply(int, uint8_t *, size_t, int) { return 0; }
+int simd_rowHash(int, const uint64_t *, size_t, const uint32_t *, size_t, uint32_t *) { return 0; }
+int simd_blendPremultiplied(int, uint8_t *, const uint8_t *, size_t, int, int) { return 0; }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -17,6 +17,8 @@
 #include <LibreOfficeKit/LibreOfficeKitEnums.h>
 #include <vector>
 #include <Log.hpp>
+#include <Simd.hpp>
+#include <kit/DeltaSimd.h>
 #include <cstdlib>
 #include <string>
 #include <cmath>
@@ -77,39 +79,36 @@ private:
     void alphaBlend(const std::vector<unsigned char>& from, int from_width, int from_height, int from_offset_x, int from_offset_y,
             unsigned char* to, int to_width, int to_height, const bool isFontBlending, bool isSlideShowLayer = false)
     {
-        bool isCalc = (_loKitDoc->getDocumentType() == LOK_DOCTYPE_SPREADSHEET);
+        const bool isCalc = (_loKitDoc->getDocumentType() == LOK_DOCTYPE_SPREADSHEET);
+        const bool opaqueOnly = !isFontBlending && !isCalc;
+        const int level = simd::getLevel();
+        const int count = std::min(to_width - from_offset_x, from_width);
+        if (count <= 0)
+            return;
+
         for (int to_y = from_offset_y, from_y = 0; (to_y < to_height) && (from_y < from_height) ; ++to_y, ++from_y)
-            for (int to_x = from_offset_x, from_x = 0; (to_x < to_width) && (from_x < from_width); ++to_x, ++from_x)
-            {
-                unsigned char* t = to + 4 * (to_y * to_width + to_x);
+        {
+            unsigned char* t = to + 4 * (to_y * to_width + from_offset_x);
+            const unsigned char* f = from.data() + 4 * (from_y * from_width);
+            if (simd_blendPremultiplied(level, t, f, count, opaqueOnly, isSlideShowLayer))
+                continue;
 
+            for (int x = 0; x < count; ++x, t += 4, f += 4)
+            {
+                // Only the transparent background is dimmed on slideshow layers.
                 const bool isTransparentBackground = isSlideShowLayer && t[3] == 0;
-                if (!isFontBlending && !isCalc && t[3] != 255 && !isTransparentBackground)
+                if (opaqueOnly && t[3] != 255 && !isTransparentBackground)
                     continue;
 
-                double dst_r = t[0];
-                double dst_g = t[1];
-                double dst_b = t[2];
-                double dst_a = t[3] / 255.0;
-
-                const unsigned char* f = from.data() + 4 * (from_y * from_width + from_x);
-                double src_r = f[0];
-                double src_g = f[1];
-                double src_b = f[2];
-                double src_a = f[3] / 255.0;
+                // Premultiplied: out = src + dst * (1 - src_alpha), for all channels.
+                const unsigned inv = 255 - f[3];
+                for (int i = 0; i < 4; ++i)
+                    t[i] = std::min(255u, f[i] + (t[i] * inv) / 255);
 
-                double out_a = src_a + dst_a * (1.0 - src_a);
                 if (isTransparentBackground)
-                    out_a /= 8;
-                unsigned char out_r = src_r + dst_r * (1.0 - src_a);
-                unsigned char out_g = src_g + dst_g * (1.0 - src_a);
-                unsigned char out_b = src_b + dst_b * (1.0 - src_a);
-
-                t[0] = out_r;
-                t[1] = out_g;
-                t[2] = out_b;
-                t[3] = static_cast<unsigned char>(out_a * 255.0);
+                    t[3] /= 8;
             }
+        }
     }
 
     /// Create bitmap that we later use as the watermark for every tile.
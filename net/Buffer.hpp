@@ -11,23 +11,76 @@
 
 #pragma once
 
+#include <common/Common.hpp>
 #include <common/HexUtil.hpp>
 #include <common/Util.hpp>
 
 #include <assert.h>
+#include <deque>
 #include <ostream>
 #include <vector>
 
-// Blocks -> we can share from client -> server ... etc.
-// headers / and a 'writeV' etc. =)
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 /**
  * Encapsulate data we need to write.
+ *
+ * Data is normally copied into a contiguous vector. Large ref-counted
+ * blobs (eg. tiles) can instead be referenced with appendShared(), in
+ * which case they are queued as segments after the contiguous data,
+ * and written out with writev without ever being copied.
+ * Ranges of open files can be queued likewise with appendFile(),
+ * to be written with sendfile(2) where the socket supports it.
+ * The contiguous accessors (data(), begin(), operator[], etc.) are
+ * only valid while there are no segments.
  */
 class Buffer
 {
+public:
+    /// An open file to send from, closed once no segment references it.
+    class File
+    {
+        const int _fd;
+
+    public:
+        explicit File(int fd)
+            : _fd(fd)
+        {
+        }
+
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+
+        ~File()
+        {
+            if (_fd >= 0)
+                ::close(_fd);
+        }
+
+        int getFD() const { return _fd; }
+    };
+
+private:
+    /// A segment of data queued after _buffer.
+    /// Either references a shared blob or a file range, or owns
+    /// the bytes appended after a shared segment, to preserve ordering.
+    struct Segment
+    {
+        std::shared_ptr<const BlobData> _blob;
+        std::size_t _offset;
+        std::size_t _size;
+        bool _owned;
+        std::shared_ptr<const File> _file;
+
+        const char* data() const { return _blob->data() + _offset; }
+    };
+
     std::size_t _offset;  /// offset into _buffer of data
     std::vector<char> _buffer;
+    std::deque<Segment> _segments;
+    std::size_t _segmentsSize; ///< The bytes remaining in _segments.
 
     void resetOffset()
     {
@@ -37,28 +90,113 @@ class Buffer
         _offset = 0;
     }
 
+    std::size_t headSize() const { return _buffer.size() - _offset; }
+
+    void eraseHead(std::size_t len)
+    {
+        assert(_offset + len <= _buffer.size());
+
+        len = std::min(len, headSize()); // Avoid accidental damage.
+
+        // avoid regular shuffling down larger chunks of data
+        if (_buffer.size() > 16384 && // lots of queued data
+            len < headSize() &&       // not a complete erase
+            _offset < 16384 * 64 &&   // do cleanup a Mb at a time or so:
+            headSize() > 512)         // early cleanup if what remains is small.
+        {
+            _offset += len;
+            return;
+        }
+
+        _buffer.erase(_buffer.begin(), _buffer.begin() + _offset + len);
+        resetOffset();
+    }
+
 public:
-    Buffer() : _offset(0)
+    /// Blobs smaller than this are cheaper to copy than to reference.
+    static constexpr std::size_t MinSharedSize = 4096;
+
+    Buffer()
+        : _offset(0)
+        , _segmentsSize(0)
     {
     }
 
     using iterator = std::vector<char>::iterator;
     using const_iterator = std::vector<char>::const_iterator;
 
-    std::size_t size() const { return _buffer.size() - _offset; }
-    std::size_t capacity() const { return _buffer.capacity(); }
-    bool empty() const { return _offset == _buffer.size(); }
+    std::size_t size() const { return headSize() + _segmentsSize; }
+    std::size_t capacity() const { return _buffer.capacity() + _segmentsSize; }
+    bool empty() const { return _offset == _buffer.size() && _segments.empty(); }
+
+    /// True when some of the data is held in segments, rather than contiguously.
+    bool isSegmented() const { return !_segments.empty(); }
+
+    /// True when the next data to write is a range of a file.
+    bool isFileBlock() const
+    {
+        return _offset == _buffer.size() && !_segments.empty() && _segments.front()._file;
+    }
+
+    /// Returns the file, offset and size of the next data to write,
+    /// which must be a file range, see isFileBlock().
+    const File& getFileBlock(off_t& offset, std::size_t& size) const
+    {
+        assert(isFileBlock());
+        const Segment& segment = _segments.front();
+        offset = segment._offset;
+        size = segment._size;
+        return *segment._file;
+    }
 
+    /// Returns the first contiguous block of data.
     const char *getBlock() const
     {
-        if (!empty())
+        if (_offset != _buffer.size())
             return &_buffer[_offset];
+        if (!_segments.empty() && !_segments.front()._file)
+            return _segments.front().data();
         return nullptr;
     }
 
+    /// Returns the size of the block returned by getBlock().
     std::size_t getBlockSize() const
     {
-        return size();
+        if (_offset != _buffer.size() || _segments.empty())
+            return headSize();
+        return _segments.front()._file ? 0 : _segments.front()._size;
+    }
+
+    /// Fills up to @maxCount entries of @iov with the blocks of data,
+    /// covering no more than @maxBytes in total, for writev.
+    /// Stops short of any file range, which is written separately.
+    /// Returns the number of entries filled.
+    int getIOVec(struct iovec* iov, int maxCount, std::size_t maxBytes) const
+    {
+        int count = 0;
+        auto add = [&](const char* data, std::size_t len)
+        {
+            len = std::min(len, maxBytes);
+            if (len == 0 || count >= maxCount)
+                return false;
+
+            iov[count].iov_base = const_cast<char*>(data);
+            iov[count].iov_len = len;
+            ++count;
+            maxBytes -= len;
+            return true;
+        };
+
+        if (_offset != _buffer.size())
+            add(&_buffer[_offset], headSize());
+
+        for (const Segment& segment : _segments)
+        {
+            if (segment._file || !add(segment.data(), segment._size))
+                break;
+        }
+
+        return count;
     }
 
     void eraseFirst(std::size_t len)
@@ -66,28 +204,78 @@ public:
         if (len <= 0)
             return;
 
-        assert(_offset + len <= _buffer.size());
-        assert(_offset + size() == _buffer.size());
+        assert(len <= size());
 
-        len = std::min(len, size()); // Avoid accidental damage.
+        const std::size_t head = std::min(len, headSize());
+        if (head > 0)
+        {
+            eraseHead(head);
+            len -= head;
+        }
 
-        // avoid regular shuffling down larger chunks of data
-        if (_buffer.size() > 16384 && // lots of queued data
-            len < size() &&           // not a complete erase
-            _offset < 16384 * 64 &&   // do cleanup a Mb at a time or so:
-            size() > 512)             // early cleanup if what remains is small.
+        while (len > 0 && !_segments.empty())
         {
-            _offset += len;
+            Segment& segment = _segments.front();
+            const std::size_t count = std::min(len, segment._size);
+            segment._offset += count;
+            segment._size -= count;
+            _segmentsSize -= count;
+            len -= count;
+            if (segment._size == 0)
+                _segments.pop_front();
+        }
+    }
+
+    void append(const char *data, const int len)
+    {
+        if (_segments.empty())
+        {
+            _buffer.insert(_buffer.end(), data, data + len);
             return;
         }
 
-        _buffer.erase(_buffer.begin(), _buffer.begin() + _offset + len);
-        resetOffset();
+        // Must come after the segments; reuse the last one if we own it.
+        if (!_segments.back()._owned)
+        {
+            auto owned = std::make_shared<BlobData>();
+            owned->reserve(std::max<std::size_t>(len, MinSharedSize));
+            _segments.push_back(Segment{ std::move(owned), 0, 0, true, nullptr });
+        }
+
+        Segment& segment = _segments.back();
+        // Only we have a reference to owned blobs.
+        BlobData& blob = const_cast<BlobData&>(*segment._blob);
+        blob.insert(blob.end(), data, data + len);
+        segment._size += len;
+        _segmentsSize += len;
     }
 
-    void append(const char *data, const int len)
+    /// Append @len bytes at @offset of @blob, by reference when large enough.
+    /// The blob must not be modified while it is referenced.
+    void appendShared(const std::shared_ptr<const BlobData>& blob, std::size_t offset,
+                      std::size_t len)
     {
-        _buffer.insert(_buffer.end(), data, data + len);
+        assert(blob && offset + len <= blob->size());
+        if (len < MinSharedSize)
+        {
+            append(blob->data() + offset, len);
+            return;
+        }
+
+        _segments.push_back(Segment{ blob, offset, len, false, nullptr });
+        _segmentsSize += len;
+    }
+
+    /// Append @len bytes at @offset of @file, to be read from it when written out.
+    /// The file must not be modified while it is referenced.
+    void appendFile(const std::shared_ptr<const File>& file, off_t offset, std::size_t len)
+    {
+        assert(file && offset >= 0);
+        if (len == 0)
+            return;
+
+        _segments.push_back(Segment{ nullptr, static_cast<std::size_t>(offset), len, false, file });
+        _segmentsSize += len;
     }
 
     void append(const std::string& s) { append(s.c_str(), s.size()); }
@@ -103,6 +291,9 @@ public:
     {
         if (size() > 0 || _offset > 0)
             os << prefix << "Buffer size: " << size() << " offset: " << _offset << '\n';
+        if (!_segments.empty())
+            os << prefix << "Buffer segments: " << _segments.size() << " of " << _segmentsSize
+               << " bytes\n";
         if (_buffer.size() > 0)
             HexUtil::dumpHex(os, _buffer, legend, prefix);
     }
@@ -112,12 +303,16 @@ public:
     void clear()
     {
         _buffer.clear();
+        _segments.clear();
+        _segmentsSize = 0;
         resetOffset();
     }
 
-    iterator begin() { return _buffer.begin() + _offset; }
+    // The following are only valid on contiguous buffers.
+
+    iterator begin() { assert(!isSegmented()); return _buffer.begin() + _offset; }
 
-    const_iterator begin() const { return _buffer.begin() + _offset; }
+    const_iterator begin() const { assert(!isSegmented()); return _buffer.begin() + _offset; }
 
     iterator end() { return _buffer.end(); }
 
@@ -127,9 +322,9 @@ public:
 
     char& operator[](int index) { return _buffer[_offset + index]; }
 
-    const char* data() const { return _buffer.data() + _offset; }
+    const char* data() const { assert(!isSegmented()); return _buffer.data() + _offset; }
 
-    char* data() { return _buffer.data() + _offset; }
+    char* data() { assert(!isSegmented()); return _buffer.data() + _offset; }
 
     iterator erase(iterator first, iterator last)
     {
@@ -15,10 +15,18 @@
 #include "HttpRequest.hpp"
 
 #include <algorithm>
+#include <charconv>
+#include <fstream>
 #include <string>
 #include <zlib.h>
+#include <zstd.h>
 
+#include <fcntl.h>
+
+#include <Poco/DigestEngine.h>
+#include <Poco/Net/HTTPRequest.h>
 #include <Poco/Net/HTTPResponse.h>
+#include <Poco/SHA1Engine.h>
 
 #include <common/Common.hpp>
 #include <common/FileUtil.hpp>
@@ -27,53 +35,83 @@
 
 namespace
 {
+/// Compressed variants are only kept when they save at least this fraction.
+constexpr double MaxCompressionRatio = 0.9;
+
+/// Favor the ratio, as assets are compressed once and served many times.
+constexpr int ZstdLevel = 12;
+
 void sendUncompressedFileContent(const std::shared_ptr<StreamSocket>& socket,
-                                 const std::string& path, const int bufferSize)
+                                 const std::string& path, const int bufferSize,
+                                 std::size_t offset, std::size_t length)
 {
     std::ifstream file(path, std::ios::binary);
+    file.seekg(offset);
     std::unique_ptr<char[]> buf = std::make_unique<char[]>(bufferSize);
-    do
+    while (length > 0 && file)
     {
-        file.read(buf.get(), bufferSize);
+        file.read(buf.get(), std::min<std::size_t>(bufferSize, length));
         const int size = file.gcount();
-        if (size > 0)
-            socket->send(buf.get(), size, true);
-        else
+        if (size <= 0)
             break;
-    } while (file);
+
+        socket->send(buf.get(), size, true);
+        length -= size;
+    }
+}
+
+/// Parses a decimal number, which must be all of @str.
+bool parseNumber(std::string_view str, std::size_t& value)
+{
+    if (str.empty())
+        return false;
+
+    const auto result = std::from_chars(str.data(), str.data() + str.size(), value);
+    return result.ec == std::errc() && result.ptr == str.data() + str.size();
 }
 
-void sendDeflatedFileContent(const std::shared_ptr<StreamSocket>& socket, const std::string& path,
-                             const int fileSize)
+std::string_view trim(std::string_view str)
 {
-    // FIXME: Should compress once ahead of time
-    // compression of bundle.js takes significant time:
-    //   200's ms for level 9 (468k), 72ms for level 1(587k)
-    //   down from 2Mb.
-    if (fileSize > 0)
+    while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+        str.remove_prefix(1);
+    while (!str.empty() && (str.back() == ' ' || str.back() == '\t'))
+        str.remove_suffix(1);
+    return str;
+}
+
+/// Sets the status and headers for the range of @size bytes to send,
+/// returns false if there is nothing to send but the headers.
+bool setRange(http::Response& response, std::string_view range, std::size_t size,
+              std::size_t& start, std::size_t& length)
+{
+    response.set("Accept-Ranges", "bytes");
+    switch (HttpHelper::parseRange(range, size, start, length))
     {
-        std::ifstream file(path, std::ios::binary);
-        std::unique_ptr<char[]> buf = std::make_unique<char[]>(fileSize);
-        file.read(buf.get(), fileSize);
+        case HttpHelper::RangeResult::Full:
+            response.setContentLength(size);
+            return true;
 
-        static const unsigned int Level = 1;
-        const long unsigned int size = file.gcount();
-        long unsigned int compSize = compressBound(size);
-        std::unique_ptr<char[]> cbuf = std::make_unique<char[]>(compSize);
-        int result = compress2((Bytef*)cbuf.get(), &compSize, (Bytef*)buf.get(), size, Level);
-        if (result != Z_OK)
-        {
-             LOG_ERR("failed compress of: " << path << " result: " << result);
-             return;
-        }
-        if (size > 0)
-            socket->send(cbuf.get(), compSize, true);
+        case HttpHelper::RangeResult::Partial:
+            response.setStatusCode(http::StatusCode::PartialContent);
+            response.set("Content-Range", "bytes " + std::to_string(start) + '-' +
+                                              std::to_string(start + length - 1) + '/' +
+                                              std::to_string(size));
+            response.setContentLength(length);
+            return true;
+
+        case HttpHelper::RangeResult::Unsatisfiable:
+            response.setStatusCode(http::StatusCode::RangeNotSatisfiable);
+            response.set("Content-Range", "bytes */" + std::to_string(size));
+            response.setContentLength(0);
+            break;
     }
+
+    return false;
 }
 
 void sendFileImpl(const std::shared_ptr<StreamSocket>& socket, const std::string& path,
-                  http::Response& response, const bool noCache, const bool deflate,
-                  const bool headerOnly, const bool closeSocket)
+                  http::Response& response, const bool noCache, const bool headerOnly,
+                  const bool closeSocket, std::string_view range)
 {
     FileUtil::Stat st(path);
     if (st.bad())
@@ -101,57 +139,352 @@ void sendFileImpl(const std::shared_ptr<StreamSocket>& socket, const std::string
         response.setConnectionToken(http::Header::ConnectionToken::Close);
     }
 
-    int bufferSize = std::min<std::size_t>(st.size(), Socket::MaximumSendBufferSize);
-    if (static_cast<long>(st.size()) >= socket->getSendBufferSize())
+    std::size_t offset = 0;
+    std::size_t length = st.size();
+    const bool hasBody = setRange(response, range, st.size(), offset, length) && !headerOnly;
+
+    int bufferSize = std::min<std::size_t>(length, Socket::MaximumSendBufferSize);
+    if (static_cast<long>(length) >= socket->getSendBufferSize())
     {
         socket->setSocketBufferSize(bufferSize);
         bufferSize = socket->getSendBufferSize();
     }
 
-    // Disable deflate for now - until we can cache deflated data.
-    // FIXME: IE/Edge doesn't work well with deflate, so check with
-    // IE/Edge before enabling the deflate again
-    if (!deflate || true)
+    // Let the kernel copy the file straight to the socket, when it can.
+    std::shared_ptr<const Buffer::File> file;
+    if (hasBody && length > 0 && socket->canSendFile())
     {
-        response.setContentLength(st.size());
-        LOG_TRC('#' << socket->getFD() << ": Sending " << (headerOnly ? "header for " : "")
-                    << " file [" << path << "].");
-        socket->send(response);
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0)
+            file = std::make_shared<Buffer::File>(fd);
+        else
+            LOG_SYS('#' << socket->getFD() << ": Failed to open [" << path
+                        << "], will read it instead");
+    }
+
+    LOG_TRC('#' << socket->getFD() << ": Sending " << (headerOnly ? "header for " : "")
+                << " file [" << path << "] " << offset << '+' << length
+                << (file ? " with sendfile" : ""));
+    socket->send(response);
 
-        if (!headerOnly)
-            sendUncompressedFileContent(socket, path, bufferSize);
+    if (file)
+    {
+        socket->sendFile(file, offset, length);
     }
-    else
+    else if (hasBody)
     {
-        response.set("Content-Encoding", "deflate");
-        LOG_TRC('#' << socket->getFD() << ": Sending " << (headerOnly ? "header for " : "")
-                    << " file [" << path << "].");
-        socket->send(response);
-
-        if (!headerOnly)
-            sendDeflatedFileContent(socket, path, st.size());
+        sendUncompressedFileContent(socket, path, bufferSize, offset, length);
     }
+
     if(closeSocket) {
         socket->asyncShutdown();
     }
 }
 
+std::shared_ptr<const BlobData> makeBlob(std::string_view data)
+{
+    return std::make_shared<const BlobData>(data.begin(), data.end());
+}
+
+/// Returns the gzip-compressed @data, or null if that doesn't pay off.
+std::shared_ptr<const BlobData> compressGzip(std::string_view data)
+{
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    const int initResult =
+        deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY);
+    if (initResult != Z_OK)
+    {
+        LOG_ERR("Failed to deflateInit2, result: " << initResult);
+        return nullptr;
+    }
+
+    auto compressed = std::make_shared<BlobData>(deflateBound(&strm, data.size()));
+    strm.next_in = (unsigned char*)data.data();
+    strm.avail_in = data.size();
+    strm.next_out = (unsigned char*)compressed->data();
+    strm.avail_out = compressed->size();
+
+    const int deflateResult = deflate(&strm, Z_FINISH);
+    const std::size_t size = compressed->size() - strm.avail_out;
+    deflateEnd(&strm);
+    if (deflateResult != Z_STREAM_END)
+    {
+        LOG_ERR("Failed to deflate, result: " << deflateResult);
+        return nullptr;
+    }
+
+    if (size > data.size() * MaxCompressionRatio)
+        return nullptr;
+
+    compressed->resize(size);
+    compressed->shrink_to_fit();
+    return compressed;
+}
+
+/// Returns the zstd-compressed @data, or null if that doesn't pay off.
+std::shared_ptr<const BlobData> compressZstd(std::string_view data)
+{
+    auto compressed = std::make_shared<BlobData>(ZSTD_compressBound(data.size()));
+    const std::size_t size = ZSTD_compress(compressed->data(), compressed->size(), data.data(),
+                                           data.size(), ZstdLevel);
+    if (ZSTD_isError(size))
+    {
+        LOG_ERR("Failed to zstd compress: " << ZSTD_getErrorName(size));
+        return nullptr;
+    }
+
+    if (size > data.size() * MaxCompressionRatio)
+        return nullptr;
+
+    compressed->resize(size);
+    compressed->shrink_to_fit();
+    return compressed;
+}
+
+/// Strong ETag from the hash of @content.
+std::string makeETag(std::string_view content)
+{
+    Poco::SHA1Engine engine;
+    engine.update(content.data(), content.size());
+    return '"' + Poco::DigestEngine::digestToHex(engine.digest()) + '"';
+}
+
 } // namespace
 
 namespace HttpHelper
 {
+RangeResult parseRange(std::string_view range, std::size_t size, std::size_t& start,
+                       std::size_t& length)
+{
+    start = 0;
+    length = size;
+
+    range = trim(range);
+    constexpr std::string_view Unit = "bytes=";
+    if (!range.starts_with(Unit))
+        return RangeResult::Full;
+
+    // Multiple ranges would need a multipart response, which isn't worth it.
+    range.remove_prefix(Unit.size());
+    const std::size_t dash = range.find('-');
+    if (dash == std::string_view::npos || range.find(',') != std::string_view::npos)
+        return RangeResult::Full;
+
+    const std::string_view first = trim(range.substr(0, dash));
+    const std::string_view last = trim(range.substr(dash + 1));
+    std::size_t from = 0;
+    std::size_t to = 0;
+    if (first.empty())
+    {
+        // The suffix, i.e. the last bytes.
+        if (!parseNumber(last, to))
+            return RangeResult::Full;
+        if (to == 0 || size == 0)
+            return RangeResult::Unsatisfiable;
+
+        length = std::min(to, size);
+        start = size - length;
+        return RangeResult::Partial;
+    }
+
+    if (!parseNumber(first, from) || (!last.empty() && (!parseNumber(last, to) || to < from)))
+        return RangeResult::Full;
+    if (from >= size)
+        return RangeResult::Unsatisfiable;
+
+    to = last.empty() ? size - 1 : std::min(to, size - 1);
+    start = from;
+    length = to - from + 1;
+    return RangeResult::Partial;
+}
+
+bool matchesETag(std::string_view ifNoneMatch, std::string_view etag)
+{
+    while (!ifNoneMatch.empty())
+    {
+        const std::size_t comma = ifNoneMatch.find(',');
+        std::string_view candidate = trim(ifNoneMatch.substr(0, comma));
+        ifNoneMatch = comma == std::string_view::npos ? std::string_view()
+                                                      : ifNoneMatch.substr(comma + 1);
+
+        // If-None-Match uses the weak comparison.
+        if (candidate.starts_with("W/"))
+            candidate.remove_prefix(2);
+        if (candidate == "*" || candidate == etag)
+            return true;
+    }
+
+    return false;
+}
+
 void sendFile(const std::shared_ptr<StreamSocket>& socket, const std::string& path,
-              http::Response& response, const bool noCache,
-              const bool deflate, const bool headerOnly)
+              http::Response& response, const bool noCache, const bool headerOnly,
+              std::string_view range)
 {
-    sendFileImpl(socket, path, response, noCache, deflate, headerOnly, false);
+    sendFileImpl(socket, path, response, noCache, headerOnly, false, range);
 }
 
 void sendFileAndShutdown(const std::shared_ptr<StreamSocket>& socket, const std::string& path,
-                         http::Response& response, const bool noCache,
-                         const bool deflate, const bool headerOnly)
+                         http::Response& response, const bool noCache, const bool headerOnly,
+                         std::string_view range)
+{
+    sendFileImpl(socket, path, response, noCache, headerOnly, true, range);
+}
+
+std::size_t StaticAsset::getMemorySize() const
+{
+    std::size_t size = sizeof(StaticAsset) + _etag.capacity();
+    for (const auto& blob : { _data, _gzip, _brotli, _zstd })
+    {
+        if (blob)
+            size += blob->capacity();
+    }
+
+    return size;
+}
+
+std::string StaticAsset::getETag(std::string_view encoding) const
+{
+    if (encoding.empty() || _etag.empty())
+        return _etag;
+
+    // Each representation is a distinct entity, so tag the encoding inside the quotes.
+    std::string etag = _etag.substr(0, _etag.size() - 1);
+    etag += '-';
+    etag += encoding;
+    etag += '"';
+    return etag;
+}
+
+StaticAsset makeStaticAsset(std::string_view data, std::string_view brotli)
+{
+    StaticAsset asset;
+    asset._data = makeBlob(data);
+    if (!brotli.empty())
+        asset._brotli = makeBlob(brotli);
+
+    if (!data.empty())
+    {
+        asset._gzip = compressGzip(data);
+        asset._zstd = compressZstd(data);
+    }
+
+    asset._etag = makeETag(data);
+    return asset;
+}
+
+StaticAsset makeBrotliAsset(std::string_view brotli)
 {
-    sendFileImpl(socket, path, response, noCache, deflate, headerOnly, true);
+    StaticAsset asset;
+    asset._brotli = makeBlob(brotli);
+
+    // Hash what is served, so the tag changes with the content.
+    asset._etag = makeETag(brotli);
+    return asset;
+}
+
+void sendAsset(const std::shared_ptr<StreamSocket>& socket, const StaticAsset& asset,
+               const Poco::Net::HTTPRequest& request, http::Response& response,
+               const bool noCache)
+{
+    response.add("X-Content-Type-Options", "nosniff");
+    response.add("Vary", "Accept-Encoding");
+
+    const bool acceptsBrotli = asset._brotli && request.hasToken("Accept-Encoding", "br");
+    if (!asset._data && !acceptsBrotli)
+    {
+        // There is nothing else to send than brotli.
+        LOG_DBG('#' << socket->getFD() << ": Client doesn't accept brotli, which is all we have");
+        response.setStatusCode(http::StatusCode::NotAcceptable);
+        response.setContentLength(0);
+        socket->send(response);
+        return;
+    }
+
+    // Ranges are of the identity encoding; only honor them while the asset is unchanged.
+    std::string range = asset._data ? request.get("Range", std::string()) : std::string();
+    if (!range.empty() && request.has("If-Range") && request.get("If-Range") != asset._etag)
+        range.clear();
+
+    // Pick the representation first, since each has its own ETag.
+    std::shared_ptr<const BlobData> content = asset._data;
+    std::string_view encoding;
+    if (range.empty())
+    {
+        // Brotli is precompressed at the highest level, so it's the smallest.
+        if (acceptsBrotli)
+        {
+            content = asset._brotli;
+            encoding = "br";
+        }
+        else if (asset._zstd && request.hasToken("Accept-Encoding", "zstd"))
+        {
+            content = asset._zstd;
+            encoding = "zstd";
+        }
+        else if (asset._gzip && request.hasToken("Accept-Encoding", "gzip"))
+        {
+            content = asset._gzip;
+            encoding = "gzip";
+        }
+    }
+
+    if (!noCache)
+    {
+        const std::string etag = asset.getETag(encoding);
+
+        // 60 * 60 * 24 * 128 (days) = 11059200
+        response.set("Cache-Control", "max-age=11059200");
+        response.set("ETag", etag);
+
+        if (matchesETag(request.get("If-None-Match", std::string()), etag))
+        {
+            response.setStatusCode(http::StatusCode::NotModified);
+            LOG_TRC('#' << socket->getFD() << ": Not modified: " << response.header());
+            socket->send(response);
+            return;
+        }
+    }
+    else
+    {
+        response.set("Cache-Control", "no-cache");
+    }
+
+    const bool headerOnly = request.getMethod() == Poco::Net::HTTPRequest::HTTP_HEAD;
+
+    std::size_t offset = 0;
+    std::size_t length = content->size();
+    if (!range.empty())
+    {
+        if (!setRange(response, range, content->size(), offset, length))
+        {
+            socket->send(response);
+            return;
+        }
+    }
+    else
+    {
+        if (!encoding.empty())
+            response.set("Content-Encoding", std::string(encoding));
+
+        if (asset._data)
+            response.set("Accept-Ranges", "bytes");
+        response.setContentLength(length);
+    }
+
+    LOG_TRC('#' << socket->getFD() << ": Sending " << (headerOnly ? "header for " : "")
+                << offset << '+' << length << " bytes: " << response.header());
+
+    socket->send(response);
+    if (!headerOnly && length > 0)
+    {
+        // Reference the content rather than copying it.
+        socket->getOutBuffer().appendShared(content, offset, length);
+        socket->attemptWrites();
+    }
 }
 
 } // namespace HttpHelper
@@ -11,14 +11,21 @@
 
 #pragma once
 
+#include <common/Common.hpp>
 #include <common/Uri.hpp>
 #include <HttpRequest.hpp>
 
 #include <memory>
 #include <string>
+#include <string_view>
 
 class StreamSocket;
 
+namespace Poco::Net
+{
+class HTTPRequest;
+}
+
 namespace HttpHelper
 {
 /// Write headers and body for an error response.
@@ -46,15 +53,66 @@ inline void sendErrorAndShutdown(http::StatusCode errorCode,
     socket->ignoreInput();
 }
 
+/// The outcome of parsing a Range header.
+enum class RangeResult
+{
+    Full, ///< No usable range; send all the content.
+    Partial, ///< Send the given range only.
+    Unsatisfiable ///< The range is outside the content.
+};
+
+/// Parses the value of a Range header for content of @size bytes into
+/// @start and @length. Only a single range of bytes is supported, anything
+/// else is ignored and the full content is to be sent, as RFC 9110 allows.
+RangeResult parseRange(std::string_view range, std::size_t size, std::size_t& start,
+                       std::size_t& length);
+
+/// True if the value of an If-None-Match header lists @etag, or is a wildcard.
+bool matchesETag(std::string_view ifNoneMatch, std::string_view etag);
+
 /// Sends file as HTTP response and shutdown the socket.
+/// When given, the value of the request's Range header is honored.
 void sendFileAndShutdown(const std::shared_ptr<StreamSocket>& socket, const std::string& path,
-                         http::Response& response, bool noCache = false, bool deflate = false,
-                         bool headerOnly = false);
+                         http::Response& response, bool noCache = false,
+                         bool headerOnly = false, std::string_view range = std::string_view());
 
 /// Sends file as HTTP response.
+/// When given, the value of the request's Range header is honored.
 void sendFile(const std::shared_ptr<StreamSocket>& socket, const std::string& path,
-              http::Response& response, bool noCache = false, bool deflate = false,
-              bool headerOnly = false);
+              http::Response& response, bool noCache = false, bool headerOnly = false,
+              std::string_view range = std::string_view());
+
+/// A static file held in memory to be served repeatedly,
+/// along with its variants compressed ahead of time.
+struct StaticAsset
+{
+    std::shared_ptr<const BlobData> _data; ///< Null when only the brotli variant exists.
+    std::shared_ptr<const BlobData> _gzip; ///< May be null, as are the other variants.
+    std::shared_ptr<const BlobData> _brotli;
+    std::shared_ptr<const BlobData> _zstd;
+    std::string _etag; ///< Strong, from the hash of the identity content, else of the brotli one.
+
+    /// Returns the ETag of the representation with the given Content-Encoding,
+    /// as each is a different entity: "<hash>-br" for "br", "<hash>" for none.
+    std::string getETag(std::string_view encoding) const;
+
+    /// Returns the total size of the content and its variants.
+    std::size_t getMemorySize() const;
+};
+
+/// Creates the asset for @data, compressing it with gzip and zstd where that pays off.
+/// @brotli is the content precompressed with brotli at build time, if any.
+StaticAsset makeStaticAsset(std::string_view data, std::string_view brotli = std::string_view());
+
+/// Creates the asset for content that only exists precompressed with @brotli.
+StaticAsset makeBrotliAsset(std::string_view brotli);
+
+/// Sends @asset as the response to @request, with the best encoding the client
+/// accepts, or just the range it asks for. Sends 304 when the client has it already,
+/// and 406 when it doesn't accept brotli for an asset that has nothing else.
+void sendAsset(const std::shared_ptr<StreamSocket>& socket, const StaticAsset& asset,
+               const Poco::Net::HTTPRequest& request, http::Response& response,
+               bool noCache = false);
 
 /// Verifies that the given WOPISrc is properly URI-encoded.
 /// Warns if it isn't and, in debug builds, closes the socket (if given) and returns false.
@@ -1106,6 +1106,9 @@ public:
     const StatusLine& statusLine() const { return _statusLine; }
     StatusCode statusCode() const { return _statusLine.statusCode(); }
 
+    /// Replace the status code, eg. when serving part of the content.
+    void setStatusCode(StatusCode statusCode) { _statusLine = StatusLine(statusCode); }
+
     const Header& header() const { return _header; }
 
     /// Add an HTTP header field.
@@ -1411,6 +1414,17 @@ public:
     bool isSecure() const { return _protocol == Protocol::HttpSsl; }
     bool isConnected() const { return _connected; };
 
+    /// Returns true when the last request completed and the connection
+    /// is kept alive, so another request can be sent over it.
+    /// The socket is still in the SocketPoll of the last request.
+    bool isReusable() const
+    {
+        return _connected && !_asyncShutdownOnFinish && _response &&
+               _response->state() == Response::State::Complete &&
+               _request.header().getConnectionToken() != Header::ConnectionToken::Close &&
+               _response->header().getConnectionToken() != Header::ConnectionToken::Close;
+    }
+
     /// Set the timeout, in microseconds.
     void setTimeout(const std::chrono::microseconds timeout) { _timeout = timeout; }
     /// Get the timeout, in microseconds.
@@ -1510,42 +1524,19 @@ public:
     /// Returns false when it fails to start the async request.
     bool asyncRequest(const Request& req, const std::weak_ptr<SocketPoll>& poll, bool asyncShutdownOnFinish = true)
     {
-        std::shared_ptr<SocketPoll> socketPoll(poll.lock());
-        if (!socketPoll)
-        {
-            LOG_ERR("Cannot start new asyncRequest without a valid SocketPoll: "
-                    << req.getVerb() << ' ' << host() << ':' << port() << ' ' << req.getUrl());
-
-            if (_onConnectFail)
-            {
-                // Call directly since we haven't started the async
-                // connect to pass the validation in callOnConnectFail().
-                _onConnectFail(shared_from_this());
-            }
-
-            return false;
-        }
-
-        LOG_TRC("New asyncRequest on [" << socketPoll->name() << "]: " << req.getVerb() << ' '
-                                        << host() << ':' << port() << ' ' << req.getUrl());
-
-        newRequest(req, asyncShutdownOnFinish);
-
-        if (!isConnected())
-        {
-            asyncConnect(poll);
-        }
-        else
-        {
-            // Technically, there is a race here. The socket can
-            // get disconnected and removed right after isConnected.
-            // In that case, we will timeout and no request will be sent.
-            socketPoll->wakeup();
-        }
+        return asyncRequestImpl(req, poll, asyncShutdownOnFinish, nullptr);
+    }
 
-        LOG_DBG("Starting asyncRequest on [" << socketPoll->name() << "]: " << req.getVerb() << ' '
-                                             << host() << ':' << port() << ' ' << req.getUrl());
-        return true;
+    /// Start an asynchronous request to download a file on the given SocketPoll.
+    /// The payload body is handed to @onBodyWrite as it arrives, see IoWriteFunc.
+    /// Note: when the server returns an error, the response body,
+    /// if any, will be stored in memory and can be read via getBody(),
+    /// as with syncDownload().
+    /// See asyncRequest() for @asyncShutdownOnFinish.
+    bool asyncDownload(const Request& req, IoWriteFunc onBodyWrite,
+                       const std::weak_ptr<SocketPoll>& poll, bool asyncShutdownOnFinish = true)
+    {
+        return asyncRequestImpl(req, poll, asyncShutdownOnFinish, std::move(onBodyWrite));
     }
 
     void asyncShutdown()
@@ -1630,6 +1621,52 @@ public:
 private:
     void logPrefix(std::ostream& os) const { os << '#' << _fd << ": "; }
 
+    /// Start an asynchronous request, see asyncRequest().
+    /// The response body goes to @onBodyWrite, when set.
+    bool asyncRequestImpl(const Request& req, const std::weak_ptr<SocketPoll>& poll,
+                          bool asyncShutdownOnFinish, IoWriteFunc onBodyWrite)
+    {
+        std::shared_ptr<SocketPoll> socketPoll(poll.lock());
+        if (!socketPoll)
+        {
+            LOG_ERR("Cannot start new asyncRequest without a valid SocketPoll: "
+                    << req.getVerb() << ' ' << host() << ':' << port() << ' ' << req.getUrl());
+
+            if (_onConnectFail)
+            {
+                // Call directly since we haven't started the async
+                // connect to pass the validation in callOnConnectFail().
+                _onConnectFail(shared_from_this());
+            }
+
+            return false;
+        }
+
+        LOG_TRC("New asyncRequest on [" << socketPoll->name() << "]: " << req.getVerb() << ' '
+                                        << host() << ':' << port() << ' ' << req.getUrl());
+
+        newRequest(req, asyncShutdownOnFinish);
+
+        if (onBodyWrite)
+            _response->saveBodyToHandler(std::move(onBodyWrite));
+
+        if (!isConnected())
+        {
+            asyncConnect(poll);
+        }
+        else
+        {
+            // Technically, there is a race here. The socket can
+            // get disconnected and removed right after isConnected.
+            // In that case, we will timeout and no request will be sent.
+            socketPoll->wakeup();
+        }
+
+        LOG_DBG("Starting asyncRequest on [" << socketPoll->name() << "]: " << req.getVerb() << ' '
+                                             << host() << ':' << port() << ' ' << req.getUrl());
+        return true;
+    }
+
     /// Make a synchronous request.
     bool syncRequestImpl(SocketPoll& poller)
     {
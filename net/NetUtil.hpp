@@ -30,6 +30,13 @@ struct sockaddr;
 namespace net
 {
 
+/// The readiness notification mechanism used by SocketPoll.
+enum class PollBackend
+{
+    Poll, ///< ppoll(2) over a pollfd array rebuilt on every iteration.
+    EPoll ///< epoll(7) with persistent, level-triggered registrations.
+};
+
 class DefaultValues
 {
 public:
@@ -39,6 +46,14 @@ public:
     /// Maximum number of concurrent external TCP connections. Zero disables instrument,
     /// limiting the maximum number of connections by the available sockets to the system.
     size_t maxExtConnections;
+
+    /// The readiness backend of SocketPolls created from now on.
+    /// Falls back to Poll where epoll(7) is unavailable.
+    PollBackend pollBackend;
+
+    /// Whether to accept the permessage-deflate WebSocket extension,
+    /// which compresses the larger text messages.
+    bool wsCompression;
 };
 extern DefaultValues Defaults;
 
@@ -0,0 +1,269 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "PerMessageDeflate.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include <common/Log.hpp>
+
+namespace
+{
+/// The empty stored block ending a sync flush, which the extension strips.
+constexpr unsigned char FlushTail[] = { 0x00, 0x00, 0xff, 0xff };
+
+std::string_view trim(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+/// Returns the next @delimiter separated token of @s, trimmed, and consumes it.
+std::string_view nextToken(std::string_view& s, char delimiter)
+{
+    const std::size_t pos = s.find(delimiter);
+    const std::string_view token = s.substr(0, pos);
+    s.remove_prefix(pos == std::string_view::npos ? s.size() : pos + 1);
+    return trim(token);
+}
+
+/// Parses a window-bits parameter value, which may be quoted. Returns 0 when invalid.
+int parseWindowBits(std::string_view value)
+{
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+        value = value.substr(1, value.size() - 2);
+
+    if (value.size() == 1 && value[0] >= '8' && value[0] <= '9')
+        return value[0] - '0';
+    if (value.size() == 2 && value[0] == '1' && value[1] >= '0' && value[1] <= '5')
+        return 10 + value[1] - '0';
+    return 0;
+}
+
+uint64_t elapsedUs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+} // namespace
+
+std::unique_ptr<PerMessageDeflate> PerMessageDeflate::negotiate(std::string_view offers,
+                                                                std::string& response)
+{
+    while (!offers.empty())
+    {
+        std::string_view params = nextToken(offers, ',');
+        if (nextToken(params, ';') != Name)
+            continue;
+
+        bool valid = true;
+        bool noContextTakeover = false;
+        bool clientNoContextTakeover = false;
+        bool clientMaxWindowBits = false;
+        int windowBits = 0;
+        while (valid && !params.empty())
+        {
+            std::string_view value = nextToken(params, ';');
+            const std::string_view param = nextToken(value, '=');
+            if (param == "server_no_context_takeover")
+            {
+                valid = !noContextTakeover && value.empty();
+                noContextTakeover = true;
+            }
+            else if (param == "client_no_context_takeover")
+            {
+                valid = !clientNoContextTakeover && value.empty();
+                clientNoContextTakeover = true;
+            }
+            else if (param == "server_max_window_bits")
+            {
+                // We can't honour 8 bits, as zlib always deflates with 9 at least.
+                valid = !windowBits && parseWindowBits(value) >= 9;
+                windowBits = parseWindowBits(value);
+            }
+            else if (param == "client_max_window_bits")
+            {
+                // Our inflater takes any window, so just validate the value.
+                valid = !clientMaxWindowBits && (value.empty() || parseWindowBits(value));
+                clientMaxWindowBits = true;
+            }
+            else
+            {
+                LOG_DBG("Unknown " << Name << " parameter [" << param << ']');
+                valid = false;
+            }
+        }
+
+        if (!valid)
+            continue;
+
+        response = Name;
+        if (noContextTakeover)
+            response += "; server_no_context_takeover";
+        if (windowBits)
+        {
+            windowBits = std::min(windowBits, WindowBits);
+            response += "; server_max_window_bits=" + std::to_string(windowBits);
+        }
+
+        return std::make_unique<PerMessageDeflate>(windowBits ? windowBits : WindowBits,
+                                                   noContextTakeover);
+    }
+
+    return nullptr;
+}
+
+PerMessageDeflate::PerMessageDeflate(int windowBits, bool noContextTakeover)
+    : _windowBits(windowBits)
+    , _noContextTakeover(noContextTakeover)
+    , _deflateReady(false)
+    , _inflateReady(false)
+    , _savedBytes(0)
+    , _timeUs(0)
+{
+    std::memset(&_deflate, 0, sizeof(_deflate));
+    std::memset(&_inflate, 0, sizeof(_inflate));
+}
+
+PerMessageDeflate::~PerMessageDeflate()
+{
+    if (_deflateReady)
+        deflateEnd(&_deflate);
+    if (_inflateReady)
+        inflateEnd(&_inflate);
+}
+
+bool PerMessageDeflate::compress(const char* data, std::size_t len, std::vector<char>& out)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    if (!_deflateReady)
+    {
+        // Raw deflate, with a memLevel to match our smaller window.
+        const int result = deflateInit2(&_deflate, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                                        -_windowBits, 7, Z_DEFAULT_STRATEGY);
+        if (result != Z_OK)
+        {
+            LOG_ERR("Failed to deflateInit2, result: " << result);
+            return false;
+        }
+
+        _deflateReady = true;
+    }
+
+    out.resize(len / 2 + 64);
+    std::size_t written = 0;
+    int result;
+    _deflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    _deflate.avail_in = len;
+    do
+    {
+        if (written == out.size())
+            out.resize(out.size() * 2);
+
+        _deflate.next_out = reinterpret_cast<Bytef*>(out.data() + written);
+        _deflate.avail_out = out.size() - written;
+        result = deflate(&_deflate, Z_SYNC_FLUSH);
+        written = out.size() - _deflate.avail_out;
+    } while (result == Z_OK && _deflate.avail_out == 0);
+
+    // A full buffer on the last round leaves nothing to flush: that's a Z_BUF_ERROR.
+    if ((result != Z_OK && result != Z_BUF_ERROR) || written < sizeof(FlushTail) ||
+        std::memcmp(out.data() + written - sizeof(FlushTail), FlushTail, sizeof(FlushTail)))
+    {
+        LOG_ERR("Failed to deflate WebSocket message of " << len << " bytes, result: " << result);
+        // The peer will never see this message, so it mustn't be in our window.
+        deflateReset(&_deflate);
+        return false;
+    }
+
+    out.resize(written - sizeof(FlushTail));
+    if (_noContextTakeover)
+        deflateReset(&_deflate);
+
+    if (out.size() < len)
+        _savedBytes += len - out.size();
+    _timeUs += elapsedUs(start);
+    return true;
+}
+
+bool PerMessageDeflate::decompress(const std::vector<char>& data, std::vector<char>& out)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    if (!_inflateReady)
+    {
+        // The client may use any window, up to the maximum.
+        const int result = inflateInit2(&_inflate, -MAX_WBITS);
+        if (result != Z_OK)
+        {
+            LOG_ERR("Failed to inflateInit2, result: " << result);
+            return false;
+        }
+
+        _inflateReady = true;
+    }
+
+    out.resize(std::max<std::size_t>(data.size() * 4, 1024));
+    std::size_t written = 0;
+    const auto inflateChunk = [&](const unsigned char* in, std::size_t size)
+    {
+        _inflate.next_in = const_cast<Bytef*>(in);
+        _inflate.avail_in = size;
+        for (;;)
+        {
+            if (written == out.size())
+            {
+                if (out.size() >= MaxInflatedSize)
+                    return Z_MEM_ERROR;
+                out.resize(std::min(out.size() * 2, MaxInflatedSize));
+            }
+
+            _inflate.next_out = reinterpret_cast<Bytef*>(out.data() + written);
+            _inflate.avail_out = out.size() - written;
+            const int result = inflate(&_inflate, Z_SYNC_FLUSH);
+            written = out.size() - _inflate.avail_out;
+            if (result != Z_OK || (_inflate.avail_in == 0 && _inflate.avail_out > 0))
+                return result;
+        }
+    };
+
+    int result = inflateChunk(reinterpret_cast<const unsigned char*>(data.data()), data.size());
+    if (result == Z_OK || result == Z_BUF_ERROR)
+        result = inflateChunk(FlushTail, sizeof(FlushTail));
+
+    if (result == Z_STREAM_END)
+    {
+        // The client ended the stream with a final block; start over for the next message.
+        inflateReset(&_inflate);
+    }
+    else if (result != Z_OK && result != Z_BUF_ERROR)
+    {
+        LOG_ERR("Failed to inflate WebSocket message of "
+                << data.size() << " bytes, result: " << result
+                << (result == Z_MEM_ERROR ? " (too large)" : ""));
+        return false;
+    }
+
+    out.resize(written);
+    _timeUs += elapsedUs(start);
+    return true;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,85 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <zlib.h>
+
+/// The server side of the permessage-deflate WebSocket extension (RFC 7692).
+/// Holds the deflate and inflate streams of a single connection, which keep
+/// their sliding window across messages (context takeover) unless the client
+/// asked otherwise, so repetitive protocol messages compress very well.
+class PerMessageDeflate
+{
+public:
+    /// The name of the extension in the Sec-WebSocket-Extensions header.
+    static constexpr std::string_view Name = "permessage-deflate";
+
+    /// Messages shorter than this aren't worth the CPU.
+    static constexpr std::size_t MinCompressSize = 256;
+
+    /// The window we compress with. Smaller than the deflate maximum of 15 bits,
+    /// to bound the memory per connection, and still ample for our messages.
+    static constexpr int WindowBits = 13;
+
+    /// The largest message we are willing to inflate, to guard against bombs.
+    static constexpr std::size_t MaxInflatedSize = 64 * 1024 * 1024;
+
+    /// Picks the first acceptable permessage-deflate offer of the
+    /// Sec-WebSocket-Extensions request header @offers.
+    /// Returns the codec and sets @response to the extension to echo back,
+    /// or returns null when there is nothing we can accept.
+    static std::unique_ptr<PerMessageDeflate> negotiate(std::string_view offers,
+                                                        std::string& response);
+
+    PerMessageDeflate(int windowBits, bool noContextTakeover);
+    ~PerMessageDeflate();
+
+    PerMessageDeflate(const PerMessageDeflate&) = delete;
+    PerMessageDeflate& operator=(const PerMessageDeflate&) = delete;
+
+    /// Compresses the payload of a message into @out, without the trailing
+    /// empty block as the extension mandates. The result must be sent, as it
+    /// is now part of the window that later messages refer back to.
+    /// Returns false on failure, in which case the message is to be sent as-is.
+    bool compress(const char* data, std::size_t len, std::vector<char>& out);
+
+    /// Inflates the payload of a compressed message into @out.
+    /// Returns false when it is corrupt or inflates beyond MaxInflatedSize.
+    bool decompress(const std::vector<char>& data, std::vector<char>& out);
+
+    /// Total bytes saved by compressing outgoing messages.
+    uint64_t getSavedBytes() const { return _savedBytes; }
+
+    /// Total time spent compressing and decompressing, in microseconds.
+    uint64_t getTimeUs() const { return _timeUs; }
+
+private:
+    const int _windowBits;
+    const bool _noContextTakeover;
+    /// The streams are allocated on first use, since many
+    /// connections only ever exchange short messages.
+    bool _deflateReady;
+    bool _inflateReady;
+    z_stream _deflate;
+    z_stream _inflate;
+    uint64_t _savedBytes;
+    uint64_t _timeUs;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -92,7 +92,9 @@ std::unique_ptr<Watchdog> SocketPoll::PollWatchdog;
 std::atomic<size_t> StreamSocket::ExternalConnectionCount = 0;
 
 net::DefaultValues net::Defaults = { .inactivityTimeout = std::chrono::seconds(3600),
-                                     .maxExtConnections = 200000 /* arbitrary value to be resolved */ };
+                                     .maxExtConnections = 200000 /* arbitrary value to be resolved */,
+                                     .pollBackend = net::PollBackend::Poll,
+                                     .wsCompression = true };
 
 constexpr std::string_view Socket::toString(Type t)
 {
@@ -311,6 +313,9 @@ namespace {
 
 SocketPoll::SocketPoll(std::string threadName)
     : _name(std::move(threadName))
+#if HAVE_EPOLL
+    , _epollFd(-1)
+#endif
     , _pollStartIndex(0)
     , _owner(std::this_thread::get_id())
     , _threadStarted(0)
@@ -332,6 +337,7 @@ SocketPoll::SocketPoll(std::string threadName)
 
     _wakeup[0] = -1;
     _wakeup[1] = -1;
+    _pollFds.resize(1); // The wakeup pipe.
 
     createWakeups();
 
@@ -396,6 +402,15 @@ void SocketPoll::removeFromWakeupArray()
 
     _wakeup[0] = -1;
     _wakeup[1] = -1;
+
+#if HAVE_EPOLL
+    if (_epollFd >= 0)
+    {
+        ::close(_epollFd);
+        _epollFd = -1;
+    }
+    _epollIndices.clear();
+#endif
 }
 
 bool SocketPoll::startThread()
@@ -527,28 +542,37 @@ int SocketPoll::poll(int64_t timeoutMaxMicroS, bool justPoll)
     disableWatchdog();
 
     int rc;
-    do
+#if HAVE_EPOLL
+    if (_epollFd >= 0)
     {
+        rc = epollWait(size, timeoutMaxMicroS);
+    }
+    else
+#endif
+    {
+        do
+        {
 #if !MOBILEAPP
 #  if HAVE_PPOLL
-        LOGA_TRC(Socket, "ppoll start, timeoutMicroS: " << timeoutMaxMicroS << " size " << size);
-        timeoutMaxMicroS = std::max(timeoutMaxMicroS, (int64_t)0);
-        struct timespec timeout;
-        timeout.tv_sec = timeoutMaxMicroS / (1000 * 1000);
-        timeout.tv_nsec = (timeoutMaxMicroS % (1000 * 1000)) * 1000;
-        rc = ::ppoll(_pollFds.data(), size + 1, &timeout, nullptr);
+            LOGA_TRC(Socket, "ppoll start, timeoutMicroS: " << timeoutMaxMicroS << " size " << size);
+            timeoutMaxMicroS = std::max(timeoutMaxMicroS, (int64_t)0);
+            struct timespec timeout;
+            timeout.tv_sec = timeoutMaxMicroS / (1000 * 1000);
+            timeout.tv_nsec = (timeoutMaxMicroS % (1000 * 1000)) * 1000;
+            rc = ::ppoll(_pollFds.data(), size + 1, &timeout, nullptr);
 #  else
-        int timeoutMaxMs = (timeoutMaxMicroS + 999) / 1000;
-        LOG_TRC("Legacy Poll start, timeoutMs: " << timeoutMaxMs);
-        rc = ::poll(_pollFds.data(), size + 1, std::max(timeoutMaxMs,0));
+            int timeoutMaxMs = (timeoutMaxMicroS + 999) / 1000;
+            LOG_TRC("Legacy Poll start, timeoutMs: " << timeoutMaxMs);
+            rc = ::poll(_pollFds.data(), size + 1, std::max(timeoutMaxMs,0));
 #  endif
 #else
-        LOG_TRC("SocketPoll Poll");
-        int timeoutMaxMs = (timeoutMaxMicroS + 999) / 1000;
-        rc = fakeSocketPoll(_pollFds.data(), size + 1, std::max(timeoutMaxMs,0));
+            LOG_TRC("SocketPoll Poll");
+            int timeoutMaxMs = (timeoutMaxMicroS + 999) / 1000;
+            rc = fakeSocketPoll(_pollFds.data(), size + 1, std::max(timeoutMaxMs,0));
 #endif
+        }
+        while (rc < 0 && errno == EINTR);
     }
-    while (rc < 0 && errno == EINTR);
     LOGA_TRC(Socket, "Poll completed with " << rc << " live polls max (" <<
              timeoutMaxMicroS << "us)" << ((rc==0) ? "(timedout)" : ""));
 
@@ -609,7 +633,7 @@ int SocketPoll::poll(int64_t timeoutMaxMicroS, bool justPoll)
                     SocketThreadOwnerChange::setThreadOwner(*i, std::this_thread::get_id());
 
                 // Copy the new sockets over and clear.
-                _pollSockets.insert(_pollSockets.end(), _newSockets.begin(), _newSockets.end());
+                insertPollSockets(_newSockets);
 
                 _newSockets.clear();
             }
@@ -721,6 +745,7 @@ int SocketPoll::poll(int64_t timeoutMaxMicroS, bool justPoll)
                     ++itemsErased;
                     LOGA_TRC(Socket, '#' << _pollFds[i].fd << ": Removing socket (at " << i
                              << " of " << _pollSockets.size() << ") from " << _name);
+                    removeEPollRegistration(_pollSockets[i]->getFD());
                     _pollSockets[i] = nullptr;
                 }
 
@@ -746,17 +771,158 @@ int SocketPoll::poll(int64_t timeoutMaxMicroS, bool justPoll)
             LOG_TRC("Scanning to removing " << itemsErased << " defunct sockets from "
                     << _pollSockets.size() << " sockets");
 
-            _pollSockets.erase(
-                std::remove_if(_pollSockets.begin(), _pollSockets.end(),
-                    [](const std::shared_ptr<Socket>& s)->bool
-                    { return !s; }),
-                _pollSockets.end());
+            compactPollSockets();
         }
     }
 
     return rc;
 }
 
+#if HAVE_EPOLL
+
+// We pass the poll(2) event bits straight through to epoll(7).
+static_assert(POLLIN == EPOLLIN && POLLOUT == EPOLLOUT && POLLPRI == EPOLLPRI &&
+                  POLLERR == EPOLLERR && POLLHUP == EPOLLHUP,
+              "poll and epoll event bits must match");
+
+void SocketPoll::modifyEPollRegistration(std::size_t index, int events)
+{
+    const int fd = _pollSockets[index]->getFD();
+    if (fd < 0)
+        return;
+
+    epoll_event ev{};
+    ev.events = static_cast<uint32_t>(events);
+    ev.data.fd = fd;
+    if (::epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &ev) < 0)
+    {
+        LOG_SYS('#' << fd << ": Failed to change the events to 0x" << std::hex << events
+                    << std::dec << " in epoll of " << _name);
+        return;
+    }
+
+    LOGA_TRC(Socket, '#' << fd << ": epoll events: 0x" << std::hex << events << std::dec);
+}
+
+int SocketPoll::epollWait(std::size_t size, int64_t timeoutMaxMicroS)
+{
+    const int timeoutMaxMs = std::max<int64_t>((timeoutMaxMicroS + 999) / 1000, 0);
+    _epollEvents.resize(size + 1); // + wakeup pipe
+
+    LOGA_TRC(Socket, "epoll_wait start, timeoutMs: " << timeoutMaxMs << " size " << size);
+    int rc;
+    do
+    {
+        rc = ::epoll_wait(_epollFd, _epollEvents.data(), _epollEvents.size(), timeoutMaxMs);
+    } while (rc < 0 && errno == EINTR);
+
+    for (int i = 0; i < rc; ++i)
+    {
+        const int fd = _epollEvents[i].data.fd;
+        const short revents = static_cast<short>(_epollEvents[i].events);
+        if (fd == _wakeup[0])
+        {
+            _pollFds[size].revents = revents;
+            continue;
+        }
+
+        // Registrations follow the sockets, so every fd has its index.
+        const int index =
+            static_cast<std::size_t>(fd) < _epollIndices.size() ? _epollIndices[fd] : -1;
+        if (index >= 0 && static_cast<std::size_t>(index) < size)
+            _pollFds[index].revents = revents;
+        else
+            LOG_WRN('#' << fd << ": Event 0x" << std::hex << revents << std::dec
+                        << " for no socket in epoll of " << _name);
+    }
+
+    return rc;
+}
+
+#endif // HAVE_EPOLL
+
+void SocketPoll::insertPollSockets(const std::vector<std::shared_ptr<Socket>>& sockets)
+{
+    const std::size_t first = _pollSockets.size();
+    _pollSockets.insert(_pollSockets.end(), sockets.begin(), sockets.end());
+
+    // The entries of the new sockets take the place of the wakeup pipe, which moves last.
+    _pollFds.resize(_pollSockets.size() + 1);
+    for (std::size_t i = first; i < _pollSockets.size(); ++i)
+    {
+        const int fd = _pollSockets[i]->getFD();
+        _pollFds[i].fd = fd;
+        _pollFds[i].events = 0; // Set by the next setupPollFds().
+        _pollFds[i].revents = 0;
+
+#if HAVE_EPOLL
+        if (_epollFd < 0 || fd < 0)
+            continue;
+
+        epoll_event ev{};
+        ev.events = 0;
+        ev.data.fd = fd;
+        if (::epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            LOG_SYS('#' << fd << ": Failed to add to epoll of " << _name);
+            continue;
+        }
+
+        if (static_cast<std::size_t>(fd) >= _epollIndices.size())
+            _epollIndices.resize(std::max<std::size_t>(fd + 1, _epollIndices.size() * 2), -1);
+        _epollIndices[fd] = i;
+#endif
+    }
+}
+
+void SocketPoll::compactPollSockets()
+{
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < _pollSockets.size(); ++i)
+    {
+        if (!_pollSockets[i])
+            continue;
+
+        if (count != i)
+        {
+            _pollSockets[count] = std::move(_pollSockets[i]);
+            _pollFds[count] = _pollFds[i];
+#if HAVE_EPOLL
+            const int fd = _pollSockets[count]->getFD();
+            if (fd >= 0 && static_cast<std::size_t>(fd) < _epollIndices.size() &&
+                _epollIndices[fd] >= 0)
+                _epollIndices[fd] = count;
+#endif
+        }
+
+        ++count;
+    }
+
+    _pollSockets.resize(count);
+    _pollFds.resize(count + 1); // The wakeup pipe is set by setupPollFds().
+}
+
+void SocketPoll::removeEPollRegistration([[maybe_unused]] int fd)
+{
+#if HAVE_EPOLL
+    if (_epollFd < 0)
+        return;
+
+    if (fd < 0)
+    {
+        // Closing it removed it only if it was the last reference to its file.
+        LOG_WRN("Removing a closed socket from epoll of " << _name);
+        return;
+    }
+
+    if (static_cast<std::size_t>(fd) < _epollIndices.size())
+        _epollIndices[fd] = -1;
+
+    if (::epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr) < 0 && errno != ENOENT)
+        LOG_SYS('#' << fd << ": Failed to remove from epoll of " << _name);
+#endif
+}
+
 void SocketPoll::transfer(const SocketTransfer& pendingTransfer)
 {
     std::shared_ptr<Socket> socket = pendingTransfer._socket.lock();
@@ -780,6 +946,7 @@ void SocketPoll::transfer(const SocketTransfer& pendingTransfer)
         disposition.setTransfer(*toPoll, pendingTransfer._cbAfterArrivalInNewPoll);
         // leave empty entry in _pollSockets to be added to toErase and
         // cleaned later.
+        removeEPollRegistration(socket->getFD());
         *it = nullptr;
         disposition.execute();
         if (pendingTransfer._cbAfterRemovalFromOldPoll)
@@ -802,6 +969,8 @@ void SocketPoll::closeAllSockets()
     // We just forked so we need to shift thread ids to this thread.
     checkAndReThread();
 
+    // This closes our epoll fd first: we share its set with our parent
+    // and must not remove the sockets from it, only close our copies.
     removeFromWakeupArray();
     for (std::shared_ptr<Socket> &it : _pollSockets)
     {
@@ -870,6 +1039,28 @@ void SocketPoll::createWakeups()
         throw std::runtime_error("Failed to allocate pipe for SocketPoll [" + _name + "] waking.");
     }
 
+#if HAVE_EPOLL
+    if (net::Defaults.pollBackend == net::PollBackend::EPoll)
+    {
+        assert(_epollFd == -1);
+        _epollIndices.clear();
+
+        // The wakeup pipe stays registered for the lifetime of the epoll fd.
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = _wakeup[0];
+        _epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+        if (_epollFd < 0 || ::epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeup[0], &ev) < 0)
+        {
+            LOG_SYS("Failed to create epoll for SocketPoll [" << _name
+                                                              << "], falling back to poll");
+            if (_epollFd >= 0)
+                ::close(_epollFd);
+            _epollFd = -1;
+        }
+    }
+#endif
+
     LOG_DBG("Created wakeup FDs for SocketPoll [" << _name << "], rfd: " << _wakeup[0]
                                                   << ", wfd: " << _wakeup[1]);
 
@@ -891,10 +1082,13 @@ void SocketPoll::removeSockets()
         LOG_DBG("Removing socket #" << socket->getFD() << " from " << _name);
         ASSERT_CORRECT_SOCKET_THREAD(socket);
         SocketThreadOwnerChange::resetThreadOwner(*socket);
+        removeEPollRegistration(socket->getFD());
 
         _pollSockets.pop_back();
     }
 
+    _pollFds.resize(1); // The wakeup pipe.
+
     while (!_newSockets.empty())
     {
         const std::shared_ptr<Socket>& socket = _newSockets.back();
@@ -1174,7 +1368,12 @@ void SocketPoll::dumpState(std::ostream& os) const
 
     os << "\n  SocketPoll [" << name() << "] with " << pollSockets.size() << " socket(s)" << " and "
        << _newCallbacks.size() << " callback(s) - wakeup rfd: " << _wakeup[0]
-       << " wfd: " << _wakeup[1] << '\n';
+       << " wfd: " << _wakeup[1];
+#if HAVE_EPOLL
+    if (_epollFd >= 0)
+        os << " epoll fd: " << _epollFd;
+#endif
+    os << '\n';
 
     if (!pollSockets.empty())
     {
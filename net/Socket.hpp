@@ -46,6 +46,13 @@
 #define HAVE_ABSTRACT_UNIX_SOCKETS
 #endif
 
+#if !MOBILEAPP && defined(__linux__)
+#define HAVE_EPOLL 1
+#include <sys/epoll.h>
+#define HAVE_SENDFILE 1
+#include <sys/sendfile.h>
+#endif
+
 // Enable to dump socket traffic as hex in logs.
 // #define LOG_SOCKET_DATA ENABLE_DEBUG
 
@@ -653,6 +660,22 @@ public:
     /// 0 for closed/invalid socket, and -1 for other errors.
     virtual int sendBinaryMessage(const char* data, size_t len, bool flush = false) const = 0;
 
+    /// Sends a binary message of the header followed by len bytes at offset of blob,
+    /// which implementations may reference rather than copy, so it must not be modified.
+    /// Returns the number of bytes written (including frame overhead) on success,
+    /// 0 for closed/invalid socket, and -1 for other errors.
+    virtual int sendSharedBinaryMessage(const std::string_view header,
+                                        const std::shared_ptr<const BlobData>& blob,
+                                        std::size_t offset, std::size_t len,
+                                        bool flush = false) const
+    {
+        std::vector<char> data;
+        data.reserve(header.size() + len);
+        data.insert(data.end(), header.begin(), header.end());
+        data.insert(data.end(), blob->begin() + offset, blob->begin() + offset + len);
+        return sendBinaryMessage(data.data(), data.size(), flush);
+    }
+
     /// Shutdown the socket and specify if the endpoint is going away or not (useful for WS).
     /// Optionally provide a message sent in the close frame (useful for WS).
     virtual void shutdown(bool goingAway = false,
@@ -660,6 +683,14 @@ public:
 
     virtual void getIOStats(uint64_t &sent, uint64_t &recv) = 0;
 
+    /// The bytes saved by compressing outgoing messages, if any,
+    /// and the time spent (de)compressing them in microseconds.
+    virtual void getCompressionStats(uint64_t& saved, uint64_t& timeUs)
+    {
+        saved = 0;
+        timeUs = 0;
+    }
+
     void dumpState(std::ostream& os) const { dumpState(os, "\n\t"); }
 
     /// Append pretty printed internal state to a line
@@ -809,13 +840,14 @@ private:
 /// Handles non-blocking socket event polling.
 /// Only polls on N-Sockets and invokes callback and
 /// doesn't manage buffers or client data.
-/// Note: uses poll(2) since it has very good performance
-/// compared to epoll up to a few hundred sockets and
-/// doesn't suffer select(2)'s poor API. Since this will
-/// be used per-document we don't expect to have several
-/// hundred users on same document to suffer poll(2)'s
-/// scalability limit. Meanwhile, epoll(2)'s high
-/// overhead to adding/removing sockets is not helpful.
+/// Note: uses poll(2) by default since it has very good
+/// performance compared to epoll up to a few hundred sockets
+/// and doesn't suffer select(2)'s poor API. For polls with
+/// many long-lived sockets (e.g. the accept poll, or busy
+/// documents) net::Defaults.pollBackend can select epoll(7),
+/// which keeps level-triggered registrations from the insertion
+/// of each socket to its removal, and only issues epoll_ctl(2)
+/// in between for sockets whose interest changed.
 class SocketPoll
 {
 public:
@@ -1086,13 +1118,33 @@ private:
     /// Actual poll implementation
     int poll(int64_t timeoutMaxMicroS, bool justPoll = false);
 
-    /// Initialize the poll fds array with the right events
+#if HAVE_EPOLL
+    /// Wait on the epoll fd and scatter the events into the _pollFds revents.
+    /// Returns the number of entries with events, like poll(2).
+    int epollWait(std::size_t size, int64_t timeoutMaxMicroS);
+
+    /// Change the events registered for the socket at @index.
+    void modifyEPollRegistration(std::size_t index, int events);
+#endif
+
+    /// Append @sockets to those we poll, registering them with epoll.
+    void insertPollSockets(const std::vector<std::shared_ptr<Socket>>& sockets);
+
+    /// Drop the sockets removed from _pollSockets, and their _pollFds.
+    void compactPollSockets();
+
+    /// Remove the registration of @fd, if any, from our epoll set.
+    /// Must be called before the fd is closed: closing it only removes it from
+    /// the set once no other fd, e.g. in a forked child, refers to the same file.
+    void removeEPollRegistration(int fd);
+
+    /// Update the events of the poll fds array, which follows _pollSockets,
+    /// and of the epoll registrations whose interest changed.
     void setupPollFds(std::chrono::steady_clock::time_point now,
                       int64_t &timeoutMaxMicroS)
     {
         const size_t size = _pollSockets.size();
-
-        _pollFds.resize(size + 1); // + wakeup pipe
+        assert(_pollFds.size() == size + 1 && "The poll fds must follow the sockets");
 
         for (size_t i = 0; i < size; ++i)
         {
@@ -1102,6 +1154,11 @@ private:
             if (_pollSockets[i]->ignoringInput())
                 events &= ~POLLIN; // mask out input.
 
+#if HAVE_EPOLL
+            if (_epollFd >= 0 && events != _pollFds[i].events)
+                modifyEPollRegistration(i, events);
+#endif
+
             _pollFds[i].fd = _pollSockets[i]->getFD();
             _pollFds[i].events = events;
             _pollFds[i].revents = 0;
@@ -1109,7 +1166,7 @@ private:
                      << events << std::dec);
         }
 
-        // Add the read-end of the wake pipe.
+        // The read-end of the wake pipe, always last.
         _pollFds[size].fd = _wakeup[0];
         _pollFds[size].events = POLLIN;
         _pollFds[size].revents = 0;
@@ -1167,9 +1224,19 @@ private:
     std::vector<CallbackFn> _newCallbacks;
     std::vector<SocketTransfer> _pendingTransfers;
 
-    /// The fds to poll.
+    /// The fds to poll, one per socket in _pollSockets, at the same
+    /// index, and the wakeup pipe last.
     std::vector<pollfd> _pollFds;
 
+#if HAVE_EPOLL
+    /// The epoll fd when using the EPoll backend, otherwise -1.
+    int _epollFd;
+    /// The index in _pollSockets of each registered fd, or -1.
+    std::vector<int> _epollIndices;
+    /// Output buffer of epoll_wait(2).
+    std::vector<epoll_event> _epollEvents;
+#endif
+
     /// main-loop wakeup pipe
     int _wakeup[2];
     /// We start handling the poll results of the above sockets at a different index each time, to
@@ -1217,6 +1284,9 @@ class StreamSocket : public Socket,
 public:
     STATE_ENUM(ReadType, NormalRead, UseRecvmsgExpectFD);
 
+    /// The maximum number of blocks to gather in a single write.
+    static constexpr int MaxWriteVBlocks = 64;
+
     /// Create a StreamSocket from native FD.
     StreamSocket(std::string host, const int fd, Type type, bool isClient,
                  HostType hostType, ReadType readType = ReadType::NormalRead,
@@ -1370,6 +1440,32 @@ public:
     /// Will always shutdown the socket.
     bool sendAndShutdown(http::Response& response);
 
+    /// True if file ranges queued with sendFile() are written by the
+    /// kernel, rather than read into our memory first.
+    virtual bool canSendFile() const
+    {
+#if HAVE_SENDFILE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /// Send @len bytes at @offset of @file, without reading them into the
+    /// output buffer. Only valid when canSendFile() is true.
+    void sendFile(const std::shared_ptr<const Buffer::File>& file, off_t offset,
+                  std::size_t len, const bool doFlush = true)
+    {
+        ASSERT_CORRECT_SOCKET_THREAD(this);
+        assert(canSendFile() && "Socket cannot send files directly");
+        if (len > 0)
+        {
+            _outBuffer.appendFile(file, offset, len);
+            if (doFlush)
+                writeOutgoingData();
+        }
+    }
+
     /// Safely attempt to write any outgoing data.
     /// Returns true iff no data is left in the buffer.
     inline bool attemptWrites()
@@ -1780,7 +1876,7 @@ public:
                 if (writeOutgoingData() < 0)
                 {
                     const int last_errno = errno;
-                    if (last_errno == EPIPE || last_errno == ECONNRESET)
+                    if (last_errno == EPIPE || last_errno == ECONNRESET || last_errno == EIO)
                     {
                         LOG_DBG("Disconnected while writing (" << Util::symbolicErrno(last_errno)
                                                                << "): " << std::strerror(last_errno)
@@ -1815,12 +1911,42 @@ public:
         {
             do
             {
-                // Writing much more than we can absorb in the kernel causes wastage.
-                const int size = std::min((int)_outBuffer.getBlockSize(), getSendBufferSize());
-                if (size == 0)
-                    break;
+                if (_outBuffer.isFileBlock())
+                {
+                    off_t offset;
+                    std::size_t size;
+                    const Buffer::File& file = _outBuffer.getFileBlock(offset, size);
+                    len = writeFileData(file.getFD(), offset,
+                                        std::min<std::size_t>(size, getSendBufferSize()));
+                    if (len == 0)
+                    {
+                        // The file was truncated since it was queued, it will never drain.
+                        LOG_ERR("File to send ends " << size << " bytes short at offset "
+                                                     << offset << ", closing");
+                        errno = EIO;
+                        len = -1;
+                    }
+                }
+                else if (_outBuffer.isSegmented())
+                {
+                    // Gather the referenced blobs, rather than copying them.
+                    struct iovec iov[MaxWriteVBlocks];
+                    const int count = _outBuffer.getIOVec(iov, MaxWriteVBlocks, getSendBufferSize());
+                    if (count == 0)
+                        break;
+
+                    len = writeDataV(iov, count);
+                }
+                else
+                {
+                    // Writing much more than we can absorb in the kernel causes wastage.
+                    const int size = std::min((int)_outBuffer.getBlockSize(), getSendBufferSize());
+                    if (size == 0)
+                        break;
+
+                    len = writeData(_outBuffer.getBlock(), size);
+                }
 
-                len = writeData(_outBuffer.getBlock(), size);
                 if (len < 0)
                     last_errno = errno; // Save only on error.
 
@@ -1836,8 +1962,12 @@ public:
                              "Wrote "
                                  << len << " bytes of " << _outBuffer.size() << " buffered data"
 #ifdef LOG_SOCKET_DATA
-                                 << (len ? HexUtil::dumpHex(std::string(_outBuffer.getBlock(), len),
-                                                            ":\n")
+                                 << (len && !_outBuffer.isFileBlock()
+                                         ? HexUtil::dumpHex(
+                                                std::string(_outBuffer.getBlock(),
+                                                            std::min<std::size_t>(
+                                                                len, _outBuffer.getBlockSize())),
+                                                ":\n")
                                          : std::string())
 #endif
                     );
@@ -1966,6 +2096,47 @@ protected:
 #endif
     }
 
+    /// Override to handle writing a gathered set of blocks differently.
+    /// May write less than all the blocks, like writev(2).
+    virtual int writeDataV(const struct iovec* iov, const int count)
+    {
+        ASSERT_CORRECT_SOCKET_THREAD(this);
+        assert((getFD() >= 0 || isShutdown()) && "Socket is closed but not marked correctly");
+        assert(count > 0);
+
+#if !MOBILEAPP
+#if ENABLE_DEBUG
+        if (simulateSocketError(false))
+            return -1;
+#endif
+        return ::writev(getFD(), iov, count);
+#else
+        return fakeSocketWrite(getFD(), static_cast<const char*>(iov[0].iov_base),
+                               iov[0].iov_len);
+#endif
+    }
+
+    /// Override to handle writing a range of a file differently.
+    virtual int writeFileData(const int fd, off_t offset, const int len)
+    {
+        ASSERT_CORRECT_SOCKET_THREAD(this);
+        assert((getFD() >= 0 || isShutdown()) && "Socket is closed but not marked correctly");
+        assert(len > 0);
+
+#if HAVE_SENDFILE
+#if ENABLE_DEBUG
+        if (simulateSocketError(false))
+            return -1;
+#endif
+        return ::sendfile(getFD(), fd, &offset, len);
+#else
+        (void)fd;
+        (void)offset;
+        errno = ENOTSUP;
+        return -1;
+#endif
+    }
+
     void setShutdownSignalled()
     {
         _shutdownSignalled = true;
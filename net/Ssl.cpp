@@ -220,6 +220,9 @@ SslContext::SslContext(const std::string& certFilePath, const std::string& keyFi
 
 SslContext::~SslContext()
 {
+    for (const auto& pair : _clientSessions)
+        SSL_SESSION_free(pair.second);
+
     SSL_CTX_free(_ctx);
     EVP_cleanup();
     ERR_free_strings();
@@ -229,6 +232,69 @@ SslContext::~SslContext()
     CONF_modules_free();
 }
 
+void SslContext::enableClientSessionCache()
+{
+    // We do the caching ourselves, by server name, as OpenSSL doesn't look up
+    // client sessions. Server contexts keep the cache off, see the ctor.
+    SSL_CTX_set_app_data(_ctx, this);
+    SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(_ctx, &SslContext::newClientSession);
+}
+
+int SslContext::newClientSession(SSL* ssl, SSL_SESSION* session)
+{
+    SslContext* context = static_cast<SslContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    const char* hostname = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (!context || !hostname)
+        return 0; // Not ours to keep.
+
+    // Enough for all the storage servers we expect to talk to.
+    constexpr std::size_t MaxClientSessions = 1024;
+
+    std::lock_guard<std::mutex> lock(context->_clientSessionsMutex);
+    auto it = context->_clientSessions.find(hostname);
+    if (it != context->_clientSessions.end())
+    {
+        // With TLS 1.3 we get a ticket or two per connection; keep the latest.
+        SSL_SESSION_free(it->second);
+        it->second = session;
+    }
+    else
+    {
+        if (context->_clientSessions.size() >= MaxClientSessions)
+        {
+            SSL_SESSION_free(context->_clientSessions.begin()->second);
+            context->_clientSessions.erase(context->_clientSessions.begin());
+        }
+
+        context->_clientSessions.emplace(hostname, session);
+    }
+
+    LOG_TRC("Cached TLS session for [" << hostname << ']');
+    return 1; // We took the reference.
+}
+
+void SslContext::resumeClientSession(SSL* ssl, const std::string& hostname)
+{
+    std::lock_guard<std::mutex> lock(_clientSessionsMutex);
+    const auto it = _clientSessions.find(hostname);
+    if (it == _clientSessions.end())
+        return;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    if (!SSL_SESSION_is_resumable(it->second))
+    {
+        SSL_SESSION_free(it->second);
+        _clientSessions.erase(it);
+        return;
+    }
+#endif
+
+    // The server decides whether to resume it, or do a full handshake.
+    if (SSL_set_session(ssl, it->second) == 1)
+        LOG_TRC("Resuming TLS session with [" << hostname << ']');
+}
+
 unsigned long SslContext::id()
 {
 #ifdef __linux__
@@ -15,7 +15,9 @@
 
 #include <cassert>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 #include <openssl/ssl.h>
 #include <openssl/rand.h>
@@ -49,7 +51,18 @@ public:
 
     ssl::CertificateVerification verification() const { return _verification; }
 
+    /// Cache the sessions of client connections, per server name,
+    /// so new connections to the same server resume them, which
+    /// saves the certificate exchange and a round-trip, or two.
+    void enableClientSessionCache();
+
+    /// Set the session last cached for @hostname on @ssl, if any.
+    void resumeClientSession(SSL* ssl, const std::string& hostname);
+
 private:
+    /// Called by OpenSSL with every new session of a client connection.
+    static int newClientSession(SSL* ssl, SSL_SESSION* session);
+
     void initDH();
     void initECDH();
     void shutdown();
@@ -66,6 +79,10 @@ private:
 private:
     SSL_CTX* _ctx;
     const ssl::CertificateVerification _verification;
+
+    /// The client sessions to resume, by server name.
+    std::unordered_map<std::string, SSL_SESSION*> _clientSessions;
+    std::mutex _clientSessionsMutex;
 };
 
 namespace ssl
@@ -107,6 +124,7 @@ public:
                "Cannot initialize the client context more than once");
         ClientInstance = std::make_unique<SslContext>(certFilePath, keyFilePath, caFilePath,
                                                       cipherList, verification);
+        ClientInstance->enableClientSessionCache();
     }
 
     static ssl::CertificateVerification getClientVerification()
@@ -127,6 +145,13 @@ public:
         return ClientInstance->newSsl();
     }
 
+    /// Resume the last session with @hostname on the client @ssl, if we have one.
+    static void resumeClientSession(SSL* ssl, const std::string& hostname)
+    {
+        assert(isClientContextInitialized() && "Client SslContext is not initialized");
+        ClientInstance->resumeClientSession(ssl, hostname);
+    }
+
 private:
     static std::unique_ptr<SslContext> ServerInstance;
     static std::unique_ptr<SslContext> ClientInstance;
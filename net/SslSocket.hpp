@@ -67,6 +67,9 @@ public:
                 LOG_WRN("Failed to set hostname for Server Name Indication [" << hostname() << ']');
             else
                 LOG_TRC("Set [" << hostname() << "] as TLS hostname.");
+
+            if (isClient)
+                ssl::Manager::resumeClientSession(_ssl, hostname());
         }
 
         SSL_set_bio(_ssl, _bio, _bio);
@@ -202,6 +205,16 @@ public:
         return handleSslState(SSL_write(_ssl, buf, len), "write");
     }
 
+    /// SSL records are written one block at a time, still without copying.
+    virtual int writeDataV(const struct iovec* iov, const int count) override
+    {
+        assert(count > 0);
+        return writeData(static_cast<const char*>(iov[0].iov_base), iov[0].iov_len);
+    }
+
+    /// The data must be encrypted, so it has to pass through our memory.
+    bool canSendFile() const override { return false; }
+
     int getPollEvents(std::chrono::steady_clock::time_point now,
                       int64_t & timeoutMaxMicroS) override
     {
@@ -21,6 +21,7 @@
 #include <net/HttpRequest.hpp>
 #endif
 #include <net/NetUtil.hpp>
+#include <net/PerMessageDeflate.hpp>
 #include <net/Socket.hpp>
 
 #include <Poco/Net/HTTPResponse.h>
@@ -45,7 +46,10 @@ private:
     int _pingTimeUs;
     bool _isMasking;
     bool _inFragmentBlock;
+    bool _inCompressed; ///< Whether the message being received is compressed.
     unsigned char _lastFlags; ///< The flags in the last frame.
+    /// The permessage-deflate codec, when negotiated by the client.
+    std::unique_ptr<PerMessageDeflate> _deflate;
 #endif
     std::atomic<bool> _shuttingDown;
     const bool _isClient;
@@ -60,6 +64,7 @@ protected:
     struct WSFrameMask
     {
         static constexpr unsigned char Fin = 0x80;
+        static constexpr unsigned char Rsv1 = 0x40;
         static constexpr unsigned char Mask = 0x80;
     };
 
@@ -82,6 +87,7 @@ public:
         , _pingTimeUs(0)
         , _isMasking(isClient && isMasking)
         , _inFragmentBlock(false)
+        , _inCompressed(false)
         , _lastFlags(0)
         ,
 #endif
@@ -252,6 +258,19 @@ protected:
         }
     }
 
+    void getCompressionStats(uint64_t& saved, uint64_t& timeUs) override
+    {
+#if !MOBILEAPP
+        if (_deflate)
+        {
+            saved = _deflate->getSavedBytes();
+            timeUs = _deflate->getTimeUs();
+            return;
+        }
+#endif
+        ProtocolHandlerInterface::getCompressionStats(saved, timeUs);
+    }
+
 public:
     void shutdown(const StatusCodes statusCode = StatusCodes::NORMAL_CLOSE,
                   const std::string& statusMessage = std::string(),
@@ -309,6 +328,7 @@ private:
         _wsPayload.clear();
 #if !MOBILEAPP
         _inFragmentBlock = false;
+        _inCompressed = false;
 #endif
         _shuttingDown = false;
     }
@@ -495,6 +515,19 @@ private:
             return true;
         }
 
+        // Only the first frame of a compressed message has RSV1 set.
+        const bool rsv1 = _lastFlags & WSFrameMask::Rsv1;
+        if (rsv1 && (!_deflate || _inFragmentBlock))
+        {
+            LOG_ERR("Unexpected RSV1 bit in WebSocket frame, compression "
+                    << (_deflate ? "negotiated" : "not negotiated"));
+            shutdown(StatusCodes::PROTOCOL_ERROR);
+            return true;
+        }
+
+        if (!_inFragmentBlock)
+            _inCompressed = rsv1;
+
         //Process data frame
         readPayload(data, payloadLen, mask, _wsPayload);
 #else
@@ -520,6 +553,19 @@ private:
         {
             // If is final fragment then process the accumulated message.
 
+            if (_inCompressed)
+            {
+                std::vector<char> inflated;
+                if (!_deflate->decompress(_wsPayload, inflated))
+                {
+                    shutdown(StatusCodes::MALFORMED_PAYLOAD);
+                    return true;
+                }
+
+                _wsPayload.swap(inflated);
+                _inCompressed = false;
+            }
+
             try
             {
                 handleMessage(_wsPayload);
@@ -727,6 +773,38 @@ public:
         return sendMessage(data, len, WSOpCode::Binary, flush);
     }
 
+    /// Implementation of the ProtocolHandlerInterface.
+    int sendSharedBinaryMessage(const std::string_view header,
+                                const std::shared_ptr<const BlobData>& blob, std::size_t offset,
+                                std::size_t len, bool flush = false) const override
+    {
+        ASSERT_CORRECT_THREAD();
+#if !MOBILEAPP
+        if (!_isMasking)
+        {
+            if (UnitBase::isUnitTesting() && !Util::isFuzzing())
+            {
+                // The filters expect the whole message.
+                std::vector<char> data(header.begin(), header.end());
+                data.insert(data.end(), blob->begin() + offset, blob->begin() + offset + len);
+
+                int unitReturn = -1;
+                if (_unit->filterSendWebSocketMessage(data.data(), data.size(), WSOpCode::Binary,
+                                                      flush, unitReturn))
+                    return unitReturn;
+            }
+
+            std::shared_ptr<StreamSocket> socket = _socket.lock();
+            return sendSharedFrame(socket, header, blob, offset, len,
+                                   WSFrameMask::Fin | static_cast<unsigned char>(WSOpCode::Binary),
+                                   flush);
+        }
+#endif
+
+        // Masking, or no framing, needs a copy anyway.
+        return ProtocolHandlerInterface::sendSharedBinaryMessage(header, blob, offset, len, flush);
+    }
+
     /// Sends a WebSocket message of WPOpCode type.
     /// Returns the number of bytes written (including frame overhead) on success,
     /// 0 for closed socket, and -1 for other errors.
@@ -742,6 +820,21 @@ public:
         //TODO: Support fragmented messages.
 
         std::shared_ptr<StreamSocket> socket = _socket.lock();
+#if !MOBILEAPP
+        // Tiles and other binary payloads are compressed already.
+        if (_deflate && code == WSOpCode::Text && len >= PerMessageDeflate::MinCompressSize)
+        {
+#if ENABLE_DEBUG
+            assertValidUtf8(data, len);
+#endif
+            std::vector<char> compressed;
+            if (_deflate->compress(data, len, compressed))
+                return sendFrame(socket, compressed.data(), compressed.size(),
+                                 WSFrameMask::Fin | WSFrameMask::Rsv1 |
+                                     static_cast<unsigned char>(code),
+                                 flush);
+        }
+#endif
         return sendFrame(socket, data, len, WSFrameMask::Fin | static_cast<unsigned char>(code), flush);
     }
 
@@ -765,9 +858,9 @@ public:
 protected:
 
 #if !MOBILEAPP
-    /// Builds a websocket frame based on data and flags received as parameters.
-    /// The frame is output in 'out' parameter
-    void buildFrame(const char* data, const uint64_t len, unsigned char flags, Buffer &out) const
+    /// Builds the header of a websocket frame of len bytes with the given flags.
+    /// The header is output in 'out' parameter
+    void buildFrameHeader(const uint64_t len, unsigned char flags, Buffer &out) const
     {
         int slen = 0;
         char scratch[16];
@@ -801,6 +894,13 @@ protected:
 
         assert(slen <= static_cast<int>(sizeof(scratch)));
         out.append(scratch, slen);
+    }
+
+    /// Builds a websocket frame based on data and flags received as parameters.
+    /// The frame is output in 'out' parameter
+    void buildFrame(const char* data, const uint64_t len, unsigned char flags, Buffer &out) const
+    {
+        buildFrameHeader(len, flags, out);
 
         if (_isMasking)
         { // flip some top bits - perhaps it helps.
@@ -833,6 +933,42 @@ protected:
     }
 #endif
 
+#if ENABLE_DEBUG
+    /// Asserts that the payload of a Text frame is valid UTF-8.
+    static void assertValidUtf8(const char* data, const uint64_t len)
+    {
+        const size_t offset = Util::isValidUtf8((unsigned char*)data, len);
+        if (offset < len)
+        {
+            std::string hex, raw;
+            if (len < 256)
+            {
+                raw = std::string(data, len);
+                hex = "whole string:" + HexUtil::dumpHex(raw);
+            }
+            else
+            {
+                // 64 bytes before & after ...
+                size_t cropstart, croplen;
+                if (offset < 64)
+                    cropstart = 0;
+                else
+                    cropstart = offset - 64;
+                croplen = std::min<size_t>(len - cropstart, 128);
+                assert (cropstart + croplen <= len);
+                raw = std::string(data + cropstart, croplen);
+                hex = "msg: " + COOLProtocol::getAbbreviatedMessage(data, len) +
+                      " string region error at byte " + std::to_string(offset - cropstart) +
+                      ": " + HexUtil::dumpHex(raw);
+            };
+            std::cerr << "attempting to send invalid UTF-8 message '" << raw << "' "
+                      << " error at offset " << std::hex << "0x" << offset << std::dec
+                      << " bytes, " << hex << '\n';
+            assert("invalid utf-8 - check Message::detectType()" && false);
+        }
+    }
+#endif
+
     /// Sends a WebSocket frame given the data, length, and flags.
     /// Returns the number of bytes written (including frame overhead) on success,
     /// 0 for closed/invalid socket, and -1 for other errors.
@@ -859,38 +995,9 @@ protected:
                  << " bytes buffered");
 
 #if ENABLE_DEBUG
-        if ((flags & 0xf) == (int)WSOpCode::Text) // utf8 validate
-        {
-            size_t offset = Util::isValidUtf8((unsigned char*)data, len);
-            if (offset < len)
-            {
-                std::string hex, raw;
-                if (len < 256)
-                {
-                    raw = std::string(data, len);
-                    hex = "whole string:" + HexUtil::dumpHex(raw);
-                }
-                else
-                {
-                    // 64 bytes before & after ...
-                    size_t cropstart, croplen;
-                    if (offset < 64)
-                        cropstart = 0;
-                    else
-                        cropstart = offset - 64;
-                    croplen = std::min<size_t>(len - cropstart, 128);
-                    assert (cropstart + croplen <= len);
-                    raw = std::string(data + cropstart, croplen);
-                    hex = "msg: " + COOLProtocol::getAbbreviatedMessage(data, len) +
-                          " string region error at byte " + std::to_string(offset - cropstart) +
-                          ": " + HexUtil::dumpHex(raw);
-                };
-                std::cerr << "attempting to send invalid UTF-8 message '" << raw << "' "
-                          << " error at offset " << std::hex << "0x" << offset << std::dec
-                          << " bytes, " << hex << '\n';
-                assert("invalid utf-8 - check Message::detectType()" && false);
-            }
-        }
+        // Compressed messages are validated before compression.
+        if ((flags & 0xf) == (int)WSOpCode::Text && !(flags & WSFrameMask::Rsv1))
+            assertValidUtf8(data, len);
 #endif
 
         // This would generate huge amounts of "instant" Trace Events. Is that what we want? If so,
@@ -916,6 +1023,55 @@ protected:
 
         assert(size >= len && "Expected to have data in outBuffer to send");
 
+        return flushFrame(socket, size, flush);
+    }
+
+#if !MOBILEAPP
+    /// Sends an unmasked WebSocket frame of the header followed by len bytes at offset of blob.
+    /// The blob is referenced by the output buffer, rather than copied, until written out.
+    /// Returns the number of bytes written (including frame overhead) on success,
+    /// 0 for closed/invalid socket, and -1 for other errors.
+    int sendSharedFrame(const std::shared_ptr<StreamSocket>& socket, const std::string_view header,
+                        const std::shared_ptr<const BlobData>& blob, std::size_t offset,
+                        std::size_t len, unsigned char flags, bool flush) const
+    {
+        assert(!_isMasking && "Masked frames must be copied");
+        if (!socket || header.empty())
+        {
+            LOG_DBG("Socket or data missing. Cannot send WS frame");
+            return -1;
+        }
+
+        if (!socket->isOpen())
+        {
+            LOG_DBG("Socket is not open. Cannot send WS frame");
+            return 0;
+        }
+
+        ASSERT_CORRECT_SOCKET_THREAD(socket);
+        Buffer& out = socket->getOutBuffer();
+
+        LOGA_TRC(WebSocket, "WebSocketHandler: Writing " << header.size() << " + " << len
+                 << " shared bytes to #" << socket->getFD() << " in addition to "
+                 << out.size() << " bytes buffered");
+
+        const size_t oldSize = out.size();
+
+        buildFrameHeader(header.size() + len, flags, out);
+        out.append(header.data(), header.size());
+        if (len > 0)
+            out.appendShared(blob, offset, len);
+
+        return flushFrame(socket, out.size() - oldSize, flush);
+    }
+#endif
+
+    /// Writes out the frame of the given size just buffered, if asked to or shutting down.
+    /// Returns the size.
+    int flushFrame(const std::shared_ptr<StreamSocket>& socket, const size_t size, bool flush) const
+    {
+        Buffer& out = socket->getOutBuffer();
+
         if (flush || _shuttingDown)
         {
             socket->writeOutgoingData();
@@ -1048,6 +1204,17 @@ protected:
         httpResponse.set("Upgrade", "websocket");
         httpResponse.setConnectionToken(http::Header::ConnectionToken::Upgrade);
         httpResponse.set("Sec-WebSocket-Accept", computeAccept(wsKey));
+        if (net::Defaults.wsCompression)
+        {
+            std::string extension;
+            _deflate = PerMessageDeflate::negotiate(req.get("Sec-WebSocket-Extensions", ""),
+                                                    extension);
+            if (_deflate)
+            {
+                LOG_DBG("WebSocket compression negotiated: " << extension);
+                httpResponse.set("Sec-WebSocket-Extensions", extension);
+            }
+        }
         LOGA_TRC(WebSocket, "Sending WS Upgrade response: " << httpResponse.header().toString());
         socket->send(httpResponse);
 #endif
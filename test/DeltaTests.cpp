@@ -19,6 +19,8 @@
 #include <common/HexUtil.hpp>
 #include <common/Util.hpp>
 #include <Png.hpp>
+#include <RenderTiles.hpp>
+#include <TileDesc.hpp>
 
 #include <cppunit/extensions/HelperMacros.h>
 
@@ -36,6 +38,8 @@ class DeltaTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testDeltaSequence);
     CPPUNIT_TEST(testRandomDeltas);
     CPPUNIT_TEST(testDeltaCopyOutOfBounds);
+    CPPUNIT_TEST(testCacheBudget);
+    CPPUNIT_TEST(testStreamedRendering);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -46,6 +50,8 @@ class DeltaTests : public CPPUNIT_NS::TestFixture
     void testDeltaSequence();
     void testRandomDeltas();
     void testDeltaCopyOutOfBounds();
+    void testCacheBudget();
+    void testStreamedRendering();
 
     std::vector<char> applyDelta(const std::vector<char>& pixmap, uint32_t width, uint32_t height,
                                  const std::vector<char>& delta, const std::string_view testname);
@@ -499,6 +505,160 @@ void DeltaTests::testDeltaCopyOutOfBounds()
     assertEqual(reText2, text2, width, height, testname);
 }
 
+void DeltaTests::testCacheBudget()
+{
+    constexpr int width = 256;
+    constexpr int height = 256;
+    std::vector<char> pixmap(width * height * 4);
+    for (size_t i = 0; i < pixmap.size(); ++i)
+        pixmap[i] = static_cast<char>(i * 7);
+
+    const auto stash = [&](DeltaGenerator& gen, int left, TileWireId wid)
+    {
+        std::vector<char> delta;
+        std::shared_ptr<DeltaGenerator::DeltaData> rleData;
+        gen.createDelta(reinterpret_cast<unsigned char*>(pixmap.data()), 0, 0, width, height,
+                        width, height, TileLocation(left, 0, 3840, 0, CanonicalViewId(1), 0),
+                        delta, wid, false, LOK_TILEMODE_RGBA, rleData);
+    };
+    const auto cached = [](DeltaGenerator& gen, int left)
+    {
+        return gen._deltaEntries.count(TileLocation(left, 0, 3840, 0, CanonicalViewId(1), 0)) > 0;
+    };
+
+    // Find the size of a tile.
+    DeltaGenerator sizer;
+    stash(sizer, 0, 1);
+    const size_t tileBytes = sizer.getUsedBytes();
+    LOK_ASSERT(tileBytes > size_t(width * height));
+
+    // Room for two and a half tiles.
+    DeltaGenerator gen(tileBytes * 5 / 2);
+    stash(gen, 0, 1);
+    stash(gen, 3840, 2);
+    LOK_ASSERT_EQUAL(2 * tileBytes, gen.getUsedBytes());
+
+    // Using the first one again makes the second the least recent.
+    stash(gen, 0, 3);
+    stash(gen, 7680, 4);
+    LOK_ASSERT(cached(gen, 0));
+    LOK_ASSERT(!cached(gen, 3840));
+    LOK_ASSERT(cached(gen, 7680));
+    LOK_ASSERT_EQUAL(2 * tileBytes, gen.getUsedBytes());
+
+    // Shrinking the budget evicts, but keeps the most recent.
+    gen.setMaxBytes(tileBytes / 2);
+    LOK_ASSERT(!cached(gen, 0));
+    LOK_ASSERT(cached(gen, 7680));
+    LOK_ASSERT_EQUAL(tileBytes, gen.getUsedBytes());
+
+    gen.dropCache();
+    LOK_ASSERT_EQUAL(size_t(0), gen.getUsedBytes());
+    LOK_ASSERT(gen._lru.empty());
+}
+
+namespace
+{
+/// Paints a pattern that depends only on the document position of each
+/// pixel, so any band of an area paints the same pixels as the whole.
+void fakePaintPartTile(LibreOfficeKitDocument*, unsigned char* buffer, const int, const int,
+                       const int canvasWidth, const int canvasHeight, const int tilePosX,
+                       const int tilePosY, const int tileWidth, const int tileHeight)
+{
+    const int left = static_cast<long>(tilePosX) * canvasWidth / tileWidth;
+    const int top = static_cast<long>(tilePosY) * canvasHeight / tileHeight;
+    for (int y = 0; y < canvasHeight; ++y)
+        for (int x = 0; x < canvasWidth; ++x)
+        {
+            unsigned char* pixel = buffer + (static_cast<size_t>(y) * canvasWidth + x) * 4;
+            pixel[0] = (left + x) * 3;
+            pixel[1] = (top + y) * 5;
+            pixel[2] = ((left + x) / 16) ^ ((top + y) / 16);
+            pixel[3] = 0xff;
+        }
+}
+
+int fakeGetTileMode(LibreOfficeKitDocument*) { return LOK_TILEMODE_BGRA; }
+
+void fakeDestroy(LibreOfficeKitDocument*) {}
+
+/// Renders @tileCombined and returns the messages sent.
+std::vector<std::string> renderTiles(TileCombined tileCombined, bool streaming)
+{
+    constexpr std::string_view testname = __func__;
+
+    static LibreOfficeKitDocumentClass docClass{};
+    docClass.nSize = sizeof(docClass);
+    docClass.destroy = fakeDestroy;
+    docClass.paintPartTile = fakePaintPartTile;
+    docClass.getTileMode = fakeGetTileMode;
+    static LibreOfficeKitDocument doc{ &docClass };
+
+    auto document = std::make_shared<lok::Document>(&doc);
+    DeltaGenerator deltaGen;
+    ThreadPool pool;
+    std::vector<std::string> messages;
+    LOK_ASSERT(RenderTiles::doRender(
+        document, deltaGen, tileCombined, pool,
+        [](unsigned char*, int, int, size_t, size_t, int, int, LibreOfficeKitTileMode) {},
+        [&](const char* buffer, size_t length) { messages.emplace_back(buffer, length); },
+        0, CanonicalViewId(1), false, streaming));
+    return messages;
+}
+
+/// Maps the position of each tile sent in @messages to its image.
+std::map<std::pair<int, int>, std::string> tileImages(const std::vector<std::string>& messages)
+{
+    constexpr std::string_view testname = __func__;
+
+    std::map<std::pair<int, int>, std::string> images;
+    for (const std::string& message : messages)
+    {
+        std::size_t offset = 0;
+        const TileCombined tiles = TileCombined::parseBinary(message.data(), message.size(), offset);
+        for (const TileDesc& tile : tiles.getTiles())
+        {
+            LOK_ASSERT(offset + tile.getImgSize() <= message.size());
+            LOK_ASSERT(images.emplace(std::make_pair(tile.getTilePosX(), tile.getTilePosY()),
+                                      message.substr(offset, tile.getImgSize())).second);
+            offset += tile.getImgSize();
+        }
+        LOK_ASSERT_EQUAL(message.size(), offset);
+    }
+    return images;
+}
+}
+
+void DeltaTests::testStreamedRendering()
+{
+    constexpr std::string_view testname = __func__;
+
+    // Four rows, not all of them full, so streaming paints them as bands.
+    const TileCombined tileCombined = TileCombined::parse(
+        "tilecombine nviewid=1 part=0 width=256 height=256 "
+        "tileposx=0,3840,0,3840,3840 tileposy=0,0,3840,7680,11520 "
+        "tilewidth=3840 tileheight=3840");
+
+    const std::vector<std::string> whole = renderTiles(tileCombined, false);
+    LOK_ASSERT_EQUAL(size_t(1), whole.size());
+
+    const std::vector<std::string> streamed = renderTiles(tileCombined, true);
+    LOK_ASSERT(streamed.size() > 1);
+
+    const auto wholeImages = tileImages(whole);
+    const auto streamedImages = tileImages(streamed);
+    LOK_ASSERT_EQUAL(tileCombined.getTiles().size(), wholeImages.size());
+    LOK_ASSERT_EQUAL(wholeImages.size(), streamedImages.size());
+    for (const auto& pair : wholeImages)
+    {
+        const auto it = streamedImages.find(pair.first);
+        LOK_ASSERT(it != streamedImages.end());
+        LOK_ASSERT(!pair.second.empty());
+        LOK_ASSERT(pair.second == it->second);
+    }
+
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(DeltaTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -33,6 +33,8 @@ class FileServeTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testPreProcessedFile);
     CPPUNIT_TEST(testPreProcessedFileRoundtrip);
     CPPUNIT_TEST(testPreProcessedFileSubstitution);
+    CPPUNIT_TEST(testRange);
+    CPPUNIT_TEST(testStaticAsset);
     CPPUNIT_TEST_SUITE_END();
 
     void testUIDefaults();
@@ -40,6 +42,8 @@ class FileServeTests : public CPPUNIT_NS::TestFixture
     void testPreProcessedFile();
     void testPreProcessedFileRoundtrip();
     void testPreProcessedFileSubstitution();
+    void testRange();
+    void testStaticAsset();
 
     void preProcessedFileSubstitution(const std::string_view testname,
                                       const std::unordered_map<std::string, std::string> variables);
@@ -455,6 +459,99 @@ void FileServeTests::testPreProcessedFileSubstitution()
                                  std::unordered_map<std::string, std::string>());
 }
 
+void FileServeTests::testRange()
+{
+    constexpr std::string_view testname = __func__;
+
+    using HttpHelper::RangeResult;
+    std::size_t start = 0;
+    std::size_t length = 0;
+
+    LOK_ASSERT(HttpHelper::parseRange("", 1000, start, length) == RangeResult::Full);
+    LOK_ASSERT_EQUAL(std::size_t(0), start);
+    LOK_ASSERT_EQUAL(std::size_t(1000), length);
+
+    LOK_ASSERT(HttpHelper::parseRange("bytes=0-499", 1000, start, length) ==
+               RangeResult::Partial);
+    LOK_ASSERT_EQUAL(std::size_t(0), start);
+    LOK_ASSERT_EQUAL(std::size_t(500), length);
+
+    LOK_ASSERT(HttpHelper::parseRange("bytes=500-", 1000, start, length) == RangeResult::Partial);
+    LOK_ASSERT_EQUAL(std::size_t(500), start);
+    LOK_ASSERT_EQUAL(std::size_t(500), length);
+
+    LOK_ASSERT(HttpHelper::parseRange("bytes=-100", 1000, start, length) == RangeResult::Partial);
+    LOK_ASSERT_EQUAL(std::size_t(900), start);
+    LOK_ASSERT_EQUAL(std::size_t(100), length);
+
+    // The end is clamped to the size, as is the suffix.
+    LOK_ASSERT(HttpHelper::parseRange("bytes=900-2000", 1000, start, length) ==
+               RangeResult::Partial);
+    LOK_ASSERT_EQUAL(std::size_t(100), length);
+    LOK_ASSERT(HttpHelper::parseRange("bytes=-2000", 1000, start, length) ==
+               RangeResult::Partial);
+    LOK_ASSERT_EQUAL(std::size_t(0), start);
+    LOK_ASSERT_EQUAL(std::size_t(1000), length);
+
+    LOK_ASSERT(HttpHelper::parseRange("bytes=1000-", 1000, start, length) ==
+               RangeResult::Unsatisfiable);
+    LOK_ASSERT(HttpHelper::parseRange("bytes=-0", 1000, start, length) ==
+               RangeResult::Unsatisfiable);
+
+    // Invalid, multiple or unknown ranges are ignored.
+    LOK_ASSERT(HttpHelper::parseRange("bytes=500-100", 1000, start, length) == RangeResult::Full);
+    LOK_ASSERT(HttpHelper::parseRange("bytes=a-b", 1000, start, length) == RangeResult::Full);
+    LOK_ASSERT(HttpHelper::parseRange("bytes=0-1,5-6", 1000, start, length) == RangeResult::Full);
+    LOK_ASSERT(HttpHelper::parseRange("items=0-1", 1000, start, length) == RangeResult::Full);
+    LOK_ASSERT_EQUAL(std::size_t(1000), length);
+}
+
+void FileServeTests::testStaticAsset()
+{
+    constexpr std::string_view testname = __func__;
+
+    std::string data;
+    for (int i = 0; i < 1000; ++i)
+        data += "function f" + std::to_string(i % 10) + "() { return 0; }\n";
+
+    const HttpHelper::StaticAsset asset = HttpHelper::makeStaticAsset(data);
+    LOK_ASSERT_EQUAL(data.size(), asset._data->size());
+    LOK_ASSERT(asset._gzip && asset._gzip->size() < data.size());
+    LOK_ASSERT(asset._zstd && asset._zstd->size() < data.size());
+    LOK_ASSERT(!asset._brotli);
+
+    // Strong ETags, that depend on the content only.
+    LOK_ASSERT(asset._etag.size() > 2 && asset._etag.front() == '"');
+    LOK_ASSERT_EQUAL(asset._etag, HttpHelper::makeStaticAsset(data)._etag);
+    LOK_ASSERT(asset._etag != HttpHelper::makeStaticAsset(data + ' ')._etag);
+
+    LOK_ASSERT(HttpHelper::matchesETag(asset._etag, asset._etag));
+    LOK_ASSERT(HttpHelper::matchesETag("\"other\", W/" + asset._etag, asset._etag));
+    LOK_ASSERT(HttpHelper::matchesETag("*", asset._etag));
+    LOK_ASSERT(!HttpHelper::matchesETag("\"other\"", asset._etag));
+    LOK_ASSERT(!HttpHelper::matchesETag("", asset._etag));
+
+    // Each encoding is tagged apart, and doesn't match the identity.
+    const std::string brTag = asset.getETag("br");
+    LOK_ASSERT_EQUAL(asset._etag, asset.getETag(std::string_view()));
+    LOK_ASSERT_EQUAL(asset._etag.substr(0, asset._etag.size() - 1) + "-br\"", brTag);
+    LOK_ASSERT(brTag != asset.getETag("gzip"));
+    LOK_ASSERT(HttpHelper::matchesETag(brTag, brTag));
+    LOK_ASSERT(!HttpHelper::matchesETag(brTag, asset._etag));
+
+    // Assets that only exist as brotli are tagged by what is served.
+    const HttpHelper::StaticAsset brotli = HttpHelper::makeBrotliAsset("brotli one");
+    LOK_ASSERT(!brotli._data);
+    LOK_ASSERT(brotli._brotli);
+    LOK_ASSERT(brotli._etag != HttpHelper::makeBrotliAsset("brotli two")._etag);
+    LOK_ASSERT(brotli._etag != HttpHelper::makeStaticAsset(std::string())._etag);
+
+    // Incompressible content isn't worth keeping compressed.
+    const HttpHelper::StaticAsset tiny = HttpHelper::makeStaticAsset("x");
+    LOK_ASSERT(!tiny._gzip);
+    LOK_ASSERT(!tiny._zstd);
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(FileServeTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
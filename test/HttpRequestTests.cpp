@@ -60,7 +60,9 @@ class HttpRequestTests final : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testBadResponse);
     CPPUNIT_TEST(testGoodResponse);
     CPPUNIT_TEST(testSimpleGet);
+    CPPUNIT_TEST(testAsyncDownload);
     CPPUNIT_TEST(testSimpleGetSync);
+    CPPUNIT_TEST(testSimpleGetSyncEPoll);
     CPPUNIT_TEST(testChunkedGetSync);
     CPPUNIT_TEST(test500GetStatuses); // Slow.
 #ifdef ENABLE_EXTERNAL_REGRESSION_CHECK
@@ -80,7 +82,9 @@ class HttpRequestTests final : public CPPUNIT_NS::TestFixture
     void testBadResponse();
     void testGoodResponse();
     void testSimpleGet();
+    void testAsyncDownload();
     void testSimpleGetSync();
+    void testSimpleGetSyncEPoll();
     void testChunkedGetSync();
     void test500GetStatuses();
     void testChunkedGetSync_External();
@@ -340,6 +344,58 @@ void HttpRequestTests::testSimpleGet()
     pollThread->joinThread();
 }
 
+void HttpRequestTests::testAsyncDownload()
+{
+    constexpr std::string_view testname = __func__;
+
+    const std::string body = Util::rng::getHexString(1024 + Util::rng::getNext() % 1024);
+    std::string URL = "/echo/" + body;
+
+    std::shared_ptr<SocketPoll> pollThread = std::make_shared<SocketPoll>("AsyncDownloadPoll");
+    pollThread->startThread();
+
+    http::Request httpRequest(std::move(URL));
+
+    auto httpSession = http::Session::create(_localUri);
+    httpSession->setTimeout(DefTimeoutSeconds);
+
+    std::condition_variable cv;
+    std::mutex mutex;
+    bool timedout = true;
+    httpSession->setFinishedHandler([&](const std::shared_ptr<http::Session>&) {
+        std::lock_guard<std::mutex> lock(mutex);
+        timedout = false;
+        cv.notify_all();
+    });
+
+    httpSession->setConnectFailHandler([testname](const std::shared_ptr<http::Session>&)
+                                       { LOK_ASSERT_FAIL("Unexpected connection failure"); });
+
+    // The body is streamed to the handler, rather than kept in memory.
+    std::string downloaded;
+    const auto onBodyWrite = [&downloaded](const char* p, int64_t len)
+    {
+        downloaded.append(p, len);
+        return len;
+    };
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    LOK_ASSERT(httpSession->asyncDownload(httpRequest, onBodyWrite, pollThread));
+
+    cv.wait_for(lock, DefTimeoutSeconds, [&]() { return timedout == false; });
+
+    const std::shared_ptr<const http::Response> httpResponse = httpSession->response();
+
+    LOK_ASSERT_EQUAL_MESSAGE("Timed out waiting for the onFinished handler", false, timedout);
+    LOK_ASSERT(httpResponse->state() == http::Response::State::Complete);
+    LOK_ASSERT_EQUAL(http::StatusCode::OK, httpResponse->statusLine().statusCode());
+    LOK_ASSERT_EQUAL(body, downloaded);
+    LOK_ASSERT(httpResponse->getBody().empty());
+
+    pollThread->joinThread();
+}
+
 void HttpRequestTests::testSimpleGetSync()
 {
     constexpr std::string_view testname = "simpleGetSync";
@@ -376,6 +432,44 @@ void HttpRequestTests::testSimpleGetSync()
     }
 }
 
+void HttpRequestTests::testSimpleGetSyncEPoll()
+{
+    constexpr std::string_view testname = "simpleGetSyncEPoll";
+
+#if HAVE_EPOLL
+    // The sync requests create their SocketPoll internally, after this.
+    // Restore the default even when an assertion fails.
+    struct PollBackendGuard
+    {
+        const net::PollBackend _oldBackend = net::Defaults.pollBackend;
+        explicit PollBackendGuard(net::PollBackend backend) { net::Defaults.pollBackend = backend; }
+        ~PollBackendGuard() { net::Defaults.pollBackend = _oldBackend; }
+    } pollBackendGuard(net::PollBackend::EPoll);
+
+    const std::string body = Util::rng::getHexString(Util::rng::getNext() % 1024);
+    std::string URL = "/echo/" + body;
+    TST_LOG("Requesting URI: [" << URL << ']');
+
+    http::Request httpRequest(std::move(URL));
+
+    auto httpSession = http::Session::create(_localUri);
+    httpSession->setTimeout(DefTimeoutSeconds);
+
+    for (int i = 0; i < 5; ++i)
+    {
+        TST_LOG("Request #" << i);
+        const std::shared_ptr<const http::Response> httpResponse
+            = httpSession->syncRequest(httpRequest);
+        LOK_ASSERT(httpResponse->done());
+        LOK_ASSERT(httpResponse->state() == http::Response::State::Complete);
+        LOK_ASSERT_EQUAL(http::StatusCode::OK, httpResponse->statusLine().statusCode());
+        LOK_ASSERT_EQUAL(body, httpResponse->getBody());
+    }
+#else
+    TST_LOG("No epoll support, skipping");
+#endif
+}
+
 void HttpRequestTests::testChunkedGetSync()
 {
     constexpr std::string_view testname = "chunkedGetSync";
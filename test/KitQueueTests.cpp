@@ -38,9 +38,12 @@ class KitQueueTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testSenderQueueLog);
     CPPUNIT_TEST(testSenderQueueProgress);
     CPPUNIT_TEST(testSenderQueueTileDeduplication);
+    CPPUNIT_TEST(testSenderQueueCoalescing);
     CPPUNIT_TEST(testInvalidateViewCursorDeduplication);
     CPPUNIT_TEST(testCallbackModifiedStatusIsSkipped);
     CPPUNIT_TEST(testCallbackInvalidation);
+    CPPUNIT_TEST(testCallbackInvalidationBulk);
+    CPPUNIT_TEST(testCallbackViewCursor);
     CPPUNIT_TEST(testCallbackIndicatorValue);
     CPPUNIT_TEST(testCallbackPageSize);
 
@@ -57,9 +60,12 @@ class KitQueueTests : public CPPUNIT_NS::TestFixture
     void testSenderQueueLog();
     void testSenderQueueProgress();
     void testSenderQueueTileDeduplication();
+    void testSenderQueueCoalescing();
     void testInvalidateViewCursorDeduplication();
     void testCallbackModifiedStatusIsSkipped();
     void testCallbackInvalidation();
+    void testCallbackInvalidationBulk();
+    void testCallbackViewCursor();
     void testCallbackIndicatorValue();
     void testCallbackPageSize();
 
@@ -387,9 +393,11 @@ void KitQueueTests::testSenderQueue()
     }
 
     LOK_ASSERT_EQUAL(static_cast<size_t>(3), queue.size());
+    LOK_ASSERT_EQUAL(static_cast<size_t>(27), queue.getBytes());
 
     LOK_ASSERT_EQUAL_STR(true, queue.dequeue(item));
     LOK_ASSERT_EQUAL(static_cast<size_t>(2), queue.size());
+    LOK_ASSERT_EQUAL(static_cast<size_t>(18), queue.getBytes());
     LOK_ASSERT(item);
     LOK_ASSERT_EQUAL(messages[0], msgStr(item));
 
@@ -404,6 +412,7 @@ void KitQueueTests::testSenderQueue()
     LOK_ASSERT_EQUAL(messages[2], msgStr(item));
 
     LOK_ASSERT_EQUAL(static_cast<size_t>(0), queue.size());
+    LOK_ASSERT_EQUAL(static_cast<size_t>(0), queue.getBytes());
 }
 
 void KitQueueTests::testSenderQueueLog()
@@ -540,6 +549,52 @@ void KitQueueTests::testSenderQueueTileDeduplication()
     LOK_ASSERT_EQUAL(static_cast<size_t>(0), queue.size());
 }
 
+void KitQueueTests::testSenderQueueCoalescing()
+{
+    constexpr std::string_view testname = __func__;
+
+    SenderQueue<std::shared_ptr<Message>> queue;
+
+    std::shared_ptr<Message> item;
+
+    const std::string tileA = "tile: nviewid=0 part=0 width=256 height=256 tileposx=0 tileposy=0 "
+                              "tilewidth=3840 tileheight=3840 ver=";
+    const std::string tileB = "tile: nviewid=0 part=0 width=256 height=256 tileposx=3840 "
+                              "tileposy=0 tilewidth=3840 tileheight=3840 ver=";
+
+    // A client that falls behind: newer tiles and states replace the queued ones.
+    const std::vector<std::string> messages = {
+        "setpart: part=1", tileA + '1', "textselection: ", tileB + '1', tileA + '2',
+        "setpart: part=2", tileB + '2'
+    };
+
+    for (const auto& msg : messages)
+        queue.enqueue(std::make_shared<Message>(msg, Message::Dir::Out));
+
+    LOK_ASSERT_EQUAL(static_cast<size_t>(4), queue.size());
+
+    std::ostringstream oss;
+    queue.dumpState(oss);
+    LOK_ASSERT(oss.str().find("coalesced tiles: 2, coalesced messages: 1") != std::string::npos);
+
+    LOK_ASSERT_EQUAL_STR(true, queue.dequeue(item));
+    LOK_ASSERT_EQUAL(std::string("textselection: "), msgStr(item));
+
+    // Replaces a tile that was queued behind superseded ones.
+    queue.enqueue(std::make_shared<Message>(tileA + '3', Message::Dir::Out));
+    LOK_ASSERT_EQUAL(static_cast<size_t>(3), queue.size());
+
+    const std::vector<std::string> expected = { "setpart: part=2", tileB + '2', tileA + '3' };
+    for (const auto& msg : expected)
+    {
+        LOK_ASSERT_EQUAL_STR(true, queue.dequeue(item));
+        LOK_ASSERT_EQUAL(msg, msgStr(item));
+    }
+
+    LOK_ASSERT_EQUAL_STR(false, queue.dequeue(item));
+    LOK_ASSERT_EQUAL(static_cast<size_t>(0), queue.size());
+}
+
 void KitQueueTests::testInvalidateViewCursorDeduplication()
 {
     constexpr std::string_view testname = __func__;
@@ -651,6 +706,88 @@ void KitQueueTests::testCallbackInvalidation()
     LOK_ASSERT_EQUAL_STR("EMPTY, 0", item._payload);
 }
 
+void KitQueueTests::testCallbackInvalidationBulk()
+{
+    constexpr std::string_view testname = __func__;
+
+    TilePrioritizer dummy;
+    KitQueue queue(dummy);
+
+    // Pasting a large range in Calc invalidates every cell.
+    constexpr int CellWidth = 1280;
+    constexpr int CellHeight = 256;
+    constexpr int Columns = 40;
+    constexpr int Rows = 200;
+    for (int row = 0; row < Rows; ++row)
+    {
+        for (int col = 0; col < Columns; ++col)
+        {
+            queue.putCallback(-1, LOK_CALLBACK_INVALIDATE_TILES,
+                              std::to_string(col * CellWidth) + ", " +
+                                  std::to_string(row * CellHeight) + ", " +
+                                  std::to_string(CellWidth) + ", " +
+                                  std::to_string(CellHeight) + ", 0");
+        }
+
+        // Another part is kept apart.
+        if (row == Rows / 2)
+            queue.putCallback(-1, LOK_CALLBACK_INVALIDATE_TILES, "0, 0, 1280, 256, 1");
+    }
+
+    // Collapsed to rectangles of a few tiles each, that still cover every cell.
+    LOK_ASSERT(queue.callbackSize() < 40);
+
+    std::vector<Util::Rectangle> areas;
+    int otherParts = 0;
+    KitQueue::Callback item;
+    while (queue.getCallback(item))
+    {
+        LOK_ASSERT_EQUAL(static_cast<int>(LOK_CALLBACK_INVALIDATE_TILES), item._type);
+        StringVector tokens = StringVector::tokenize(item._payload);
+        LOK_ASSERT_EQUAL(static_cast<std::size_t>(5), tokens.size());
+        if (tokens[4] != "0")
+        {
+            LOK_ASSERT_EQUAL_STR("0, 0, 1280, 256, 1", item._payload);
+            ++otherParts;
+            continue;
+        }
+
+        areas.emplace_back(std::atoi(tokens[0].c_str()), std::atoi(tokens[1].c_str()),
+                           std::atoi(tokens[2].c_str()), std::atoi(tokens[3].c_str()));
+    }
+
+    LOK_ASSERT_EQUAL(1, otherParts);
+    for (int row = 0; row < Rows; ++row)
+    {
+        for (int col = 0; col < Columns; ++col)
+        {
+            const Util::Rectangle cell(col * CellWidth, row * CellHeight, CellWidth, CellHeight);
+            LOK_ASSERT(std::any_of(areas.begin(), areas.end(), [&cell](const Util::Rectangle& area)
+                                   { return area.contains(cell); }));
+        }
+    }
+}
+
+void KitQueueTests::testCallbackViewCursor()
+{
+    constexpr std::string_view testname = __func__;
+
+    TilePrioritizer dummy;
+    KitQueue queue(dummy);
+
+    // The view cursors of different views are kept, the older of the same view not.
+    const std::string cursor1 = R"({ "viewId": "1", "rectangle": "10, 10, 1, 20" })";
+    const std::string cursor2 = R"({ "viewId": "2", "rectangle": "10, 10, 1, 20" })";
+    const std::string cursor1Moved = R"({ "viewId": "1", "rectangle": "30, 10, 1, 20" })";
+    queue.putCallback(0, LOK_CALLBACK_INVALIDATE_VIEW_CURSOR, cursor1);
+    queue.putCallback(0, LOK_CALLBACK_INVALIDATE_VIEW_CURSOR, cursor2);
+    queue.putCallback(0, LOK_CALLBACK_INVALIDATE_VIEW_CURSOR, cursor1Moved);
+
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(2), queue.callbackSize());
+    LOK_ASSERT_EQUAL_STR(cursor2, queue.getCallback()._payload);
+    LOK_ASSERT_EQUAL_STR(cursor1Moved, queue.getCallback()._payload);
+}
+
 void KitQueueTests::testCallbackIndicatorValue()
 {
     constexpr std::string_view testname = __func__;
@@ -13,6 +13,7 @@
 
 #include <net/Buffer.hpp>
 #include <net/NetUtil.hpp>
+#include <net/PerMessageDeflate.hpp>
 #include <net/Uri.hpp>
 
 #include <test/lokassert.hpp>
@@ -25,17 +26,23 @@ class NetUtilWhiteBoxTests : public CPPUNIT_NS::TestFixture
 {
     CPPUNIT_TEST_SUITE(NetUtilWhiteBoxTests);
     CPPUNIT_TEST(testBufferClass);
+    CPPUNIT_TEST(testBufferSegments);
     CPPUNIT_TEST(testParseUri);
     CPPUNIT_TEST(testParseUriUrl);
     CPPUNIT_TEST(testParseUrl);
     CPPUNIT_TEST(testSameOrigin);
+    CPPUNIT_TEST(testPerMessageDeflateNegotiate);
+    CPPUNIT_TEST(testPerMessageDeflate);
     CPPUNIT_TEST_SUITE_END();
 
     void testBufferClass();
+    void testBufferSegments();
     void testParseUri();
     void testParseUriUrl();
     void testParseUrl();
     void testSameOrigin();
+    void testPerMessageDeflateNegotiate();
+    void testPerMessageDeflate();
 };
 
 void NetUtilWhiteBoxTests::testBufferClass()
@@ -123,6 +130,57 @@ void NetUtilWhiteBoxTests::testBufferClass()
     LOK_ASSERT_EQUAL(true, buf.empty());
 }
 
+void NetUtilWhiteBoxTests::testBufferSegments()
+{
+    constexpr std::string_view testname = __func__;
+
+    Buffer buf;
+    buf.append("head");
+
+    // Small blobs are copied.
+    auto small = std::make_shared<BlobData>(16, 's');
+    buf.appendShared(small, 4, 8);
+    LOK_ASSERT_EQUAL(false, buf.isSegmented());
+    LOK_ASSERT_EQUAL(std::size_t(12), buf.size());
+
+    // Large ones are referenced, and what follows them is kept in order.
+    auto large = std::make_shared<BlobData>(Buffer::MinSharedSize * 2, 'l');
+    buf.appendShared(large, 1, Buffer::MinSharedSize);
+    buf.append("tail");
+    LOK_ASSERT_EQUAL(true, buf.isSegmented());
+    LOK_ASSERT_EQUAL(std::size_t(12 + Buffer::MinSharedSize + 4), buf.size());
+
+    struct iovec iov[8];
+    LOK_ASSERT_EQUAL(3, buf.getIOVec(iov, 8, buf.size()));
+    LOK_ASSERT_EQUAL(std::size_t(12), iov[0].iov_len);
+    LOK_ASSERT(iov[1].iov_base == large->data() + 1);
+    LOK_ASSERT_EQUAL(Buffer::MinSharedSize, iov[1].iov_len);
+    LOK_ASSERT_EQUAL(0, memcmp(iov[2].iov_base, "tail", 4));
+
+    // Limited by the number of bytes.
+    LOK_ASSERT_EQUAL(2, buf.getIOVec(iov, 8, 20));
+    LOK_ASSERT_EQUAL(std::size_t(8), iov[1].iov_len);
+
+    // Erase across the segments.
+    buf.eraseFirst(14);
+    LOK_ASSERT_EQUAL(std::size_t(Buffer::MinSharedSize - 2 + 4), buf.size());
+    LOK_ASSERT(buf.getBlock() == large->data() + 3);
+    LOK_ASSERT_EQUAL(Buffer::MinSharedSize - 2, buf.getBlockSize());
+
+    buf.eraseFirst(Buffer::MinSharedSize - 1);
+    LOK_ASSERT_EQUAL(std::size_t(3), buf.size());
+    LOK_ASSERT_EQUAL(0, memcmp(buf.getBlock(), "ail", 3));
+
+    buf.eraseFirst(3);
+    LOK_ASSERT_EQUAL(true, buf.empty());
+    LOK_ASSERT_EQUAL(false, buf.isSegmented());
+
+    // Back to contiguous appending.
+    buf.append("again");
+    LOK_ASSERT_EQUAL(false, buf.isSegmented());
+    LOK_ASSERT_EQUAL(0, memcmp(buf.data(), "again", 5));
+}
+
 void NetUtilWhiteBoxTests::testParseUri()
 {
     constexpr std::string_view testname = __func__;
@@ -291,6 +349,82 @@ void NetUtilWhiteBoxTests::testSameOrigin()
     LOK_ASSERT(!net::sameOrigin("http://sub.domain.com:88", "http://sub.domain.com:80"));
 }
 
+void NetUtilWhiteBoxTests::testPerMessageDeflateNegotiate()
+{
+    constexpr std::string_view testname = __func__;
+
+    std::string response;
+    LOK_ASSERT(!PerMessageDeflate::negotiate("", response));
+    LOK_ASSERT(!PerMessageDeflate::negotiate("x-webkit-deflate-frame", response));
+
+    // What browsers offer.
+    LOK_ASSERT(PerMessageDeflate::negotiate("permessage-deflate; client_max_window_bits", response));
+    LOK_ASSERT_EQUAL(std::string("permessage-deflate"), response);
+
+    LOK_ASSERT(PerMessageDeflate::negotiate(
+        "permessage-deflate;server_no_context_takeover; server_max_window_bits=\"15\"", response));
+    LOK_ASSERT_EQUAL(std::string("permessage-deflate; server_no_context_takeover; "
+                                 "server_max_window_bits=13"),
+                     response);
+
+    // Zlib can't deflate with a window of 8 bits, so the first offer is declined.
+    LOK_ASSERT(PerMessageDeflate::negotiate(
+        "permessage-deflate; server_max_window_bits=8, permessage-deflate; "
+        "server_max_window_bits=10",
+        response));
+    LOK_ASSERT_EQUAL(std::string("permessage-deflate; server_max_window_bits=10"), response);
+
+    // Invalid, duplicate and unknown parameters.
+    LOK_ASSERT(!PerMessageDeflate::negotiate("permessage-deflate; server_max_window_bits", response));
+    LOK_ASSERT(!PerMessageDeflate::negotiate("permessage-deflate; client_max_window_bits=16",
+                                             response));
+    LOK_ASSERT(!PerMessageDeflate::negotiate(
+        "permessage-deflate; client_no_context_takeover; client_no_context_takeover", response));
+    LOK_ASSERT(!PerMessageDeflate::negotiate("permessage-deflate; unknown", response));
+}
+
+void NetUtilWhiteBoxTests::testPerMessageDeflate()
+{
+    constexpr std::string_view testname = __func__;
+
+    PerMessageDeflate server(PerMessageDeflate::WindowBits, /*noContextTakeover=*/false);
+    PerMessageDeflate client(PerMessageDeflate::WindowBits, /*noContextTakeover=*/false);
+
+    std::string message;
+    for (int i = 0; i < 64; ++i)
+        message += "statechanged: .uno:Bold=false .uno:Italic=" + std::to_string(i % 3) + '\n';
+
+    // The first message compresses, the identical second one is all back-references.
+    std::vector<char> compressed, inflated;
+    LOK_ASSERT(server.compress(message.data(), message.size(), compressed));
+    LOK_ASSERT(compressed.size() < message.size() / 4);
+    const std::size_t firstSize = compressed.size();
+    LOK_ASSERT(client.decompress(compressed, inflated));
+    LOK_ASSERT_EQUAL(message, std::string(inflated.begin(), inflated.end()));
+
+    LOK_ASSERT(server.compress(message.data(), message.size(), compressed));
+    LOK_ASSERT(compressed.size() < firstSize);
+    LOK_ASSERT(client.decompress(compressed, inflated));
+    LOK_ASSERT_EQUAL(message, std::string(inflated.begin(), inflated.end()));
+
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(2 * message.size() - firstSize - compressed.size()),
+                     server.getSavedBytes());
+
+    // Without context takeover, each message stands alone.
+    PerMessageDeflate standalone(PerMessageDeflate::WindowBits, /*noContextTakeover=*/true);
+    PerMessageDeflate fresh(PerMessageDeflate::WindowBits, /*noContextTakeover=*/false);
+    LOK_ASSERT(standalone.compress(message.data(), message.size(), compressed));
+    LOK_ASSERT(standalone.compress(message.data(), message.size(), compressed));
+    LOK_ASSERT_EQUAL(firstSize, compressed.size());
+    LOK_ASSERT(fresh.decompress(compressed, inflated));
+    LOK_ASSERT_EQUAL(message, std::string(inflated.begin(), inflated.end()));
+
+    // Garbage is rejected.
+    const std::vector<char> garbage(64, '\xff');
+    PerMessageDeflate victim(PerMessageDeflate::WindowBits, /*noContextTakeover=*/false);
+    LOK_ASSERT(!victim.decompress(garbage, inflated));
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(NetUtilWhiteBoxTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -70,6 +70,9 @@ class TileCacheTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testSimpleCombine);
     CPPUNIT_TEST(testTileSubscription);
     CPPUNIT_TEST(testSize);
+    CPPUNIT_TEST(testLru);
+    CPPUNIT_TEST(testGlobalBudget);
+    CPPUNIT_TEST(testInvalidateScaling);
     CPPUNIT_TEST(testDisconnectMultiView);
     CPPUNIT_TEST(testUnresponsiveClient);
     CPPUNIT_TEST(testImpressTiles);
@@ -108,6 +111,9 @@ class TileCacheTests : public CPPUNIT_NS::TestFixture
     void testSimpleCombine();
     void testTileSubscription();
     void testSize();
+    void testLru();
+    void testGlobalBudget();
+    void testInvalidateScaling();
     void testDisconnectMultiView();
     void testUnresponsiveClient();
     void testImpressTiles();
@@ -444,6 +450,173 @@ void TileCacheTests::testSize()
     LOK_ASSERT_MESSAGE("tile cache too big", tc.getMemorySize() < maxSize);
 }
 
+void TileCacheTests::testLru()
+{
+    constexpr std::string_view testname = __func__;
+
+    TileCache tc("doc.ods", std::chrono::system_clock::time_point());
+
+    const std::vector<char> data = genRandomData(4096);
+    std::vector<TileDesc> tiles;
+    for (int i = 0; i < 5; ++i)
+    {
+        TileDesc tile(CanonicalViewId::None, 0, 0, 256, 256, 0, i * 3840, 3840, 3840, -1, 0, -1);
+        tile.setWireId(i + 1);
+        tiles.push_back(tile);
+    }
+
+    tc.saveTileAndNotify(tiles[0], data.data(), data.size());
+    const size_t entrySize = tc.getMemorySize();
+    LOK_ASSERT(entrySize > data.size());
+
+    // Room for four tiles.
+    tc.setMaxCacheSize(entrySize * 4 + 1);
+    for (int i = 1; i < 4; ++i)
+        tc.saveTileAndNotify(tiles[i], data.data(), data.size());
+    LOK_ASSERT_EQUAL(entrySize * 4, tc.getMemorySize());
+
+    // Using the oldest tile makes the next one the eviction candidate.
+    LOK_ASSERT(tc.lookupTile(tiles[0]));
+    tc.saveTileAndNotify(tiles[4], data.data(), data.size());
+    LOK_ASSERT_EQUAL(entrySize * 4, tc.getMemorySize());
+
+    LOK_ASSERT(tc.lookupTile(tiles[0]));
+    LOK_ASSERT(!tc.lookupTile(tiles[1]));
+    LOK_ASSERT(tc.lookupTile(tiles[4]));
+
+    const TileCache::Stats stats = tc.getStats();
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(3), stats._hits);
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(1), stats._misses);
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(1), stats._evictions);
+    LOK_ASSERT_EQUAL(tc.getMemorySize(), stats._bytes);
+}
+
+void TileCacheTests::testInvalidateScaling()
+{
+    constexpr std::string_view testname = __func__;
+
+    constexpr int tileSize = 3840;
+    constexpr int iterations = 1000;
+    std::vector<char> data = genRandomData(64);
+    data[0] = 'Z'; // compressed pixels.
+
+    // Typing invalidates a line at a time: it should cost the same however big the cache.
+    constexpr int lineColumns = 8;
+    for (const int columns : { 16, 32, 64 })
+    {
+        TileCache tc("doc.odt", std::chrono::system_clock::time_point());
+        tc.setMaxCacheSize(1024 * 1024 * 1024);
+
+        const int rows = columns * 8;
+        TileWireId id = 0;
+        for (int row = 0; row < rows; ++row)
+        {
+            for (int col = 0; col < columns; ++col)
+            {
+                TileDesc tile(CanonicalViewId::None, 0, 0, 256, 256, col * tileSize,
+                              row * tileSize, tileSize, tileSize, -1, 0, -1);
+                tile.setWireId(++id);
+                tc.saveTileAndNotify(tile, data.data(), data.size());
+            }
+        }
+
+        const std::string invalidate = "invalidatetiles: part=0 mode=0 x=1000 y=" +
+                                       std::to_string(rows / 2 * tileSize + 1000) +
+                                       " width=" + std::to_string(lineColumns * tileSize - 2000) +
+                                       " height=200 wid=0";
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            tc.invalidateTiles(invalidate, CanonicalViewId::None);
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+
+        TST_LOG("Invalidating a line of " << lineColumns << " tiles in a cache of "
+                                          << rows * columns << " tiles took "
+                                          << elapsed / iterations << " on average");
+
+        // Just the line is invalid, to the edges of the tiles it touches.
+        for (const int row : { rows / 2 - 1, rows / 2, rows / 2 + 1 })
+        {
+            for (const int col : { 0, lineColumns - 1, lineColumns, columns - 1 })
+            {
+                const TileDesc tile(CanonicalViewId::None, 0, 0, 256, 256, col * tileSize,
+                                    row * tileSize, tileSize, tileSize, -1, 0, -1);
+                const Tile tileData = tc.lookupTile(tile);
+                LOK_ASSERT(tileData);
+                LOK_ASSERT_EQUAL(row != rows / 2 || col >= lineColumns, tileData->isValid());
+            }
+        }
+    }
+
+    // Tiles off the grid, of other sizes and other parts.
+    TileCache tc("doc.odp", std::chrono::system_clock::time_point());
+    const TileDesc offGrid(CanonicalViewId::None, 0, 0, 256, 256, tileSize / 2, tileSize / 2,
+                           tileSize, tileSize, -1, 0, -1);
+    const TileDesc zoomed(CanonicalViewId::None, 0, 0, 256, 256, 0, 0, tileSize * 2,
+                          tileSize * 2, -1, 0, -1);
+    const TileDesc otherPart(CanonicalViewId::None, 1, 0, 256, 256, tileSize, tileSize,
+                             tileSize, tileSize, -1, 0, -1);
+    for (const TileDesc& tile : { offGrid, zoomed, otherPart })
+        tc.saveTileAndNotify(tile, data.data(), data.size());
+
+    tc.invalidateTiles("invalidatetiles: part=0 mode=0 x=" + std::to_string(tileSize + 100) +
+                           " y=" + std::to_string(tileSize + 100) + " width=10 height=10 wid=0",
+                       CanonicalViewId::None);
+    LOK_ASSERT(!tc.lookupTile(offGrid)->isValid());
+    LOK_ASSERT(!tc.lookupTile(zoomed)->isValid());
+    LOK_ASSERT(tc.lookupTile(otherPart)->isValid());
+
+    tc.invalidateTiles("invalidatetiles: EMPTY", CanonicalViewId::None);
+    LOK_ASSERT(!tc.lookupTile(otherPart)->isValid());
+}
+
+void TileCacheTests::testGlobalBudget()
+{
+    constexpr std::string_view testname = __func__;
+
+    const std::vector<char> data = genRandomData(4096);
+    const auto makeTile = [](int i)
+    {
+        TileDesc tile(CanonicalViewId::None, 0, 0, 256, 256, 0, i * 3840, 3840, 3840, -1, 0, -1);
+        tile.setWireId(i + 1);
+        return tile;
+    };
+
+    TileCache first("first.ods", std::chrono::system_clock::time_point());
+    first.saveTileAndNotify(makeTile(0), data.data(), data.size());
+    const size_t entrySize = first.getMemorySize();
+
+    // Room for eight tiles: alone, the first cache gets all of it.
+    struct BudgetGuard
+    {
+        ~BudgetGuard() { TileCache::setGlobalMaxCacheSize(0); }
+    } guard;
+    TileCache::setGlobalMaxCacheSize(entrySize * 8);
+
+    const size_t globalBefore = TileCache::getGlobalCacheSize();
+    first.setMaxCacheSize(TileCache::getGlobalCacheShare());
+    for (int i = 1; i < 8; ++i)
+        first.saveTileAndNotify(makeTile(i), data.data(), data.size());
+    LOK_ASSERT_EQUAL(entrySize * 7, first.getMemorySize());
+
+    // A second document halves the share, and the first gives it up
+    // when next trimmed, even without caching anything.
+    TileCache second("second.ods", std::chrono::system_clock::time_point());
+    LOK_ASSERT_EQUAL(entrySize * 4, TileCache::getGlobalCacheShare());
+    first.setMaxCacheSize(TileCache::getGlobalCacheShare());
+    LOK_ASSERT_EQUAL(entrySize * 3, first.getMemorySize());
+    LOK_ASSERT_EQUAL(globalBefore + entrySize * 2, TileCache::getGlobalCacheSize());
+
+    // Conversions store no tiles, so they don't take a share.
+    TileCache convert("convert.ods", std::chrono::system_clock::time_point(), /*dontCache=*/true);
+    LOK_ASSERT_EQUAL(entrySize * 4, TileCache::getGlobalCacheShare());
+
+    // The most recent tiles are kept.
+    LOK_ASSERT(first.lookupTile(makeTile(7)));
+    LOK_ASSERT(!first.lookupTile(makeTile(1)));
+}
+
 
 void TileCacheTests::testDisconnectMultiView()
 {
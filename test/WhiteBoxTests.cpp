@@ -21,20 +21,32 @@
 #include <common/StateEnum.hpp>
 #include <common/ThreadPool.hpp>
 #include <common/Util.hpp>
+#include <wsd/ConversionQueue.hpp>
+#include <wsd/MemoryPressure.hpp>
+#include <wsd/PrespawnController.hpp>
+#include <wsd/ProcessStats.hpp>
 #include <wsd/TileCache.hpp>
 #include <wsd/TileDesc.hpp>
+#include <wsd/TilePacer.hpp>
 
 #include <test/lokassert.hpp>
 
 #include <cppunit/TestAssert.h>
 #include <cppunit/extensions/HelperMacros.h>
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <csignal>
 #include <cstddef>
 #include <cstdlib>
 #include <ctime>
 #include <fstream>
+#include <map>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <sys/wait.h>
 #include <unistd.h>
 
 using namespace std::literals;
@@ -55,6 +67,7 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testRegexListMatcher);
     CPPUNIT_TEST(testRegexListMatcher_Init);
     CPPUNIT_TEST(testTileDesc);
+    CPPUNIT_TEST(testTileDescBinary);
     CPPUNIT_TEST(testTileData);
     CPPUNIT_TEST(testRectanglesIntersect);
     CPPUNIT_TEST(testJson);
@@ -70,6 +83,11 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testFindInVector);
     CPPUNIT_TEST(testJoinPair);
     CPPUNIT_TEST(testThreadPool);
+    CPPUNIT_TEST(testPrespawnController);
+    CPPUNIT_TEST(testConversionQueue);
+    CPPUNIT_TEST(testTilePacer);
+    CPPUNIT_TEST(testProcessStats);
+    CPPUNIT_TEST(testMemoryPressure);
     CPPUNIT_TEST_SUITE_END();
 
     void testCOOLProtocolFunctions();
@@ -84,6 +102,7 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     void testRegexListMatcher();
     void testRegexListMatcher_Init();
     void testTileDesc();
+    void testTileDescBinary();
     void testTileData();
     void testRectanglesIntersect();
     void testJson();
@@ -99,6 +118,11 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     void testFindInVector();
     void testJoinPair();
     void testThreadPool();
+    void testPrespawnController();
+    void testConversionQueue();
+    void testTilePacer();
+    void testProcessStats();
+    void testMemoryPressure();
 
     size_t waitForThreads(size_t count);
 };
@@ -609,6 +633,82 @@ void WhiteBoxTests::testTileDesc()
     }
 }
 
+void WhiteBoxTests::testTileDescBinary()
+{
+    constexpr std::string_view testname = __func__;
+
+    const std::string text = "tilecombine: nviewid=3 part=5 width=256 height=256 "
+                             "tileposx=0,3840 tileposy=7680,7680 imgsize=10,0 "
+                             "tilewidth=3840 tileheight=3840 ver=-1,42 oldwid=7,0 wid=8,9 mode=1";
+    const TileCombined combined = TileCombined::parse(text);
+
+    // The header has a fixed size, and is followed by the images.
+    std::string message = combined.serializeBinary(TileBinary::Kind::Tile);
+    LOK_ASSERT_EQUAL(TileBinary::getTileOffset(2), message.size());
+    message.append(10, 'Z');
+
+    const TileBinary::Header header = TileBinary::Header::parse(message.data(), message.size());
+    LOK_ASSERT_EQUAL(static_cast<int>(TileBinary::Kind::Tile), static_cast<int>(header.kind));
+    LOK_ASSERT_EQUAL(2, static_cast<int>(header.count));
+
+    // Parses back to the same, as the text would.
+    std::size_t offset = 0;
+    const TileCombined parsed = TileCombined::parseBinary(message.data(), message.size(), offset);
+    LOK_ASSERT_EQUAL(TileBinary::getTileOffset(2), offset);
+    LOK_ASSERT_EQUAL(text, parsed.serialize("tilecombine:"));
+    LOK_ASSERT(parsed.getCombined());
+    LOK_ASSERT_EQUAL(10, parsed.getTiles()[0].getImgSize());
+    LOK_ASSERT_EQUAL(std::string(10, 'Z'), message.substr(offset));
+
+    // Single tiles, of all kinds, including previews.
+    TileDesc desc = TileDesc::parse("tile: nviewid=0 part=2 width=256 height=256 tileposx=3840 "
+                                    "tileposy=0 tilewidth=3840 tileheight=3840 oldwid=4 wid=5 "
+                                    "ver=6 id=7 imgsize=8");
+    for (const TileBinary::Kind kind :
+         { TileBinary::Kind::Tile, TileBinary::Kind::Delta, TileBinary::Kind::Update })
+    {
+        const std::string single = desc.serializeBinary(kind);
+        LOK_ASSERT_EQUAL(static_cast<int>(kind),
+                         static_cast<int>(TileBinary::Header::parse(single.data(), single.size()).kind));
+        const TileDesc parsedDesc = TileDesc::parseBinary(single.data(), single.size());
+        LOK_ASSERT_EQUAL(desc.serialize("tile:"), parsedDesc.serialize("tile:"));
+        LOK_ASSERT_EQUAL(desc.getOldWireId(), parsedDesc.getOldWireId());
+    }
+
+    // Malformed messages are rejected.
+    const auto isRejected = [](const std::string& bad)
+    {
+        try
+        {
+            TileDesc::parseBinary(bad.data(), bad.size());
+        }
+        catch (const BadArgumentException&)
+        {
+            return true;
+        }
+
+        return false;
+    };
+
+    std::string truncated = desc.serializeBinary(TileBinary::Kind::Tile);
+    truncated.pop_back();
+    LOK_ASSERT(isRejected(truncated));
+
+    std::string future = desc.serializeBinary(TileBinary::Kind::Tile);
+    future[TileBinary::HeaderOffset] = TileBinary::Version + 1;
+    LOK_ASSERT(isRejected(future));
+
+    LOK_ASSERT(isRejected(combined.serializeBinary(TileBinary::Kind::Tile)));
+
+    // Without throwing, as needed when sending tiles.
+    TileBinary::Header checked{};
+    LOK_ASSERT(!TileBinary::Header::tryParse(truncated.data(), truncated.size(), checked));
+    LOK_ASSERT(!TileBinary::Header::tryParse(future.data(), future.size(), checked));
+    LOK_ASSERT(!TileBinary::Header::tryParse(message.data(), TileBinary::HeaderOffset, checked));
+    LOK_ASSERT(TileBinary::Header::tryParse(message.data(), message.size(), checked));
+    LOK_ASSERT_EQUAL(2, static_cast<int>(checked.count));
+}
+
 void WhiteBoxTests::testTileData()
 {
     constexpr std::string_view testname = __func__;
@@ -664,6 +764,24 @@ void WhiteBoxTests::testTileData()
     LOK_ASSERT_EQUAL(data.size(), size_t(9));
     LOK_ASSERT_EQUAL(data._wids.size(), size_t(4));
     LOK_ASSERT_EQUAL(data._wids.back(), unsigned(54));
+
+    // shared changes are left intact by later deltas
+    size_t offset = 0;
+    LOK_ASSERT(!data.getChangesSince(128, offset));
+    std::shared_ptr<const BlobData> shared = data.getChangesSince(43, offset);
+    LOK_ASSERT(shared);
+    LOK_ASSERT_EQUAL_STR("baabaz", std::string(shared->data() + offset, shared->size() - offset));
+
+    data.appendBlob(55, "Dbar", 4);
+    LOK_ASSERT_EQUAL(data.size(), size_t(12));
+    LOK_ASSERT_EQUAL(shared->size(), size_t(9));
+
+    // and by keyframes
+    shared = data.getChangesSince(0, offset);
+    LOK_ASSERT_EQUAL(size_t(0), offset);
+    data.appendBlob(56, "Zqux", 4);
+    LOK_ASSERT_EQUAL(data.size(), size_t(3));
+    LOK_ASSERT_EQUAL_STR("foobaabazbar", std::string(shared->data(), shared->size()));
 }
 
 void WhiteBoxTests::testRectanglesIntersect()
@@ -1198,6 +1316,331 @@ void WhiteBoxTests::testThreadPool()
     pool.start();
     LOK_ASSERT_EQUAL(size_t(7), pool._threads.size());
 //    LOK_ASSERT_EQUAL(size_t(7 + existingUnrelatedThreads), waitForThreads(8 + existingUnrelatedThreads));
+
+    // Concurrent producers, each waiting for its own batch only.
+    std::atomic<int> done(0);
+    const auto producer = [&pool, &done, testname]()
+    {
+        for (int i = 0; i < 20; ++i)
+        {
+            ThreadPool::Batch batch(pool);
+            std::atomic<int> ours(0);
+            for (int j = 0; j < 50; ++j)
+                batch.pushWork([&ours, &done]() { ++ours; ++done; });
+            batch.wait();
+            LOK_ASSERT_EQUAL(size_t(0), batch.pending());
+            LOK_ASSERT_EQUAL(50, ours.load());
+        }
+    };
+
+    std::thread other(producer);
+    producer();
+    other.join();
+    LOK_ASSERT_EQUAL(2 * 20 * 50, done.load());
+    LOK_ASSERT_EQUAL(size_t(0), pool.count());
+}
+
+void WhiteBoxTests::testPrespawnController()
+{
+    constexpr std::string_view testname = __func__;
+
+    // Nothing to expect, nothing to keep.
+    LOK_ASSERT_EQUAL(size_t(0), PrespawnController::getPoissonTarget(0, 0.95, 8));
+    // One load while replacing, on average: P(<= 2) = 0.92, P(<= 3) = 0.98.
+    LOK_ASSERT_EQUAL(size_t(3), PrespawnController::getPoissonTarget(1, 0.95, 8));
+    LOK_ASSERT_EQUAL(size_t(2), PrespawnController::getPoissonTarget(1, 0.90, 8));
+    LOK_ASSERT_EQUAL(size_t(8), PrespawnController::getPoissonTarget(100, 0.95, 8));
+    LOK_ASSERT_EQUAL(size_t(8), PrespawnController::getPoissonTarget(1000, 0.95, 8));
+
+    const std::string configId;
+    auto now = std::chrono::steady_clock::now();
+
+    PrespawnController controller(1, 8, 0.95, 0);
+    LOK_ASSERT_EQUAL(size_t(1), controller.getTarget(configId, now));
+
+    // It takes two seconds to get a Kit.
+    for (int i = 0; i < 20; ++i)
+    {
+        controller.forkRequested(configId, 1, now);
+        controller.forkArrived(configId, now + std::chrono::seconds(2));
+    }
+
+    // The average approaches the latency: 2000 - 1000 * 0.8^20.
+    LOK_ASSERT_EQUAL(std::chrono::milliseconds(1988), controller.getStats(now).forkLatency);
+
+    // The morning rush: a load every second, for a minute.
+    for (int i = 0; i < 60; ++i)
+    {
+        now += std::chrono::seconds(1);
+        controller.loadRequested(configId, now);
+    }
+
+    const std::size_t busy = controller.getTarget(configId, now);
+    LOK_ASSERT_MESSAGE("Expected more spares under load, have " + std::to_string(busy),
+                       busy >= 3 && busy <= 8);
+    LOK_ASSERT_EQUAL(busy, controller.getStats(now).targetCount);
+    LOK_ASSERT(controller.getStats(now).loadsPerMinute > 30);
+
+    // And a quiet night.
+    now += std::chrono::minutes(30);
+    LOK_ASSERT_EQUAL(size_t(1), controller.getTarget(configId, now));
+
+    // With a budget for two spares, of all the configIds together.
+    PrespawnController capped(1, 8, 0.95, 100 * 1024 * 1024);
+    capped.setSpareMemory(50 * 1024 * 1024);
+    for (int i = 0; i < 120; ++i)
+    {
+        now += std::chrono::milliseconds(500);
+        capped.loadRequested(configId, now);
+        capped.loadRequested("other", now);
+    }
+
+    LOK_ASSERT_EQUAL(size_t(2), capped.getTarget(configId, now));
+    LOK_ASSERT_EQUAL(size_t(1), capped.getTarget("other", now));
+    LOK_ASSERT_EQUAL(uint64_t(2), capped.getStats(now).memoryCappedCount);
+}
+
+void WhiteBoxTests::testConversionQueue()
+{
+    constexpr std::string_view testname = __func__;
+
+    // Two at a time, one per client, three waiting.
+    ConversionQueue queue(2, 1, 3);
+    const auto now = std::chrono::steady_clock::now();
+
+    std::string started;
+    auto job = [&started](const std::string& name) { return [&started, name]() { started += name; }; };
+
+    LOK_ASSERT_EQUAL(ConversionQueue::Admission::Start, queue.submit("a", job("a0"), now));
+    LOK_ASSERT_EQUAL(ConversionQueue::Admission::Queued, queue.submit("a", job("a1"), now));
+    LOK_ASSERT_EQUAL(ConversionQueue::Admission::Start, queue.submit("b", job("b0"), now));
+    LOK_ASSERT_EQUAL(ConversionQueue::Admission::Queued, queue.submit("c", job("c0"), now));
+    LOK_ASSERT_EQUAL(ConversionQueue::Admission::Queued, queue.submit("c", job("c1"), now));
+    LOK_ASSERT_EQUAL(ConversionQueue::Admission::Rejected, queue.submit("d", job("d0"), now));
+    LOK_ASSERT_EQUAL(std::size_t(3), queue.getStats().queued);
+
+    // The clients take turns.
+    ConversionQueue::Job next = queue.finished("a", std::chrono::seconds(1));
+    LOK_ASSERT(next);
+    next();
+    next = queue.finished("b", std::chrono::seconds(1));
+    LOK_ASSERT(next);
+    next();
+    LOK_ASSERT_EQUAL(std::string("a1c0"), started);
+
+    // Only c is waiting, but already has one running.
+    LOK_ASSERT(!queue.release("a"));
+    next = queue.finished("c", std::chrono::seconds(2));
+    LOK_ASSERT(next);
+    next();
+    LOK_ASSERT_EQUAL(std::string("a1c0c1"), started);
+
+    const ConversionQueue::Stats stats = queue.getStats();
+    LOK_ASSERT_EQUAL(std::size_t(1), stats.active);
+    LOK_ASSERT_EQUAL(std::size_t(0), stats.queued);
+    LOK_ASSERT_EQUAL(uint64_t(3), stats.completed);
+    LOK_ASSERT_EQUAL(uint64_t(1), stats.rejected);
+    LOK_ASSERT_EQUAL(uint64_t(5), stats.waitTime.count());
+    LOK_ASSERT_EQUAL(uint64_t(3), stats.duration.count());
+
+    std::ostringstream oss;
+    stats.duration.dump(oss, "conversion_duration_seconds");
+    LOK_ASSERT(oss.str().find("conversion_duration_seconds_bucket{le=\"0.5\"} 0\n") !=
+               std::string::npos);
+    LOK_ASSERT(oss.str().find("conversion_duration_seconds_bucket{le=\"1\"} 2\n") !=
+               std::string::npos);
+    LOK_ASSERT(oss.str().find("conversion_duration_seconds_bucket{le=\"+Inf\"} 3\n") !=
+               std::string::npos);
+    LOK_ASSERT(oss.str().find("conversion_duration_seconds_sum 4\n") != std::string::npos);
+}
+
+void WhiteBoxTests::testTilePacer()
+{
+    constexpr std::string_view testname = __func__;
+
+    // Sends @count tiles of @bytes at once, over a link of @bytesPerSec and @rtt.
+    const auto simulate = [](TilePacer& pacer, std::size_t count, std::size_t bytes,
+                             std::size_t bytesPerSec, std::chrono::milliseconds rtt)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < count; ++i)
+            pacer.sent(i + 1, bytes, start);
+
+        const auto perTile = std::chrono::microseconds(bytes * 1000 * 1000 / bytesPerSec);
+        for (std::size_t i = 0; i < count; ++i)
+            pacer.acknowledged(i + 1, start + rtt + perTile * (i + 1));
+    };
+
+    // Before we know better, about a screenful, and a reserve near the cursor.
+    TilePacer pacer;
+    LOK_ASSERT_EQUAL(TilePacer::InitialWindowBytes, pacer.getWindowBytes());
+    LOK_ASSERT(pacer.canSend(0, false));
+    LOK_ASSERT(!pacer.canSend(TilePacer::InitialWindowBytes, false));
+    LOK_ASSERT(pacer.canSend(TilePacer::InitialWindowBytes, true));
+    LOK_ASSERT(!pacer.acknowledged(42, std::chrono::steady_clock::now()));
+
+    // 3G: 50 kB/s and 300 ms.
+    TilePacer slow;
+    simulate(slow, 20, 16 * 1024, 50 * 1024, std::chrono::milliseconds(300));
+    LOK_ASSERT_EQUAL(std::size_t(0), slow.getBytesOnFly());
+    LOK_ASSERT_EQUAL(std::size_t(16 * 1024), slow.getAverageTileBytes());
+    LOK_ASSERT_EQUAL(std::chrono::microseconds(std::chrono::milliseconds(620)), slow.getMinRtt());
+    LOK_ASSERT(slow.getBandwidth() > 40 * 1024 && slow.getBandwidth() <= 50 * 1024);
+    LOK_ASSERT_EQUAL(TilePacer::MinWindowBytes, slow.getWindowBytes());
+
+    // LAN: 50 MB/s and 2 ms; the window grows to keep the link busy.
+    TilePacer fast;
+    simulate(fast, 200, 16 * 1024, 50 * 1024 * 1024, std::chrono::milliseconds(2));
+    LOK_ASSERT(fast.getBandwidth() > 40 * 1024 * 1024);
+    LOK_ASSERT_MESSAGE("Expected a larger window, have " + std::to_string(fast.getWindowBytes()),
+                       fast.getWindowBytes() > 2 * TilePacer::MinWindowBytes);
+
+    // A client that stops acknowledging.
+    const auto now = std::chrono::steady_clock::now();
+    fast.sent(1000, 1024, now - std::chrono::seconds(20));
+    fast.sent(1001, 1024, now - std::chrono::seconds(9));
+    fast.sent(1002, 1024, now);
+    LOK_ASSERT_EQUAL(std::size_t(3 * 1024), fast.getBytesOnFly());
+    LOK_ASSERT_EQUAL(std::size_t(2), fast.expire(now, std::chrono::seconds(10),
+                                                 std::chrono::seconds(8)));
+    LOK_ASSERT_EQUAL(std::size_t(1), fast.getTilesOnFly());
+    LOK_ASSERT_EQUAL(std::size_t(1024), fast.getBytesOnFly());
+}
+
+void WhiteBoxTests::testProcessStats()
+{
+    constexpr std::string_view testname = __func__;
+
+    std::size_t pssKb = 0;
+    std::size_t dirtyKb = 0;
+    LOK_ASSERT(ProcessStatsCollector::parseSMaps("55d0a0000000-55d0a0021000 r--p 00000000 08:01 42\n"
+                                                 "Rss:                 132 kB\n"
+                                                 "Pss:                  40 kB\n"
+                                                 "Private_Dirty:         8 kB\n"
+                                                 "Pss:                 100 kB\n"
+                                                 "Shared_Dirty:         64 kB\n"
+                                                 "Private_Dirty:        12 kB",
+                                                 pssKb, dirtyKb));
+    LOK_ASSERT_EQUAL(std::size_t(140), pssKb);
+    LOK_ASSERT_EQUAL(std::size_t(20), dirtyKb);
+    LOK_ASSERT(!ProcessStatsCollector::parseSMaps("", pssKb, dirtyKb));
+
+    // The command may have spaces and parentheses.
+    std::size_t jiffies = 0;
+    std::size_t threads = 0;
+    std::size_t rssPages = 0;
+    LOK_ASSERT(ProcessStatsCollector::parseStat(
+        "4242 (kit (x) y) S 1 2 3 0 -1 4194560 100 0 0 0 70 30 0 0 20 0 9 0 1000 4096 512 "
+        "18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 3 0 0 0 0 0",
+        jiffies, threads, rssPages));
+    LOK_ASSERT_EQUAL(std::size_t(100), jiffies);
+    LOK_ASSERT_EQUAL(std::size_t(9), threads);
+    LOK_ASSERT_EQUAL(std::size_t(512), rssPages);
+    LOK_ASSERT(!ProcessStatsCollector::parseStat("4242 (kit) S 1 2 3", jiffies, threads, rssPages));
+
+    // Sample ourselves, and a child until it exits.
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::map<pid_t, ProcessStatsCollector::Sample> samples;
+    ProcessStatsCollector collector(
+        [&](std::vector<ProcessStatsCollector::Sample>&& changed)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& sample : changed)
+                samples[sample.pid] = sample;
+            cond.notify_all();
+        });
+
+    const pid_t child = fork();
+    if (child == 0)
+    {
+        pause();
+        _exit(0);
+    }
+
+    // Don't leave it paused behind us when an assertion fails.
+    struct ChildGuard
+    {
+        pid_t pid;
+
+        void reap()
+        {
+            if (pid > 0)
+            {
+                kill(pid, SIGKILL);
+                waitpid(pid, nullptr, 0);
+                pid = 0;
+            }
+        }
+
+        ~ChildGuard() { reap(); }
+    } childGuard{ child };
+
+    collector.add(getpid());
+    collector.add(child);
+    collector.start(std::chrono::milliseconds(50));
+
+    std::unique_lock<std::mutex> lock(mutex);
+    LOK_ASSERT(cond.wait_for(lock, std::chrono::seconds(10),
+                             [&] { return samples.count(getpid()) && samples.count(child); }));
+    LOK_ASSERT(samples[getpid()].pssKb > 0);
+    LOK_ASSERT(samples[getpid()].rssKb > 0);
+    LOK_ASSERT(samples[getpid()].threads > 1);
+    LOK_ASSERT(!samples[child].exited);
+
+    lock.unlock();
+    childGuard.reap();
+    lock.lock();
+
+    LOK_ASSERT(cond.wait_for(lock, std::chrono::seconds(10),
+                             [&] { return samples[child].exited; }));
+    lock.unlock();
+
+    collector.stop();
+}
+
+void WhiteBoxTests::testMemoryPressure()
+{
+    constexpr std::string_view testname = __func__;
+
+    double someAvg10 = -1;
+    double fullAvg10 = -1;
+    LOK_ASSERT(MemoryPressure::parsePsi("some avg10=12.50 avg60=3.00 avg300=1.00 total=123\n"
+                                        "full avg10=2.25 avg60=0.00 avg300=0.00 total=0\n",
+                                        someAvg10, fullAvg10));
+    LOK_ASSERT_EQUAL(12.5, someAvg10);
+    LOK_ASSERT_EQUAL(2.25, fullAvg10);
+    LOK_ASSERT(!MemoryPressure::parsePsi("", someAvg10, fullAvg10));
+
+    LOK_ASSERT_EQUAL(uint64_t(15),
+                     MemoryPressure::parseEvents("low 0\nhigh 12\nmax 3\noom_group_kill 7\n",
+                                                 { "high", "max" }));
+
+    // One step at a time while under pressure, all the way back once it is gone for long enough.
+    MemoryPressure pressure(10, std::chrono::seconds(10), std::chrono::seconds(60));
+    const auto now = std::chrono::steady_clock::now();
+    LOK_ASSERT(!pressure.update(false, now));
+    LOK_ASSERT_EQUAL(MemoryPressure::Level::None, pressure.getLevel());
+
+    LOK_ASSERT(pressure.update(true, now));
+    LOK_ASSERT_EQUAL(MemoryPressure::Level::ShrinkCaches, pressure.getLevel());
+    LOK_ASSERT(!pressure.update(true, now + std::chrono::seconds(5)));
+    LOK_ASSERT(pressure.update(true, now + std::chrono::seconds(10)));
+    LOK_ASSERT_EQUAL(MemoryPressure::Level::DropCaches, pressure.getLevel());
+    LOK_ASSERT(pressure.update(true, now + std::chrono::seconds(20)));
+    LOK_ASSERT_EQUAL(MemoryPressure::Level::TrimKits, pressure.getLevel());
+    LOK_ASSERT(pressure.update(true, now + std::chrono::seconds(30)));
+    LOK_ASSERT_EQUAL(MemoryPressure::Level::UnloadDocs, pressure.getLevel());
+
+    // Another document to unload at each step.
+    LOK_ASSERT(pressure.update(true, now + std::chrono::seconds(40)));
+    LOK_ASSERT_EQUAL(MemoryPressure::Level::UnloadDocs, pressure.getLevel());
+    LOK_ASSERT_EQUAL(uint64_t(5), pressure.getSteps());
+
+    LOK_ASSERT(!pressure.update(false, now + std::chrono::seconds(99)));
+    LOK_ASSERT(pressure.update(false, now + std::chrono::seconds(100)));
+    LOK_ASSERT_EQUAL(MemoryPressure::Level::None, pressure.getLevel());
+    LOK_ASSERT(!pressure.update(false, now + std::chrono::seconds(200)));
 }
 
 CPPUNIT_TEST_SUITE_REGISTRATION(WhiteBoxTests);
@@ -15,14 +15,23 @@
 #include "config.h"
 
 #include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <map>
 
 #include <common/Png.hpp>
+#include <common/Simd.hpp>
 #include <kit/Delta.hpp>
+#include <kit/DeltaSimd.h>
 
 using Pixmap = std::vector<char>;
 
 std::vector<Pixmap> pixmaps;
 
+constexpr int TileSize = 256;
+constexpr size_t TilePixels = TileSize * TileSize;
+
 class DeltaTests {
 public:
     static void rleBitmap(Pixmap &pix)
@@ -30,39 +39,99 @@ public:
         TileLocation loc = { 0, 0, 0, 0, CanonicalViewId::None, 0 };
         DeltaGenerator::DeltaData rleData(
             1 /*wid*/, reinterpret_cast<unsigned char *>(pix.data()),
-            0, 0, 256, 256, loc, 256, 256);
+            0, 0, TileSize, TileSize, loc, TileSize, TileSize);
     }
 
-    static void timeRLE(const char *description)
+    /// Delta between a tile and its scrolled version, which hunts for moved rows.
+    static void shiftDelta(Pixmap &prev, Pixmap &cur)
     {
-        std::cout << "Benchmark " << description << "\n";
+        TileLocation loc = { 0, 0, 0, 0, CanonicalViewId::None, 0 };
+        DeltaGenerator::DeltaData prevData(
+            1 /*wid*/, reinterpret_cast<unsigned char *>(prev.data()),
+            0, 0, TileSize, TileSize, loc, TileSize, TileSize);
+        DeltaGenerator::DeltaData curData(
+            2 /*wid*/, reinterpret_cast<unsigned char *>(cur.data()),
+            0, 0, TileSize, TileSize, loc, TileSize, TileSize);
 
-        int deltas = 0;
-        const auto start = std::chrono::steady_clock::now();
+        DeltaGenerator gen;
+        std::vector<char> output;
+        gen.makeDelta(prevData, curData, output, LOK_TILEMODE_BGRA);
+    }
+};
 
-        // check we have enough work:
-        int maxIters = (50000 + pixmaps.size() - 1) / pixmaps.size();
-        for (int it = 0; it < maxIters; ++it)
-        {
-//          std::cerr << "iter " << it << "\n";
-            for (Pixmap &pix : pixmaps)
-            {
-                deltas++;
-                rleBitmap(pix);
-            }
-        }
+/// The scalar blend, as in Watermark::alphaBlend().
+static void blendCpu(unsigned char* t, const unsigned char* f, size_t pixels)
+{
+    for (size_t x = 0; x < pixels; ++x, t += 4, f += 4)
+    {
+        if (t[3] != 255)
+            continue;
 
-        const auto end = std::chrono::steady_clock::now();
+        const unsigned inv = 255 - f[3];
+        for (int i = 0; i < 4; ++i)
+            t[i] = std::min(255u, f[i] + (t[i] * inv) / 255);
+    }
+}
 
-        std::cout << "took: " <<
-            std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms - ";
+static void unpremultiply(Pixmap &pix)
+{
+    png_row_info info;
+    std::memset(&info, 0, sizeof(info));
+    info.rowbytes = TileSize * 4;
+    for (int y = 0; y < TileSize; ++y)
+        Png::unpremultiply_bgra_data(nullptr, &info,
+                                     reinterpret_cast<png_bytep>(pix.data()) + y * info.rowbytes);
+}
 
-        assert(deltas && "div by zero otherwise");
+static void blend(Pixmap &to, const Pixmap &from)
+{
+    auto t = reinterpret_cast<unsigned char*>(to.data());
+    auto f = reinterpret_cast<const unsigned char*>(from.data());
+    if (!simd_blendPremultiplied(simd::getLevel(), t, f, TilePixels, 1, 0))
+        blendCpu(t, f, TilePixels);
+}
 
-        std::cout << "time/rle: " <<
-            (1.0*std::chrono::duration_cast<std::chrono::microseconds>(end - start).count())/deltas << "us\n";
+static const char* levelName(int level)
+{
+    switch (level)
+    {
+        case SIMD_NEON: return "NEON";
+        case SIMD_AVX2: return "AVX2";
+        case SIMD_AVX512: return "AVX-512";
+        default: return "scalar";
     }
-};
+}
+
+/// Restrict the kernels to the given level.
+static void setLevel(int level, bool hasAVX2, bool hasAVX512, bool hasNEON)
+{
+    simd::HasAVX2 = hasAVX2 && level >= SIMD_AVX2;
+    simd::HasAVX512 = hasAVX512 && level >= SIMD_AVX512;
+    simd::HasNEON = hasNEON && level == SIMD_NEON;
+}
+
+/// Runs fn over all the pixmaps for a while, returns the mega-pixels per second.
+static double timeKernel(const char* kernel, int level, const std::function<void(size_t)>& fn)
+{
+    size_t pixels = 0;
+    const auto start = std::chrono::steady_clock::now();
+    auto end = start;
+    do
+    {
+        for (size_t i = 0; i < pixmaps.size(); ++i)
+        {
+            fn(i);
+            pixels += TilePixels;
+        }
+        end = std::chrono::steady_clock::now();
+    } while (end - start < std::chrono::milliseconds(500));
+
+    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    const double mps = static_cast<double>(pixels) / us;
+    std::cout << "Benchmark " << kernel << ' ' << levelName(level) << ": took "
+              << us / 1000 << "ms - " << std::fixed << std::setprecision(1) << mps << " MP/s\n";
+    return mps;
+}
 
 int main (int argc, char **argv)
 {
@@ -70,16 +139,120 @@ int main (int argc, char **argv)
     {
         uint32_t height, width, rowBytes;
         pixmaps.push_back(Png::loadPng(argv[i], height, width, rowBytes));
-//        std::cout << "Loaded: " << argv[i] << " " << width << "x" << height << "\n";
+        if (width != TileSize || height != TileSize)
+        {
+            std::cerr << "Expected " << TileSize << 'x' << TileSize << " tiles, but " << argv[i]
+                      << " is " << width << 'x' << height << '\n';
+            return 1;
+        }
     }
 
-    DeltaTests::timeRLE("CPU");
+    if (pixmaps.empty())
+    {
+        std::cerr << "Usage: coolbench <" << TileSize << 'x' << TileSize << " tile png>...\n";
+        return 1;
+    }
+
+    if (simd::init())
+        simd_deltaInit();
+
+    const bool hasAVX2 = simd::HasAVX2;
+    const bool hasAVX512 = simd::HasAVX512;
+    const bool hasNEON = simd::HasNEON;
+
+    std::vector<int> levels = { SIMD_NONE };
+    if (hasNEON)
+        levels.push_back(SIMD_NEON);
+    if (hasAVX2)
+        levels.push_back(SIMD_AVX2);
+    if (hasAVX512)
+        levels.push_back(SIMD_AVX512);
+
+    // Scrolled by a few rows, and a semi-transparent overlay to blend.
+    std::vector<Pixmap> scrolled, overlays;
+    for (const Pixmap &pix : pixmaps)
+    {
+        const size_t rowBytes = TileSize * 4;
+        const size_t shift = 3 * rowBytes;
+        Pixmap moved(pix.size());
+        std::memcpy(moved.data(), pix.data() + shift, pix.size() - shift);
+        std::memcpy(moved.data() + pix.size() - shift, pix.data(), shift);
+        scrolled.push_back(std::move(moved));
+
+        Pixmap overlay(pix.size());
+        for (size_t i = 0; i < pix.size(); i += 4)
+        {
+            const unsigned char alpha = (i / 4) % 128; // premultiplied white
+            std::memset(overlay.data() + i, alpha, 4);
+        }
+        overlays.push_back(std::move(overlay));
+    }
+
+    // The scalar results to check the vectorized ones against.
+    std::vector<Pixmap> unpremultiplied, blended;
 
-    simd::init();
+    bool mismatch = false;
+    std::map<std::string, std::vector<double>> results;
+    Pixmap scratch(TilePixels * 4);
+    for (int level : levels)
+    {
+        setLevel(level, hasAVX2, hasAVX512, hasNEON);
+
+        results["rle"].push_back(timeKernel("rle", level, [](size_t i)
+            { DeltaTests::rleBitmap(pixmaps[i]); }));
 
-    DeltaTests::timeRLE("SIMD");
+        results["shift-delta"].push_back(timeKernel("shift-delta", level, [&](size_t i)
+            { DeltaTests::shiftDelta(pixmaps[i], scrolled[i]); }));
+
+        // These work in place, so include copying the source.
+        results["unpremultiply"].push_back(timeKernel("unpremultiply", level, [&](size_t i)
+            {
+                std::memcpy(scratch.data(), pixmaps[i].data(), scratch.size());
+                unpremultiply(scratch);
+            }));
+
+        results["blend"].push_back(timeKernel("blend", level, [&](size_t i)
+            {
+                std::memcpy(scratch.data(), pixmaps[i].data(), scratch.size());
+                blend(scratch, overlays[i]);
+            }));
+
+        for (size_t i = 0; i < pixmaps.size(); ++i)
+        {
+            Pixmap unpre = pixmaps[i];
+            unpremultiply(unpre);
+            Pixmap overlaid = pixmaps[i];
+            blend(overlaid, overlays[i]);
+
+            if (level == SIMD_NONE)
+            {
+                unpremultiplied.push_back(std::move(unpre));
+                blended.push_back(std::move(overlaid));
+                continue;
+            }
+
+            if (unpre != unpremultiplied[i] || overlaid != blended[i])
+            {
+                std::cerr << "ERROR: " << levelName(level) << " results differ from scalar for "
+                          << argv[i + 1] << '\n';
+                mismatch = true;
+            }
+        }
+    }
+
+    std::cout << "\n" << std::setw(16) << "MP/s";
+    for (int level : levels)
+        std::cout << std::setw(10) << levelName(level);
+    std::cout << std::setw(10) << "speedup\n";
+    for (const auto& it : results)
+    {
+        std::cout << std::setw(16) << it.first;
+        for (double mps : it.second)
+            std::cout << std::setw(10) << mps;
+        std::cout << std::setw(9) << it.second.back() / it.second.front() << "x\n";
+    }
 
-    return 0;
+    return mismatch ? 1 : 0;
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -15,13 +15,16 @@
 #include <iomanip>
 #include <chrono>
 #include <cstring>
+#include <deque>
 #include <unordered_map>
 
 #include "Socket.hpp"
 #include "WebSocketHandler.hpp"
 #include <TraceFile.hpp>
 #include <Util.hpp>
+#include <common/JsonUtil.hpp>
 #include <common/Log.hpp>
+#include <common/Rectangle.hpp>
 #include <net/Ssl.hpp>
 #include <wsd/TileDesc.hpp>
 #if ENABLE_SSL
@@ -135,6 +138,61 @@ struct Histogram {
 
 };
 
+// keep every latency, to report percentiles
+struct LatencySamples {
+    std::vector<size_t> _samplesUs;
+
+    void add(std::chrono::steady_clock::duration duration)
+    {
+        _samplesUs.push_back(
+            std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    }
+
+    /// The nearest-rank @percentile of the samples, in microseconds.
+    size_t getPercentileUs(double percentile)
+    {
+        if (_samplesUs.empty())
+            return 0;
+
+        const size_t rank = ::ceil(percentile / 100 * _samplesUs.size());
+        const auto nth = _samplesUs.begin() + std::clamp<size_t>(rank, 1, _samplesUs.size()) - 1;
+        std::nth_element(_samplesUs.begin(), nth, _samplesUs.end());
+        return *nth;
+    }
+
+    void dump(std::ostream& os, const char* legend)
+    {
+        if (_samplesUs.empty())
+            return;
+
+        os << legend << ' ' << _samplesUs.size() << " items, " << std::fixed
+           << std::setprecision(1) << "p50: " << getPercentileUs(50) / 1000.0
+           << " ms, p95: " << getPercentileUs(95) / 1000.0
+           << " ms, p99: " << getPercentileUs(99) / 1000.0
+           << " ms, max: " << getPercentileUs(100) / 1000.0 << " ms\n"
+           << std::defaultfloat;
+    }
+
+    std::vector<PerfMetricInfo> getLatencyStats(const std::string& typeOfLatency,
+                                                const std::string& testPhase)
+    {
+        std::vector<PerfMetricInfo> latencyStatsList;
+        if (_samplesUs.empty())
+            return latencyStatsList;
+
+        latencyStatsList.emplace_back(testPhase, typeOfLatency + " Count", _samplesUs.size());
+        for (const int percentile : { 50, 95, 99 })
+        {
+            latencyStatsList.emplace_back(testPhase,
+                                          typeOfLatency + " p" + std::to_string(percentile) +
+                                              " (us)",
+                                          getPercentileUs(percentile));
+        }
+
+        return latencyStatsList;
+    }
+};
+
 struct Stats {
     Stats() :
         _start(std::chrono::steady_clock::now()),
@@ -155,6 +213,13 @@ struct Stats {
     size_t _connections;
     Histogram _pingLatency;
     Histogram _tileLatency;
+    LatencySamples _keyLatency; ///< From a keystroke to the next invalidation.
+    LatencySamples _tileRoundTrip; ///< From requesting a tile to getting it.
+    LatencySamples _openLatency; ///< From load to the first status.
+
+    // sampled from the server's admin console
+    std::vector<size_t> _serverCpuPercent;
+    std::vector<size_t> _serverMemoryKb;
 
     size_t _peakMemoryUsage;
     size_t _startUpMemoryUsage;
@@ -245,6 +310,21 @@ struct Stats {
         }
     }
 
+    void dumpServerSamples(std::ostream& os, const char* legend, const std::vector<size_t>& samples,
+                           const char* unit)
+    {
+        if (samples.empty())
+            return;
+
+        size_t total = 0;
+        for (const size_t sample : samples)
+            total += sample;
+
+        const auto [min, max] = std::minmax_element(samples.begin(), samples.end());
+        os << legend << ' ' << samples.size() << " samples, min: " << *min << unit
+           << ", avg: " << total / samples.size() << unit << ", max: " << *max << unit << '\n';
+    }
+
     void dump(std::ostream& os)
     {
         const auto now = std::chrono::steady_clock::now();
@@ -255,6 +335,11 @@ struct Stats {
         os << "  tiles: " << _tileCount << " => TPS: " << ((_tileCount * 1000.0) / runMs) << '\n';
         _pingLatency.dump(os, "ping latency:");
         _tileLatency.dump(os, "tile latency:");
+        _keyLatency.dump(os, "  keystroke to invalidation:");
+        _tileRoundTrip.dump(os, "  tile round-trip:");
+        _openLatency.dump(os, "  document open:");
+        dumpServerSamples(os, "  server CPU:", _serverCpuPercent, "%");
+        dumpServerSamples(os, "  server memory:", _serverMemoryKb, " kB");
         size_t recvKbps = (_bytesRecvd * 1000) / (_connections * runMs * 1024);
         size_t sentKbps = (_bytesSent * 1000) / (_connections * runMs * 1024);
         os << "  we sent " << Util::getHumanizedBytes(_bytesSent) << " (" << sentKbps << " kB/s) "
@@ -309,6 +394,29 @@ struct Stats {
             {
                 _perfStatsList.push_back(statsList[i]);
             }
+
+            statsList = _keyLatency.getLatencyStats("KL", phaseAsString);
+            _perfStatsList.insert(_perfStatsList.end(), statsList.begin(), statsList.end());
+
+            statsList = _tileRoundTrip.getLatencyStats("TRT", phaseAsString);
+            _perfStatsList.insert(_perfStatsList.end(), statsList.begin(), statsList.end());
+
+            statsList = _openLatency.getLatencyStats("OL", phaseAsString);
+            _perfStatsList.insert(_perfStatsList.end(), statsList.begin(), statsList.end());
+
+            if (!_serverMemoryKb.empty())
+            {
+                _perfStatsList.emplace_back(
+                    phaseAsString, "Server peak memory (kB)",
+                    *std::max_element(_serverMemoryKb.begin(), _serverMemoryKb.end()));
+            }
+
+            if (!_serverCpuPercent.empty())
+            {
+                _perfStatsList.emplace_back(
+                    phaseAsString, "Server peak CPU (%)",
+                    *std::max_element(_serverCpuPercent.begin(), _serverCpuPercent.end()));
+            }
         }
     }
 
@@ -388,12 +496,27 @@ class StressSocketHandler : public WebSocketHandler
     std::shared_ptr<Stats> _stats;
     std::chrono::steady_clock::time_point _lastTile;
 
+    const float _latencyFactor;
+    const double _speed; ///< How many times faster than recorded to replay.
+    const double _jitter; ///< The fraction by which to vary each gap at random.
+    std::chrono::steady_clock::time_point _nextSend;
+    int64_t _lastTimestampUs;
+
+    // when we asked for what we measure the latency of
+    std::deque<std::chrono::steady_clock::time_point> _pendingKeys;
+    /// The cursor of our view, in twips, where our keystrokes edit.
+    Util::Rectangle _cursorArea;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> _pendingTiles;
+    std::chrono::steady_clock::time_point _loadSent;
+    bool _loading;
+
 public:
     StressSocketHandler(SocketPoll& poll, /* bad style */
                         const std::shared_ptr<Stats>& stats, const std::string& uri,
                         const std::string& trace,
                         const std::chrono::milliseconds delay = std::chrono::milliseconds::zero(),
-                        const float latencyFactor = 1)
+                        const float latencyFactor = 1, const double speed = 1,
+                        const double jitter = 0)
         : WebSocketHandler(true, true)
         , _poll(poll)
         , _reader(trace, latencyFactor)
@@ -401,14 +524,21 @@ public:
         , _uri(uri)
         , _trace(trace)
         , _stats(stats)
+        , _latencyFactor(latencyFactor)
+        , _speed(speed)
+        , _jitter(jitter)
+        , _lastTimestampUs(_reader.getEpochStart())
+        , _loading(false)
     {
         assert(_stats && "stats must be provided");
+        assert(_speed > 0 && "speed must be positive");
 
         static std::atomic<int> number;
         _logPre = '[' + std::to_string(++number) + "] ";
         LOG_TST("Attempt connect to " << uri << " for trace " << _trace);
-        getNextRecord();
         _start = std::chrono::steady_clock::now() + delay;
+        _nextSend = _start;
+        getNextRecord();
         _nextPing = _start + std::chrono::milliseconds(Util::rng::getNext() % 1000);
         _lastTile = _start;
     }
@@ -437,17 +567,12 @@ public:
             _nextPing += std::chrono::seconds(1);
         }
 
-        int64_t nextTime = -1;
-        while (nextTime <= 0) {
-            nextTime = std::chrono::duration_cast<std::chrono::microseconds>(
-                std::chrono::microseconds((_next.getTimestampUs() - _reader.getEpochStart()) * TRACE_MULTIPLIER)
-                + _start - now).count();
-            if (nextTime <= 0)
-            {
-                sendTraceMessage();
-                events = WebSocketHandler::getPollEvents(now, timeoutMaxMicroS);
-                break;
-            }
+        const int64_t nextTime =
+            std::chrono::duration_cast<std::chrono::microseconds>(_nextSend - now).count();
+        if (nextTime <= 0)
+        {
+            sendTraceMessage();
+            events = WebSocketHandler::getPollEvents(now, timeoutMaxMicroS);
         }
 
         //        LOG_TST( "next event in " << nextTime << " us");
@@ -473,7 +598,19 @@ public:
                 break;
             }
         }
-        return _next.getDir () != TraceFileRecord::Direction::Invalid;
+
+        if (_next.getDir() == TraceFileRecord::Direction::Invalid)
+            return false;
+
+        // The gap since the previous message, compressed and jittered.
+        double gapUs = (static_cast<int64_t>(_next.getTimestampUs()) - _lastTimestampUs) *
+                       static_cast<double>(TRACE_MULTIPLIER) / _speed;
+        if (_jitter > 0)
+            gapUs *= 1 + _jitter * ((Util::rng::getNext() % 2001) / 1000.0 - 1);
+
+        _lastTimestampUs = _next.getTimestampUs();
+        _nextSend += std::chrono::microseconds(static_cast<int64_t>(gapUs));
+        return true;
     }
 
     void performWrites(std::size_t capacity) override
@@ -501,6 +638,7 @@ public:
         {
             LOG_TST(_logPre << "Send: '" << msg << "'");
             sendMessage(msg);
+            trackRequest(msg);
         }
 
         if (!getNextRecord())
@@ -549,6 +687,82 @@ public:
         return out;
     }
 
+    /// Notes when we sent what we measure the latency of the response to.
+    void trackRequest(const std::string& msg)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        StringVector tokens = StringVector::tokenize(COOLProtocol::getFirstLine(msg));
+
+        if ((tokens.equals(0, "key") && tokens.equals(1, "type=input")) ||
+            tokens.equals(0, "textinput"))
+        {
+            _pendingKeys.push_back(now);
+        }
+        else if (tokens.equals(0, "load"))
+        {
+            _loadSent = now;
+            _loading = true;
+        }
+        else if (tokens.equals(0, "tile") || tokens.equals(0, "tilecombine"))
+        {
+            // Requests that are never answered, eg. when the view moved on, pile up.
+            if (_pendingTiles.size() > 4096)
+                _pendingTiles.clear();
+
+            const TileCombined tileCombined = TileCombined::parse(tokens);
+            for (const TileDesc& tile : tileCombined.getTiles())
+                _pendingTiles.emplace(getTileKey(tile), now); // The first request counts.
+        }
+    }
+
+    /// Identifies a tile in both a request and its response, which differ in the view id.
+    static std::string getTileKey(const TileDesc& tile)
+    {
+        std::ostringstream key;
+        key << tile.getPart() << ':' << tile.getEditMode() << ':' << tile.getTilePosX() << ':'
+            << tile.getTilePosY() << ':' << tile.getTileWidth() << ':' << tile.getTileHeight();
+        return key.str();
+    }
+
+    /// Notes where our cursor is, from the JSON of invalidatecursor:.
+    void updateCursorArea(const std::string& json)
+    {
+        Poco::JSON::Object::Ptr object;
+        std::string rectangle;
+        if (!JsonUtil::parseJSON(json, object) ||
+            !JsonUtil::findJSONValue(object, "rectangle", rectangle))
+            return;
+
+        const StringVector rectangleTokens = StringVector::tokenize(rectangle, ',');
+        int x = 0, y = 0, w = 0, h = 0;
+        if (rectangleTokens.size() < 4 || !COOLProtocol::stringToInteger(rectangleTokens[0], x) ||
+            !COOLProtocol::stringToInteger(rectangleTokens[1], y) ||
+            !COOLProtocol::stringToInteger(rectangleTokens[2], w) ||
+            !COOLProtocol::stringToInteger(rectangleTokens[3], h))
+            return;
+
+        // The cursor of text is a line, and so has no surface.
+        _cursorArea = Util::Rectangle(x, y, std::max(w, 1), std::max(h, 1));
+    }
+
+    /// Whether the invalidation in @tokens may come from our keystrokes. Invalidations carry
+    /// no view, so we take those that cover our cursor, as editing invalidates around it.
+    bool isNearCursor(const StringVector& tokens) const
+    {
+        // Until we know where our cursor is, and for whole parts, anything may be ours.
+        if (!_cursorArea.hasSurface() || tokens.size() < 2 || tokens[1].starts_with("EMPTY"))
+            return true;
+
+        int x = 0, y = 0, width = 0, height = 0;
+        if (!COOLProtocol::getTokenInteger(tokens, "x", x) ||
+            !COOLProtocol::getTokenInteger(tokens, "y", y) ||
+            !COOLProtocol::getTokenInteger(tokens, "width", width) ||
+            !COOLProtocol::getTokenInteger(tokens, "height", height))
+            return true;
+
+        return Util::Rectangle(x, y, width, height).intersects(_cursorArea);
+    }
+
     // handle incoming messages
     void handleMessage(const std::vector<char> &data) override
     {
@@ -560,6 +774,25 @@ public:
 
         _stats->accumulateRecv(tokens[0], data.size());
 
+        if (_loading && tokens.equals(0, "status:"))
+        {
+            _stats->_openLatency.add(now - _loadSent);
+            _loading = false;
+        }
+        else if (tokens.equals(0, "invalidatecursor:"))
+        {
+            // Only sent for our own view; the others' come as invalidateviewcursor:.
+            updateCursorArea(firstLine.substr(tokens[0].size()));
+        }
+        else if (tokens.equals(0, "invalidatetiles:") && !_pendingKeys.empty() &&
+                 isNearCursor(tokens))
+        {
+            // One invalidation may show several keystrokes.
+            for (const auto& sent : _pendingKeys)
+                _stats->_keyLatency.add(now - sent);
+            _pendingKeys.clear();
+        }
+
         if (tokens.equals(0, "tile:")) {
             // accumulate latencies
             _stats->_tileLatency.addTime(std::chrono::duration_cast<std::chrono::milliseconds>(now - _lastTile).count());
@@ -569,6 +802,13 @@ public:
             // eg. tileprocessed tile=0:9216:0:3072:3072:0
             TileDesc desc = TileDesc::parse(tokens);
 
+            const auto it = _pendingTiles.find(getTileKey(desc));
+            if (it != _pendingTiles.end())
+            {
+                _stats->_tileRoundTrip.add(now - it->second);
+                _pendingTiles.erase(it);
+            }
+
             sendMessage("tileprocessed tile=" + desc.generateID());
             LOG_TST(_logPre << "Sent tileprocessed tile= " << desc.generateID());
         }
@@ -597,7 +837,8 @@ public:
                 shutdown(true, "bye");
                 auto handler =
                     std::make_shared<StressSocketHandler>(_poll, _stats, _uri, _trace,
-                                                          /*delay=*/std::chrono::seconds(1));
+                                                          /*delay=*/std::chrono::seconds(1),
+                                                          _latencyFactor, _speed, _jitter);
                 _poll.insertNewWebSocketSync(Poco::URI(_uri), handler);
                 return;
             }
@@ -618,7 +859,9 @@ public:
 
     static void addPollFor(SocketPoll& poll, const std::string& server, const std::string& filePath,
                            const std::string& tracePath, const std::shared_ptr<Stats>& optStats,
-                           float latencyFactor = 1)
+                           float latencyFactor = 1,
+                           std::chrono::milliseconds delay = std::chrono::milliseconds::zero(),
+                           double speed = 1, double jitter = 0)
     {
         assert(optStats && "optStats must be provided");
 
@@ -629,11 +872,108 @@ public:
         std::string uri = server + "/cool/" + wrap + "/ws";
 
         auto handler = std::make_shared<StressSocketHandler>(
-            poll, optStats, file, tracePath, /*delay=*/std::chrono::seconds::zero(), latencyFactor);
+            poll, optStats, file, tracePath, delay, latencyFactor, speed, jitter);
         poll.insertNewWebSocketSync(Poco::URI(uri), handler);
 
         optStats->addConnection();
     }
 };
 
+/// Samples the CPU and memory use of the server, from its admin console.
+class AdminMonitorHandler : public WebSocketHandler
+{
+    std::shared_ptr<Stats> _stats;
+    std::string _jwt;
+    bool _connecting;
+    bool _monitoring;
+
+public:
+    AdminMonitorHandler(const std::shared_ptr<Stats>& stats, std::string jwt)
+        : WebSocketHandler(true, true)
+        , _stats(stats)
+        , _jwt(std::move(jwt))
+        , _connecting(true)
+        , _monitoring(true)
+    {
+    }
+
+    /// Until the server drops us, eg. for a bad token.
+    bool isMonitoring() const { return _monitoring; }
+
+    void performWrites(std::size_t capacity) override
+    {
+        if (_connecting)
+        {
+            LOG_TST("Admin console connected, subscribing to the stats");
+            _connecting = false;
+            sendMessage("auth jwt=" + _jwt);
+            sendMessage("subscribe mem_stats cpu_stats");
+        }
+
+        return WebSocketHandler::performWrites(capacity);
+    }
+
+    int getPollEvents(std::chrono::steady_clock::time_point now,
+                      int64_t& timeoutMaxMicroS) override
+    {
+        if (_connecting)
+            return POLLOUT;
+
+        return WebSocketHandler::getPollEvents(now, timeoutMaxMicroS);
+    }
+
+    void onDisconnect() override
+    {
+        LOG_TST("Admin console dis-connected");
+        _monitoring = false;
+        WebSocketHandler::onDisconnect();
+    }
+
+    void handleMessage(const std::vector<char>& data) override
+    {
+        const std::string firstLine = COOLProtocol::getFirstLine(data.data(), data.size());
+        StringVector tokens = StringVector::tokenize(firstLine);
+
+        // eg. mem_stats 123456 (kB) and cpu_stats 42 (% of a core)
+        uint64_t value = 0;
+        if (tokens.size() == 2 && COOLProtocol::stringToUInt64(tokens[1], value))
+        {
+            if (tokens.equals(0, "mem_stats"))
+                _stats->_serverMemoryKb.push_back(value);
+            else if (tokens.equals(0, "cpu_stats"))
+                _stats->_serverCpuPercent.push_back(value);
+        }
+        else if (tokens.equals(0, "InvalidAuthToken") || tokens.equals(0, "NotAuthenticated"))
+        {
+            std::cerr << "Admin console refused us: " << firstLine << '\n';
+            _monitoring = false;
+        }
+    }
+
+    /// Logs into the admin console of @server with @user and @password.
+    /// Returns the token to authenticate the websocket with, or empty on failure.
+    static std::string getToken(const std::string& server, const std::string& user,
+                                const std::string& password)
+    {
+        // ws://host:port -> http://host:port, wss:// -> https://
+        const std::string uri = "http" + server.substr(std::min<size_t>(2, server.size()));
+        std::shared_ptr<http::Session> session = http::Session::create(uri);
+        if (!session)
+            return std::string();
+
+        http::Request request("/browser/dist/admin/admin.html");
+        request.setBasicAuth(user, password);
+        const std::shared_ptr<const http::Response> response = session->syncRequest(request);
+        if (!response || response->statusCode() != http::StatusCode::OK)
+            return std::string();
+
+        // eg. jwt=<token>; path=/browser/dist/; secure
+        const std::string cookie = response->get("Set-Cookie");
+        if (!cookie.starts_with("jwt="))
+            return std::string();
+
+        return cookie.substr(4, cookie.find(';') - 4);
+    }
+};
+
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
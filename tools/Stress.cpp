@@ -13,6 +13,9 @@
 
 #include <tools/Replay.hpp>
 
+#include <common/FileUtil.hpp>
+
+#include <map>
 #include <sysexits.h>
 
 #include <Poco/Util/Application.h>
@@ -25,12 +28,31 @@ int ClientPortNumber = DEFAULT_CLIENT_PORT_NUMBER;
 class Stress: public Poco::Util::Application
 {
 public:
-    Stress() {}
+    Stress()
+        : _users(0)
+        , _documents(1)
+        , _speed(1)
+        , _jitter(0)
+        , _rampUpSecs(0)
+    {
+    }
 protected:
     void defineOptions(Poco::Util::OptionSet& options) override;
     void printHelp();
     void handleOption(const std::string& name, const std::string& value) override;
     int  main(const std::vector<std::string>& args) override;
+
+private:
+    /// Adds the virtual users, replaying the traces of @args, over copies of their documents.
+    void addUsers(SocketPoll& poll, const std::vector<std::string>& args,
+                  const std::string& tmpDir, const std::shared_ptr<Stats>& stats);
+
+    std::size_t _users; ///< The number of virtual users, 0 for one per trace.
+    std::size_t _documents; ///< The number of documents they share.
+    double _speed;
+    double _jitter;
+    std::size_t _rampUpSecs;
+    std::string _admin; ///< user:password of the admin console, to sample the server.
 };
 
 void Stress::defineOptions(Poco::Util::OptionSet& optionSet)
@@ -39,6 +61,24 @@ void Stress::defineOptions(Poco::Util::OptionSet& optionSet)
 
     optionSet.addOption(Poco::Util::Option("help", "", "Display help information on command line arguments.")
                         .required(false).repeatable(false));
+    optionSet.addOption(Poco::Util::Option("users", "", "Number of virtual users to replay the traces.")
+                        .required(false).repeatable(false)
+                        .argument("N"));
+    optionSet.addOption(Poco::Util::Option("documents", "", "Number of documents the virtual users share.")
+                        .required(false).repeatable(false)
+                        .argument("M"));
+    optionSet.addOption(Poco::Util::Option("speed", "", "Replay the traces this many times faster.")
+                        .required(false).repeatable(false)
+                        .argument("FACTOR"));
+    optionSet.addOption(Poco::Util::Option("jitter", "", "Vary the time between messages by up to this percentage.")
+                        .required(false).repeatable(false)
+                        .argument("PERCENT"));
+    optionSet.addOption(Poco::Util::Option("ramp-up", "", "Spread the start of the virtual users over this many seconds.")
+                        .required(false).repeatable(false)
+                        .argument("SECONDS"));
+    optionSet.addOption(Poco::Util::Option("admin", "", "Sample the server CPU and memory from its admin console.")
+                        .required(false).repeatable(false)
+                        .argument("USER:PASSWORD"));
 }
 
 void Stress::handleOption(const std::string& optionName,
@@ -51,6 +91,25 @@ void Stress::handleOption(const std::string& optionName,
         printHelp();
         Util::forcedExit(EX_OK);
     }
+    else if (optionName == "users")
+        _users = std::stoul(value);
+    else if (optionName == "documents")
+        _documents = std::max<std::size_t>(std::stoul(value), 1);
+    else if (optionName == "speed")
+    {
+        _speed = std::stod(value);
+        if (_speed <= 0)
+        {
+            std::cerr << "Speed must be positive, not " << value << '\n';
+            Util::forcedExit(EX_USAGE);
+        }
+    }
+    else if (optionName == "jitter")
+        _jitter = std::clamp(std::stod(value), 0.0, 100.0) / 100;
+    else if (optionName == "ramp-up")
+        _rampUpSecs = std::stoul(value);
+    else if (optionName == "admin")
+        _admin = value;
     else
     {
         std::cout << "Unknown option: " << optionName << std::endl;
@@ -63,6 +122,41 @@ void Stress::printHelp()
     std::cerr << "Usage: coolstress wss://localhost:9980 <test-document-path> <trace-path> " << std::endl;
     std::cerr << "       Trace files may be plain text or gzipped (with .gz extension)." << std::endl;
     std::cerr << "       --help for full arguments list." << std::endl;
+    std::cerr << "       --users=N replays the traces in turn as N virtual users," << std::endl;
+    std::cerr << "       --documents=M over M copies of each document." << std::endl;
+    std::cerr << "       --speed=FACTOR compresses time, --jitter=PERCENT varies it." << std::endl;
+    std::cerr << "       --ramp-up=SECONDS spreads the start of the users." << std::endl;
+    std::cerr << "       --admin=USER:PASSWORD samples the server CPU and memory." << std::endl;
+}
+
+void Stress::addUsers(SocketPoll& poll, const std::vector<std::string>& args,
+                      const std::string& tmpDir, const std::shared_ptr<Stats>& stats)
+{
+    const std::size_t traces = (args.size() - 1) / 2;
+
+    // Each copy is loaded as a separate document.
+    std::map<std::pair<std::size_t, std::size_t>, std::string> copies;
+    for (std::size_t user = 0; user < _users; ++user)
+    {
+        const std::size_t trace = user % traces;
+        const std::size_t document = user % _documents;
+        const std::string& path = args[1 + trace * 2];
+
+        std::string& copy = copies[{ trace, document }];
+        if (copy.empty())
+        {
+            copy = tmpDir + '/' + std::to_string(trace) + '-' + std::to_string(document) + '-' +
+                   Poco::Path(path).getFileName();
+            FileUtil::copyFileTo(path, copy);
+        }
+
+        const std::chrono::milliseconds delay(_rampUpSecs * 1000 * user / _users);
+        StressSocketHandler::addPollFor(poll, args[0], copy, args[2 + trace * 2], stats,
+                                        /*latencyFactor=*/1, delay, _speed, _jitter);
+    }
+
+    std::cerr << "Replaying " << traces << " traces as " << _users << " users over "
+              << copies.size() << " documents\n";
 }
 
 // coverity[root_function] : don't warn about uncaught exceptions
@@ -97,15 +191,53 @@ int Stress::main(const std::vector<std::string>& args)
         return -1;
     }
 
+    if (args.size() < 3)
+    {
+        printHelp();
+        return EX_NOINPUT;
+    }
+
     auto stats = std::make_shared<Stats>();
 
+    std::shared_ptr<AdminMonitorHandler> monitor;
+    if (!_admin.empty())
+    {
+        const std::size_t colon = _admin.find(':');
+        const std::string jwt = AdminMonitorHandler::getToken(
+            server, _admin.substr(0, colon),
+            colon != std::string::npos ? _admin.substr(colon + 1) : std::string());
+        if (jwt.empty())
+        {
+            std::cerr << "Failed to log into the admin console of " << server << '\n';
+            return EX_NOPERM;
+        }
+
+        monitor = std::make_shared<AdminMonitorHandler>(stats, jwt);
+        poll->insertNewWebSocketSync(Poco::URI(server + "/cool/adminws"), monitor);
+    }
+
     std::cerr << "Connect to " << server << "\n";
-    for (size_t i = 1; i < args.size() - 1; i += 2)
-        StressSocketHandler::addPollFor(*poll, server, args[i], args[i+1], stats);
 
+    std::unique_ptr<FileUtil::OwnedFile> tmpDir;
+    if (_users > 0)
+    {
+        tmpDir = std::make_unique<FileUtil::OwnedFile>(FileUtil::createRandomTmpDir(),
+                                                       /*recursive=*/true);
+        addUsers(*poll, args, tmpDir->_file, stats);
+    }
+    else
+    {
+        for (size_t i = 1; i < args.size() - 1; i += 2)
+            StressSocketHandler::addPollFor(*poll, server, args[i], args[i + 1], stats,
+                                            /*latencyFactor=*/1,
+                                            std::chrono::milliseconds::zero(), _speed, _jitter);
+    }
+
+    // The admin console is only polled while the users are busy.
     do {
         poll->poll(TerminatingPoll::DefaultPollTimeoutMicroS);
-    } while (poll->continuePolling() && poll->getSocketCount() > 0);
+    } while (poll->continuePolling() &&
+             poll->getSocketCount() > (monitor && monitor->isMonitoring() ? 1 : 0));
 
     stats->dump(std::cerr);
 
@@ -14,11 +14,14 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <thread>
+#include <vector>
 #include <sysexits.h>
 
 #include <Poco/Net/HTMLForm.h>
@@ -30,6 +33,7 @@
 #include <Poco/Net/SSLManager.h>
 #include <Poco/Net/KeyConsoleHandler.h>
 #include <Poco/Net/AcceptCertificateHandler.h>
+#include <Poco/NullStream.h>
 #include <Poco/StreamCopier.h>
 #include <Poco/URI.h>
 #include <Poco/Util/Application.h>
@@ -51,12 +55,23 @@ public:
     const std::string& getServerURI() const { return _serverURI; }
     const std::string& getDestinationFormat() const { return _destinationFormat; }
     const std::string& getDestinationDir() const { return _destinationDir; }
+    bool isBenchmark() const { return _benchmarkRepeat > 0; }
+
+    /// Accounts for a conversion, for the benchmark.
+    void addResult(std::chrono::steady_clock::duration latency, bool success);
 
 private:
+    /// Reports the throughput and latencies of the benchmark.
+    void printBenchmark(std::chrono::steady_clock::duration elapsed);
+
     unsigned    _numWorkers;
+    unsigned    _benchmarkRepeat;
     std::string _serverURI;
     std::string _destinationFormat;
     std::string _destinationDir;
+    std::mutex _resultsMutex;
+    std::vector<std::chrono::steady_clock::duration> _latencies;
+    unsigned _failures;
 
 protected:
     void defineOptions(Poco::Util::OptionSet& options) override;
@@ -93,6 +108,13 @@ public:
     }
 
     void convertFile(const std::string& document)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const bool success = convert(document);
+        _app.addResult(std::chrono::steady_clock::now() - start, success);
+    }
+
+    bool convert(const std::string& document)
     {
         Poco::URI uri(_app.getServerURI());
 
@@ -118,7 +140,7 @@ public:
         {
             std::cerr << "Failed to write data: " << e.name() <<
                   ' ' << e.message() << '\n';
-            return;
+            return false;
         }
 
         Poco::Net::HTTPResponse response;
@@ -127,34 +149,79 @@ public:
             // receiveResponse() resulted in a Poco::Net::NoMessageException.
             std::istream& responseStream = session->receiveResponse(response);
 
-            Poco::Path path(document);
-            std::string outPath = _app.getDestinationDir() + '/' + path.getBaseName() + '.' + _app.getDestinationFormat();
-            std::ofstream fileStream(outPath);
-
-            Poco::StreamCopier::copyStream(responseStream, fileStream);
+            if (_app.isBenchmark())
+            {
+                // Only the timing matters.
+                Poco::NullOutputStream nullStream;
+                Poco::StreamCopier::copyStream(responseStream, nullStream);
+            }
+            else
+            {
+                Poco::Path path(document);
+                std::string outPath = _app.getDestinationDir() + '/' + path.getBaseName() + '.' + _app.getDestinationFormat();
+                std::ofstream fileStream(outPath);
+
+                Poco::StreamCopier::copyStream(responseStream, fileStream);
+            }
         }
         catch (const Poco::Exception &e)
         {
             std::cerr << "Exception converting: " << e.name() <<
                   ' ' << e.message() << '\n';
-            return;
+            return false;
         }
 
         delete session;
+        return response.getStatus() == Poco::Net::HTTPResponse::HTTP_OK;
     }
 };
 
 Tool::Tool() :
     _numWorkers(4),
+    _benchmarkRepeat(0),
 #if ENABLE_SSL
     _serverURI("https://127.0.0.1:" + std::to_string(DEFAULT_CLIENT_PORT_NUMBER)),
 #else
     _serverURI("http://127.0.0.1:" + std::to_string(DEFAULT_CLIENT_PORT_NUMBER)),
 #endif
-    _destinationFormat("txt")
+    _destinationFormat("txt"),
+    _failures(0)
 {
 }
 
+void Tool::addResult(std::chrono::steady_clock::duration latency, bool success)
+{
+    std::lock_guard<std::mutex> lock(_resultsMutex);
+    if (success)
+        _latencies.push_back(latency);
+    else
+        ++_failures;
+}
+
+void Tool::printBenchmark(std::chrono::steady_clock::duration elapsed)
+{
+    std::sort(_latencies.begin(), _latencies.end());
+
+    const double secs = std::chrono::duration<double>(elapsed).count();
+    std::cout << "Converted " << _latencies.size() << " documents, " << _failures
+              << " failed, in " << secs << " s with " << _numWorkers << " threads: "
+              << (secs > 0 ? _latencies.size() / secs : 0) << " conversions/s\n";
+
+    if (_latencies.empty())
+        return;
+
+    const auto percentile = [this](double p)
+    {
+        const std::size_t index =
+            std::min(static_cast<std::size_t>(p * _latencies.size()), _latencies.size() - 1);
+        return std::chrono::duration_cast<std::chrono::milliseconds>(_latencies[index]).count();
+    };
+
+    std::cout << "Latency: p50 " << percentile(0.5) << " ms, p90 " << percentile(0.9)
+              << " ms, p99 " << percentile(0.99) << " ms, max " << percentile(1) << " ms"
+              << std::endl;
+}
+
 void Tool::displayHelp()
 {
     std::cout << "Collabora Online document converter tool.\n"
@@ -164,6 +231,8 @@ void Tool::displayHelp()
               << "  --extension=format          File format to convert to\n"
               << "  --outdir=directory          Output directory for converted files\n"
               << "  --parallelism=threads       Number of simultaneous threads to use\n"
+              << "  --benchmark=count           Convert each file count times, discarding the\n"
+              << "                              results, and report conversions/s and latencies\n"
               << "  --server=uri                URI of COOL server\n"
               << "  --no-check-certificate      Disable checking of SSL certificate\n"
               << "In addition, the options taken by the libreoffice command for its --convert-to\n"
@@ -190,6 +259,8 @@ void Tool::handleOption(const std::string& optionName,
         _destinationDir = value;
     else if (optionName == "parallelism")
         _numWorkers = std::max(std::stoi(value), 1);
+    else if (optionName == "benchmark")
+        _benchmarkRepeat = std::max(std::stoi(value), 1);
     else if (optionName == "server")
         _serverURI = value;
     else if (optionName == "no-check-certificate")
@@ -253,6 +324,15 @@ int Tool::main(const std::vector<std::string>& origArgs)
         return EX_NOINPUT;
     }
 
+    if (isBenchmark())
+    {
+        const std::vector<std::string> files = args;
+        for (unsigned i = 1; i < _benchmarkRepeat; ++i)
+            args.insert(args.end(), files.begin(), files.end());
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
     std::vector<std::thread> clients;
     clients.reserve(_numWorkers);
 
@@ -275,6 +355,9 @@ int Tool::main(const std::vector<std::string>& origArgs)
         client.join();
     }
 
+    if (isBenchmark())
+        printBenchmark(std::chrono::steady_clock::now() - start);
+
     return EX_OK;
 }
 
@@ -28,9 +28,11 @@
 #include "ConfigUtil.hpp"
 #include <Common.hpp>
 #include <COOLWSD.hpp>
+#include <wsd/PrespawnController.hpp>
 #include <Log.hpp>
 #include <Protocol.hpp>
 #include <StringVector.hpp>
+#include <TraceEvent.hpp>
 #include <Unit.hpp>
 #include <Util.hpp>
 #include <common/JsonUtil.hpp>
@@ -326,6 +328,27 @@ void AdminSocketHandler::handleMessage(const std::vector<char> &payload)
         // Let's send back the current log levels in return. So the user can be sure of the values.
         sendTextFrame("channel_list " + _admin->getChannelLogLevels());
     }
+    else if (tokens.equals(0, "tracesampling") && (tokens.size() == 2 || tokens.size() == 3))
+    {
+        uint32_t rate = 0;
+        int pid = 0;
+        if (!COOLProtocol::stringToUInt32(tokens[1], rate) ||
+            (tokens.size() == 3 && !COOLProtocol::stringToInteger(tokens[2], pid)) || pid < 0)
+        {
+            LOG_ERR("Invalid tracesampling command: " << firstLine);
+            return;
+        }
+
+        if (Admin::instance().logAdminAction())
+        {
+            LOG_ANY("Admin request to sample one in " << rate << " ProfileZones of "
+                                                      << (pid ? std::to_string(pid) : "all")
+                                                      << " with source IPAddress ["
+                                                      << _clientIPAdress << ']');
+        }
+
+        COOLWSD::setTraceSampling(rate, pid);
+    }
     else if (tokens.equals(0, "updateroutetoken") && tokens.size() > 1)
     {
         // parse the json object of serverId to routeToken
@@ -520,6 +543,17 @@ bool AdminSocketHandler::handleInitialRequest(
 /// An admin command processor.
 Admin::Admin()
     : SocketPoll("admin")
+    , _processStats(
+          [this](std::vector<ProcessStatsCollector::Sample>&& samples)
+          {
+              addCallback(
+                  [this, samples = std::move(samples)]
+                  {
+                      _model.updateProcessStats(samples);
+                      updateSpareMemory(samples);
+                  });
+          })
+    , _memoryPressureLevel(MemoryPressure::Level::None)
     , _totalSysMemKb(Util::getTotalSystemMemoryKb())
     , _totalAvailMemKb(_totalSysMemKb)
     , _lastTotalMemory(0)
@@ -596,6 +630,17 @@ Admin::Admin()
                                                        << " MB of RAM available");
 
     LOG_INF("Hardware threads: " << std::thread::hardware_concurrency());
+
+    if (ConfigUtil::getConfigValue<bool>("memory_pressure[@enable]", true))
+    {
+        _memoryPressure = std::make_unique<MemoryPressure>(
+            ConfigUtil::getConfigValue<double>("memory_pressure.threshold_percent", 10),
+            std::chrono::seconds(ConfigUtil::getConfigValue<int>("memory_pressure.step_secs", 10)),
+            std::chrono::seconds(
+                ConfigUtil::getConfigValue<int>("memory_pressure.recovery_secs", 60)));
+        if (!_memoryPressure->open())
+            _memoryPressure.reset();
+    }
 }
 
 Admin::~Admin()
@@ -632,11 +677,6 @@ void Admin::pollingThread()
             std::chrono::duration_cast<std::chrono::milliseconds>(now - lastMem).count();
         if (memWait <= MinStatsIntervalMs / 2) // Close enough
         {
-            // disable watchdog to avoid Document::updateMemoryDirty noise
-            disableWatchdog();
-            _model.UpdateMemoryDirty();
-            enableWatchdog();
-
             const size_t totalMem = getTotalMemoryUsage();
             _model.addMemStats(totalMem);
 
@@ -648,7 +688,7 @@ void Admin::pollingThread()
                 _lastTotalMemory = totalMem;
             }
 
-            notifyDocsMemDirtyChanged();
+            checkMemoryPressure(now);
 
             memWait += _memStatsTaskIntervalMs;
             lastMem = now;
@@ -722,6 +762,9 @@ void Admin::pollingThread()
             LOG_WRN(str);
         }
 
+        // The Trace Events sampled by our threads.
+        TraceEvent::emitSamples();
+
         // Handle websockets & other work.
         const auto timeout = std::chrono::milliseconds(capAndRoundInterval(
             std::min<int>(std::min(std::min(cpuWait, memWait), netWait), cleanupWait.count())));
@@ -729,6 +772,8 @@ void Admin::pollingThread()
         poll(timeout); // continue with ms for admin, settings etc.
     }
 
+    _processStats.stop();
+
     if (!COOLWSD::IndirectionServerEnabled)
         return;
 
@@ -789,12 +834,26 @@ void Admin::uploadedAlert(const std::string& docKey, pid_t pid, bool value)
     addCallback([this, docKey, pid, value] { _model.uploadedAlert(docKey, pid, value); });
 }
 
+void Admin::updateSpareMemory(const std::vector<ProcessStatsCollector::Sample>& samples)
+{
+    if (!COOLWSD::Prespawn)
+        return;
+
+    // The spares are measured by the collector, rather than as they arrive.
+    const std::set<pid_t> spares = COOLWSD::getSpareKitPids();
+    for (const ProcessStatsCollector::Sample& sample : samples)
+    {
+        if (!sample.exited && sample.pssKb > 0 && spares.contains(sample.pid))
+            COOLWSD::Prespawn->setSpareMemory(sample.pssKb * 1024);
+    }
+}
+
 void Admin::addDoc(const std::string& docKey, pid_t pid, const std::string& filename,
                    const std::string& sessionId, const std::string& userName, const std::string& userId,
-                   const std::weak_ptr<FILE>& smapsFp, const std::string& wopiSrc, bool readOnly)
+                   const std::string& wopiSrc, bool readOnly)
 {
-    addCallback([this, docKey, pid, filename, sessionId, userName, userId, smapsFp, wopiSrc, readOnly] {
-        _model.addDocument(docKey, pid, filename, sessionId, userName, userId, smapsFp, Poco::URI(wopiSrc), readOnly);
+    addCallback([this, docKey, pid, filename, sessionId, userName, userId, wopiSrc, readOnly] {
+        _model.addDocument(docKey, pid, filename, sessionId, userName, userId, Poco::URI(wopiSrc), readOnly);
     });
 }
 
@@ -815,6 +874,7 @@ void Admin::rescheduleMemTimer(unsigned interval)
     LOG_INF("Memory stats interval changed - New interval: " << _memStatsTaskIntervalMs);
     _netStatsTaskIntervalMs = capAndRoundInterval(interval); // Until we support modifying this.
     LOG_INF("Network stats interval changed - New interval: " << _netStatsTaskIntervalMs);
+    _processStats.setInterval(getProcessStatsInterval());
     wakeup();
 }
 
@@ -822,6 +882,7 @@ void Admin::rescheduleCpuTimer(unsigned interval)
 {
     _cpuStatsTaskIntervalMs = capAndRoundInterval(interval);
     LOG_INF("CPU stats interval changed - New interval: " << _cpuStatsTaskIntervalMs);
+    _processStats.setInterval(getProcessStatsInterval());
     wakeup();
 }
 
@@ -836,8 +897,8 @@ size_t Admin::getTotalMemoryUsage() const
     // inside the forkit - we should account all of our fixed cost of
     // memory to the forkit; and then count only dirty pages in the clients
     // since we know that they share everything else with the forkit.
-    const size_t forkitRssKb = Util::getMemoryUsageRSS(_forKitPid);
-    const size_t wsdPssKb = Util::getMemoryUsagePSS(Util::getProcessId());
+    const size_t forkitRssKb = _model.getProcessStats(_forKitPid).rssKb;
+    const size_t wsdPssKb = _model.getProcessStats(Util::getProcessId()).pssKb;
     const size_t kitsDirtyKb = _model.getKitsMemoryUsage();
     const size_t totalMem = wsdPssKb + forkitRssKb + kitsDirtyKb;
 
@@ -846,10 +907,15 @@ size_t Admin::getTotalMemoryUsage() const
 
 size_t Admin::getTotalCpuUsage() const
 {
-    const size_t forkitJ = Util::getCpuUsage(_forKitPid);
-    const size_t wsdJ = Util::getCpuUsage(Util::getProcessId());
+    const size_t forkitJ = _model.getProcessStats(_forKitPid).jiffies;
+    const size_t wsdJ = _model.getProcessStats(Util::getProcessId()).jiffies;
+
+    // Not sampled yet.
+    if (forkitJ == 0 || wsdJ == 0)
+        return 0;
 
-    if (_lastJiffies == 0)
+    // The first time, or after forkit restarts, there is nothing to compare with.
+    if (_lastJiffies == 0 || forkitJ + wsdJ < _lastJiffies)
     {
         _lastJiffies = forkitJ + wsdJ;
         return 0;
@@ -964,9 +1030,11 @@ void Admin::updateLastActivityTime(const std::string& docKey)
 }
 
 
-void Admin::addBytes(const std::string& docKey, uint64_t sent, uint64_t recv)
+void Admin::addBytes(const std::string& docKey, uint64_t sent, uint64_t recv, uint64_t saved,
+                     uint64_t compressUs)
 {
-    addCallback([this, docKey, sent, recv] { _model.addBytes(docKey, sent, recv); });
+    addCallback([this, docKey, sent, recv, saved, compressUs]
+                { _model.addBytes(docKey, sent, recv, saved, compressUs); });
 }
 
 void Admin::setViewLoadDuration(const std::string& docKey, const std::string& sessionId, std::chrono::milliseconds viewLoadDuration)
@@ -984,6 +1052,16 @@ void Admin::setDocWopiUploadDuration(const std::string& docKey, const std::chron
     addCallback([this, docKey, uploadDuration]{ _model.setDocWopiUploadDuration(docKey, uploadDuration); });
 }
 
+void Admin::setDocDeltaCache(const std::string& docKey, uint64_t used, uint64_t max)
+{
+    addCallback([this, docKey, used, max]{ _model.setDocDeltaCache(docKey, used, max); });
+}
+
+void Admin::setDocTileCacheStats(const std::string& docKey, const TileCache::Stats& stats)
+{
+    addCallback([this, docKey, stats]{ _model.setDocTileCacheStats(docKey, stats); });
+}
+
 void Admin::addErrorExitCounters(unsigned segFaultCount, unsigned killedCount,
                                  unsigned oomKilledCount)
 {
@@ -1082,9 +1160,39 @@ void Admin::triggerMemoryCleanup(const size_t totalMem)
     }
 }
 
-void Admin::notifyDocsMemDirtyChanged()
+void Admin::checkMemoryPressure(std::chrono::steady_clock::time_point now)
 {
-    _model.notifyDocsMemDirtyChanged();
+    if (!_memoryPressure || !_memoryPressure->update(now))
+        return;
+
+    const MemoryPressure::Level level = _memoryPressure->getLevel();
+    if (level != _memoryPressureLevel)
+    {
+        COOLWSD::setMemoryPressure(level);
+        _memoryPressureLevel = level;
+    }
+
+    if (level == MemoryPressure::Level::UnloadDocs)
+        unloadIdleDocument();
+}
+
+void Admin::unloadIdleDocument()
+{
+    for (const auto& doc : _model.getDocumentsSortedByIdle())
+    {
+        if (doc.getSaved())
+        {
+            LOG_WRN("Under memory pressure: unloading saved document with DocKey ["
+                    << doc.getDocKey() << "], Idletime: [" << doc.getIdleTime() << "] using "
+                    << doc.getMem() << " KB");
+            COOLWSD::closeDocument(doc.getDocKey(), "oom");
+            return;
+        }
+
+        // Save it, to unload it at the next step if the pressure lasts.
+        LOG_DBG("Saving document: DocKey [" << doc.getDocKey() << ']');
+        COOLWSD::autoSave(doc.getDocKey());
+    }
 }
 
 void Admin::cleanupResourceConsumingDocs()
@@ -1256,6 +1364,15 @@ void Admin::getMetrics(std::ostream& metrics) const
     metrics << "global_memory_available_bytes " << memAvail * 1024 << std::endl;
     metrics << "global_memory_used_bytes " << memUsed * 1024 << std::endl;
     metrics << "global_memory_free_bytes " << (memAvail - memUsed) * 1024 << std::endl;
+    if (_memoryPressure)
+    {
+        metrics << "global_memory_pressure_level " << static_cast<int>(_memoryPressure->getLevel())
+                << std::endl;
+        metrics << "global_memory_pressure_stall_percent " << _memoryPressure->getSomeAvg10()
+                << std::endl;
+        metrics << "global_memory_pressure_step_count " << _memoryPressure->getSteps()
+                << std::endl;
+    }
     metrics << std::endl;
 
     _model.getMetrics(metrics);
@@ -1286,6 +1403,10 @@ void Admin::sendMetrics(const std::shared_ptr<StreamSocket>& socket,
 void Admin::start()
 {
     startMonitors();
+
+    _processStats.add(Util::getProcessId());
+    _processStats.start(getProcessStatsInterval());
+
     startThread();
 }
 
@@ -15,6 +15,8 @@
 
 #include <net/WebSocketHandler.hpp>
 #include <common/ConfigUtil.hpp>
+#include <wsd/MemoryPressure.hpp>
+#include <wsd/ProcessStats.hpp>
 
 class Admin;
 
@@ -119,8 +121,7 @@ public:
     /// Calls with same pid will increment view count, if pid already exists
     void addDoc(const std::string& docKey, pid_t pid, const std::string& filename,
                 const std::string& sessionId, const std::string& userName,
-                const std::string& userId, const std::weak_ptr<FILE>& smapsFD,
-                const std::string& wopiSrc, bool readOnly);
+                const std::string& userId, const std::string& wopiSrc, bool readOnly);
 
     /// Decrement view count till becomes zero after which doc is removed
     void rmDoc(const std::string& docKey, const std::string& sessionId);
@@ -128,7 +129,15 @@ public:
     /// Remove the document with all views. Used on termination or catastrophic failure.
     void rmDoc(const std::string& docKey);
 
-    void setForKitPid(const int forKitPid) { _forKitPid = forKitPid; _model.setForKitPid(forKitPid);}
+    void setForKitPid(const int forKitPid)
+    {
+        _forKitPid = forKitPid;
+        _model.setForKitPid(forKitPid);
+        _processStats.add(forKitPid);
+    }
+
+    /// Samples the memory and CPU use of the kit @pid, from its @smapsFd, which we take over.
+    void addKitProcess(pid_t pid, int smapsFd) { _processStats.add(pid, smapsFd); }
 
     /// Callers must ensure that modelMutex is acquired
     AdminModel& getModel();
@@ -152,7 +161,8 @@ public:
     void rescheduleCpuTimer(unsigned interval);
 
     void updateLastActivityTime(const std::string& docKey);
-    void addBytes(const std::string& docKey, uint64_t sent, uint64_t recv);
+    void addBytes(const std::string& docKey, uint64_t sent, uint64_t recv, uint64_t saved,
+                  uint64_t compressUs);
 
     void dumpState(std::ostream& os) const override;
 
@@ -176,6 +186,8 @@ public:
     void setDocWopiDownloadDuration(const std::string& docKey, std::chrono::milliseconds wopiDownloadDuration);
     void setDocWopiUploadDuration(const std::string& docKey,
                                   std::chrono::milliseconds uploadDuration);
+    void setDocDeltaCache(const std::string& docKey, uint64_t used, uint64_t max);
+    void setDocTileCacheStats(const std::string& docKey, const TileCache::Stats& stats);
     void addErrorExitCounters(unsigned segFaultCount, unsigned killedCount,
                               unsigned oomKilledCount);
     void addLostKitsTerminated(unsigned lostKitsTerminated);
@@ -206,7 +218,11 @@ private:
     /// Memory consumption has increased, start killing kits etc. till memory consumption gets back
     /// under @hardModeLimit
     void triggerMemoryCleanup(size_t hardModeLimit);
-    void notifyDocsMemDirtyChanged();
+
+    /// Sheds memory a step further, or returns to full budgets, as the memory pressure tells.
+    void checkMemoryPressure(std::chrono::steady_clock::time_point now);
+    /// Unloads the most idle saved document, saving the more idle ones to unload them next.
+    void unloadIdleDocument();
     void cleanupResourceConsumingDocs();
     void cleanupLostKits();
 
@@ -218,6 +234,16 @@ private:
         return ((value + MinStatsIntervalMs - 1) / MinStatsIntervalMs) * MinStatsIntervalMs;
     }
 
+    /// Tells the prespawn controller how much memory the spare kits in @samples take.
+    void updateSpareMemory(const std::vector<ProcessStatsCollector::Sample>& samples);
+
+    /// Processes are sampled as often as the CPU or memory stats need.
+    std::chrono::milliseconds getProcessStatsInterval() const
+    {
+        return std::chrono::milliseconds(
+            std::min(_cpuStatsTaskIntervalMs, _memStatsTaskIntervalMs));
+    }
+
     /// Synchronous connection setup to remote monitoring server
     void connectToMonitorSync(const std::string &uri);
 
@@ -226,6 +252,12 @@ private:
     /// the Admin Poll thread.
     AdminModel _model;
     DocProcSettings _defDocProcSettings;
+    /// Samples our processes, off the Admin poll, into the model.
+    ProcessStatsCollector _processStats;
+    /// The pressure stall information of our memory, if enabled and available.
+    std::unique_ptr<MemoryPressure> _memoryPressure;
+    /// The level last applied to the documents.
+    MemoryPressure::Level _memoryPressureLevel;
     // map to make sure only connection with unique monitor uri exists
     std::map<std::string, std::shared_ptr<MonitorSocketHandler>> _monitorSockets;
 
@@ -30,7 +30,9 @@
 #include <common/ConfigUtil.hpp>
 #include <net/WebSocketHandler.hpp>
 #include <wsd/COOLWSD.hpp>
+#include <wsd/ConversionQueue.hpp>
 #include <wsd/Exceptions.hpp>
+#include <wsd/PrespawnController.hpp>
 
 #include <fnmatch.h>
 #include <dirent.h>
@@ -162,21 +164,6 @@ std::string Document::to_string() const
     return oss.str();
 }
 
-void Document::updateMemoryDirty()
-{
-    // Avoid accessing smaps too often
-    const time_t now = std::time(nullptr);
-    if (now - _lastTimeSMapsRead >= 5)
-    {
-        size_t lastMemDirty = _memoryDirty;
-        auto procSMaps = _procSMaps.lock();
-        _memoryDirty = procSMaps ? Util::getPssAndDirtyFromSMaps(procSMaps.get()).second : 0;
-        _lastTimeSMapsRead = now;
-        if (lastMemDirty != _memoryDirty)
-            _hasMemDirtyChanged = true;
-    }
-}
-
 void Document::setLastJiffies(size_t newJ)
 {
     const auto now = std::chrono::steady_clock::now();
@@ -356,7 +343,7 @@ size_t AdminModel::getKitsJiffies() const
             const int pid = it.second.getPid();
             if (pid > 0)
             {
-                unsigned newJ = Util::getCpuUsage(pid);
+                unsigned newJ = getProcessStats(pid).jiffies;
                 unsigned prevJ = it.second.getLastJiffies();
                 if(newJ >= prevJ)
                 {
@@ -515,13 +502,14 @@ void AdminModel::notify(const std::string& message)
     }
 }
 
-void AdminModel::addBytes(const std::string& docKey, uint64_t sent, uint64_t recv)
+void AdminModel::addBytes(const std::string& docKey, uint64_t sent, uint64_t recv,
+                          uint64_t saved, uint64_t compressUs)
 {
     ASSERT_CORRECT_THREAD_OWNER(_owner);
 
     auto doc = _documents.find(docKey);
     if(doc != _documents.end())
-        doc->second.addBytes(sent, recv);
+        doc->second.addBytes(sent, recv, saved, compressUs);
 
     _sentBytesTotal += sent;
     _recvBytesTotal += recv;
@@ -559,12 +547,14 @@ void AdminModel::uploadedAlert(const std::string& docKey, pid_t pid, bool value)
 void AdminModel::addDocument(const std::string& docKey, pid_t pid,
                              const std::string& filename, const std::string& sessionId,
                              const std::string& userName, const std::string& userId,
-                             const std::weak_ptr<FILE>& smapsFp, const Poco::URI& wopiSrc, bool isViewReadOnly)
+                             const Poco::URI& wopiSrc, bool isViewReadOnly)
 {
     ASSERT_CORRECT_THREAD_OWNER(_owner);
     const auto ret =
         _documents.emplace(docKey, Document(docKey, pid, filename, wopiSrc));
-    ret.first->second.setProcSMapsFp(smapsFp);
+    const auto stats = _processStats.find(pid);
+    if (stats != _processStats.end())
+        ret.first->second.setMemoryDirty(stats->second.dirtyKb);
     ret.first->second.takeSnapshot();
     ret.first->second.addView(sessionId, userName, userId, isViewReadOnly);
     LOG_DBG("Added admin document [" << docKey << "].");
@@ -921,6 +911,20 @@ void AdminModel::setDocWopiUploadDuration(const std::string& docKey, const std::
         it->second.setWopiUploadDuration(wopiUploadDuration);
 }
 
+void AdminModel::setDocDeltaCache(const std::string& docKey, uint64_t used, uint64_t max)
+{
+    auto it = _documents.find(docKey);
+    if (it != _documents.end())
+        it->second.setDeltaCache(used, max);
+}
+
+void AdminModel::setDocTileCacheStats(const std::string& docKey, const TileCache::Stats& stats)
+{
+    auto it = _documents.find(docKey);
+    if (it != _documents.end())
+        it->second.setTileCacheStats(stats);
+}
+
 void AdminModel::addErrorExitCounters(unsigned segFaultCount, unsigned killedCount,
                                       unsigned oomKilledCount)
 {
@@ -1078,6 +1082,8 @@ struct DocumentAggregateStats final
         _openedTime.Update(d.getOpenTime(), active);
         _bytesSentToClients.Update(d.getSentBytes(), active);
         _bytesRecvFromClients.Update(d.getRecvBytes(), active);
+        _bytesSavedByCompression.Update(d.getSavedBytes(), active);
+        _compressionTime.Update(d.getCompressUs(), active);
         _wopiDownloadDuration.Update(d.getWopiDownloadDuration().count(), active);
         _wopiUploadDuration.Update(d.getWopiUploadDuration().count(), active);
 
@@ -1106,6 +1112,8 @@ struct DocumentAggregateStats final
     ActiveExpiredStats _openedTime;
     ActiveExpiredStats _bytesSentToClients;
     ActiveExpiredStats _bytesRecvFromClients;
+    ActiveExpiredStats _bytesSavedByCompression;
+    ActiveExpiredStats _compressionTime;
     ActiveExpiredStats _wopiDownloadDuration;
     ActiveExpiredStats _wopiUploadDuration;
     ActiveExpiredStats _viewLoadDuration;
@@ -1117,10 +1125,10 @@ struct DocumentAggregateStats final
 
 struct KitProcStats
 {
-    void UpdateAggregateStats(int pid)
+    void UpdateAggregateStats(const ProcessStatsCollector::Sample& sample)
     {
-        _threadCount.Update(Util::getStatFromPid(pid, 19));
-        _cpuTime.Update(Util::getCpuUsage(pid) / sysconf (_SC_CLK_TCK));
+        _threadCount.Update(sample.threads);
+        _cpuTime.Update(sample.jiffies / sysconf (_SC_CLK_TCK));
     }
 
     int unassignedCount;
@@ -1168,14 +1176,14 @@ void AdminModel::CalcDocAggregateStats(DocumentAggregateStats& stats) const
         stats.Update(d.second, true);
 }
 
-void CalcKitStats(KitProcStats& stats)
+void CalcKitStats(const AdminModel& model, KitProcStats& stats)
 {
     std::vector<int> childProcs;
     stats.unassignedCount = AdminModel::getUnassignedKitPids(&childProcs);
     stats.assignedCount = AdminModel::getAssignedKitPids(&childProcs);
     for (int pid : childProcs)
     {
-        stats.UpdateAggregateStats(pid);
+        stats.UpdateAggregateStats(model.getProcessStats(pid));
     }
 }
 
@@ -1197,23 +1205,34 @@ void AdminModel::getMetrics(std::ostream& oss) const
     ASSERT_CORRECT_THREAD_OWNER(_owner);
 
     oss << "coolwsd_count " << getPidsFromProcName(std::regex("coolwsd"), nullptr) << std::endl;
-    oss << "coolwsd_thread_count " << Util::getStatFromPid(Util::getProcessId(), 19) << std::endl;
-    oss << "coolwsd_cpu_time_seconds " << Util::getCpuUsage(Util::getProcessId()) / sysconf (_SC_CLK_TCK) << std::endl;
-    oss << "coolwsd_memory_used_bytes " << Util::getMemoryUsagePSS(Util::getProcessId()) * 1024 << std::endl;
+    const ProcessStatsCollector::Sample wsdStats = getProcessStats(Util::getProcessId());
+    oss << "coolwsd_thread_count " << wsdStats.threads << std::endl;
+    oss << "coolwsd_cpu_time_seconds " << wsdStats.jiffies / sysconf (_SC_CLK_TCK) << std::endl;
+    oss << "coolwsd_memory_used_bytes " << wsdStats.pssKb * 1024 << std::endl;
     oss << "coolwsd_tcp_connections_used " << StreamSocket::getExternalConnectionCount() << std::endl;
+    oss << "coolwsd_tile_cache_used_bytes " << TileCache::getGlobalCacheSize() << std::endl;
+    oss << "coolwsd_tile_cache_max_bytes " << TileCache::getGlobalMaxCacheSize() << std::endl;
+    const Log::AsyncStats logStats = Log::getAsyncStats();
+    if (logStats.enabled)
+    {
+        oss << "coolwsd_log_written_bytes " << logStats.bytesWritten << std::endl;
+        oss << "coolwsd_log_dropped_count " << logStats.dropped << std::endl;
+        oss << "coolwsd_log_blocked_count " << logStats.blocked << std::endl;
+    }
     oss << std::endl;
 
     oss << "forkit_count " << getPidsFromProcName(std::regex("forkit"), nullptr) << std::endl;
-    oss << "forkit_thread_count " << Util::getStatFromPid(_forKitPid, 19) << std::endl;
-    oss << "forkit_cpu_time_seconds " << Util::getCpuUsage(_forKitPid) / sysconf (_SC_CLK_TCK) << std::endl;
-    oss << "forkit_memory_used_bytes " << Util::getMemoryUsageRSS(_forKitPid) * 1024 << std::endl;
+    const ProcessStatsCollector::Sample forkitStats = getProcessStats(_forKitPid);
+    oss << "forkit_thread_count " << forkitStats.threads << std::endl;
+    oss << "forkit_cpu_time_seconds " << forkitStats.jiffies / sysconf (_SC_CLK_TCK) << std::endl;
+    oss << "forkit_memory_used_bytes " << forkitStats.rssKb * 1024 << std::endl;
     oss << std::endl;
 
     DocumentAggregateStats docStats;
     KitProcStats kitStats;
 
     CalcDocAggregateStats(docStats);
-    CalcKitStats(kitStats);
+    CalcKitStats(*this, kitStats);
 
     oss << "kit_count " << kitStats.unassignedCount + kitStats.assignedCount << std::endl;
     oss << "kit_unassigned_count " << kitStats.unassignedCount << std::endl;
@@ -1225,8 +1244,31 @@ void AdminModel::getMetrics(std::ostream& oss) const
     PrintKitAggregateMetrics(oss, "thread_count", "", kitStats._threadCount);
     PrintKitAggregateMetrics(oss, "memory_used", "bytes", docStats._kitUsedMemory.active());
     PrintKitAggregateMetrics(oss, "cpu_time", "seconds", kitStats._cpuTime);
+    if (COOLWSD::Prespawn)
+    {
+        const PrespawnController::Stats prespawn =
+            COOLWSD::Prespawn->getStats(std::chrono::steady_clock::now());
+        oss << "kit_prespawn_target_count " << prespawn.targetCount << std::endl;
+        oss << "kit_prespawn_load_rate_per_minute " << prespawn.loadsPerMinute << std::endl;
+        oss << "kit_prespawn_fork_latency_seconds " << prespawn.forkLatency.count() / 1000.
+            << std::endl;
+        oss << "kit_prespawn_spare_memory_bytes " << prespawn.spareMemoryBytes << std::endl;
+        oss << "kit_prespawn_memory_capped_count " << prespawn.memoryCappedCount << std::endl;
+    }
     oss << std::endl;
 
+    if (COOLWSD::Conversions)
+    {
+        const ConversionQueue::Stats conversions = COOLWSD::Conversions->getStats();
+        oss << "conversion_active_count " << conversions.active << std::endl;
+        oss << "conversion_queued_count " << conversions.queued << std::endl;
+        oss << "conversion_completed_count " << conversions.completed << std::endl;
+        oss << "conversion_rejected_count " << conversions.rejected << std::endl;
+        conversions.waitTime.dump(oss, "conversion_wait_seconds");
+        conversions.duration.dump(oss, "conversion_duration_seconds");
+        oss << std::endl;
+    }
+
     oss << "document_resource_consuming_count " << docStats._resConsCount << std::endl;
     oss << "document_resource_consuming_abort_started_count " << docStats._resConsAbortPendingCount << std::endl;
     oss << "document_resource_consuming_aborted_count " << docStats._resConsAbortCount << std::endl;
@@ -1243,6 +1285,10 @@ void AdminModel::getMetrics(std::ostream& oss) const
     oss << std::endl;
     PrintDocActExpMetrics(oss, "received_from_clients", "bytes", docStats._bytesRecvFromClients);
     oss << std::endl;
+    PrintDocActExpMetrics(oss, "saved_by_compression", "bytes", docStats._bytesSavedByCompression);
+    oss << std::endl;
+    PrintDocActExpMetrics(oss, "compression_time", "microseconds", docStats._compressionTime);
+    oss << std::endl;
     PrintDocActExpMetrics(oss, "wopi_upload_duration", "milliseconds", docStats._wopiUploadDuration);
     oss << std::endl;
     PrintDocActExpMetrics(oss, "wopi_download_duration", "milliseconds", docStats._wopiDownloadDuration);
@@ -1283,6 +1329,13 @@ void AdminModel::getMetrics(std::ostream& oss) const
         oss << "doc_idle_time_seconds" << suffix << doc.getIdleTime() << "\n";
         oss << "doc_download_time_seconds" << suffix << ((double)doc.getWopiDownloadDuration().count() / 1000) << "\n";
         oss << "doc_upload_time_seconds" << suffix << ((double)doc.getWopiUploadDuration().count() / 1000) << "\n";
+        oss << "doc_delta_cache_bytes" << suffix << doc.getDeltaCacheBytes() << "\n";
+        oss << "doc_delta_cache_max_bytes" << suffix << doc.getDeltaCacheMaxBytes() << "\n";
+        const TileCache::Stats& tileCache = doc.getTileCacheStats();
+        oss << "doc_tile_cache_bytes" << suffix << tileCache._bytes << "\n";
+        oss << "doc_tile_cache_hits" << suffix << tileCache._hits << "\n";
+        oss << "doc_tile_cache_misses" << suffix << tileCache._misses << "\n";
+        oss << "doc_tile_cache_evictions" << suffix << tileCache._evictions << "\n";
         oss << std::endl;
     }
 }
@@ -1297,12 +1350,41 @@ std::set<pid_t> AdminModel::getDocumentPids() const
     return pids;
 }
 
-void AdminModel::UpdateMemoryDirty()
+void AdminModel::updateProcessStats(const std::vector<ProcessStatsCollector::Sample>& samples)
 {
-    for (auto& it: _documents)
+    ASSERT_CORRECT_THREAD_OWNER(_owner);
+
+    for (const ProcessStatsCollector::Sample& sample : samples)
     {
-        it.second.updateMemoryDirty();
+        if (sample.exited)
+            _processStats.erase(sample.pid);
+        else
+            _processStats[sample.pid] = sample;
     }
+
+    for (auto& [docKey, doc] : _documents)
+    {
+        const auto it = _processStats.find(doc.getPid());
+        if (it != _processStats.end())
+            doc.setMemoryDirty(it->second.dirtyKb);
+    }
+
+    notifyDocsMemDirtyChanged();
+}
+
+ProcessStatsCollector::Sample AdminModel::getProcessStats(pid_t pid) const
+{
+    ASSERT_CORRECT_THREAD_OWNER(_owner);
+
+    const auto it = _processStats.find(pid);
+    if (it != _processStats.end())
+        return it->second;
+
+    // Not sampled yet, or gone. Reading /proc here would block the Admin poll,
+    // which is what the collector thread is for; it will have it next round.
+    ProcessStatsCollector::Sample sample;
+    sample.pid = pid;
+    return sample;
 }
 
 void AdminModel::notifyDocsMemDirtyChanged()
@@ -13,6 +13,8 @@
 
 #include <common/Log.hpp>
 #include <net/WebSocketHandler.hpp>
+#include <wsd/ProcessStats.hpp>
+#include <wsd/TileCache.hpp>
 
 #include <ctime>
 #include <deque>
@@ -169,9 +171,12 @@ public:
         , _lastSnapshotTime(0)
         , _sentBytes(0)
         , _recvBytes(0)
+        , _savedBytes(0)
+        , _compressUs(0)
         , _wopiDownloadDuration(0)
         , _wopiUploadDuration(0)
-        , _lastTimeSMapsRead(0)
+        , _deltaCacheBytes(0)
+        , _deltaCacheMaxBytes(0)
         , _badBehaviorDetectionTime(0)
         , _abortTime(0)
         , _pid(pid)
@@ -213,8 +218,15 @@ public:
 
     void updateLastActivityTime(std::time_t lastActivity) { _lastActivity = lastActivity; }
     std::time_t getLastActivityTime() const { return _lastActivity; }
-    void updateMemoryDirty();
     size_t getMemoryDirty() const { return _memoryDirty; }
+    void setMemoryDirty(size_t memoryDirty)
+    {
+        if (memoryDirty != _memoryDirty)
+        {
+            _memoryDirty = memoryDirty;
+            _hasMemDirtyChanged = true;
+        }
+    }
 
     std::string getSnapshot(std::time_t now) const;
     const std::string getHistory() const;
@@ -226,21 +238,33 @@ public:
     void setUploaded(bool value) { _isUploaded = value; }
     bool getUploadedStatus() const { return _isUploaded; }
 
-    void addBytes(uint64_t sent, uint64_t recv)
+    void addBytes(uint64_t sent, uint64_t recv, uint64_t saved, uint64_t compressUs)
     {
         _sentBytes += sent;
         _recvBytes += recv;
+        _savedBytes += saved;
+        _compressUs += compressUs;
     }
 
     std::time_t getOpenTime() const { return isExpired() ? _end - _start : getElapsedTime(); }
     uint64_t getSentBytes() const { return _sentBytes; }
     uint64_t getRecvBytes() const { return _recvBytes; }
+    uint64_t getSavedBytes() const { return _savedBytes; }
+    uint64_t getCompressUs() const { return _compressUs; }
     void setViewLoadDuration(const std::string& sessionId, std::chrono::milliseconds viewLoadDuration);
     void setWopiDownloadDuration(std::chrono::milliseconds wopiDownloadDuration) { _wopiDownloadDuration = wopiDownloadDuration; }
     std::chrono::milliseconds getWopiDownloadDuration() const { return _wopiDownloadDuration; }
     void setWopiUploadDuration(const std::chrono::milliseconds wopiUploadDuration) { _wopiUploadDuration = wopiUploadDuration; }
     std::chrono::milliseconds getWopiUploadDuration() const { return _wopiUploadDuration; }
-    void setProcSMapsFp(std::weak_ptr<FILE> procSMaps) { _procSMaps = std::move(procSMaps); }
+    void setDeltaCache(uint64_t used, uint64_t max)
+    {
+        _deltaCacheBytes = used;
+        _deltaCacheMaxBytes = max;
+    }
+    uint64_t getDeltaCacheBytes() const { return _deltaCacheBytes; }
+    uint64_t getDeltaCacheMaxBytes() const { return _deltaCacheMaxBytes; }
+    void setTileCacheStats(const TileCache::Stats& stats) { _tileCacheStats = stats; }
+    const TileCache::Stats& getTileCacheStats() const { return _tileCacheStats; }
     bool hasMemDirtyChanged() const { return _hasMemDirtyChanged; }
     void setMemDirtyChanged(bool changeStatus) { _hasMemDirtyChanged = changeStatus; }
     time_t getBadBehaviorDetectionTime() const { return _badBehaviorDetectionTime; }
@@ -272,12 +296,19 @@ private:
     /// Total bytes sent and recv'd by this document.
     uint64_t _sentBytes, _recvBytes;
 
+    /// Bytes saved by WebSocket compression, and the time spent on it.
+    uint64_t _savedBytes, _compressUs;
+
     //Download/upload duration from/to storage for this document
     std::chrono::milliseconds _wopiDownloadDuration;
     std::chrono::milliseconds _wopiUploadDuration;
 
-    std::weak_ptr<FILE> _procSMaps;
-    std::time_t _lastTimeSMapsRead;
+    /// Memory used by the tile delta cache of the kit, and its budget.
+    uint64_t _deltaCacheBytes;
+    uint64_t _deltaCacheMaxBytes;
+
+    /// Effectiveness and memory use of the tile cache of this document.
+    TileCache::Stats _tileCacheStats;
 
     std::time_t _badBehaviorDetectionTime;
     std::time_t _abortTime;
@@ -384,8 +415,7 @@ public:
 
     void addDocument(const std::string& docKey, pid_t pid, const std::string& filename,
                      const std::string& sessionId, const std::string& userName,
-                     const std::string& userId, const std::weak_ptr<FILE>& smapsFp,
-                     const Poco::URI& wopiSrc, bool readOnly);
+                     const std::string& userId, const Poco::URI& wopiSrc, bool readOnly);
 
     void removeDocument(const std::string& docKey, const std::string& sessionId);
     void removeDocument(const std::string& docKey);
@@ -393,7 +423,10 @@ public:
     void updateLastActivityTime(const std::string& docKey);
     std::time_t getLastActivityTime() const { return _lastActivity; }
 
-    void addBytes(const std::string& docKey, uint64_t sent, uint64_t recv);
+    /// Adds to the traffic of the document, and to what WebSocket compression
+    /// saved of it, at the cost of compressUs microseconds.
+    void addBytes(const std::string& docKey, uint64_t sent, uint64_t recv, uint64_t saved,
+                  uint64_t compressUs);
 
     uint64_t getSentBytesTotal() const { return _sentBytesTotal; }
     uint64_t getRecvBytesTotal() const { return _recvBytesTotal; }
@@ -408,6 +441,8 @@ public:
     void setDocWopiDownloadDuration(const std::string& docKey, std::chrono::milliseconds wopiDownloadDuration);
     void setDocWopiUploadDuration(const std::string& docKey,
                                   std::chrono::milliseconds wopiUploadDuration);
+    void setDocDeltaCache(const std::string& docKey, uint64_t used, uint64_t max);
+    void setDocTileCacheStats(const std::string& docKey, const TileCache::Stats& stats);
     void addErrorExitCounters(unsigned segFaultCount, unsigned killedCount,
                               unsigned oomKilledCount);
     void setForKitPid(pid_t pid) { _forKitPid = pid; }
@@ -416,7 +451,13 @@ public:
     void getMetrics(std::ostream& oss) const;
 
     std::set<pid_t> getDocumentPids() const;
-    void UpdateMemoryDirty();
+
+    /// Takes in the @samples that changed, and notifies of the memory of the documents.
+    void updateProcessStats(const std::vector<ProcessStatsCollector::Sample>& samples);
+
+    /// The last sample of @pid, or an empty one if we have none yet.
+    ProcessStatsCollector::Sample getProcessStats(pid_t pid) const;
+
     void notifyDocsMemDirtyChanged();
 
     const DocProcSettings& getDefDocProcSettings() const { return _defDocProcSettings; }
@@ -464,6 +505,9 @@ private:
     std::map<int, Subscriber> _subscribers;
     std::map<std::string, Document> _documents;
 
+    /// The last samples of our processes, by pid.
+    std::map<pid_t, ProcessStatsCollector::Sample> _processStats;
+
     /// The serialized histories of all expired documents.
     std::vector<std::string> _expiredDocumentsHistories;
 
@@ -84,8 +84,11 @@
 #include <Crypto.hpp>
 #include <DelaySocket.hpp>
 #include <wsd/COOLWSDServer.hpp>
+#include <wsd/ConversionQueue.hpp>
 #include <wsd/DocumentBroker.hpp>
+#include <wsd/PrespawnController.hpp>
 #include <wsd/Process.hpp>
+#include <wsd/TileCache.hpp>
 #include <common/JsonUtil.hpp>
 #include <common/FileUtil.hpp>
 
@@ -98,6 +101,7 @@
 #include <common/ConfigUtil.hpp>
 #include <common/HexUtil.hpp>
 #include <common/SigUtil.hpp>
+#include <common/TraceEvent.hpp>
 #include <common/Unit.hpp>
 #include <common/Util.hpp>
 
@@ -174,6 +178,7 @@ std::atomic<std::chrono::milliseconds> ChildSpawnTimeoutMs =
 } // namespace
 
 std::atomic<unsigned> COOLWSD::NumConnections;
+std::atomic<MemoryPressure::Level> COOLWSD::MemoryPressureLevel(MemoryPressure::Level::None);
 std::unordered_set<std::string> COOLWSD::EditFileExtensions;
 
 extern "C"
@@ -340,13 +345,46 @@ void COOLWSD::alertUserInternal(const std::string& dockey, const std::string& ms
     }
 }
 
-void COOLWSD::writeTraceEventRecording(const char *data, std::size_t nbytes)
+static std::mutex traceEventFileMutex;
+
+bool COOLWSD::openTraceEventFile()
 {
-    static std::mutex traceEventFileMutex;
+    std::unique_lock<std::mutex> lock(traceEventFileMutex);
+
+    if (TraceEventFile != NULL)
+        return true;
 
+    const auto traceEventFile =
+        ConfigUtil::getConfigValue<std::string>("trace_event.path", COOLWSD_TRACEEVENTFILE);
+    LOG_INF("Trace Event file is " << traceEventFile << ".");
+    FILE* file = fopen(traceEventFile.c_str(), "w");
+    if (file == NULL)
+        return false;
+
+    if (fcntl(fileno(file), F_SETFD, FD_CLOEXEC) == -1)
+    {
+        fclose(file);
+        return false;
+    }
+
+    fprintf(file, "[\n");
+    // Output a metadata event that tells that this is the WSD process
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"args\":{\"name\":\"WSD\"},\"pid\":%ld,\"tid\":%ld},\n",
+            Util::getProcessId(), Util::getThreadId());
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"args\":{\"name\":\"Main\"},\"pid\":%ld,\"tid\":%ld},\n",
+            Util::getProcessId(), Util::getThreadId());
+
+    // Only now, as other threads write to it once they see it.
+    TraceEventFile = file;
+    return true;
+}
+
+void COOLWSD::writeTraceEventRecording(const char *data, std::size_t nbytes)
+{
     std::unique_lock<std::mutex> lock(traceEventFileMutex);
 
-    fwrite(data, nbytes, 1, COOLWSD::TraceEventFile);
+    if (FILE* file = COOLWSD::TraceEventFile)
+        fwrite(data, nbytes, 1, file);
 }
 
 void COOLWSD::writeTraceEventRecording(const std::string &recording)
@@ -422,6 +460,8 @@ SubForKitMap::iterator dropSubForKit(SubForKitMap::iterator it)
 
     LastSubForKitBrokerExitTimes.erase(configId);
     OutstandingForks.erase(configId);
+    if (COOLWSD::Prespawn)
+        COOLWSD::Prespawn->forget(configId);
     it = SubForKitProcs.erase(it);
     UnitWSD::get().killSubForKit(configId);
 
@@ -541,6 +581,9 @@ static void forkChildren(const std::string& configId, const int number)
             TotalOutstandingForks += number;
             OutstandingForks[configId] += number;
             LastForkRequestTimes[configId] = std::chrono::steady_clock::now();
+            if (COOLWSD::Prespawn)
+                COOLWSD::Prespawn->forkRequested(configId, number,
+                                                 LastForkRequestTimes[configId]);
         }
     }
 }
@@ -594,6 +637,15 @@ static bool cleanupChildren()
     return static_cast<int>(NewChildren.size()) != count;
 }
 
+/// Returns the number of spare children to keep for @configId.
+static int getNumPreSpawnedChildren(const std::string& configId)
+{
+    if (COOLWSD::Prespawn)
+        return COOLWSD::Prespawn->getTarget(configId, std::chrono::steady_clock::now());
+
+    return COOLWSD::NumPreSpawnedChildren;
+}
+
 /// Decides how many children need spawning and spawns.
 static void rebalanceChildren(const std::string& configId, int64_t balance)
 {
@@ -622,6 +674,8 @@ static void rebalanceChildren(const std::string& configId, int64_t balance)
                                              << " children. Resetting.");
         TotalOutstandingForks -= OutstandingForks[configId];
         OutstandingForks[configId] = 0;
+        if (COOLWSD::Prespawn)
+            COOLWSD::Prespawn->forkReset(configId);
     }
 
     balance -= available;
@@ -645,7 +699,7 @@ static void prespawnChildren()
     std::unique_lock<std::mutex> lock(NewChildrenMutex, std::defer_lock);
     if (lock.try_lock())
     {
-        rebalanceChildren("", COOLWSD::NumPreSpawnedChildren);
+        rebalanceChildren("", getNumPreSpawnedChildren(""));
     }
 }
 
@@ -659,6 +713,9 @@ static size_t addNewChild(std::shared_ptr<ChildProcess> child)
     const auto pid = child->getPid();
     const std::string& configId = child->getConfigId();
 
+    if (COOLWSD::Prespawn)
+        COOLWSD::Prespawn->forkArrived(configId, std::chrono::steady_clock::now());
+
     std::unique_lock<std::mutex> lock(NewChildrenMutex);
 
     --TotalOutstandingForks;
@@ -787,7 +844,7 @@ std::string COOLWSD::ConfigDir = COOLWSD_CONFIGDIR "/conf.d";
 bool COOLWSD::EnableTraceEventLogging = false;
 bool COOLWSD::EnableAccessibility = false;
 bool COOLWSD::EnableMountNamespaces = false;
-FILE *COOLWSD::TraceEventFile = NULL;
+std::atomic<FILE*> COOLWSD::TraceEventFile(NULL);
 std::string COOLWSD::LogLevel = "trace";
 std::string COOLWSD::LogLevelStartup = "trace";
 std::string COOLWSD::LogDisabledAreas = "Socket,WebSocket,Admin,Pixel";
@@ -814,6 +871,10 @@ bool COOLWSD::GeolocationSetup = false;
 static std::string UnitTestLibrary;
 
 unsigned int COOLWSD::NumPreSpawnedChildren = 0;
+std::unique_ptr<PrespawnController> COOLWSD::Prespawn;
+#if !MOBILEAPP
+std::unique_ptr<ConversionQueue> COOLWSD::Conversions;
+#endif
 std::unique_ptr<TraceFileWriter> COOLWSD::TraceDumper;
 
 class PrisonPoll : public TerminatingPoll
@@ -915,9 +976,12 @@ std::shared_ptr<ChildProcess> getNewChild_Blocks(const std::shared_ptr<SocketPol
 
     std::chrono::milliseconds spawnTimeoutMs = ChildSpawnTimeoutMs.load() / 2;
 
+    if (COOLWSD::Prespawn)
+        COOLWSD::Prespawn->loadRequested(configId, startTime);
+
     if (configId.empty() || SubForKitProcs.contains(configId))
     {
-        int numPreSpawn = COOLWSD::NumPreSpawnedChildren;
+        int numPreSpawn = getNumPreSpawnedChildren(configId);
         ++numPreSpawn; // Replace the one we'll dispatch just now.
         LOG_DBG("getNewChild: Rebalancing children of config[" << configId << "] to " << numPreSpawn);
         rebalanceChildren(configId, numPreSpawn);
@@ -1447,6 +1511,23 @@ void COOLWSD::innerInitialize(Poco::Util::Application& self)
         }
     }
 
+    // Log to the console from a thread of its own; the kits are told by the environment.
+    if (!logToFile && ConfigUtil::getConfigValue<bool>(conf, "logging.async[@enable]", false))
+    {
+        std::string overflow =
+            ConfigUtil::getConfigValue<std::string>(conf, "logging.async.overflow", "drop");
+        if (overflow != "block")
+            overflow = "drop";
+
+        const std::string bufferSize = std::to_string(
+            ConfigUtil::getConfigValue<unsigned>(conf, "logging.async.buffer_size", 262144));
+
+        logProperties.emplace("async", overflow);
+        logProperties.emplace("async_buffer_size", bufferSize);
+        setenv("COOL_LOGASYNC", overflow.c_str(), true);
+        setenv("COOL_LOGASYNC_BUFFER_SIZE", bufferSize.c_str(), true);
+    }
+
     // Do the same for ui command logging
     const bool logToFileUICmd =
         ConfigUtil::getConfigValue<bool>(conf, "logging_ui_cmd.file[@enable]", false);
@@ -1499,6 +1580,7 @@ void COOLWSD::innerInitialize(Poco::Util::Application& self)
     setenv("COOL_LOGLEVEL_STARTUP", LogLevelStartup.c_str(), true);
 
     Log::initialize("wsd", LogLevelStartup, withColor, logToFile, logProperties, logToFileUICmd, logPropertiesUICmd);
+    Log::startAsync();
     if (LogLevel != LogLevelStartup)
     {
         LOG_INF("Setting log-level to [" << LogLevelStartup << "] and delaying setting to ["
@@ -1539,29 +1621,7 @@ void COOLWSD::innerInitialize(Poco::Util::Application& self)
     EnableTraceEventLogging = ConfigUtil::getConfigValue<bool>(conf, "trace_event[@enable]", false);
 
     if (EnableTraceEventLogging)
-    {
-        const auto traceEventFile = ConfigUtil::getConfigValue<std::string>(
-            conf, "trace_event.path", COOLWSD_TRACEEVENTFILE);
-        LOG_INF("Trace Event file is " << traceEventFile << ".");
-        TraceEventFile = fopen(traceEventFile.c_str(), "w");
-        if (TraceEventFile != NULL)
-        {
-            if (fcntl(fileno(TraceEventFile), F_SETFD, FD_CLOEXEC) == -1)
-            {
-                fclose(TraceEventFile);
-                TraceEventFile = NULL;
-            }
-            else
-            {
-                fprintf(TraceEventFile, "[\n");
-                // Output a metadata event that tells that this is the WSD process
-                fprintf(TraceEventFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"args\":{\"name\":\"WSD\"},\"pid\":%ld,\"tid\":%ld},\n",
-                        Util::getProcessId(), Util::getThreadId());
-                fprintf(TraceEventFile, "{\"name\":\"thread_name\",\"ph\":\"M\",\"args\":{\"name\":\"Main\"},\"pid\":%ld,\"tid\":%ld},\n",
-                        Util::getProcessId(), Util::getThreadId());
-            }
-        }
-    }
+        openTraceEventFile();
 
     // Check deprecated settings.
     if (ConfigUtil::hasProperty("storage.wopi.reuse_cookies"))
@@ -1657,6 +1717,18 @@ void COOLWSD::innerInitialize(Poco::Util::Application& self)
         setenv("ENABLE_WEBSOCKET_URP", enableWebsocketURP ? "true" : "false", 1);
     }
 
+    {
+        const bool streamTileRendering =
+            ConfigUtil::getConfigValue<bool>(conf, "per_document.stream_tile_rendering", false);
+        setenv("COOL_STREAM_TILE_RENDERING", streamTileRendering ? "true" : "false", 1);
+    }
+
+    {
+        const unsigned deltaCacheSizeMB =
+            ConfigUtil::getConfigValue<unsigned>(conf, "per_document.delta_cache_size_mb", 64);
+        setenv("COOL_DELTA_CACHE_SIZE_MB", std::to_string(deltaCacheSizeMB).c_str(), 1);
+    }
+
     {
         std::string proto = ConfigUtil::getConfigValue<std::string>(conf, "net.proto", "");
         if (Util::iequal(proto, "ipv4"))
@@ -1679,6 +1751,18 @@ void COOLWSD::innerInitialize(Poco::Util::Application& self)
             LOG_WRN("Invalid listen address: " << listen << ". Falling back to default: 'any'" );
     }
 
+    {
+        std::string pollBackend =
+            ConfigUtil::getConfigValue<std::string>(conf, "net.poll_backend", "poll");
+        if (Util::iequal(pollBackend, "epoll"))
+            net::Defaults.pollBackend = net::PollBackend::EPoll;
+        else if (!Util::iequal(pollBackend, "poll"))
+            LOG_WRN("Invalid poll backend: " << pollBackend << ". Falling back to default: 'poll'");
+    }
+
+    net::Defaults.wsCompression =
+        ConfigUtil::getConfigValue<bool>(conf, "net.websocket_compression", true);
+
     // Prefix for the coolwsd pages; should not end with a '/'
     ServiceRoot = ConfigUtil::getPathFromConfig("net.service_root");
     while (ServiceRoot.length() > 0 && ServiceRoot[ServiceRoot.length() - 1] == '/')
@@ -1885,6 +1969,46 @@ void COOLWSD::innerInitialize(Poco::Util::Application& self)
     }
     LOG_INF("NumPreSpawnedChildren set to " << NumPreSpawnedChildren << '.');
 
+#if !MOBILEAPP
+    if (!SingleKit && ConfigUtil::getConfigValue<bool>(conf, "prespawn.adaptive", true))
+    {
+        // Between num_prespawn_children and max_children, as the load demands.
+        const unsigned maxPreSpawn =
+            ConfigUtil::getConfigValue<unsigned>(conf, "prespawn.max_children", 8);
+        const double percentile =
+            ConfigUtil::getConfigValue<double>(conf, "prespawn.percentile", 95.0) / 100;
+        const std::size_t maxMemory =
+            ConfigUtil::getConfigValue<unsigned>(conf, "prespawn.max_memory_mb", 512) * 1024UL *
+            1024;
+        Prespawn = std::make_unique<PrespawnController>(NumPreSpawnedChildren, maxPreSpawn,
+                                                        percentile, maxMemory);
+        LOG_INF("Adapting the spare children to the load, up to "
+                << maxPreSpawn << " for " << percentile * 100
+                << "% of loads, within " << maxMemory / (1024 * 1024) << " MB");
+    }
+
+    // Each conversion takes a Kit; by default, as many at a time as we have cores.
+    std::size_t maxConversions =
+        ConfigUtil::getConfigValue<unsigned>(conf, "per_document.batch_max_concurrent", 0);
+    if (maxConversions == 0)
+        maxConversions = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+    const std::size_t maxConversionsPerClient =
+        ConfigUtil::getConfigValue<unsigned>(conf, "per_document.batch_max_per_client", 0);
+    const std::size_t maxConversionsQueued =
+        ConfigUtil::getConfigValue<unsigned>(conf, "per_document.batch_max_queued", 1000);
+    Conversions = std::make_unique<ConversionQueue>(maxConversions, maxConversionsPerClient,
+                                                    maxConversionsQueued);
+    LOG_INF("Running up to " << maxConversions << " conversions at a time, "
+                             << maxConversionsPerClient << " per client (0 for no limit), with "
+                             << maxConversionsQueued << " waiting (0 for no limit)");
+#endif // !MOBILEAPP
+
+    const size_t tileCacheSize =
+        ConfigUtil::getConfigValue<unsigned>(conf, "tile_cache_size_mb", 0) * 1024UL * 1024;
+    TileCache::setGlobalMaxCacheSize(tileCacheSize);
+    if (tileCacheSize > 0)
+        LOG_INF("Tile caches share a budget of " << tileCacheSize << " bytes");
+
     FileUtil::registerFileSystemForDiskSpaceChecks(ChildRoot);
 
     int threads = std::max<int>(std::thread::hardware_concurrency(), 1);
@@ -1960,7 +2084,9 @@ void COOLWSD::innerInitialize(Poco::Util::Application& self)
 #endif
     {
         LOG_DBG("net::Defaults: Socket[inactivityTimeout " << net::Defaults.inactivityTimeout
-                << ", maxExtConnections " << net::Defaults.maxExtConnections << "]");
+                << ", maxExtConnections " << net::Defaults.maxExtConnections
+                << ", pollBackend " << (net::Defaults.pollBackend == net::PollBackend::EPoll ? "epoll" : "poll")
+                << "]");
     }
 
 #if !MOBILEAPP
@@ -2660,6 +2786,46 @@ void COOLWSD::setLogLevelsOfKits(const std::string& level)
     }
 }
 
+void COOLWSD::setTraceSampling(unsigned rate, pid_t pid)
+{
+    // Sampling is meant to be switched on in production, where trace_event is off.
+    if (rate && !openTraceEventFile())
+    {
+        LOG_WRN("Cannot sample Trace Events, as the trace_event file could not be opened");
+        return;
+    }
+
+    LOG_INF("Sampling one in " << rate << " ProfileZones of "
+                               << (pid ? "kit " + std::to_string(pid) : std::string("all")));
+
+    if (!pid)
+    {
+        TraceEvent::setSampling(rate);
+        sendMessageToForKit("tracesampling " + std::to_string(rate)); // For future kits.
+    }
+
+    std::lock_guard<std::mutex> docBrokersLock(DocBrokersMutex);
+    for (const auto& brokerIt : DocBrokers)
+    {
+        std::shared_ptr<DocumentBroker> docBroker = brokerIt.second;
+        if (!pid || docBroker->getPid() == pid)
+            docBroker->addCallback([docBroker, rate]() { docBroker->setKitTraceSampling(rate); });
+    }
+}
+
+void COOLWSD::setMemoryPressure(MemoryPressure::Level level)
+{
+    MemoryPressureLevel = level;
+    TileCache::setLowMemory(level >= MemoryPressure::Level::ShrinkCaches);
+
+    std::lock_guard<std::mutex> docBrokersLock(DocBrokersMutex);
+    for (const auto& brokerIt : DocBrokers)
+    {
+        std::shared_ptr<DocumentBroker> docBroker = brokerIt.second;
+        docBroker->addCallback([docBroker, level]() { docBroker->setMemoryPressure(level); });
+    }
+}
+
 /// Really do the house-keeping
 void PrisonPoll::wakeupHook()
 {
@@ -2814,6 +2980,8 @@ bool COOLWSD::createForKit()
     LOG_INF("Launching forkit process: " << forKitPath << ' ' << args.cat(' ', 0));
 
     LastForkRequestTimes[defaultConfigId] = std::chrono::steady_clock::now();
+    if (Prespawn)
+        Prespawn->forkRequested(defaultConfigId, 1, LastForkRequestTimes[defaultConfigId]);
     int child = createForkit(forKitPath, args);
     ForKitProcId = child;
 
@@ -2822,7 +2990,7 @@ bool COOLWSD::createForKit()
     // Init the Admin manager
     Admin::instance().setForKitPid(ForKitProcId);
 
-    const int balance = COOLWSD::NumPreSpawnedChildren - OutstandingForks[defaultConfigId];
+    const int balance = getNumPreSpawnedChildren(defaultConfigId) - OutstandingForks[defaultConfigId];
     if (balance > 0)
         rebalanceChildren(defaultConfigId, balance);
 
@@ -2932,7 +3100,7 @@ private:
             else
                 LOG_WRN("Unknown Kit process closed with pid " << (child ? child->getPid() : -1));
 #if !MOBILEAPP
-            rebalanceChildren(configId, COOLWSD::NumPreSpawnedChildren);
+            rebalanceChildren(configId, getNumPreSpawnedChildren(configId));
 #endif
         }
     }
@@ -3029,7 +3197,7 @@ private:
                     socket->getInBuffer().clear();
                     // created subforkit for a reason, create spare early
                     std::unique_lock<std::mutex> lock(NewChildrenMutex);
-                    rebalanceChildren(configId, COOLWSD::NumPreSpawnedChildren);
+                    rebalanceChildren(configId, getNumPreSpawnedChildren(configId));
 
                     UnitWSD::get().newSubForKit(SubForKitProcs[configId], configId);
                 }
@@ -3095,7 +3263,7 @@ private:
             _pid = pid;
             _socketFD = socket->getFD();
 #if !MOBILEAPP
-            child->setSMapsFD(socket->getIncomingFD(SharedFDType::SMAPS));
+            Admin::instance().addKitProcess(pid, socket->getIncomingFD(SharedFDType::SMAPS));
 #endif
             _childProcess = child; // weak
 
@@ -3979,15 +4147,17 @@ void COOLWSD::innerMain()
 
     SigUtil::addActivity("save traces");
 
-    if (TraceEventFile != NULL)
     {
-        // If we have written any objects to it, it ends with a comma and newline. Back over those.
-        if (ftell(TraceEventFile) > 2)
-            (void)fseek(TraceEventFile, -2, SEEK_CUR);
-        // Close the JSON array.
-        fprintf(TraceEventFile, "\n]\n");
-        fclose(TraceEventFile);
-        TraceEventFile = NULL;
+        std::unique_lock<std::mutex> lock(traceEventFileMutex);
+        if (FILE* traceEventFile = TraceEventFile.exchange(NULL))
+        {
+            // If we have written any objects to it, it ends with a comma and newline. Back over those.
+            if (ftell(traceEventFile) > 2)
+                (void)fseek(traceEventFile, -2, SEEK_CUR);
+            // Close the JSON array.
+            fprintf(traceEventFile, "\n]\n");
+            fclose(traceEventFile);
+        }
     }
 
 #if !MOBILEAPP
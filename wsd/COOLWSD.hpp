@@ -15,6 +15,7 @@
 #include <common/FileUtil.hpp>
 #include <common/Unit.hpp>
 #include <common/Util.hpp>
+#include <wsd/MemoryPressure.hpp>
 
 #include <algorithm>
 #include <atomic>
@@ -35,9 +36,11 @@ class WSProcess;
 class ForKitProcess;
 class ChildProcess;
 class ClipboardCache;
+class ConversionQueue;
 class DocumentBroker;
 class FileServerRequestHandler;
 class ForKitProcess;
+class PrespawnController;
 class SocketPoll;
 class TraceFileWriter;
 
@@ -57,7 +60,11 @@ public:
     // An Application is a singleton anyway,
     // so just keep these as statics.
     static unsigned int NumPreSpawnedChildren;
+    /// Sizes the spare children to the load, when enabled.
+    static std::unique_ptr<PrespawnController> Prespawn;
 #if !MOBILEAPP
+    /// Admits the batch conversions, in turns.
+    static std::unique_ptr<ConversionQueue> Conversions;
     static bool NoCapsForKit;
     static bool NoSeccomp;
     static bool AdminEnabled;
@@ -87,7 +94,9 @@ public:
     static bool EnableTraceEventLogging;
     static bool EnableAccessibility;
     static bool EnableMountNamespaces;
-    static FILE *TraceEventFile;
+    static std::atomic<FILE*> TraceEventFile;
+    /// Opens the trace_event.path file, unless already open. Returns false on failure.
+    static bool openTraceEventFile();
     static void writeTraceEventRecording(const char *data, std::size_t nbytes);
     static void writeTraceEventRecording(const std::string &recording);
     static std::string LogLevel;
@@ -101,6 +110,8 @@ public:
     static bool CleanupOnly;
     static bool IsProxyPrefixEnabled;
     static std::atomic<unsigned> NumConnections;
+    /// The last level given to setMemoryPressure(), for the documents that come later.
+    static std::atomic<MemoryPressure::Level> MemoryPressureLevel;
     static std::unique_ptr<TraceFileWriter> TraceDumper;
     static bool IndirectionServerEnabled;
     static bool GeolocationSetup;
@@ -229,6 +240,14 @@ public:
     /// Sets the log level of current kits.
     static void setLogLevelsOfKits(const std::string& level);
 
+    /// Samples one in @rate ProfileZones of the kit of @pid, or of all the
+    /// processes when @pid is 0, into the Trace Event file. 0 stops sampling.
+    static void setTraceSampling(unsigned rate, pid_t pid);
+
+    /// Sheds memory in the tile caches, the documents and their kits as
+    /// far as @level tells (currently only called from Admin).
+    static void setMemoryPressure(MemoryPressure::Level level);
+
     /// Anonymize the basename of filenames, preserving the path and extension.
     static std::string anonymizeUrl(const std::string& url)
     {
@@ -41,6 +41,7 @@
 #if !MOBILEAPP
 #include <Admin.hpp>
 #include <JailUtil.hpp>
+#include <wsd/ConversionQueue.hpp>
 #include <wsd/SpecialBrokers.hpp>
 #include <HostUtil.hpp>
 #endif // !MOBILEAPP
@@ -2232,22 +2233,72 @@ bool ClientRequestDispatcher::handlePostRequest(const RequestDetails& requestDet
                 Poco::URI::encode(transformJSON, "", encodedTransformJSON);
             }
 
-            // This lock could become a bottleneck.
-            // In that case, we can use a pool and index by publicPath.
-            std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
+            const std::string client = socket->clientAddress();
+            const auto submitTime = std::chrono::steady_clock::now();
+            auto createDocBroker = [requestType = requestDetails[1], fromPath, uriPublic, docKey,
+                                    format, options, lang, target, filter, encodedTransformJSON,
+                                    client, submitTime]()
+            {
+                LOG_DBG("New DocumentBroker for docKey [" << docKey << "].");
+                auto docBroker = getConvertToBrokerImplementation(
+                    requestType, fromPath, uriPublic, docKey, format, options, lang, target,
+                    filter, encodedTransformJSON);
+                docBroker->setAdmitted(client, submitTime);
 
-            LOG_DBG("New DocumentBroker for docKey [" << docKey << "].");
-            auto docBroker = getConvertToBrokerImplementation(
-                requestDetails[1], fromPath, uriPublic, docKey, format, options, lang, target,
-                filter, encodedTransformJSON);
-            handler.takeFiles();
+                COOLWSD::cleanupDocBrokers();
 
-            COOLWSD::cleanupDocBrokers();
+                DocBrokers.emplace(docKey, docBroker);
+                LOG_TRC("Have " << DocBrokers.size() << " DocBrokers after inserting [" << docKey
+                                << "].");
+                return docBroker;
+            };
+
+            // Beyond the limits, wait for a turn, with the socket where it is.
+            ConversionQueue::Admission admission = ConversionQueue::Admission::Start;
+            if (COOLWSD::Conversions)
+            {
+                ConversionQueue::Job job =
+                    [createDocBroker, client, fromPaths, additionalFileUrisPublic, id = _id,
+                     socketWeak = std::weak_ptr<StreamSocket>(socket)]()
+                {
+                    std::shared_ptr<StreamSocket> streamSocket = socketWeak.lock();
+                    if (!streamSocket || streamSocket->isShutdown())
+                    {
+                        LOG_DBG("Client of queued conversion [" << id << "] has gone");
+                        for (const auto& pair : fromPaths)
+                            StatelessBatchBroker::removeFile(pair.second);
+
+                        ConversionQueue::Job next = COOLWSD::Conversions->release(client);
+                        if (next)
+                            COOLWSD::getWebServerPoll()->addCallback(std::move(next));
+                        return;
+                    }
 
-            DocBrokers.emplace(docKey, docBroker);
-            LOG_TRC("Have " << DocBrokers.size() << " DocBrokers after inserting [" << docKey
-                            << "].");
+                    std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
+                    auto docBroker = createDocBroker();
+                    docBroker->startConversion(*COOLWSD::getWebServerPoll(), streamSocket, id,
+                                               additionalFileUrisPublic);
+                };
+
+                admission = COOLWSD::Conversions->submit(client, std::move(job), submitTime);
+            }
+
+            if (admission == ConversionQueue::Admission::Rejected)
+            {
+                HttpHelper::sendErrorAndShutdown(http::StatusCode::ServiceUnavailable, socket,
+                                                 std::string_view(), "Retry-After: 5\r\n");
+                return true;
+            }
+
+            handler.takeFiles();
+            if (admission == ConversionQueue::Admission::Queued)
+                return false;
+
+            // This lock could become a bottleneck.
+            // In that case, we can use a pool and index by publicPath.
+            std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
 
+            auto docBroker = createDocBroker();
             if (!docBroker->startConversion(disposition, _id, additionalFileUrisPublic))
             {
                 LOG_WRN("Failed to create Client Session with id [" << _id << "] on docKey ["
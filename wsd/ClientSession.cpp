@@ -50,7 +50,6 @@
 
 using namespace COOLProtocol;
 
-static constexpr float TILES_ON_FLY_MIN_UPPER_LIMIT = 10.0;
 static constexpr int SYNTHETIC_COOL_PID_OFFSET = 10000000;
 
 using Poco::Path;
@@ -488,15 +487,7 @@ void ClientSession::handleClipboardRequest(DocumentBroker::ClipboardRequest
 
 void ClientSession::onTileProcessed(TileWireId wireId)
 {
-    auto iter = std::find_if(_tilesOnFly.begin(), _tilesOnFly.end(),
-    [wireId](const std::pair<TileWireId, std::chrono::steady_clock::time_point>& curTile)
-    {
-        return curTile.first == wireId;
-    });
-
-    if(iter != _tilesOnFly.end())
-        _tilesOnFly.erase(iter);
-    else
+    if (!_tilePacer.acknowledged(wireId, std::chrono::steady_clock::now()))
         LOG_INF("Tileprocessed message with an unknown wire-id '" << wireId << "' from session " << getId());
 }
 
@@ -2127,10 +2118,16 @@ void ClientSession::writeQueuedMessages(std::size_t capacity)
         while (capacity > wrote && _senderQueue.dequeue(item) && item)
         {
             const std::vector<char>& data = item->data();
-            const auto size = data.size();
+            const auto size = data.size() + item->payloadSize();
             assert(size && "Zero-sized messages must never be queued for sending.");
 
-            if (item->isBinary())
+            if (item->payload())
+            {
+                Session::sendSharedBinaryFrame(std::string_view(data.data(), data.size()),
+                                               item->payload(), item->payloadOffset(),
+                                               item->payloadSize());
+            }
+            else if (item->isBinary())
             {
                 Session::sendBinaryFrame(data.data(), size);
             }
@@ -2141,6 +2138,11 @@ void ClientSession::writeQueuedMessages(std::size_t capacity)
 
             wrote += size;
             LOG_TRC("wrote " << size << ", total " << wrote << " bytes");
+
+            // Tiles are on the fly from here, until the client has processed them.
+            TileWireId wireId = 0;
+            if (getTileWireId(*item, wireId))
+                _tilePacer.sent(wireId, size, std::chrono::steady_clock::now());
         }
     }
     catch (const std::exception& ex)
@@ -2869,6 +2871,7 @@ ClientSession::handleOpenDocKitToClientMessage(const std::shared_ptr<Message>& p
                 }
 
                 docBroker->invalidateCursor(x, y, w, h);
+                _cursorArea = Util::Rectangle(x, y, std::max(w, 1), std::max(h, 1));
 
                 // session used for thumbnailing and target already was set
                 if (_thumbnailSession)
@@ -3214,78 +3217,51 @@ void ClientSession::enqueueSendMessage(const std::shared_ptr<Message>& data)
     LOG_CHECK_RET(docBroker && "Null DocumentBroker instance", );
     docBroker->ASSERT_CORRECT_THREAD();
 
-    TileWireId wireId = 0;
-    bool haveWireId = false;
-    if (data->firstTokenMatches("tile:") ||
-        data->firstTokenMatches("delta:"))
-    {
-        // Avoid sending tile or delta if it has the same wireID as the
-        // previously sent tile
-        wireId = TileDesc::parse(data->firstLine()).getWireId();
-        haveWireId = true;
-    }
-
     LOG_TRC("Enqueueing client message " << data->id());
-    const std::size_t sizeBefore = _senderQueue.size();
-    const std::size_t newSize = _senderQueue.enqueue(data);
-
-    // Track sent tile
-    if (haveWireId && sizeBefore != newSize)
-        addTileOnFly(wireId);
-}
-
-void ClientSession::addTileOnFly(TileWireId wireId)
-{
-    _tilesOnFly.emplace_back(wireId, std::chrono::steady_clock::now());
+    _senderQueue.enqueue(data);
 }
 
-size_t ClientSession::getTilesOnFlyUpperLimit() const
+bool ClientSession::getTileWireId(Message& message, TileWireId& wireId)
 {
-    // How many tiles we have on the visible area, set the upper limit accordingly
-    Util::Rectangle normalizedVisArea = getNormalizedVisibleArea();
-
-    float tilesOnFlyUpperLimit = 0;
-    if (normalizedVisArea.hasSurface() && getTileWidthInTwips() != 0 && getTileHeightInTwips() != 0)
+    if (message.firstTokenMatches("tile:") || message.firstTokenMatches("delta:"))
     {
-        const int tilesFitOnWidth = (normalizedVisArea.getRight() / getTileWidthInTwips()) -
-                                    (normalizedVisArea.getLeft() / getTileWidthInTwips()) + 1;
-        const int tilesFitOnHeight = (normalizedVisArea.getBottom() / getTileHeightInTwips()) -
-                                     (normalizedVisArea.getTop() / getTileHeightInTwips()) + 1;
-        const int tilesInVisArea = tilesFitOnWidth * tilesFitOnHeight;
-
-        tilesOnFlyUpperLimit = std::max(TILES_ON_FLY_MIN_UPPER_LIMIT, tilesInVisArea * 1.1f);
+        wireId = TileDesc::parse(message.firstLine()).getWireId();
+        return true;
     }
-    else
+
+    if (message.firstTokenMatches(TileBinary::Token))
     {
-        tilesOnFlyUpperLimit = 200; // Have a big number here to get all tiles requested by file opening
+        const char* buffer = message.data().data();
+        TileBinary::Header header{};
+        if (TileBinary::Header::tryParse(buffer, message.size(), header) &&
+            header.kind != TileBinary::Kind::Update && header.count > 0)
+        {
+            const char* tile = buffer + TileBinary::getTileOffset(0);
+            wireId = TileDesc::parseBinaryTile(header, tile).getWireId();
+            return true;
+        }
     }
-    return tilesOnFlyUpperLimit;
+
+    return false;
+}
+
+bool ClientSession::isNearCursor(const TileDesc& tile) const
+{
+    if (!_cursorArea.hasSurface())
+        return false;
+
+    // The tile, and those around it.
+    const Util::Rectangle neighbourhood(tile.getTilePosX() - tile.getTileWidth(),
+                                        tile.getTilePosY() - tile.getTileHeight(),
+                                        tile.getTileWidth() * 3, tile.getTileHeight() * 3);
+    return neighbourhood.intersects(_cursorArea);
 }
 
 void ClientSession::removeOutdatedTilesOnFly(const std::chrono::steady_clock::time_point now)
 {
-    size_t dropped = 0;
     const auto highTimeoutMs = std::chrono::milliseconds(TILE_ROUNDTRIP_TIMEOUT_MS);
     const auto lowTimeoutMs = std::chrono::milliseconds((int)(0.9 * TILE_ROUNDTRIP_TIMEOUT_MS));
-    // Check only the beginning of the list, tiles are ordered by timestamp
-    while(!_tilesOnFly.empty())
-    {
-        auto tileIter = _tilesOnFly.begin();
-        const auto elapsedTimeMs = std::chrono::duration_cast<
-            std::chrono::milliseconds>(now - tileIter->second);
-        if (elapsedTimeMs > highTimeoutMs ||
-            // once we start dropping - drop lots in a similar range of time
-            (dropped > 0 && elapsedTimeMs > lowTimeoutMs))
-        {
-            LOG_TRC("Tracker tileID " << tileIter->first << " was dropped because of time out ("
-                    << elapsedTimeMs
-                    << "). Tileprocessed message did not arrive in time.");
-            dropped++;
-            _tilesOnFly.erase(tileIter);
-        }
-        else
-            break;
-    }
+    const std::size_t dropped = _tilePacer.expire(now, highTimeoutMs, lowTimeoutMs);
     if (dropped > 0)
         LOG_WRN("client not consuming tiles; stalled for " << (TILE_ROUNDTRIP_TIMEOUT_MS/1000) << " seconds: removed tracking for " << dropped << " on the fly tiles");
 }
@@ -3397,15 +3373,8 @@ void ClientSession::dumpState(std::ostream& os)
         os << "\n\t\tsent/keystroke: " << sent / 1024. / _keyEvents << " Kbytes";
     }
 
-    os << "\n\t\tonFlyUpperLimit: " << getTilesOnFlyUpperLimit();
-    os << "\n\t\tonFlyCount: " << getTilesOnFlyCount();
-    if (_tilesOnFly.size() > 0)
-        os << " between wid: " << _tilesOnFly.front().first << " as of " <<
-            std::chrono::duration_cast<std::chrono::milliseconds>(
-                std::chrono::steady_clock::now() - _tilesOnFly.front().second) << " ms "
-           << " and wid: " << _tilesOnFly.back().first << " as of " <<
-            std::chrono::duration_cast<std::chrono::milliseconds>(
-                std::chrono::steady_clock::now() - _tilesOnFly.back().second) << " ms ";
+    _tilePacer.dumpState(os);
+    os << "\n\t\tqueued: " << _senderQueue.getBytes() << " bytes";
 
     os << '\n';
     _senderQueue.dumpState(os);
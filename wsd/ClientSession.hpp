@@ -16,6 +16,7 @@
 #include "SenderQueue.hpp"
 #include "ServerURL.hpp"
 #include "DocumentBroker.hpp"
+#include "TilePacer.hpp"
 
 #include <Poco/JSON/Object.h>
 #include <Poco/SharedPtr.h>
@@ -107,8 +108,14 @@ public:
     bool sendUpdateNow(const TileDesc &desc)
     {
         TileWireId lastSentId = _tracker.updateTileSeq(desc);
+        LOG_TRC("Sending update from " << lastSentId << " to " << desc.serialize("update:"));
+        if (hasBinaryTileHeaders())
+        {
+            const std::string header = desc.serializeBinary(TileBinary::Kind::Update);
+            return sendBinaryFrame(header.data(), header.size());
+        }
+
         std::string header = desc.serialize("update:", "\n");
-        LOG_TRC("Sending update from " << lastSentId << " to " << header);
         return sendTextFrame(header.data(), header.size());
     }
 
@@ -116,34 +123,45 @@ public:
     {
         TileWireId lastSentId = _tracker.updateTileSeq(desc);
 
+        const bool keyframe = tile->needsKeyframe(lastSentId) || tile->isPng();
         std::string header;
-        if (tile->needsKeyframe(lastSentId) || tile->isPng())
+        if (hasBinaryTileHeaders())
+            header = desc.serializeBinary(keyframe ? TileBinary::Kind::Tile
+                                                   : TileBinary::Kind::Delta);
+        else if (keyframe)
             header = desc.serialize("tile:", "\n");
         else
             header = desc.serialize("delta:", "\n");
 
-        // FIXME: performance - optimize away this copy ...
-        std::vector<char> output;
-
-        // copy in the header
-        output.resize(header.size());
-        std::memcpy(output.data(), header.data(), header.size());
+        std::size_t offset = 0;
+        const std::shared_ptr<const BlobData> changes =
+            tile->getChangesSince(tile->isPng() ? 0 : lastSentId, offset);
+        LOG_TRC("Sending tile message: " << desc.serialize(keyframe ? "tile:" : "delta:")
+                                         << " lastSendId " << lastSentId << " content "
+                                         << (changes != nullptr));
+        if (!changes)
+            return sendBinaryFrame(header.data(), header.size());
 
-        bool hasContent = tile->appendChangesSince(output, tile->isPng() ? 0 : lastSentId);
-        LOG_TRC("Sending tile message: " << header << " lastSendId " << lastSentId << " content " << hasContent);
-        return sendBinaryFrame(output.data(), output.size());
+        return sendSharedBinaryFrame(header, changes, offset, changes->size() - offset);
     }
 
     bool sendBlob(const std::string &header, const Blob &blob)
     {
-        // FIXME: performance - optimize away this copy ...
-        std::vector<char> output;
+        return sendSharedBinaryFrame(header, blob, 0, blob->size());
+    }
 
-        output.resize(header.size() + blob->size());
-        std::memcpy(output.data(), header.data(), header.size());
-        std::memcpy(output.data() + header.size(), blob->data(), blob->size());
+    bool sendSharedBinaryFrame(const std::string_view header,
+                               const std::shared_ptr<const BlobData>& blob, std::size_t offset,
+                               std::size_t len) override
+    {
+        if (!isCloseFrame())
+        {
+            enqueueSendMessage(
+                std::make_shared<Message>(header, blob, offset, len, Message::Dir::Out));
+            return true;
+        }
 
-        return sendBinaryFrame(output.data(), output.size());
+        return false;
     }
 
     bool sendTextFrame(const char* buffer, const int length) override
@@ -193,13 +211,18 @@ public:
     /// Get requested tiles waiting for sending to the client
     std::deque<TileDesc>& getRequestedTiles() { return _requestedTiles; }
 
-    /// Mark a new tile as sent
-    void addTileOnFly(TileWireId wireId);
-    size_t getTilesOnFlyCount() const { return _tilesOnFly.size(); }
-    size_t getTilesOnFlyUpperLimit() const;
+    /// Paces the tiles sent by the bandwidth and round-trip time to the client.
+    const TilePacer& getTilePacer() const { return _tilePacer; }
+    size_t getTilesOnFlyCount() const { return _tilePacer.getTilesOnFly(); }
     void removeOutdatedTilesOnFly(std::chrono::steady_clock::time_point now);
     void onTileProcessed(TileWireId wireId);
 
+    /// The bytes queued for the client, not yet handed to the socket.
+    size_t getQueuedBytes() const { return _senderQueue.getBytes(); }
+
+    /// True if @tile is next to the cursor, where the user is likely typing.
+    bool isNearCursor(const TileDesc& tile) const;
+
     Util::Rectangle getVisibleArea() const { return _clientVisibleArea; }
     /// Visible area can have negative value as position, but we have tiles only in the positive range
     Util::Rectangle getNormalizedVisibleArea() const;
@@ -338,6 +361,9 @@ private:
     /// SocketHandler: send those messages
     void writeQueuedMessages(std::size_t capacity) override;
 
+    /// Gets the @wireId of @message, if it carries a tile.
+    static bool getTileWireId(Message& message, TileWireId& wireId);
+
     virtual bool _handleInput(const char* buffer, int length) override;
 
     bool handleSignatureAction(const StringVector& tokens);
@@ -432,8 +458,11 @@ private:
     /// Wopi FileInfo object
     std::unique_ptr<WopiStorage::WOPIFileInfo> _wopiFileInfo;
 
-    /// wire-ids's of the in-flight tiles. Push by sending and pop by tileprocessed message from the client.
-    std::vector<std::pair<TileWireId, std::chrono::steady_clock::time_point>> _tilesOnFly;
+    /// The in-flight tiles. Push by writing to the socket and pop by tileprocessed message from the client.
+    TilePacer _tilePacer;
+
+    /// Our own cursor, in twips.
+    Util::Rectangle _cursorArea;
 
     /// Sockets to send binary selection content to
     std::vector<std::weak_ptr<StreamSocket>> _clipSockets;
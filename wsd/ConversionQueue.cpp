@@ -0,0 +1,167 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "ConversionQueue.hpp"
+
+#include <common/Log.hpp>
+
+#include <algorithm>
+
+void LatencyHistogram::add(std::chrono::steady_clock::duration duration)
+{
+    const double secs = std::chrono::duration<double>(duration).count();
+    const auto it = std::lower_bound(Bounds.begin(), Bounds.end(), secs);
+    if (it != Bounds.end())
+        ++_buckets[it - Bounds.begin()];
+
+    _sumSecs += secs;
+    ++_count;
+}
+
+void LatencyHistogram::dump(std::ostream& os, const std::string& name) const
+{
+    uint64_t cumulative = 0;
+    for (std::size_t i = 0; i < Bounds.size(); ++i)
+    {
+        cumulative += _buckets[i];
+        os << name << "_bucket{le=\"" << Bounds[i] << "\"} " << cumulative << '\n';
+    }
+
+    os << name << "_bucket{le=\"+Inf\"} " << _count << '\n';
+    os << name << "_sum " << _sumSecs << '\n';
+    os << name << "_count " << _count << '\n';
+}
+
+ConversionQueue::ConversionQueue(std::size_t maxActive, std::size_t maxActivePerClient,
+                                 std::size_t maxQueued)
+    : _maxActive(std::max<std::size_t>(maxActive, 1))
+    , _maxActivePerClient(maxActivePerClient)
+    , _maxQueued(maxQueued)
+    , _active(0)
+    , _queued(0)
+    , _completed(0)
+    , _rejected(0)
+{
+}
+
+ConversionQueue::Admission ConversionQueue::submit(const std::string& client, Job job,
+                                                   std::chrono::steady_clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    Client& entry = _clients[client];
+    if (_active < _maxActive && entry.pending.empty() &&
+        (!_maxActivePerClient || entry.active < _maxActivePerClient))
+    {
+        ++entry.active;
+        ++_active;
+        _waitTime.add(std::chrono::steady_clock::duration::zero());
+        return Admission::Start;
+    }
+
+    if (_maxQueued && _queued >= _maxQueued)
+    {
+        LOG_WRN("Rejecting conversion from [" << client << "] with " << _active << " active and "
+                                              << _queued << " queued");
+        if (!entry.active && entry.pending.empty())
+            _clients.erase(client);
+
+        ++_rejected;
+        return Admission::Rejected;
+    }
+
+    if (entry.pending.empty())
+        _turns.push_back(client);
+
+    entry.pending.emplace_back(std::move(job), now);
+    ++_queued;
+
+    LOG_DBG("Queued conversion from [" << client << "], " << entry.pending.size()
+                                       << " waiting for it, " << _queued << " in all, with "
+                                       << _active << " active");
+    return Admission::Queued;
+}
+
+ConversionQueue::Job ConversionQueue::finished(const std::string& client,
+                                               std::chrono::steady_clock::duration duration)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    ++_completed;
+    _duration.add(duration);
+    return next(client);
+}
+
+ConversionQueue::Job ConversionQueue::release(const std::string& client)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return next(client);
+}
+
+ConversionQueue::Job ConversionQueue::next(const std::string& client)
+{
+    const auto it = _clients.find(client);
+    if (it != _clients.end())
+    {
+        if (it->second.active > 0)
+            --it->second.active;
+
+        if (!it->second.active && it->second.pending.empty())
+            _clients.erase(it);
+    }
+
+    if (_active > 0)
+        --_active;
+
+    // Serve the first client, in turn, that may have more running.
+    for (auto turn = _turns.begin(); turn != _turns.end(); ++turn)
+    {
+        Client& candidate = _clients[*turn];
+        if (_maxActivePerClient && candidate.active >= _maxActivePerClient)
+            continue;
+
+        auto [job, submitted] = std::move(candidate.pending.front());
+        candidate.pending.pop_front();
+        ++candidate.active;
+        ++_active;
+        --_queued;
+        _waitTime.add(std::chrono::steady_clock::now() - submitted);
+
+        // To the back of the line, if it has more.
+        std::string name = std::move(*turn);
+        _turns.erase(turn);
+        if (!candidate.pending.empty())
+            _turns.push_back(std::move(name));
+
+        return job;
+    }
+
+    return nullptr;
+}
+
+ConversionQueue::Stats ConversionQueue::getStats() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    Stats stats;
+    stats.active = _active;
+    stats.queued = _queued;
+    stats.completed = _completed;
+    stats.rejected = _rejected;
+    stats.waitTime = _waitTime;
+    stats.duration = _duration;
+    return stats;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
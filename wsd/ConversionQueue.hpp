@@ -0,0 +1,125 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <common/StateEnum.hpp>
+
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+/// Counts durations in buckets, to dump as a Prometheus histogram.
+class LatencyHistogram
+{
+public:
+    /// The upper bounds of the buckets, in seconds; the last is implicitly +Inf.
+    static constexpr std::array<double, 11> Bounds{ 0.05, 0.1, 0.25, 0.5, 1,  2.5,
+                                                    5,    10,  30,   60,  120 };
+
+    void add(std::chrono::steady_clock::duration duration);
+
+    uint64_t count() const { return _count; }
+
+    /// Dumps the cumulative buckets, the sum and the count of @name.
+    void dump(std::ostream& os, const std::string& name) const;
+
+private:
+    std::array<uint64_t, Bounds.size()> _buckets{};
+    double _sumSecs = 0;
+    uint64_t _count = 0;
+};
+
+/// Admits the batch conversions (convert-to, get-thumbnail, etc.) to start,
+/// at most so many at a time, and so many per client. A burst of them then
+/// neither forks a Kit for each at once, nor lets one client starve the
+/// others: those beyond the limits wait in a queue per client, and the
+/// clients take turns as conversions finish.
+/// Thread-safe.
+class ConversionQueue
+{
+public:
+    /// Starts a queued conversion.
+    using Job = std::function<void()>;
+
+    STATE_ENUM(Admission, Start, Queued, Rejected);
+
+    /// @maxActive is the number of conversions running at a time.
+    /// @maxActivePerClient is that of each client, 0 for no limit.
+    /// @maxQueued is the number of waiting conversions, 0 for no limit.
+    ConversionQueue(std::size_t maxActive, std::size_t maxActivePerClient, std::size_t maxQueued);
+
+    /// A conversion from @client arrives at @now.
+    /// Start: the caller starts it right away.
+    /// Queued: @job is returned by finished() or release() once it may start.
+    /// Rejected: too many are waiting already.
+    Admission submit(const std::string& client, Job job, std::chrono::steady_clock::time_point now);
+
+    /// A conversion of @client has finished, having taken @duration since submitted.
+    /// Returns the next conversion to start, if any, to run outside of any locks.
+    Job finished(const std::string& client, std::chrono::steady_clock::duration duration);
+
+    /// A conversion of @client has been admitted, but given up on.
+    /// Returns the next conversion to start, if any.
+    Job release(const std::string& client);
+
+    struct Stats
+    {
+        std::size_t active = 0;
+        std::size_t queued = 0;
+        uint64_t completed = 0;
+        uint64_t rejected = 0;
+        LatencyHistogram waitTime; ///< From submitted to started.
+        LatencyHistogram duration; ///< From submitted to finished.
+    };
+
+    Stats getStats() const;
+
+private:
+    struct Client
+    {
+        std::size_t active = 0;
+        std::deque<std::pair<Job, std::chrono::steady_clock::time_point>> pending;
+    };
+
+    /// Frees the slot of @client and picks the next conversion, in turns.
+    Job next(const std::string& client);
+
+    const std::size_t _maxActive;
+    const std::size_t _maxActivePerClient;
+    const std::size_t _maxQueued;
+    std::map<std::string, Client> _clients;
+    /// The clients with pending conversions, the next to be served first.
+    std::deque<std::string> _turns;
+    std::size_t _active;
+    std::size_t _queued;
+    uint64_t _completed;
+    uint64_t _rejected;
+    LatencyHistogram _waitTime;
+    LatencyHistogram _duration;
+    mutable std::mutex _mutex;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const ConversionQueue::Admission& admission)
+{
+    os << ConversionQueue::name(admission);
+    return os;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
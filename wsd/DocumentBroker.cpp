@@ -342,6 +342,13 @@ void DocumentBroker::pollThread()
 
     setupPriorities();
 
+    // The kit only hears of changes; tell it where we are already.
+    if (const MemoryPressure::Level level = COOLWSD::MemoryPressureLevel;
+        level != MemoryPressure::Level::None)
+    {
+        setMemoryPressure(level);
+    }
+
 #if !MOBILEAPP
     CONFIG_STATIC const std::chrono::seconds IdleDocTimeoutSecs =
         ConfigUtil::getConfigValue<std::chrono::seconds>("per_document.idle_timeout_secs", 3600);
@@ -354,6 +361,8 @@ void DocumentBroker::pollThread()
     // Used to accumulate B/W deltas.
     uint64_t adminSent = 0;
     uint64_t adminRecv = 0;
+    uint64_t adminSaved = 0;
+    uint64_t adminCompressUs = 0;
     auto lastBWUpdateTime = std::chrono::steady_clock::now();
     auto lastClipboardHashUpdateTime = std::chrono::steady_clock::now();
 
@@ -405,9 +414,15 @@ void DocumentBroker::pollThread()
         const auto now = std::chrono::steady_clock::now();
 
         // a tile's data is ~8k, a 4k screen is ~256 256x256 tiles -
-        // so double that - 4Mb per view.
+        // so double that - 4Mb per view, unless sharing a global budget.
+        // This trims the cache too, so idle documents give up their share
+        // as others open, rather than only when caching new tiles.
         if (_tileCache)
-            _tileCache->setMaxCacheSize(8 * 1024 * 256 * 2 * _sessions.size());
+        {
+            _tileCache->setMaxCacheSize(TileCache::getGlobalMaxCacheSize() > 0
+                                            ? TileCache::getGlobalCacheShare()
+                                            : 8 * 1024 * 256 * 2 * _sessions.size());
+        }
 
         if (isInteractive())
         {
@@ -477,10 +492,31 @@ void DocumentBroker::pollThread()
                 deltaRecv = recv - adminRecv;
                 adminRecv = recv;
             }
-            LOG_TRC("Doc [" << _docKey << "] added stats sent: +" << deltaSent << ", recv: +" << deltaRecv << " bytes to totals.");
+
+            // What WebSocket compression saved of it, and its cost.
+            uint64_t saved = 0, compressUs = 0;
+            getCompressionStats(saved, compressUs);
+
+            uint64_t deltaSaved = 0, deltaCompressUs = 0;
+            if (saved > adminSaved)
+            {
+                deltaSaved = saved - adminSaved;
+                adminSaved = saved;
+            }
+            if (compressUs > adminCompressUs)
+            {
+                deltaCompressUs = compressUs - adminCompressUs;
+                adminCompressUs = compressUs;
+            }
+            LOG_TRC("Doc [" << _docKey << "] added stats sent: +" << deltaSent << ", recv: +"
+                            << deltaRecv << " bytes to totals, saved by compression: +"
+                            << deltaSaved << " bytes in " << deltaCompressUs << "us.");
 
             // send change since last notification.
-            _admin.addBytes(getDocKey(), deltaSent, deltaRecv);
+            _admin.addBytes(getDocKey(), deltaSent, deltaRecv, deltaSaved, deltaCompressUs);
+
+            if (_tileCache)
+                _admin.setDocTileCacheStats(getDocKey(), _tileCache->getStats());
         }
 
         if (_storage && !_lockStateUpdateRequest && _lockCtx->needsRefresh(now))
@@ -955,7 +991,8 @@ bool DocumentBroker::download(
     const std::shared_ptr<ClientSession>& session, const std::string& jailId,
     const Poco::URI& uriPublic,
     const AdditionalFilePocoUris& additionalFileUrisPublic,
-    [[maybe_unused]] std::unique_ptr<WopiStorage::WOPIFileInfo> wopiFileInfo)
+    [[maybe_unused]] std::unique_ptr<WopiStorage::WOPIFileInfo> wopiFileInfo,
+    [[maybe_unused]] std::shared_ptr<GetFile> getFile)
 {
     ASSERT_CORRECT_THREAD();
 
@@ -1188,6 +1225,15 @@ bool DocumentBroker::download(
     std::chrono::milliseconds getFileCallDurationMs = std::chrono::milliseconds::zero();
     if (!_storage->isDownloaded())
     {
+#if !MOBILEAPP
+        if (getFile && wopiStorage != nullptr)
+        {
+            // Started when CheckFileInfo succeeded, and completed before
+            // the vetting station handed the session over to us.
+            wopiStorage->setGetFile(std::move(getFile));
+        }
+#endif // !MOBILEAPP
+
         const Authorization auth =
             session ? session->getAuthorization() : Authorization::create(uriPublic);
         if (!doDownloadDocument(auth, templateSource, fileInfo.getFilename(),
@@ -3862,7 +3908,8 @@ std::string DocumentBroker::getJailRoot() const
 }
 
 std::size_t DocumentBroker::addSession(const std::shared_ptr<ClientSession>& session,
-                                       std::unique_ptr<WopiStorage::WOPIFileInfo> wopiFileInfo)
+                                       std::unique_ptr<WopiStorage::WOPIFileInfo> wopiFileInfo,
+                                       std::shared_ptr<GetFile> getFile)
 {
     ASSERT_CORRECT_THREAD();
 
@@ -3875,7 +3922,7 @@ std::size_t DocumentBroker::addSession(const std::shared_ptr<ClientSession>& ses
         // First, download the document, since this can fail.
         if (!download(session, _childProcess->getJailId(), session->getPublicUri(),
                       session->getAdditionalFilePublicUri(),
-                      std::move(wopiFileInfo)))
+                      std::move(wopiFileInfo), std::move(getFile)))
         {
             const auto msg = "Failed to load document with URI [" + session->getPublicUri().toString() + "].";
             LOG_ERR(msg);
@@ -3892,7 +3939,7 @@ std::size_t DocumentBroker::addSession(const std::shared_ptr<ClientSession>& ses
         // Create uri without query parameters
         const std::string wopiSrc(uri.getScheme() + "://" + uri.getAuthority() + uri.getPath());
         _admin.addDoc(_docKey, getPid(), getFilename(), id, session->getUserName(),
-                      session->getUserId(), _childProcess->getSMapsFp(), wopiSrc, session->isReadOnly());
+                      session->getUserId(), wopiSrc, session->isReadOnly());
         _admin.setDocWopiDownloadDuration(_docKey, _wopiDownloadDuration);
 #endif
 
@@ -4399,6 +4446,27 @@ void DocumentBroker::setKitLogLevel(const std::string& level)
     _childProcess->sendTextFrame("setloglevel " + level);
 }
 
+void DocumentBroker::setKitTraceSampling(unsigned rate)
+{
+    ASSERT_CORRECT_THREAD();
+    _childProcess->sendTextFrame("tracesampling " + std::to_string(rate));
+}
+
+void DocumentBroker::setMemoryPressure(MemoryPressure::Level level)
+{
+    ASSERT_CORRECT_THREAD();
+
+    // The lower limit of the tile cache applies from now on; evict what's beyond it now.
+    if (_tileCache)
+        _tileCache->ensureCacheSize();
+
+    if (level >= MemoryPressure::Level::DropCaches)
+        _slideLayerCache.erase_all();
+
+    if (_childProcess)
+        _childProcess->sendTextFrame("memorypressure " + std::to_string(static_cast<int>(level)));
+}
+
 std::string DocumentBroker::getDownloadURL(const std::string& downloadId)
 {
     auto found = _registeredDownloadLinks.find(downloadId);
@@ -4441,7 +4509,11 @@ bool DocumentBroker::handleInput(const std::shared_ptr<Message>& message)
     }
     else
     {
-        if (message->firstTokenMatches("tile:"))
+        if (message->firstTokenMatches(TileBinary::Token))
+        {
+            handleTileBinaryResponse(message);
+        }
+        else if (message->firstTokenMatches("tile:"))
         {
             handleTileResponse(message);
         }
@@ -4518,6 +4590,19 @@ bool DocumentBroker::handleInput(const std::shared_ptr<Message>& message)
         {
             clearCaches();
         }
+        else if (message->firstTokenMatches("deltacache:"))
+        {
+            LOG_CHECK_RET(message->tokens().size() == 3, false);
+            uint64_t used = 0;
+            uint64_t max = 0;
+            if (COOLProtocol::getTokenUInt64(message->tokens()[1], "used", used) &&
+                COOLProtocol::getTokenUInt64(message->tokens()[2], "max", max))
+            {
+#if !MOBILEAPP
+                _admin.setDocDeltaCache(_docKey, used, max);
+#endif
+            }
+        }
 #if ENABLE_DEBUG
         else if (message->firstTokenMatches("unitresult:"))
         {
@@ -4899,24 +4984,40 @@ void DocumentBroker::sendRequestedTiles(const std::shared_ptr<ClientSession>& se
 {
     ASSERT_CORRECT_THREAD();
 
-    size_t tilesOnFlyUpperLimit = session->getTilesOnFlyUpperLimit();
-
     auto now = std::chrono::steady_clock::now();
 
     // Drop tiles which we are waiting for too long
     session->removeOutdatedTilesOnFly(now);
 
-    // All tiles were processed on client side that we sent last time, so we can send
-    // a new batch of tiles which was invalidated / requested in the meantime
+    // Send as many of the tiles which were invalidated / requested in the meantime
+    // as the link to the client takes, without queuing them up.
     std::deque<TileDesc>& requestedTiles = session->getRequestedTiles();
     bool bumpedVersion = false;
     if (!requestedTiles.empty() && hasTileCache())
     {
+        // Those next to the cursor first, as the user is likely typing there.
+        std::stable_partition(requestedTiles.begin(), requestedTiles.end(),
+                              [&session](const TileDesc& tile)
+                              { return session->isNearCursor(tile); });
+
         std::vector<TileDesc> tilesNeedsRendering;
         bool allSamePartAndSize = true;
+
+        // Those queued, and those being rendered for us, counted by the usual size, are about
+        // to be sent. That includes the tiles we asked for in earlier calls, still in the Kit.
+        const TilePacer& pacer = session->getTilePacer();
+        std::size_t tilesRendering = _tileCache->countTilesBeingRenderedForSession(session, now);
+        const auto getPendingBytes = [&]()
+        { return session->getQueuedBytes() + tilesRendering * pacer.getAverageTileBytes(); };
+
+        // With nothing on the fly or coming, no tileprocessed would come to send the rest.
+        bool mustSend = pacer.getTilesOnFly() == 0 && tilesRendering == 0;
+
         while (!requestedTiles.empty() &&
-               session->getTilesOnFlyCount() < tilesOnFlyUpperLimit)
+               (mustSend ||
+                pacer.canSend(getPendingBytes(), session->isNearCursor(requestedTiles.front()))))
         {
+            mustSend = false;
             TileDesc& tile = *(requestedTiles.begin());
 
             // Satisfy as many tiles from the cache.
@@ -4946,6 +5047,7 @@ void DocumentBroker::sendRequestedTiles(const std::shared_ptr<ClientSession>& se
                 }
                 bool forceKeyFrame = !cachedTile;
                 allSamePartAndSize &= requestTileRendering(tile, forceKeyFrame, _tileVersion, now, tilesNeedsRendering, session);
+                ++tilesRendering;
             }
             requestedTiles.pop_front();
         }
@@ -5058,6 +5160,38 @@ void DocumentBroker::handleTileCombinedResponse(const std::shared_ptr<Message>&
     }
 }
 
+void DocumentBroker::handleTileBinaryResponse(const std::shared_ptr<Message>& message)
+{
+    ASSERT_CORRECT_THREAD();
+
+    try
+    {
+        const char* buffer = message->data().data();
+        const std::size_t length = message->size();
+
+        std::size_t offset = 0;
+        const TileCombined tileCombined = TileCombined::parseBinary(buffer, length, offset);
+        LOG_DBG("Handling " << tileCombined.getTiles().size() << " binary tiles");
+
+        for (const auto& tile : tileCombined.getTiles())
+        {
+            if (offset + tile.getImgSize() > length)
+            {
+                LOG_WRN("Dropping truncated tile response: " << tile.serialize());
+                // They will get re-issued if we don't forget them.
+                break;
+            }
+
+            tileCache().saveTileAndNotify(tile, buffer + offset, tile.getImgSize());
+            offset += tile.getImgSize();
+        }
+    }
+    catch (const std::exception& exc)
+    {
+        LOG_ERR("Failed to process binary tile response: " << exc.what() << '.');
+    }
+}
+
 bool DocumentBroker::haveAnotherEditableSession(const std::string& id) const
 {
     ASSERT_CORRECT_THREAD();
@@ -5522,6 +5656,20 @@ void DocumentBroker::getIOStats(uint64_t &sent, uint64_t &recv)
     }
 }
 
+void DocumentBroker::getCompressionStats(uint64_t& saved, uint64_t& timeUs)
+{
+    saved = 0;
+    timeUs = 0;
+    ASSERT_CORRECT_THREAD();
+    for (const auto& sessionIt : _sessions)
+    {
+        uint64_t s = 0, t = 0;
+        sessionIt.second->getCompressionStats(s, t);
+        saved += s;
+        timeUs += t;
+    }
+}
+
 #if !MOBILEAPP
 void DocumentBroker::checkFileInfo(const std::shared_ptr<ClientSession>& session, int redirectLimit)
 {
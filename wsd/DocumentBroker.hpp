@@ -18,6 +18,7 @@
 #include <common/Util.hpp>
 #include <net/Socket.hpp>
 #include <wsd/QuarantineUtil.hpp>
+#include <wsd/MemoryPressure.hpp>
 #include <wsd/ServerAuditUtil.hpp>
 #include <wsd/SlideCache.hpp>
 #include <wsd/Storage.hpp>
@@ -49,6 +50,7 @@
 class PrisonerRequestDispatcher;
 class CheckFileInfo;
 class DocumentBroker;
+class GetFile;
 class LockContext;
 class PresetsInstallTask;
 class TileCache;
@@ -380,8 +382,14 @@ public:
     std::string getJailRoot() const;
 
     /// Loads and adds a new session. Returns the new number of sessions.
+    /// The document is taken from @getFile, if given, when it needs downloading.
     std::size_t addSession(const std::shared_ptr<ClientSession>& session,
-                           std::unique_ptr<WopiStorage::WOPIFileInfo> wopiFileInfo = nullptr);
+                           std::unique_ptr<WopiStorage::WOPIFileInfo> wopiFileInfo = nullptr,
+                           std::shared_ptr<GetFile> getFile = nullptr);
+
+    /// Returns true only the first time it's called, to the one
+    /// caller that should download the document ahead of loading it.
+    bool claimGetFile() { return !_getFileClaimed.exchange(true); }
 
     /// Removes a session by ID. Returns the new number of sessions.
     std::size_t removeSession(const std::shared_ptr<ClientSession>& session);
@@ -410,6 +418,12 @@ public:
     /// Sets the log level of kit.
     void setKitLogLevel(const std::string& level);
 
+    /// Sets the rate at which the kit samples its ProfileZones, 0 for none.
+    void setKitTraceSampling(unsigned rate);
+
+    /// Drops our caches and has the kit shed memory as far as @level tells.
+    void setMemoryPressure(MemoryPressure::Level level);
+
     /// Invalidate the cursor position.
     void invalidateCursor(int x, int y, int w, int h)
     {
@@ -656,7 +670,8 @@ private:
     bool download(const std::shared_ptr<ClientSession>& session, const std::string& jailId,
                   const Poco::URI& uriPublic,
                   const AdditionalFilePocoUris& additionalFileUrisPublic,
-                  std::unique_ptr<WopiStorage::WOPIFileInfo> wopiFileInfo);
+                  std::unique_ptr<WopiStorage::WOPIFileInfo> wopiFileInfo,
+                  std::shared_ptr<GetFile> getFile);
 
     /// Actual document download and post-download processing.
     /// Must be called only when creating the storage for the first time.
@@ -708,6 +723,7 @@ private:
     void handleTileResponse(const std::shared_ptr<Message>& message);
     void handleDialogPaintResponse(const std::vector<char>& payload, bool child);
     void handleTileCombinedResponse(const std::shared_ptr<Message>& message);
+    void handleTileBinaryResponse(const std::shared_ptr<Message>& message);
     void handleSlideLayerResponse(const std::shared_ptr<Message>& message);
     void handleDialogRequest(const std::string& dialogCmd);
 
@@ -910,6 +926,9 @@ private:
     /// Sum the I/O stats from all connected sessions
     void getIOStats(uint64_t &sent, uint64_t &recv);
 
+    /// Sums the WebSocket compression savings and time of our sessions.
+    void getCompressionStats(uint64_t& saved, uint64_t& timeUs);
+
     /// Returns true iff this is a Convert-To request.
     /// This is needed primarily for security reasons,
     /// because we can't trust the given file-path is
@@ -1860,6 +1879,8 @@ private:
     DocumentState _docState;
 
     std::atomic<bool> _migrateMsgReceived = false;
+    /// Whether the document is, or was, downloaded ahead of loading.
+    std::atomic<bool> _getFileClaimed = false;
 
     std::atomic<bool> _isModified;
 
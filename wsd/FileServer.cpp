@@ -71,7 +71,6 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <zlib.h>
 #include <security/pam_appl.h>
 
 #include <openssl/evp.h>
@@ -227,13 +226,6 @@ FileServerRequestHandler::FileServerRequestHandler(const std::string& root)
     try
     {
         readDirToHash(root, "/browser/dist");
-
-        // Shrink this from approx 200M to 50M for debug version
-        for (auto& entry : FileHash)
-        {
-            entry.second.first.shrink_to_fit();
-            entry.second.second.shrink_to_fit();
-        }
     }
     catch (...)
     {
@@ -250,8 +242,7 @@ void FileServerRequestHandler::dumpState(std::ostream& os)
     for (const auto& entry : FileHash)
     {
         fileHashEstSize += entry.first.capacity();
-        fileHashEstSize += entry.second.first.capacity();
-        fileHashEstSize += entry.second.second.capacity();
+        fileHashEstSize += entry.second.getMemorySize();
     }
 
     os << "\t Estimated allocation size: " << fileHashEstSize << " bytes\n";
@@ -1018,8 +1009,7 @@ bool FileServerRequestHandler::handleRequest(const HTTPRequest& request,
         }
 
         // Is this a file we read at startup - if not; it's not for serving.
-        if (FileHash.find(relPath) == FileHash.end() &&
-            FileHash.find(relPath + ".br") == FileHash.end())
+        if (FileHash.find(relPath) == FileHash.end())
         {
             throw Poco::FileNotFoundException("Invalid URI request (hash): [" +
                                               requestUri.toString() + "].");
@@ -1105,26 +1095,6 @@ bool FileServerRequestHandler::handleRequest(const HTTPRequest& request,
 
             response.setContentType(std::move(mimeType));
 
-            auto it = request.find("If-None-Match");
-            if (it != request.end())
-            {
-                // if ETags match avoid re-sending the file.
-                if (!noCache && it->second == etagString)
-                {
-                    // TESTME: harder ... - do we even want ETag support ?
-                    std::ostringstream oss;
-                    Poco::DateTime now;
-                    Poco::DateTime later(now.utcTime(), int64_t(1000)*1000 * 60 * 60 * 24 * 128);
-                    std::string extraHeaders =
-                        "Expires: " + Poco::DateTimeFormatter::format(
-                            later, Poco::DateTimeFormat::HTTP_FORMAT) + "\r\n" +
-                        "Cache-Control: max-age=11059200\r\n";
-                    HttpHelper::sendErrorAndShutdown(http::StatusCode::NotModified, socket,
-                                                     std::string(), extraHeaders);
-                    return true;
-                }
-            }
-
 #if !MOBILEAPP
             if (COOLWSD::WASMState != COOLWSD::WASMActivationState::Disabled &&
                 relPath.find("wasm") != std::string::npos)
@@ -1135,7 +1105,6 @@ bool FileServerRequestHandler::handleRequest(const HTTPRequest& request,
             }
 #endif // !MOBILEAPP
 
-            const bool brotli = request.hasToken("Accept-Encoding", "br");
 #if ENABLE_DEBUG
             if (std::getenv("COOL_SERVE_FROM_FS"))
             {
@@ -1143,49 +1112,21 @@ bool FileServerRequestHandler::handleRequest(const HTTPRequest& request,
                 // Avoids having to restart cool everytime you make a change in cool
                 std::string filePath =
                     Poco::Path(COOLWSD::FileServerRoot, relPath).absolute().toString();
-                if (brotli && FileUtil::Stat(filePath + ".br").exists())
+                std::string range = request.get("Range", std::string());
+                if (request.hasToken("Accept-Encoding", "br") &&
+                    FileUtil::Stat(filePath + ".br").exists())
                 {
                     filePath += ".br";
                     response.set("Content-Encoding", "br");
+                    range.clear(); // Ranges are of the identity encoding.
                 }
 
-                HttpHelper::sendFile(socket, filePath, response, noCache);
+                HttpHelper::sendFile(socket, filePath, response, noCache, false, range);
                 return true;
             }
 #endif
 
-            bool compressed = false;
-            const std::string* content;
-            if (brotli && FileHash.find(relPath + ".br") != FileHash.end())
-            {
-                compressed = true;
-                response.set("Content-Encoding", "br");
-                content = getUncompressedFile(relPath + ".br");
-            }
-            else if (request.hasToken("Accept-Encoding", "gzip"))
-            {
-                compressed = true;
-                response.set("Content-Encoding", "gzip");
-                content = getCompressedFile(relPath);
-            }
-            else
-                content = getUncompressedFile(relPath);
-
-            response.setContentLength(content->size());
-
-            if (!noCache)
-            {
-                // 60 * 60 * 24 * 128 (days) = 11059200
-                response.set("Cache-Control", "max-age=11059200");
-                response.set("ETag", etagString);
-            }
-            response.add("X-Content-Type-Options", "nosniff");
-
-            LOG_TRC('#' << socket->getFD() << ": Sending " << (!compressed ? "un" : "")
-                        << "compressed : file [" << relPath << "]: " << response.header());
-
-            socket->send(response);
-            socket->send(*content);
+            HttpHelper::sendAsset(socket, FileHash[relPath], request, response, noCache);
         }
     }
     catch (const Poco::Net::NotAuthenticatedException& exc)
@@ -1262,6 +1203,10 @@ void FileServerRequestHandler::readDirToHash(const std::string &basePath, const
     std::string filesRead;
     filesRead.reserve(1024);
 
+    // The brotli variants are built ahead of time, as .br files next to the originals.
+    std::map<std::string, std::string> files;
+    std::map<std::string, std::string> brotliFiles;
+
     struct dirent *currentFile;
     while ((currentFile = readdir(workingdir)) != nullptr)
     {
@@ -1279,122 +1224,65 @@ void FileServerRequestHandler::readDirToHash(const std::string &basePath, const
         if (S_ISDIR(fileStat.st_mode))
             readDirToHash(basePath, relPath);
 
-        else if (S_ISREG(fileStat.st_mode) && relPath.ends_with(".br"))
-        {
-            // Only cache without compressing.
-            fileCount++;
-            filesRead.append(currentFile->d_name);
-            filesRead += ' ';
-
-            std::string uncompressedFile;
-            const ssize_t size =
-                FileUtil::readFile(basePath + relPath, uncompressedFile, MaxFileSizeToCacheInBytes);
-            assert(size < MaxFileSizeToCacheInBytes && "MaxFileSizeToCacheInBytes is too small for "
-                                                       "static-file serving; please increase it");
-            if (size <= 0)
-            {
-                assert(uncompressedFile.empty() &&
-                       "Unexpected data in uncompressedFile after failed read");
-                if (size < 0)
-                {
-                    LOG_ERR("Failed to read file [" << basePath << relPath
-                                                    << "] or is too large to cache and serve");
-                }
-            }
-
-            FileHash.emplace(prefix + relPath,
-                             std::make_pair(std::move(uncompressedFile), std::string()));
-        }
         else if (S_ISREG(fileStat.st_mode))
         {
-            std::string uncompressedFile;
+            std::string content;
             const ssize_t size =
-                FileUtil::readFile(basePath + relPath, uncompressedFile, MaxFileSizeToCacheInBytes);
+                FileUtil::readFile(basePath + relPath, content, MaxFileSizeToCacheInBytes);
             assert(size < MaxFileSizeToCacheInBytes && "MaxFileSizeToCacheInBytes is too small for "
                                                        "static-file serving; please increase it");
             if (size <= 0)
             {
-                assert(uncompressedFile.empty() &&
-                       "Unexpected data in uncompressedFile after failed read");
+                assert(content.empty() && "Unexpected data in content after failed read");
                 if (size < 0)
                 {
                     LOG_ERR("Failed to read file [" << basePath << relPath
                                                     << "] or is too large to cache and serve");
                 }
-
-                // Always add the entry, even if the contents are empty.
-                FileHash.emplace(prefix + relPath,
-                                 std::make_pair(std::move(uncompressedFile), std::string()));
-                continue;
-            }
-
-            z_stream strm;
-            strm.zalloc = Z_NULL;
-            strm.zfree = Z_NULL;
-            strm.opaque = Z_NULL;
-            const int initResult = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY);
-            if (initResult != Z_OK)
-            {
-                LOG_ERR("Failed to deflateInit2 for file [" << basePath << relPath
-                                                            << "], result: " << initResult);
-                // Add the uncompressed version; it's better to serve uncompressed than nothing at all.
-                FileHash.emplace(prefix + relPath,
-                                 std::make_pair(std::move(uncompressedFile), std::string()));
-
-                deflateEnd(&strm);
-                continue;
             }
 
             fileCount++;
             filesRead.append(currentFile->d_name);
             filesRead += ' ';
 
-            // Compress.
-            assert(size > 0 && "No data to compress");
-            assert(!uncompressedFile.empty() && "Unexpected empty uncompressedFile");
-            std::string compressedFile;
-            const long unsigned int compSize = compressBound(size);
-            compressedFile.resize(compSize);
-            strm.next_in = (unsigned char*)uncompressedFile.data();
-            strm.avail_in = size;
-            strm.avail_out = compSize;
-            strm.next_out = (unsigned char*)compressedFile.data();
-            strm.total_out = strm.total_in = 0;
-
-            const int deflateResult = deflate(&strm, Z_FINISH);
-            if (deflateResult != Z_OK && deflateResult != Z_STREAM_END)
-            {
-                LOG_ERR("Failed to deflate [" << basePath << relPath
-                                              << "], result: " << deflateResult);
-                compressedFile.clear(); // Can't trust the compressed data, if any.
-            }
+            if (relPath.ends_with(".br"))
+                brotliFiles.emplace(relPath.substr(0, relPath.size() - 3), std::move(content));
             else
-            {
-                compressedFile.resize(compSize - strm.avail_out);
-            }
-
-            FileHash.emplace(prefix + relPath, std::make_pair(std::move(uncompressedFile),
-                                                              std::move(compressedFile)));
-            deflateEnd(&strm);
+                files.emplace(relPath, std::move(content));
         }
     }
     closedir(workingdir);
 
+    // Always add the entries, even if the contents are empty,
+    // and serve the brotli variants even without their originals.
+    for (const auto& file : files)
+    {
+        std::string brotli;
+        const auto it = brotliFiles.find(file.first);
+        if (it != brotliFiles.end())
+        {
+            brotli = std::move(it->second);
+            brotliFiles.erase(it);
+        }
+
+        FileHash[prefix + file.first] = HttpHelper::makeStaticAsset(file.second, brotli);
+    }
+
+    for (const auto& brotli : brotliFiles)
+        FileHash[prefix + brotli.first] = HttpHelper::makeBrotliAsset(brotli.second);
+
     if (fileCount > 0)
         LOG_TRC("Pre-read " << fileCount << " file(s) from directory: " << fullPath << ": "
                             << filesRead);
 }
 
-const std::string *FileServerRequestHandler::getCompressedFile(const std::string &path)
+std::string FileServerRequestHandler::getUncompressedFile(const std::string &path)
 {
-    // If a compressed version is not available, return the original uncompressed data.
-    const auto& pair = FileHash[path];
-    return pair.second.empty() ? &pair.first : &pair.second;
-}
+    const auto it = FileHash.find(path);
+    if (it == FileHash.end() || !it->second._data)
+        return std::string();
 
-const std::string *FileServerRequestHandler::getUncompressedFile(const std::string &path)
-{
-    return &FileHash[path].first;
+    return std::string(it->second._data->begin(), it->second._data->end());
 }
 
 std::string FileServerRequestHandler::getRequestPathname(const HTTPRequest& request,
@@ -1677,7 +1565,7 @@ void FileServerRequestHandler::replaceServiceRoot(const HTTPRequest& request,
     const std::string responseRoot = cnxDetails.getResponseRoot();
     const std::string relPath = getRequestPathname(request, requestDetails);
     LOG_DBG("Preprocessing file: " << relPath);
-    std::string preprocess = *getUncompressedFile(relPath);
+    std::string preprocess = getUncompressedFile(relPath);
     Poco::replaceInPlace(preprocess, std::string("%SERVICE_ROOT%"), responseRoot);
     Poco::replaceInPlace(preprocess, std::string("%VERSION%"), Util::getCoolVersionHash());
     httpResponse.setBody(preprocess, "text/javascript");
@@ -1696,7 +1584,7 @@ FileServerRequestHandler::ResourceAccessDetails FileServerRequestHandler::prepro
     // Is this a file we read at startup - if not; it's not for serving.
     const std::string relPath = getRequestPathname(request, requestDetails);
     LOG_DBG("Preprocessing file: " << relPath);
-    std::string preprocess = *getUncompressedFile(relPath);
+    std::string preprocess = getUncompressedFile(relPath);
 
     // We need to pass certain parameters from the cool html GET URI
     // to the embedded document URI. Here we extract those params
@@ -2093,7 +1981,7 @@ void FileServerRequestHandler::preprocessWelcomeFile(const HTTPRequest& request,
 {
     const std::string relPath = getRequestPathname(request, requestDetails);
     LOG_DBG("Preprocessing file: " << relPath);
-    std::string templateWelcome = *getUncompressedFile(relPath);
+    std::string templateWelcome = getUncompressedFile(relPath);
 
     HTMLForm form(request, message);
     std::string uiTheme = form.get("ui_theme", "");
@@ -2462,7 +2350,7 @@ void FileServerRequestHandler::preprocessIntegratorAdminFile(const HTTPRequest&
 
     const std::string relPath = getRequestPathname(request, requestDetails);
     LOG_DBG("Preprocessing file: " << relPath);
-    std::string adminFile = *getUncompressedFile(relPath);
+    std::string adminFile = getUncompressedFile(relPath);
 
     HTMLForm form(request, message);
     const UserRequestVars urv(request, form);
@@ -2554,10 +2442,10 @@ void FileServerRequestHandler::preprocessAdminFile(const HTTPRequest& request,
 
     const std::string relPath = getRequestPathname(request, requestDetails);
     LOG_DBG("Preprocessing file: " << relPath);
-    std::string adminFile = *getUncompressedFile(relPath);
+    std::string adminFile = getUncompressedFile(relPath);
     const std::string templatePath =
         Poco::Path(relPath).setFileName("admintemplate.html").toString();
-    std::string templateFile = *getUncompressedFile(templatePath);
+    std::string templateFile = getUncompressedFile(templatePath);
 
     const std::string escapedJwtToken = Uri::encode(jwtToken, "'");
     Poco::replaceInPlace(templateFile, std::string("%JWT_TOKEN%"), escapedJwtToken);
@@ -2565,7 +2453,7 @@ void FileServerRequestHandler::preprocessAdminFile(const HTTPRequest& request,
         relPath == "/browser/dist/admin/adminClusterOverviewAbout.html")
     {
         std::string bodyPath = Poco::Path(relPath).setFileName("adminClusterBody.html").toString();
-        std::string bodyFile = *getUncompressedFile(bodyPath);
+        std::string bodyFile = getUncompressedFile(bodyPath);
         Poco::replaceInPlace(templateFile, std::string("<!--%BODY%-->"), bodyFile);
         Poco::replaceInPlace(templateFile, std::string("<!--%MAIN_CONTENT%-->"), adminFile);
         Poco::replaceInPlace(templateFile, std::string("%ROUTE_TOKEN%"), COOLWSD::RouteToken);
@@ -2573,7 +2461,7 @@ void FileServerRequestHandler::preprocessAdminFile(const HTTPRequest& request,
     else
     {
         std::string bodyPath = Poco::Path(relPath).setFileName("adminBody.html").toString();
-        std::string bodyFile = *getUncompressedFile(bodyPath);
+        std::string bodyFile = getUncompressedFile(bodyPath);
         Poco::replaceInPlace(templateFile, std::string("<!--%BODY%-->"), bodyFile);
         Poco::replaceInPlace(templateFile, std::string("<!--%MAIN_CONTENT%-->"),
                              adminFile); // Now template has the main content..
@@ -13,6 +13,7 @@
 
 #include <COOLWSD.hpp>
 #include <ConfigUtil.hpp>
+#include <HttpHelper.hpp>
 #include <HttpRequest.hpp>
 #include <Poco/Net/PartHandler.h>
 #include <Socket.hpp>
@@ -206,9 +207,8 @@ public:
 
     void readDirToHash(const std::string &basePath, const std::string &path, const std::string &prefix = std::string());
 
-    const std::string *getCompressedFile(const std::string &path);
-
-    const std::string *getUncompressedFile(const std::string &path);
+    /// Returns the content of a file read at startup, or empty if there is no such file.
+    std::string getUncompressedFile(const std::string &path);
 
     /// If configured and necessary, sets the HSTS headers.
     static void hstsHeaders([[maybe_unused]] http::Response& response)
@@ -232,7 +232,7 @@ public:
     void dumpState(std::ostream& os);
 
 private:
-    std::map<std::string, std::pair<std::string, std::string>> FileHash;
+    std::map<std::string, HttpHelper::StaticAsset> FileHash;
     static void sendError(http::StatusCode errorCode, const std::string& requestPath,
                           const std::shared_ptr<StreamSocket>& socket,
                           const std::string& shortMessage, const std::string& longMessage,
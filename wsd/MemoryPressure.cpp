@@ -0,0 +1,264 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "MemoryPressure.hpp"
+
+#include <common/Log.hpp>
+#include <common/Util.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <string>
+
+namespace
+{
+/// The counters of memory.events that tell the cgroup is reclaiming, or worse.
+const std::vector<std::string_view> PressureEvents{ "high", "max", "oom", "oom_kill" };
+
+/// Returns the value of @key=, in the space-separated @line, or -1.
+double findValue(std::string_view line, std::string_view key)
+{
+    std::size_t pos = 0;
+    while ((pos = line.find(key, pos)) != std::string_view::npos)
+    {
+        const bool start = (pos == 0 || line[pos - 1] == ' ');
+        pos += key.size();
+        if (start && pos < line.size() && line[pos] == '=')
+        {
+            const std::string value(line.substr(pos + 1, line.find(' ', pos) - pos - 1));
+            char* end = nullptr;
+            const double result = std::strtod(value.c_str(), &end);
+            return end != value.c_str() ? result : -1;
+        }
+    }
+
+    return -1;
+}
+} // namespace
+
+MemoryPressure::MemoryPressure(double thresholdPercent, std::chrono::seconds stepDelay,
+                               std::chrono::seconds recoveryDelay)
+    : _thresholdPercent(thresholdPercent)
+    , _stepDelay(stepDelay)
+    , _recoveryDelay(recoveryDelay)
+    , _pressureFd(-1)
+    , _eventsFd(-1)
+    , _events(0)
+    , _level(Level::None)
+    , _someAvg10(0)
+    , _steps(0)
+{
+}
+
+MemoryPressure::~MemoryPressure()
+{
+    if (_pressureFd >= 0)
+        ::close(_pressureFd);
+    if (_eventsFd >= 0)
+        ::close(_eventsFd);
+}
+
+bool MemoryPressure::open()
+{
+    // Our cgroup first: the limit we hit may well be its own, not the system's.
+    const std::string pressurePath = Util::getCGroupV2Path("memory.pressure");
+    if (!pressurePath.empty())
+    {
+        _pressureFd = ::open(pressurePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (_pressureFd >= 0)
+            _path = pressurePath;
+    }
+
+    if (_pressureFd < 0)
+    {
+        _path = "/proc/pressure/memory";
+        _pressureFd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+
+    std::string text;
+    double someAvg10 = 0;
+    double fullAvg10 = 0;
+    if (_pressureFd < 0 || !read(_pressureFd, text) || !parsePsi(text, someAvg10, fullAvg10))
+    {
+        LOG_INF("No memory pressure stall information (PSI), needs Linux 4.20 with PSI enabled");
+        _path.clear();
+        return false;
+    }
+
+    const std::string eventsPath = Util::getCGroupV2Path("memory.events");
+    if (!eventsPath.empty())
+    {
+        _eventsFd = ::open(eventsPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (_eventsFd >= 0 && read(_eventsFd, text))
+            _events = parseEvents(text, PressureEvents);
+    }
+
+    LOG_INF("Watching the memory pressure in " << _path << ", " << someAvg10
+                                                << "% now, threshold: " << _thresholdPercent
+                                                << '%');
+    return true;
+}
+
+bool MemoryPressure::update(std::chrono::steady_clock::time_point now)
+{
+    if (_pressureFd < 0)
+        return false;
+
+    std::string text;
+    double fullAvg10 = 0;
+    if (!read(_pressureFd, text) || !parsePsi(text, _someAvg10, fullAvg10))
+    {
+        LOG_WRN("Failed to read the memory pressure from " << _path);
+        return false;
+    }
+
+    bool underPressure = (_someAvg10 >= _thresholdPercent);
+
+    // Hitting memory.high or memory.max means reclaim, even before tasks stall for long.
+    if (_eventsFd >= 0 && read(_eventsFd, text))
+    {
+        const uint64_t events = parseEvents(text, PressureEvents);
+        if (events > _events)
+        {
+            LOG_DBG("The cgroup hit its memory limits " << events - _events << " times");
+            underPressure = true;
+        }
+
+        _events = events;
+    }
+
+    return update(underPressure, now);
+}
+
+bool MemoryPressure::update(bool underPressure, std::chrono::steady_clock::time_point now)
+{
+    if (underPressure)
+    {
+        _lastPressure = now;
+
+        // Give the last step time to take effect first.
+        if (_level != Level::None && now - _lastStep < _stepDelay)
+            return false;
+
+        if (_level != Level::UnloadDocs)
+            _level = static_cast<Level>(static_cast<int>(_level) + 1);
+
+        LOG_WRN("Under memory pressure: " << _someAvg10 << "% of the time stalled, stepping up to "
+                                          << _level);
+        _lastStep = now;
+        ++_steps;
+        return true;
+    }
+
+    if (_level != Level::None && now - _lastPressure >= _recoveryDelay)
+    {
+        LOG_INF("No more memory pressure, back from " << _level << " to full budgets");
+        _level = Level::None;
+        _lastStep = now;
+        return true;
+    }
+
+    return false;
+}
+
+bool MemoryPressure::parsePsi(std::string_view text, double& someAvg10, double& fullAvg10)
+{
+    // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    // full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    bool found = false;
+    while (!text.empty())
+    {
+        std::size_t end = text.find('\n');
+        if (end == std::string_view::npos)
+            end = text.size();
+
+        const std::string_view line = text.substr(0, end);
+        if (line.starts_with("some "))
+        {
+            someAvg10 = findValue(line, "avg10");
+            found = someAvg10 >= 0;
+        }
+        else if (line.starts_with("full "))
+        {
+            fullAvg10 = findValue(line, "avg10");
+        }
+
+        text.remove_prefix(std::min(end + 1, text.size()));
+    }
+
+    return found;
+}
+
+uint64_t MemoryPressure::parseEvents(std::string_view text,
+                                     const std::vector<std::string_view>& keys)
+{
+    // low 0
+    // high 12
+    // max 3
+    uint64_t total = 0;
+    while (!text.empty())
+    {
+        std::size_t end = text.find('\n');
+        if (end == std::string_view::npos)
+            end = text.size();
+
+        const std::string_view line = text.substr(0, end);
+        const std::size_t space = line.find(' ');
+        if (space != std::string_view::npos)
+        {
+            for (const std::string_view key : keys)
+            {
+                if (line.substr(0, space) == key)
+                {
+                    uint64_t value = 0;
+                    std::from_chars(line.data() + space + 1, line.data() + line.size(), value);
+                    total += value;
+                    break;
+                }
+            }
+        }
+
+        text.remove_prefix(std::min(end + 1, text.size()));
+    }
+
+    return total;
+}
+
+bool MemoryPressure::read(int fd, std::string& text)
+{
+    char buffer[1024];
+    text.clear();
+    for (;;)
+    {
+        // Each read from the start regenerates the file.
+        const ssize_t n = pread(fd, buffer, sizeof(buffer), text.size());
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        if (n == 0)
+            return true;
+
+        text.append(buffer, n);
+    }
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,107 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <common/StateEnum.hpp>
+
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Tells how hard to shed memory, from the pressure stall information (PSI)
+/// of our cgroup, or of the system: the share of time our tasks stall
+/// waiting for memory, which rises before the OOM killer strikes, unlike
+/// what we use. While under pressure, it escalates a step at a time, giving
+/// each step time to take effect, and once the pressure is gone for a
+/// while, it relaxes at once.
+/// Not thread-safe: owned by the Admin poll.
+class MemoryPressure
+{
+public:
+    /// The steps, each taken on top of the previous ones.
+    STATE_ENUM(Level,
+               None, ///< Full budgets.
+               ShrinkCaches, ///< Smaller tile and delta cache budgets.
+               DropCaches, ///< The slide layer caches dropped.
+               TrimKits, ///< Idle kits trim their memory.
+               UnloadDocs ///< The most idle documents unloaded, one per step.
+    );
+
+    /// @thresholdPercent is the share of the last 10 seconds with some of
+    /// our tasks stalled on memory, above which we are under pressure.
+    MemoryPressure(double thresholdPercent, std::chrono::seconds stepDelay,
+                   std::chrono::seconds recoveryDelay);
+    ~MemoryPressure();
+
+    MemoryPressure(const MemoryPressure&) = delete;
+    MemoryPressure& operator=(const MemoryPressure&) = delete;
+
+    /// Opens the memory.pressure and memory.events of our cgroup (v2), or
+    /// /proc/pressure/memory. Returns false if the kernel has no PSI for us.
+    bool open();
+
+    /// Reads the pressure at @now. Returns true if a step is due: to the
+    /// next level, another document to unload, or back to None.
+    bool update(std::chrono::steady_clock::time_point now);
+
+    /// As above, with the pressure already measured.
+    bool update(bool underPressure, std::chrono::steady_clock::time_point now);
+
+    Level getLevel() const { return _level; }
+
+    /// The share of the last 10 seconds some of our tasks stalled on memory, in percent.
+    double getSomeAvg10() const { return _someAvg10; }
+
+    /// The number of times a step was taken.
+    uint64_t getSteps() const { return _steps; }
+
+    const std::string& getPath() const { return _path; }
+
+    /// Finds the avg10 of the "some" and "full" lines of PSI @text.
+    static bool parsePsi(std::string_view text, double& someAvg10, double& fullAvg10);
+
+    /// Sums the counters of @keys in memory.events @text.
+    static uint64_t parseEvents(std::string_view text, const std::vector<std::string_view>& keys);
+
+private:
+    /// Reads all of @fd, returns false on failure.
+    bool read(int fd, std::string& text);
+
+    const double _thresholdPercent;
+    const std::chrono::seconds _stepDelay;
+    const std::chrono::seconds _recoveryDelay;
+
+    std::string _path;
+    int _pressureFd;
+    /// Counts the times the cgroup hit memory.high or memory.max, -1 if none.
+    int _eventsFd;
+    uint64_t _events;
+
+    Level _level;
+    std::chrono::steady_clock::time_point _lastStep;
+    std::chrono::steady_clock::time_point _lastPressure;
+    double _someAvg10;
+    uint64_t _steps;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const MemoryPressure::Level& level)
+{
+    os << MemoryPressure::name(level);
+    return os;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
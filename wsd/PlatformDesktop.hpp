@@ -21,6 +21,7 @@
 #include "FileServer.hpp"
 #include "UserMessages.hpp"
 #include <wopi/CheckFileInfo.hpp>
+#include <wopi/GetFile.hpp>
 #include <wopi/StorageConnectionManager.hpp>
 #include <net/HttpHelper.hpp>
 #include <sys/wait.h>
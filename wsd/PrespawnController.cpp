@@ -0,0 +1,198 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "PrespawnController.hpp"
+
+#include <common/Log.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+/// Until we measure it, assume a Kit takes this long to get.
+constexpr double DefaultForkLatencyMs = 1000;
+
+/// The weight of a new fork latency sample in the average.
+constexpr double ForkLatencyWeight = 0.2;
+
+/// Bounds the requests we remember, should their Kits never arrive.
+constexpr std::size_t MaxForkRequests = 256;
+} // namespace
+
+PrespawnController::PrespawnController(std::size_t minSpare, std::size_t maxSpare,
+                                       double percentile, std::size_t maxMemoryBytes)
+    : _minSpare(minSpare)
+    , _maxSpare(std::max(minSpare, maxSpare))
+    , _percentile(std::clamp(percentile, 0.0, 0.9999))
+    , _maxMemoryBytes(maxMemoryBytes)
+    , _forkLatencyMs(DefaultForkLatencyMs)
+    , _spareMemoryBytes(0)
+    , _memoryCappedCount(0)
+{
+}
+
+double PrespawnController::getRate(const Demand& demand,
+                                   std::chrono::steady_clock::time_point now)
+{
+    const double windowSecs = RateWindow.count();
+    const double elapsedSecs = std::chrono::duration<double>(now - demand.lastLoad).count();
+    return demand.loads * std::exp(-std::max(elapsedSecs, 0.0) / windowSecs) / windowSecs;
+}
+
+void PrespawnController::loadRequested(const std::string& configId,
+                                       std::chrono::steady_clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    Demand& demand = _demand[configId];
+    demand.loads = getRate(demand, now) * RateWindow.count() + 1;
+    demand.lastLoad = now;
+}
+
+void PrespawnController::forkRequested(const std::string& configId, std::size_t count,
+                                       std::chrono::steady_clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::deque<std::chrono::steady_clock::time_point>& requests = _demand[configId].forkRequests;
+    requests.insert(requests.end(), count, now);
+    while (requests.size() > MaxForkRequests)
+        requests.pop_front();
+}
+
+void PrespawnController::forkArrived(const std::string& configId,
+                                     std::chrono::steady_clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const auto it = _demand.find(configId);
+    if (it == _demand.end() || it->second.forkRequests.empty())
+        return; // Unsolicited, or after a reset; nothing to learn.
+
+    const double latencyMs =
+        std::chrono::duration<double, std::milli>(now - it->second.forkRequests.front()).count();
+    it->second.forkRequests.pop_front();
+
+    _forkLatencyMs += ForkLatencyWeight * (latencyMs - _forkLatencyMs);
+    LOG_TRC("New Kit of config [" << configId << "] in " << latencyMs << "ms, average "
+                                  << _forkLatencyMs << "ms");
+}
+
+void PrespawnController::forkReset(const std::string& configId)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const auto it = _demand.find(configId);
+    if (it != _demand.end())
+        it->second.forkRequests.clear();
+}
+
+void PrespawnController::forget(const std::string& configId)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _demand.erase(configId);
+}
+
+void PrespawnController::setSpareMemory(std::size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // Spares are all alike, but smooth out the noise of measuring.
+    _spareMemoryBytes = _spareMemoryBytes ? (_spareMemoryBytes * 3 + bytes) / 4 : bytes;
+}
+
+std::size_t PrespawnController::getPoissonTarget(double expectedLoads, double percentile,
+                                                 std::size_t maxSpare)
+{
+    // Beyond this, exp() underflows, and we couldn't keep up anyway.
+    if (expectedLoads > 500)
+        return maxSpare;
+
+    // The probability of k loads while replacing, and of at most k.
+    double probability = std::exp(-expectedLoads);
+    double cumulative = probability;
+    std::size_t target = 0;
+    while (cumulative < percentile && target < maxSpare)
+    {
+        ++target;
+        probability *= expectedLoads / target;
+        cumulative += probability;
+    }
+
+    return target;
+}
+
+std::size_t PrespawnController::getTarget(const std::string& configId,
+                                          std::chrono::steady_clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    Demand& demand = _demand[configId];
+
+    // Each load uses a spare, so we need as many as loads arrive while we replace them.
+    const double expectedLoads = getRate(demand, now) * _forkLatencyMs / 1000;
+    std::size_t target =
+        std::max(_minSpare, getPoissonTarget(expectedLoads, _percentile, _maxSpare));
+
+    if (_maxMemoryBytes && _spareMemoryBytes && target > _minSpare)
+    {
+        // The budget is shared; the others keep their current targets.
+        std::size_t others = 0;
+        for (const auto& pair : _demand)
+        {
+            if (pair.first != configId)
+                others += pair.second.target;
+        }
+
+        const std::size_t budget = _maxMemoryBytes / _spareMemoryBytes;
+        const std::size_t capped = std::max(_minSpare, budget > others ? budget - others : 0);
+        if (capped < target)
+        {
+            LOG_DBG("Capping spare Kits of config [" << configId << "] from " << target << " to "
+                                                     << capped << " by the memory budget");
+            target = capped;
+            ++_memoryCappedCount;
+        }
+    }
+
+    if (target != demand.target)
+    {
+        LOG_INF("Keeping " << target << " spare Kits of config [" << configId << "] for "
+                           << expectedLoads << " loads expected in " << _forkLatencyMs
+                           << "ms to get a new Kit");
+        demand.target = target;
+    }
+
+    return target;
+}
+
+PrespawnController::Stats PrespawnController::getStats(std::chrono::steady_clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    Stats stats;
+    for (const auto& pair : _demand)
+    {
+        stats.targetCount += pair.second.target;
+        stats.loadsPerMinute += getRate(pair.second, now) * 60;
+    }
+
+    stats.forkLatency = std::chrono::milliseconds(static_cast<int64_t>(_forkLatencyMs));
+    stats.spareMemoryBytes = _spareMemoryBytes;
+    stats.memoryCappedCount = _memoryCappedCount;
+    return stats;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,107 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+
+/// Sizes the pool of spare Kit processes, per configId, to the demand.
+/// Tracks the rate at which documents are loaded and the time it takes
+/// to get a new Kit, from requesting it to having it ready. While a used
+/// spare is being replaced, loads keep arriving; we keep enough spares
+/// that, with Poisson arrivals, the given percentile of loads find one
+/// ready, rather than wait for a fork. All within a memory budget.
+/// Thread-safe.
+class PrespawnController
+{
+public:
+    /// How far back we look to estimate the rate of loads.
+    static constexpr std::chrono::seconds RateWindow = std::chrono::seconds(60);
+
+    /// @minSpare and @maxSpare bound the spares of each configId.
+    /// @percentile is the fraction of loads that should find a spare, in [0, 1).
+    /// @maxMemoryBytes is the budget of all the spares, 0 for unlimited.
+    PrespawnController(std::size_t minSpare, std::size_t maxSpare, double percentile,
+                       std::size_t maxMemoryBytes);
+
+    /// A document of @configId is being loaded, at @now.
+    void loadRequested(const std::string& configId, std::chrono::steady_clock::time_point now);
+
+    /// We have asked for @count new Kits of @configId at @now.
+    void forkRequested(const std::string& configId, std::size_t count,
+                       std::chrono::steady_clock::time_point now);
+
+    /// A new Kit of @configId has arrived at @now.
+    void forkArrived(const std::string& configId, std::chrono::steady_clock::time_point now);
+
+    /// The outstanding requests of @configId will not arrive.
+    void forkReset(const std::string& configId);
+
+    /// We no longer serve @configId.
+    void forget(const std::string& configId);
+
+    /// Sets the memory that a spare Kit takes, measured.
+    void setSpareMemory(std::size_t bytes);
+
+    /// Returns the number of spare Kits to keep for @configId at @now.
+    std::size_t getTarget(const std::string& configId, std::chrono::steady_clock::time_point now);
+
+    /// The smallest number of spares for which at least @percentile of loads
+    /// find one, when @expectedLoads arrive, on average, while replacing one.
+    static std::size_t getPoissonTarget(double expectedLoads, double percentile,
+                                        std::size_t maxSpare);
+
+    /// The decisions of the controller, for the metrics.
+    struct Stats
+    {
+        std::size_t targetCount = 0; ///< The spares we aim for, over all configIds.
+        double loadsPerMinute = 0; ///< The estimated rate of loads, over all configIds.
+        std::chrono::milliseconds forkLatency{ 0 }; ///< The average time to get a new Kit.
+        std::size_t spareMemoryBytes = 0; ///< The memory of a spare Kit.
+        uint64_t memoryCappedCount = 0; ///< The times the budget capped a target.
+    };
+
+    Stats getStats(std::chrono::steady_clock::time_point now);
+
+private:
+    /// The demand for, and supply of, the Kits of a configId.
+    struct Demand
+    {
+        /// The number of loads, decayed exponentially over RateWindow.
+        double loads = 0;
+        std::chrono::steady_clock::time_point lastLoad;
+        /// The requests for new Kits, oldest first, to match with arrivals.
+        std::deque<std::chrono::steady_clock::time_point> forkRequests;
+        std::size_t target = 0;
+    };
+
+    /// Returns the rate of loads per second at @now.
+    static double getRate(const Demand& demand, std::chrono::steady_clock::time_point now);
+
+    const std::size_t _minSpare;
+    const std::size_t _maxSpare;
+    const double _percentile;
+    const std::size_t _maxMemoryBytes;
+    std::map<std::string, Demand> _demand;
+    /// The average time from requesting a new Kit to having it, in ms.
+    double _forkLatencyMs;
+    std::size_t _spareMemoryBytes;
+    uint64_t _memoryCappedCount;
+    std::mutex _mutex;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
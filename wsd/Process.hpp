@@ -233,7 +233,6 @@ public:
         std::shared_ptr<StreamSocket> urpToKit(_urpToKit.lock());
         if (urpToKit)
             urpToKit->asyncShutdown();
-        _smapsFp.reset();
     }
 
     const ChildProcess& operator=(ChildProcess&& other) = delete;
@@ -242,28 +241,6 @@ public:
     std::shared_ptr<DocumentBroker> getDocumentBroker() const { return _docBroker.lock(); }
     const std::string& getJailId() const { return _jailId; }
     const std::string& getConfigId() const { return _configId; }
-#if !MOBILEAPP
-    void setSMapsFD(int smapsFD)
-    {
-        if (smapsFD < 0)
-        {
-            _smapsFp.reset();
-            return;
-        }
-        _smapsFp = std::shared_ptr<FILE>(fdopen(smapsFD, "r"), [](FILE* p) {
-            if (!p)
-                return;
-            fclose(p);
-        });
-        if (!_smapsFp)
-        {
-            LOG_ERR("Error while fdopen smaps fd");
-            FileUtil::closeFD(smapsFD);
-        }
-    }
-    std::weak_ptr<FILE> getSMapsFp() const { return _smapsFp; }
-#endif
-
     std::map<std::string, std::string> getJailProps() const
     {
         return _jailProps;
@@ -281,7 +258,6 @@ private:
     std::weak_ptr<DocumentBroker> _docBroker;
     std::weak_ptr<StreamSocket> _urpFromKit;
     std::weak_ptr<StreamSocket> _urpToKit;
-    std::shared_ptr<FILE> _smapsFp;
     std::map<std::string, std::string> _jailProps;
     int _urpFromKitFD;
     int _urpToKitFD;
@@ -0,0 +1,471 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "ProcessStats.hpp"
+
+#include <common/Log.hpp>
+#include <common/Util.hpp>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <string>
+
+namespace
+{
+/// Enough for smaps_rollup and stat; smaps grows the buffer as needed.
+constexpr std::size_t InitialBufferSize = 4096;
+
+/// Parses the number at the start of @text, skipping blanks.
+std::size_t parseNumber(std::string_view text)
+{
+    const std::size_t start = text.find_first_not_of(" \t");
+    if (start == std::string_view::npos)
+        return 0;
+
+    std::size_t value = 0;
+    std::from_chars(text.data() + start, text.data() + text.size(), value);
+    return value;
+}
+
+int openPidFd([[maybe_unused]] pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    return -1;
+#endif
+}
+} // namespace
+
+ProcessStatsCollector::ProcessStatsCollector(Callback callback)
+    : _callback(std::move(callback))
+    , _buffer(InitialBufferSize)
+    , _interval(std::chrono::seconds(1))
+    , _stop(false)
+    , _wakeupPipe{ -1, -1 }
+{
+}
+
+ProcessStatsCollector::~ProcessStatsCollector()
+{
+    stop();
+
+    for (auto& pair : _processes)
+        close(pair.second);
+
+    for (const auto& pair : _added)
+    {
+        if (pair.second >= 0)
+            ::close(pair.second);
+    }
+}
+
+void ProcessStatsCollector::start(std::chrono::milliseconds interval)
+{
+    if (_thread.joinable())
+        return;
+
+    if (pipe2(_wakeupPipe, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        LOG_SYS("Failed to create the wakeup pipe of the process stats collector");
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _interval = interval;
+        _stop = false;
+    }
+
+    _thread = std::thread([this] { run(); });
+}
+
+void ProcessStatsCollector::stop()
+{
+    if (!_thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+
+    if (::write(_wakeupPipe[1], "w", 1) < 0 && errno != EAGAIN)
+        LOG_SYS("Failed to wake up the process stats collector");
+
+    _thread.join();
+
+    ::close(_wakeupPipe[0]);
+    ::close(_wakeupPipe[1]);
+    _wakeupPipe[0] = _wakeupPipe[1] = -1;
+}
+
+void ProcessStatsCollector::setInterval(std::chrono::milliseconds interval)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _interval = interval;
+}
+
+void ProcessStatsCollector::add(pid_t pid, int smapsFd)
+{
+    if (pid <= 0)
+    {
+        if (smapsFd >= 0)
+            ::close(smapsFd);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _added.emplace_back(pid, smapsFd);
+    // No need to wake up: new processes are sampled at the next round.
+}
+
+bool ProcessStatsCollector::parseSMaps(std::string_view text, std::size_t& pssKb,
+                                       std::size_t& dirtyKb)
+{
+    constexpr std::string_view Pss = "Pss:";
+    // Shared_Dirty is accounted for by forkit's RSS.
+    constexpr std::string_view PrivateDirty = "Private_Dirty:";
+
+    pssKb = 0;
+    dirtyKb = 0;
+    bool found = false;
+    while (!text.empty())
+    {
+        std::size_t end = text.find('\n');
+        if (end == std::string_view::npos)
+            end = text.size();
+
+        const std::string_view line = text.substr(0, end);
+        if (!line.empty() && line[0] == 'P')
+        {
+            if (line.starts_with(Pss))
+            {
+                pssKb += parseNumber(line.substr(Pss.size()));
+                found = true;
+            }
+            else if (line.starts_with(PrivateDirty))
+            {
+                dirtyKb += parseNumber(line.substr(PrivateDirty.size()));
+            }
+        }
+
+        text.remove_prefix(std::min(end + 1, text.size()));
+    }
+
+    return found;
+}
+
+bool ProcessStatsCollector::parseStat(std::string_view text, std::size_t& jiffies,
+                                      std::size_t& threads, std::size_t& rssPages)
+{
+    // The command, the second field, may have spaces and parentheses, so start after its end.
+    const std::size_t commEnd = text.rfind(')');
+    if (commEnd == std::string_view::npos)
+        return false;
+    text.remove_prefix(commEnd + 1);
+
+    // The fields from the third, the state, as of proc(5).
+    constexpr std::size_t UTime = 14 - 3;
+    constexpr std::size_t STime = 15 - 3;
+    constexpr std::size_t NumThreads = 20 - 3;
+    constexpr std::size_t Rss = 24 - 3;
+
+    jiffies = 0;
+    std::size_t field = 0;
+    for (;;)
+    {
+        const std::size_t start = text.find_first_not_of(' ');
+        if (start == std::string_view::npos)
+            break;
+        text.remove_prefix(start);
+
+        switch (field)
+        {
+            case UTime:
+            case STime:
+                jiffies += parseNumber(text);
+                break;
+            case NumThreads:
+                threads = parseNumber(text);
+                break;
+            case Rss:
+                rssPages = parseNumber(text);
+                return true;
+        }
+
+        const std::size_t end = text.find(' ');
+        if (end == std::string_view::npos)
+            break;
+        text.remove_prefix(end);
+        ++field;
+    }
+
+    return false;
+}
+
+void ProcessStatsCollector::run()
+{
+    Util::setThreadName("procstats");
+    LOG_DBG("Process stats collector started");
+
+    auto deadline = std::chrono::steady_clock::now();
+    for (;;)
+    {
+        std::vector<std::pair<pid_t, int>> added;
+        std::chrono::milliseconds interval;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_stop)
+                break;
+
+            added.swap(_added);
+            interval = _interval;
+        }
+
+        for (const auto& pair : added)
+            open(pair.first, pair.second);
+
+        std::vector<Sample> changed;
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            sampleAll(changed);
+
+            // Don't pile up rounds when sampling falls behind.
+            deadline = std::max(deadline + interval, std::chrono::steady_clock::now());
+        }
+
+        wait(deadline, changed);
+
+        if (!changed.empty())
+            _callback(std::move(changed));
+    }
+
+    LOG_DBG("Process stats collector stopped");
+}
+
+void ProcessStatsCollector::sampleAll(std::vector<Sample>& changed)
+{
+    for (auto it = _processes.begin(); it != _processes.end();)
+    {
+        Sample current;
+        current.pid = it->first;
+        if (!sample(it->first, it->second, current))
+        {
+            exited(it, changed);
+            it = _processes.erase(it);
+            continue;
+        }
+
+        if (!(current == it->second.last))
+        {
+            it->second.last = current;
+            changed.push_back(current);
+        }
+
+        ++it;
+    }
+}
+
+void ProcessStatsCollector::exited(std::map<pid_t, Process>::iterator it,
+                                   std::vector<Sample>& changed)
+{
+    LOG_DBG("Process " << it->first << " has exited, no longer sampling it");
+    Sample last = it->second.last;
+    last.exited = true;
+    changed.push_back(last);
+
+    close(it->second);
+}
+
+void ProcessStatsCollector::open(pid_t pid, int smapsFd)
+{
+    Process& process = _processes[pid];
+    if (process.statFd >= 0)
+    {
+        // Already sampling, maybe with our own smaps; keep those given to us.
+        if (smapsFd >= 0)
+        {
+            ::close(process.smapsFd);
+            process.smapsFd = smapsFd;
+        }
+
+        return;
+    }
+
+    process.last.pid = pid;
+    const std::string proc = "/proc/" + std::to_string(pid);
+
+    process.smapsFd = smapsFd;
+    if (process.smapsFd < 0)
+    {
+        // Rereading smaps_rollup is broken on some kernels, as found on startup.
+        if (std::getenv("COOL_DISABLE_SMAPS_ROLLUP") == nullptr)
+            process.smapsFd = ::open((proc + "/smaps_rollup").c_str(), O_RDONLY | O_CLOEXEC);
+        if (process.smapsFd < 0)
+            process.smapsFd = ::open((proc + "/smaps").c_str(), O_RDONLY | O_CLOEXEC);
+        if (process.smapsFd < 0)
+            LOG_WRN("Failed to open the smaps of process " << pid << ", no memory stats for it");
+    }
+
+    process.statFd = ::open((proc + "/stat").c_str(), O_RDONLY | O_CLOEXEC);
+    if (process.statFd < 0)
+    {
+        LOG_WRN("Failed to open the stat of process " << pid << ", not sampling it");
+        close(process);
+        _processes.erase(pid);
+        return;
+    }
+
+    // Without pidfds, we find out that the process is gone when its stat no longer reads.
+    process.pidFd = openPidFd(pid);
+
+    LOG_TRC("Sampling process " << pid);
+}
+
+void ProcessStatsCollector::close(Process& process)
+{
+    for (int* fd : { &process.smapsFd, &process.statFd, &process.pidFd })
+    {
+        if (*fd >= 0)
+            ::close(*fd);
+        *fd = -1;
+    }
+}
+
+bool ProcessStatsCollector::sample(pid_t pid, Process& process, Sample& sample)
+{
+    ssize_t size = read(process.statFd);
+    if (size < 0)
+        return false;
+
+    std::size_t rssPages = 0;
+    if (!parseStat(std::string_view(_buffer.data(), size), sample.jiffies, sample.threads,
+                   rssPages))
+    {
+        LOG_WRN("Failed to parse the stat of process " << pid);
+    }
+
+    static const std::size_t pageSizeKb = getpagesize() / 1024;
+    sample.rssKb = rssPages * pageSizeKb;
+
+    if (process.smapsFd >= 0)
+    {
+        size = read(process.smapsFd);
+        if (size < 0)
+            return errno != ESRCH;
+
+        // Only a zombie has no mappings at all.
+        return parseSMaps(std::string_view(_buffer.data(), size), sample.pssKb, sample.dirtyKb);
+    }
+
+    return true;
+}
+
+ssize_t ProcessStatsCollector::read(int fd)
+{
+    std::size_t size = 0;
+    for (;;)
+    {
+        if (size == _buffer.size())
+            _buffer.resize(_buffer.size() * 2);
+
+        // Each read from the start regenerates the file, no seeking needed.
+        const ssize_t n = pread(fd, _buffer.data() + size, _buffer.size() - size, size);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        if (n == 0)
+            break;
+
+        size += n;
+    }
+
+    return size;
+}
+
+void ProcessStatsCollector::wait(std::chrono::steady_clock::time_point deadline,
+                                 std::vector<Sample>& changed)
+{
+    std::vector<pollfd> fds;
+    std::vector<pid_t> pids;
+    fds.push_back({ _wakeupPipe[0], POLLIN, 0 });
+    for (const auto& pair : _processes)
+    {
+        if (pair.second.pidFd >= 0)
+        {
+            fds.push_back({ pair.second.pidFd, POLLIN, 0 });
+            pids.push_back(pair.first);
+        }
+    }
+
+    for (;;)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline)
+            return;
+
+        const auto timeout =
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+        const int ready = poll(fds.data(), fds.size(), timeout);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            LOG_SYS("Process stats collector failed to poll");
+            return;
+        }
+
+        if (ready == 0)
+            return;
+
+        if (fds[0].revents)
+        {
+            char buf[16];
+            while (::read(_wakeupPipe[0], buf, sizeof(buf)) > 0)
+            {
+            }
+            return;
+        }
+
+        for (std::size_t i = 1; i < fds.size(); ++i)
+        {
+            if (!fds[i].revents)
+                continue;
+
+            const auto it = _processes.find(pids[i - 1]);
+            exited(it, changed);
+            _processes.erase(it);
+
+            // No longer poll it.
+            fds[i].fd = -1;
+        }
+
+        // Tell about the exits right away.
+        return;
+    }
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,124 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// Samples the memory and CPU use of our processes: the kits, forkit and
+/// ourselves, on a thread of its own, so hundreds of kits neither cost the
+/// Admin poll its responsiveness nor get parsed line by line through stdio.
+/// The smaps_rollup (or smaps) and stat of each process are kept open and
+/// read with a pread() or two each round, and a pidfd tells as soon as a
+/// process exits. Only the samples that changed are handed on.
+/// Thread-safe.
+class ProcessStatsCollector
+{
+public:
+    struct Sample
+    {
+        pid_t pid = 0;
+        std::size_t pssKb = 0;
+        /// Private_Dirty: the rest a kit shares with forkit.
+        std::size_t dirtyKb = 0;
+        std::size_t rssKb = 0;
+        /// User and system time.
+        std::size_t jiffies = 0;
+        std::size_t threads = 0;
+        /// The last sample of a process that is gone.
+        bool exited = false;
+
+        bool operator==(const Sample& other) const = default;
+    };
+
+    /// Called on the collector thread, with the samples that changed since the last call.
+    using Callback = std::function<void(std::vector<Sample>&& samples)>;
+
+    explicit ProcessStatsCollector(Callback callback);
+    ~ProcessStatsCollector();
+
+    ProcessStatsCollector(const ProcessStatsCollector&) = delete;
+    ProcessStatsCollector& operator=(const ProcessStatsCollector&) = delete;
+
+    /// Samples every @interval from now on.
+    void start(std::chrono::milliseconds interval);
+    void stop();
+    void setInterval(std::chrono::milliseconds interval);
+
+    /// Samples @pid until it exits. @smapsFd is its smaps_rollup, or smaps,
+    /// as it opened them itself, which we take over; if invalid, we open them.
+    void add(pid_t pid, int smapsFd = -1);
+
+    /// Sums the Pss and Private_Dirty of the mappings in @text, returns false if none.
+    static bool parseSMaps(std::string_view text, std::size_t& pssKb, std::size_t& dirtyKb);
+
+    /// Finds the CPU time, thread count and RSS pages in @text of /proc/<pid>/stat.
+    static bool parseStat(std::string_view text, std::size_t& jiffies, std::size_t& threads,
+                          std::size_t& rssPages);
+
+private:
+    struct Process
+    {
+        int smapsFd = -1;
+        int statFd = -1;
+        int pidFd = -1;
+        Sample last;
+    };
+
+    void run();
+
+    /// Opens what we need of @pid, taking over @smapsFd.
+    void open(pid_t pid, int smapsFd);
+    static void close(Process& process);
+
+    /// Samples all processes, adding those that changed or exited to @changed.
+    void sampleAll(std::vector<Sample>& changed);
+
+    /// Adds the last sample of the process at @it to @changed, and closes it.
+    void exited(std::map<pid_t, Process>::iterator it, std::vector<Sample>& changed);
+
+    /// Returns false if the process is gone.
+    bool sample(pid_t pid, Process& process, Sample& sample);
+
+    /// Reads all of @fd into _buffer, returns the size or -1.
+    ssize_t read(int fd);
+
+    /// Waits until @deadline, or until woken up, dropping those processes that exit.
+    void wait(std::chrono::steady_clock::time_point deadline, std::vector<Sample>& changed);
+
+    const Callback _callback;
+
+    /// Owned by the collector thread.
+    std::map<pid_t, Process> _processes;
+    std::vector<char> _buffer;
+
+    std::mutex _mutex;
+    /// Processes to add on the next round, guarded by _mutex.
+    std::vector<std::pair<pid_t, int>> _added;
+    std::chrono::milliseconds _interval;
+    bool _stop;
+
+    /// Written to wake the collector up from its poll().
+    int _wakeupPipe[2];
+    std::thread _thread;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -30,8 +30,11 @@
 
 #if !MOBILEAPP
 #include <wopi/CheckFileInfo.hpp>
+#include <wopi/GetFile.hpp>
 #endif // !MOBILEAPP
 
+#include <algorithm>
+
 extern std::pair<std::shared_ptr<DocumentBroker>, std::string>
 findOrCreateDocBroker(DocumentBroker::ChildType type, const std::string& uri,
                       const std::string& docKey, const std::string& configId,
@@ -363,6 +366,7 @@ void RequestVettingStation::transferToDocBroker(const std::string& url,
     if (std::shared_ptr<DocumentBroker> docBroker = createDocBroker(docKey, configId, url, uriPublic))
     {
         launchInstallPresets();
+        startGetFile(docBroker, uriPublic);
         if (_ws)
         {
             // If we don't have the WebSocket, defer creating the client session.
@@ -387,6 +391,44 @@ void RequestVettingStation::transferToDocBroker(const std::string& url,
     }
 }
 
+void RequestVettingStation::startGetFile(const std::shared_ptr<DocumentBroker>& docBroker,
+                                         const Poco::URI& uriPublic)
+{
+    Poco::JSON::Object::Ptr wopiInfo = _checkFileInfo->wopiInfo();
+
+    // Templates are downloaded by the docBroker, as they need saving-as first.
+    std::string templateSource;
+    JsonUtil::findJSONValue(wopiInfo, "TemplateSource", templateSource);
+    if (!templateSource.empty())
+        return;
+
+    // Only for the first session, later ones share the downloaded document.
+    if (!docBroker->claimGetFile())
+        return;
+
+    const Authorization auth = Authorization::create(uriPublic);
+
+    // The FileUrl, if provided, else the default, as WopiStorage does.
+    std::string fileUrl;
+    JsonUtil::findJSONValue(wopiInfo, "FileUrl", fileUrl);
+    Poco::URI uri(uriPublic);
+    if (!fileUrl.empty())
+    {
+        uri = Poco::URI(fileUrl);
+    }
+    else
+    {
+        uri.setPath(uri.getPath() + "/contents");
+        auth.authorizeURI(uri);
+    }
+
+    _getFile = std::make_shared<GetFile>(_poll, uri, auth);
+
+    // Typically, we are in the CheckFileInfo finished handler; start
+    // once its connection is back in the pool, so we can reuse it.
+    _poll->addCallback([getFile = _getFile]() { getFile->getFile(HTTP_REDIRECTION_LIMIT); });
+}
+
 void RequestVettingStation::checkFileInfo(const Poco::URI& uri, int redirectLimit)
 {
     auto cfiContinuation = [this](CheckFileInfo& checkFileInfo)
@@ -478,6 +520,50 @@ void RequestVettingStation::createClientSession(const std::shared_ptr<DocumentBr
         return;
     }
 
+#if !MOBILEAPP
+    if (_getFile && !_getFile->completed())
+    {
+        // Hand over the session once the document is downloaded, rather than
+        // have the DocumentBroker wait for it on its poll thread. Meanwhile,
+        // the client socket is still ours, so we report the progress directly.
+        LOG_DBG("Waiting for WOPI::GetFile of [" << docKey << "] before creating the session");
+
+        _getFile->setProgressCallback(
+            [selfWeak = weak_from_this(), this, lastPercent = -1](const GetFile& getFile) mutable
+            {
+                std::shared_ptr<RequestVettingStation> selfLifecycle = selfWeak.lock();
+                const uint64_t total = getFile.totalBytes();
+                if (!selfLifecycle || !_ws || total == 0)
+                    return;
+
+                const int percent = std::min<uint64_t>(getFile.downloadedBytes() * 100 / total, 100);
+                if (percent == lastPercent)
+                    return;
+
+                if (lastPercent < 0)
+                    _ws->sendMessage("progress: { \"id\":\"start\" }");
+
+                lastPercent = percent;
+                _ws->sendMessage("progress: { \"id\":\"setvalue\", \"value\":" +
+                                 std::to_string(percent) + " }");
+            });
+
+        _getFile->setCompletionCallback(
+            [selfWeak = weak_from_this(), this, docBroker, docKey, url,
+             uriPublic](const GetFile& getFile)
+            {
+                std::shared_ptr<RequestVettingStation> selfLifecycle = selfWeak.lock();
+                if (!selfLifecycle || !_ws)
+                    return;
+
+                LOG_DBG("WOPI::GetFile of [" << docKey << "] " << GetFile::name(getFile.state())
+                                             << ", creating the session");
+                createClientSession(docBroker, docKey, url, uriPublic);
+            });
+        return;
+    }
+#endif // !MOBILEAPP
+
     std::unique_ptr<WopiStorage::WOPIFileInfo> realWopiFileInfo;
 #if !MOBILEAPP
     assert((!_checkFileInfo || _checkFileInfo->wopiInfo()) &&
@@ -489,6 +575,11 @@ void RequestVettingStation::createClientSession(const std::shared_ptr<DocumentBr
     std::shared_ptr<std::unique_ptr<WopiStorage::WOPIFileInfo>> wopiFileInfo =
         std::make_shared<std::unique_ptr<WopiStorage::WOPIFileInfo>>(std::move(realWopiFileInfo));
 
+    std::shared_ptr<GetFile> getFile;
+#if !MOBILEAPP
+    getFile = std::move(_getFile);
+#endif // !MOBILEAPP
+
     std::weak_ptr<StreamSocket> socket = _socket;
     _socket.reset();
 
@@ -501,7 +592,8 @@ void RequestVettingStation::createClientSession(const std::shared_ptr<DocumentBr
     // Transfer the client socket to the DocumentBroker when we get back to the poll:
     std::shared_ptr<WebSocketHandler> ws = _ws;
     docBroker->setupTransfer(*_poll, socket,
-        [wopiFileInfo = std::move(wopiFileInfo), ws = std::move(ws), id = _id,
+        [wopiFileInfo = std::move(wopiFileInfo), getFile = std::move(getFile),
+         ws = std::move(ws), id = _id,
          requestDetails = _requestDetails, docBroker, docKey, url, uriPublic,
          selfLifecycle = shared_from_this()](const std::shared_ptr<Socket>& moveSocket)
         {
@@ -534,8 +626,9 @@ void RequestVettingStation::createClientSession(const std::shared_ptr<DocumentBr
                                     << docKey << "] acquired for [" << url << ']');
 
                 // Add and load the session.
-                // Will download synchronously, but in own docBroker thread.
-                docBroker->addSession(clientSession, std::move(*wopiFileInfo));
+                // Takes the document downloaded after CheckFileInfo, if any,
+                // or else downloads synchronously, but in own docBroker thread.
+                docBroker->addSession(clientSession, std::move(*wopiFileInfo), getFile);
 
                 COOLWSD::checkDiskSpaceAndWarnClients(true);
                 // Users of development versions get just an info
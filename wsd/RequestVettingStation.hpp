@@ -21,6 +21,7 @@
 #include <string>
 
 class CheckFileInfo;
+class GetFile;
 class PresetsInstallTask;
 
 /// RequestVettingStation is used to vet the request in the background.
@@ -106,6 +107,12 @@ private:
 
     void checkFileInfo(const Poco::URI& uri, int redirectionLimit);
     std::shared_ptr<CheckFileInfo> _checkFileInfo;
+
+    /// Starts downloading the document, unless it's the docBroker's to do,
+    /// so it downloads while the docBroker gets its Kit process.
+    void startGetFile(const std::shared_ptr<DocumentBroker>& docBroker,
+                      const Poco::URI& uriPublic);
+    std::shared_ptr<GetFile> _getFile;
     std::shared_ptr<PresetsInstallTask> _asyncInstallTask;
 #endif // !MOBILEAPP
 
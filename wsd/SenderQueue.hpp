@@ -21,8 +21,15 @@
 
 #include <deque>
 #include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
 
 /// A queue of data to send to certain Session's WS.
+/// Messages superseded by newer ones, like tiles at the same position,
+/// are dropped from the queue. They are found via an index into the queue,
+/// so that enqueuing stays cheap even when a slow client falls behind.
 template <typename Item>
 class SenderQueue final
 {
@@ -34,7 +41,10 @@ public:
         std::unique_lock<std::mutex> lock(_mutex);
 
         if (!SigUtil::getTerminationFlag() && deduplicate(item))
+        {
             _queue.push_back(item);
+            _bytes += getSize(item);
+        }
 
         return _queue.size();
     }
@@ -51,10 +61,18 @@ public:
 
         std::unique_lock<std::mutex> lock(_mutex);
 
+        // Skip the slots of superseded items.
+        while (!_queue.empty() && !_queue.front())
+        {
+            --_superseded;
+            popFront();
+        }
+
         if (!_queue.empty())
         {
-            item = _queue.front();
-            _queue.pop_front();
+            _bytes -= getSize(_queue.front());
+            item = std::move(_queue.front());
+            popFront();
             return true;
         }
 
@@ -64,21 +82,33 @@ public:
     size_t size() const
     {
         std::lock_guard<std::mutex> lock(_mutex);
-        return _queue.size();
+        return _queue.size() - _superseded;
+    }
+
+    /// The bytes queued, to pace what we add by how fast they drain.
+    size_t getBytes() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _bytes;
     }
 
     void dumpState(std::ostream& os)
     {
         std::lock_guard<std::mutex> lock(_mutex);
-        size_t queueSize = _queue.size();
+        size_t queueSize = _queue.size() - _superseded;
         size_t totalSize = 0;
 
         os << "\t\tqueue items: " << queueSize << '\n';
+        os << "\t\tcoalesced tiles: " << _coalescedTiles
+           << ", coalesced messages: " << _coalescedMessages << '\n';
 
         std::size_t repeats = 0;
         std::string lastStr;
         for (const Item &item : _queue)
         {
+            if (!item)
+                continue;
+
             std::string itemStr = COOLProtocol::getAbbreviatedMessage(
                 item->data().data(), item->size());
             if (lastStr == itemStr && !item->isBinary())
@@ -94,7 +124,7 @@ public:
                 os << ": " << item->id() << " - " << itemStr << '\n';
             }
             lastStr = std::move(itemStr);
-            totalSize += item->size();
+            totalSize += getSize(item);
         }
         if (repeats > 0)
             os << "\t\t\t<repeats " << repeats << " times>\n";
@@ -102,70 +132,104 @@ public:
     }
 
 private:
+    static size_t getSize(const Item& item) { return item->size() + item->payloadSize(); }
+
+    /// The sequence number the next queued item will have.
+    uint64_t nextSeq() const { return _frontSeq + _queue.size(); }
+
+    void popFront()
+    {
+        _queue.pop_front();
+        ++_frontSeq;
+
+        // Nothing left to find; this also keeps the indexes small.
+        if (_queue.empty())
+        {
+            assert(_superseded == 0 && "Expected no superseded items in an empty queue");
+            _tileIndex.clear();
+            _commandIndex.clear();
+        }
+    }
+
+    /// Drops the item with sequence number @seq, if it is still queued.
+    /// Its slot is left empty, so the sequence numbers of the rest stay valid.
+    bool supersede(uint64_t seq)
+    {
+        if (seq < _frontSeq || seq >= nextSeq())
+            return false;
+
+        Item& item = _queue[seq - _frontSeq];
+        if (!item)
+            return false;
+
+        _bytes -= getSize(item);
+        item = Item();
+        ++_superseded;
+        return true;
+    }
+
     /// Deduplicate messages based on the new one.
     /// Returns true if the new message should be
     /// enqueued, otherwise false.
+    /// The indexes are updated to find the new message at nextSeq().
     bool deduplicate(const Item& item)
     {
         // Deduplicate messages based on the incoming one.
         std::string command = item->firstToken();
+        std::optional<TileDesc> tile;
         if (command == "tile:")
+            tile = TileDesc::parse(item->firstLine());
+        else if (command == TileBinary::Token)
+        {
+            // Invalid messages are not deduplicated; let the client deal with them.
+            const char* buffer = item->data().data();
+            TileBinary::Header header{};
+            if (TileBinary::Header::tryParse(buffer, item->size(), header) &&
+                header.kind == TileBinary::Kind::Tile && header.count > 0)
+                tile = TileDesc::parseBinaryTile(header, buffer + TileBinary::getTileOffset(0));
+        }
+
+        if (tile)
         {
             // Remove previous identical tile, if any, and use most recent (incoming).
-            const TileDesc newTile = TileDesc::parse(item->firstLine());
+            const TileDesc& newTile = *tile;
             uint32_t newTilePosHash = newTile.equalityHash();
             // store a hash of position for this tile.
             item->setHash(newTilePosHash);
 
-            const auto& pos = std::find_if(_queue.begin(), _queue.end(),
-                                           [&newTile, newTilePosHash](const queue_item_t& cur)
+            const auto [it, inserted] = _tileIndex.try_emplace(newTilePosHash, nextSeq(), newTile);
+            if (!inserted)
+            {
+                if (newTile != it->second.second)
                 {
-                    if (!cur->firstTokenMatches("tile:"))
-                        return false;
-                    if (newTilePosHash != cur->getHash()) // eliminate N^2 parsing
-                        return false;
-                    if (newTile != TileDesc::parse(cur->firstLine()))
-                    {
-                        LOG_TRC("Ununusal - tile " << newTile.serialize() << " has quality "
-                                " hash collision with " << cur->firstLine() << " of " << newTilePosHash);
-                        return false;
-                    }
-                    return true;
-                });
-
-            if (pos != _queue.end())
-                _queue.erase(pos);
+                    // The older tile is left queued, unindexed.
+                    LOG_TRC("Ununusal - tile " << newTile.serialize() << " has quality "
+                            " hash collision with " << it->second.second.serialize() << " of "
+                            << newTilePosHash);
+                }
+                else if (supersede(it->second.first))
+                    ++_coalescedTiles;
+
+                it->second = std::make_pair(nextSeq(), newTile);
+            }
+
+            return true;
         }
-        else if (command == "invalidatecursor:" ||
-                 command == "setpart:")
+
+        std::string key;
+        if (command == "invalidatecursor:" ||
+            command == "setpart:")
         {
             // Remove previous identical entries of this command,
             // if any, and use most recent (incoming).
-            const auto& pos = std::find_if(_queue.begin(), _queue.end(),
-                [&command](const queue_item_t& cur)
-                {
-                    return cur->firstTokenMatches(command);
-                });
-
-            if (pos != _queue.end())
-                _queue.erase(pos);
+            key = std::move(command);
         }
         else if (command == "progress:")
         {
             // find other progress commands with similar content
             static constexpr std::string_view setvalueTag = R"("id":"setvalue")";
             if (item->contains(setvalueTag))
-            {
-                const auto& pos = std::find_if(_queue.begin(), _queue.end(),
-                                               [&command](const queue_item_t& cur)
-                {
-                    return cur->firstTokenMatches(command) &&
-                           cur->contains(setvalueTag);
-                });
-
-                if (pos != _queue.end())
-                    _queue.erase(pos);
-            }
+                key = command + std::string(setvalueTag);
         }
         else if (command == "invalidateviewcursor:")
         {
@@ -175,25 +239,18 @@ private:
             Poco::JSON::Parser newParser;
             const Poco::Dynamic::Var newResult = newParser.parse(newMsg);
             const auto& newJson = newResult.extract<Poco::JSON::Object::Ptr>();
-            std::string viewId = newJson->get("viewId").toString();
-            const auto& pos = std::find_if(_queue.begin(), _queue.end(),
-                [command=std::move(command),
-                 viewId=std::move(viewId)](const queue_item_t& cur)
-                {
-                    if (cur->firstTokenMatches(command))
-                    {
-                        const std::string msg = cur->jsonString();
-                        Poco::JSON::Parser parser;
-                        const Poco::Dynamic::Var result = parser.parse(msg);
-                        const auto& json = result.extract<Poco::JSON::Object::Ptr>();
-                        return viewId == json->get("viewId").toString();
-                    }
-
-                    return false;
-                });
-
-            if (pos != _queue.end())
-                _queue.erase(pos);
+            key = command + newJson->get("viewId").toString();
+        }
+
+        if (!key.empty())
+        {
+            const auto [it, inserted] = _commandIndex.try_emplace(std::move(key), nextSeq());
+            if (!inserted)
+            {
+                if (supersede(it->second))
+                    ++_coalescedMessages;
+                it->second = nextSeq();
+            }
         }
 
         return true;
@@ -202,7 +259,22 @@ private:
 private:
     mutable std::mutex _mutex;
     std::deque<Item> _queue;
-    using queue_item_t = typename std::deque<Item>::value_type;
+
+    /// The sequence number of the item at the front of the queue.
+    uint64_t _frontSeq = 0;
+    /// The number of empty slots left by superseded items.
+    std::size_t _superseded = 0;
+    /// The size of the items queued, superseded ones excluded.
+    std::size_t _bytes = 0;
+
+    /// The queued tiles by their position hash: the sequence number and the tile.
+    std::unordered_map<uint32_t, std::pair<uint64_t, TileDesc>> _tileIndex;
+    /// The sequence number of the queued message superseded by the next of its kind.
+    std::unordered_map<std::string, uint64_t> _commandIndex;
+
+    /// The number of tiles and other messages that were replaced by newer ones.
+    std::size_t _coalescedTiles = 0;
+    std::size_t _coalescedMessages = 0;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
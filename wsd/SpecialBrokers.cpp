@@ -29,6 +29,7 @@
 
 #include "ClientSession.hpp"
 #include "Common.hpp"
+#include "ConversionQueue.hpp"
 #include "COOLWSD.hpp"
 #include "FileServer.hpp"
 #include "Socket.hpp"
@@ -90,6 +91,22 @@ ConvertToBroker::ConvertToBroker(const std::string& uri, const Poco::URI& uriPub
 ConvertToBroker::~ConvertToBroker() {}
 
 bool ConvertToBroker::startConversion(SocketDisposition& disposition, const std::string& id, const AdditionalFilePocoUris& additionalFileUrisPublic)
+{
+    setupTransfer(disposition, prepareConversion(id, additionalFileUrisPublic));
+    return true;
+}
+
+bool ConvertToBroker::startConversion(SocketPoll& from, const std::weak_ptr<StreamSocket>& socket,
+                                      const std::string& id,
+                                      const AdditionalFilePocoUris& additionalFileUrisPublic)
+{
+    setupTransfer(from, socket, prepareConversion(id, additionalFileUrisPublic));
+    return true;
+}
+
+SocketDisposition::MoveFunction
+ConvertToBroker::prepareConversion(const std::string& id,
+                                   const AdditionalFilePocoUris& additionalFileUrisPublic)
 {
     std::shared_ptr<ConvertToBroker> docBroker =
         std::static_pointer_cast<ConvertToBroker>(shared_from_this());
@@ -110,25 +127,22 @@ bool ConvertToBroker::startConversion(SocketDisposition& disposition, const std:
                                                      additionalFileUrisPublic);
     _clientSession->construct();
 
-    docBroker->setupTransfer(
-        disposition,
-        [docBroker](const std::shared_ptr<Socket>& moveSocket)
-        {
-            auto streamSocket = std::static_pointer_cast<StreamSocket>(moveSocket);
-            docBroker->_clientSession->setSaveAsSocket(streamSocket);
+    return [docBroker](const std::shared_ptr<Socket>& moveSocket)
+    {
+        auto streamSocket = std::static_pointer_cast<StreamSocket>(moveSocket);
+        docBroker->_clientSession->setSaveAsSocket(streamSocket);
 
-            // First add and load the session.
-            docBroker->addSession(docBroker->_clientSession);
+        // First add and load the session.
+        docBroker->addSession(docBroker->_clientSession);
 
-            // Load the document manually and request saving in the target format.
-            std::string encodedFrom;
-            Poco::URI::encode(docBroker->getPublicUri().getPath(), "", encodedFrom);
+        // Load the document manually and request saving in the target format.
+        std::string encodedFrom;
+        Poco::URI::encode(docBroker->getPublicUri().getPath(), "", encodedFrom);
 
-            docBroker->sendStartMessage(docBroker->_clientSession, encodedFrom);
+        docBroker->sendStartMessage(docBroker->_clientSession, encodedFrom);
 
-            // Save is done in the setLoaded
-        });
-    return true;
+        // Save is done in the setLoaded
+    };
 }
 
 void ConvertToBroker::sendStartMessage(const std::shared_ptr<ClientSession>& clientSession,
@@ -191,6 +205,17 @@ void ConvertToBroker::dispose()
         removeFile(_uriOrig);
         _uriOrig.clear();
     }
+
+    if (!_client.empty() && COOLWSD::Conversions)
+    {
+        // Let the next one in.
+        ConversionQueue::Job job = COOLWSD::Conversions->finished(
+            _client, std::chrono::steady_clock::now() - _submitTime);
+        if (job)
+            COOLWSD::getWebServerPoll()->addCallback(std::move(job));
+
+        _client.clear();
+    }
 }
 
 void ConvertToBroker::setLoaded()
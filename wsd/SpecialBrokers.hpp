@@ -17,6 +17,7 @@
 
 #include <wsd/DocumentBroker.hpp>
 
+#include <chrono>
 #include <cstddef>
 #include <memory>
 #include <string>
@@ -48,6 +49,9 @@ class ConvertToBroker : public StatelessBatchBroker
     const std::string _format;
     const std::string _sOptions;
     const std::string _lang;
+    /// The client the conversion was admitted for, and when it asked.
+    std::string _client;
+    std::chrono::steady_clock::time_point _submitTime;
 
 public:
     /// Construct DocumentBroker with URI and docKey
@@ -62,6 +66,19 @@ public:
     /// Move socket to this broker for response & do conversion
     bool startConversion(SocketDisposition& disposition, const std::string& id, const AdditionalFilePocoUris& additionalFileUrisPublic);
 
+    /// Same, for a conversion that waited its turn, with the socket in @from.
+    bool startConversion(SocketPoll& from, const std::weak_ptr<StreamSocket>& socket,
+                         const std::string& id,
+                         const AdditionalFilePocoUris& additionalFileUrisPublic);
+
+    /// The conversion has been admitted by COOLWSD::Conversions for @client,
+    /// which asked at @submitTime. Its slot is freed on dispose().
+    void setAdmitted(const std::string& client, std::chrono::steady_clock::time_point submitTime)
+    {
+        _client = client;
+        _submitTime = submitTime;
+    }
+
     /// When the load completes - lets start saving
     void setLoaded() override;
 
@@ -74,6 +91,11 @@ public:
 protected:
     bool isConvertTo() const override { return true; }
 
+    /// Creates the session, and returns what starts the conversion once the socket is ours.
+    SocketDisposition::MoveFunction
+    prepareConversion(const std::string& id,
+                      const AdditionalFilePocoUris& additionalFileUrisPublic);
+
     virtual bool isReadOnly() const { return true; }
 
     virtual bool isGetThumbnail() const { return false; }
@@ -13,12 +13,15 @@
 
 #include "TileCache.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <climits>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -35,6 +38,20 @@
 
 using namespace COOLProtocol;
 
+namespace
+{
+/// The row or column of @pos in a grid of @size, rounding down, within int range.
+int gridIndex(int64_t pos, int size)
+{
+    size = std::max(size, 1);
+    int64_t index = pos / size;
+    if (pos % size < 0)
+        --index;
+
+    return std::clamp<int64_t>(index, INT_MIN + 1, INT_MAX - 1);
+}
+} // namespace
+
 TileCache::TileCache(std::string docURL, const std::chrono::system_clock::time_point& modifiedTime,
                      bool dontCache)
     : _docURL(std::move(docURL))
@@ -42,6 +59,9 @@ TileCache::TileCache(std::string docURL, const std::chrono::system_clock::time_p
     , _maxCacheSize(1024 * 1024)
     , _dontCache(dontCache)
 {
+    // Conversions don't keep tiles, so leave the budget to those that do.
+    if (!_dontCache)
+        ++CacheCount;
 #ifndef BUILDING_TESTS
     LOG_INF("TileCache ctor for uri [" << COOLWSD::anonymizeUrl(_docURL) <<
             "], modifiedTime=" << std::chrono::duration_cast<std::chrono::seconds>
@@ -53,6 +73,9 @@ TileCache::TileCache(std::string docURL, const std::chrono::system_clock::time_p
 TileCache::~TileCache()
 {
     _owner = std::thread::id();
+    GlobalCacheSize -= _cacheSize;
+    if (!_dontCache)
+        --CacheCount;
 #ifndef BUILDING_TESTS
     LOG_INF("~TileCache dtor for uri [" << COOLWSD::anonymizeUrl(_docURL) << "].");
 #endif
@@ -61,7 +84,9 @@ TileCache::~TileCache()
 void TileCache::clear()
 {
     _cache.clear();
-    _cacheSize = 0;
+    _grids.clear();
+    _lru.clear();
+    adjustCacheSize(-static_cast<ssize_t>(_cacheSize));
     for (std::map<std::string, Blob>& i : _streamCache)
         i.clear();
 
@@ -176,6 +201,10 @@ Tile TileCache::lookupTile(const TileDesc& tile)
         return Tile();
 
     Tile ret = findTile(tile);
+    if (ret)
+        ++_stats._hits;
+    else
+        ++_stats._misses;
 
     UnitWSD::get().lookupTile(tile.getPart(), tile.getEditMode(),
                               tile.getWidth(), tile.getHeight(),
@@ -297,24 +326,37 @@ bool TileCache::invalidateTiles(int part, int mode, int x, int y, int width, int
         return false;
     }
 
-    for (auto it = _cache.begin(); it != _cache.end();)
+    for (auto& [key, grid] : _grids)
     {
-        if (intersectsTile(it->first, part, mode, x, y, width, height, canonicalViewId))
-        {
-            // FIXME: only want to keep as invalid keyframes in the view area(s)
-            it->second->invalidate();
-            ++it;
-        }
-#if 0
-        {
-            LOG_TRC("Removing tile: " << it->first.serialize());
-            _cacheSize -= itemCacheSize(it->second);
-            it = _cache.erase(it);
-        }
-#endif
-        else
+        const auto& [tilePart, tileMode, tileViewId, tileWidth, tileHeight] = key;
+        if ((part != -1 && tilePart != part) || tileMode != mode || tileViewId != canonicalViewId)
+            continue;
+
+        // Tiles off the grid reach into the next cell, and touching counts.
+        const int firstRow = gridIndex(y, tileHeight) - 1;
+        const int lastRow = gridIndex(static_cast<int64_t>(y) + height, tileHeight);
+        const int firstCol = gridIndex(x, tileWidth) - 1;
+        const int lastCol = gridIndex(static_cast<int64_t>(x) + width, tileWidth);
+
+        // Skip from row to row, to visit only the cells we have tiles in.
+        auto it = grid.lower_bound({ firstRow, firstCol });
+        while (it != grid.end() && it->first.first <= lastRow)
         {
-            ++it;
+            const auto [row, col] = it->first;
+            if (col < firstCol)
+                it = grid.lower_bound({ row, firstCol });
+            else if (col > lastCol)
+                it = grid.upper_bound({ row, INT_MAX });
+            else
+            {
+                CacheMap::value_type& entry = *it->second;
+                if (intersectsTile(entry.first, part, mode, x, y, width, height, canonicalViewId))
+                {
+                    // FIXME: only want to keep as invalid keyframes in the view area(s)
+                    entry.second._tile->invalidate();
+                }
+                ++it;
+            }
         }
     }
 
@@ -494,8 +536,9 @@ Tile TileCache::findTile(const TileDesc &desc)
     const auto it = _cache.find(desc);
     if (it != _cache.end())
     {
-        LOG_TRC("Found cache tile: " << desc.serialize() << " of size " << it->second);
-        return it->second;
+        LOG_TRC("Found cache tile: " << desc.serialize() << " of size " << it->second._tile);
+        _lru.splice(_lru.begin(), _lru, it->second._lru);
+        return it->second._tile;
     }
 
     return Tile();
@@ -506,10 +549,9 @@ Tile TileCache::saveDataToCache(const TileDesc &desc, const char *data, const si
     if (_dontCache)
         return std::make_shared<TileData>(desc.getWireId(), data, size);
 
-    ensureCacheSize();
-
-    Tile tile = _cache[desc];
-    if (!tile)
+    Tile tile;
+    const auto it = _cache.find(desc);
+    if (it == _cache.end())
     {
         if (!TileData::isKeyframe(data, size))
         {
@@ -518,23 +560,25 @@ Tile TileCache::saveDataToCache(const TileDesc &desc, const char *data, const si
             // underlying keyframe.
             LOG_TRC("rare race between canceltiles and delta rendering - "
                     "discarding delta for " << desc.serialize());
-            _cache.erase(desc);
             return Tile();
         }
-        else
-        {
-            LOG_TRC("new tile for " << desc.serialize() << " of size " << size);
-            tile = std::make_shared<TileData>(desc.getWireId(), data, size);
-            _cache[desc] = tile;
-            _cacheSize += itemCacheSize(tile);
-        }
+
+        LOG_TRC("new tile for " << desc.serialize() << " of size " << size);
+        tile = std::make_shared<TileData>(desc.getWireId(), data, size);
+        _lru.push_front(desc);
+        addToGrid(*_cache.emplace(desc, CacheEntry{ tile, _lru.begin() }).first);
+        adjustCacheSize(itemCacheSize(tile));
     }
     else
     {
         LOG_TRC("append blob to " << desc.serialize() << " of size " << size);
-        _cacheSize += tile->appendBlob(desc.getWireId(), data, size);
+        tile = it->second._tile;
+        _lru.splice(_lru.begin(), _lru, it->second._lru);
+        adjustCacheSize(tile->appendBlob(desc.getWireId(), data, size));
     }
 
+    ensureCacheSize();
+
     return tile;
 }
 
@@ -549,82 +593,106 @@ void TileCache::assertCacheSize()
     size_t recalcSize = 0;
     for (const auto& it : _cache)
     {
-        recalcSize += itemCacheSize(it.second);
+        recalcSize += itemCacheSize(it.second._tile);
     }
     assert(recalcSize == _cacheSize);
+    assert(_lru.size() == _cache.size());
+
+    size_t gridSize = 0;
+    for (const auto& [key, grid] : _grids)
+    {
+        assert(!grid.empty());
+        for (const auto& [cell, entry] : grid)
+        {
+            assert(getGridKey(entry->first) == key);
+            assert(getGridCell(entry->first) == cell);
+            assert(_cache.find(entry->first) != _cache.end());
+        }
+        gridSize += grid.size();
+    }
+    assert(gridSize == _cache.size());
 #endif
 }
 
-void TileCache::ensureCacheSize()
+TileCache::GridKey TileCache::getGridKey(const TileDesc& desc)
 {
-    assertCacheSize();
-
-    if (_cacheSize < _maxCacheSize || _cache.size() < 2)
-        return;
-
-    LOG_TRC("Cleaning tile cache of size " << _cacheSize << " vs. " << _maxCacheSize <<
-            " with " << _cache.size() << " entries");
+    return GridKey(desc.getPart(), desc.getEditMode(), desc.getCanonicalViewId(),
+                   desc.getTileWidth(), desc.getTileHeight());
+}
 
-    struct WidSize {
-        TileWireId _wid;
-        size_t     _size;
-        WidSize(TileWireId w, size_t s) : _wid(w), _size(s) {}
-    };
-    std::vector<WidSize> wids;
-    wids.reserve(_cache.size());
-    for (const auto& it : _cache)
-        wids.emplace_back(it.first.getWireId(), itemCacheSize(it.second));
+std::pair<int, int> TileCache::getGridCell(const TileDesc& desc)
+{
+    return { gridIndex(desc.getTilePosY(), desc.getTileHeight()),
+             gridIndex(desc.getTilePosX(), desc.getTileWidth()) };
+}
 
-    std::sort(wids.begin(), wids.end(),
-              [](const WidSize &a, const WidSize &b) { return a._wid < b._wid; });
+void TileCache::addToGrid(CacheMap::value_type& entry)
+{
+    _grids[getGridKey(entry.first)].emplace(getGridCell(entry.first), &entry);
+}
 
-    // FIXME: should we just take a wid 25% into the list ?
-    TileWireId maxToRemove = wids.front()._wid;
+void TileCache::removeFromGrid(const CacheMap::value_type& entry)
+{
+    const auto git = _grids.find(getGridKey(entry.first));
+    assert(git != _grids.end());
+    if (git == _grids.end())
+        return;
 
-    // do we have (the very rare) WID wrap-around
-    if (wids.back()._wid - wids.front()._wid > 256 * 256 * 256)
+    Grid& grid = git->second;
+    const auto range = grid.equal_range(getGridCell(entry.first));
+    for (auto it = range.first; it != range.second; ++it)
     {
-        maxToRemove = wids.back()._wid;
-        LOG_TRC("Rare wid wrap-around detected, clear tile cache");
-    }
-    else
-    {
-        // calculate which wid to start at.
-        size_t total = 0;
-        for (const auto &it : wids)
+        if (it->second == &entry)
         {
-            total += it._size;
-            maxToRemove = it._wid;
-            if (total > _maxCacheSize / 4)
-                break;
+            grid.erase(it);
+            break;
         }
     }
-    LOG_TRC("cleaning up to wid " << maxToRemove << " between " <<
-            wids.front()._wid << " and " << wids.back()._wid);
 
-    for (auto it = _cache.begin(); it != _cache.end();)
+    if (grid.empty())
+        _grids.erase(git);
+}
+
+size_t TileCache::getCacheSizeLimit() const
+{
+    // Rendering tiles again is cheaper than getting the kits killed.
+    return LowMemory ? _maxCacheSize / 4 : _maxCacheSize;
+}
+
+void TileCache::ensureCacheSize()
+{
+    assertCacheSize();
+
+    const size_t limit = getCacheSizeLimit();
+    if (_cacheSize < limit || _cache.size() < 2)
+        return;
+
+    LOG_TRC("Cleaning tile cache of size " << _cacheSize << " vs. " << limit <<
+            " with " << _cache.size() << " entries");
+
+    // Never evict the most recent tile, and give each other one chance only.
+    size_t candidates = _lru.size() - 1;
+    while (_cacheSize >= limit && candidates-- > 0)
     {
-        if (it->first.getWireId() <= maxToRemove)
+        const auto oldest = std::prev(_lru.end());
+        const auto rit = _tilesBeingRendered.find(*oldest);
+        if (rit != _tilesBeingRendered.end())
         {
-            auto rit = _tilesBeingRendered.find(it->first);
-            if (rit != _tilesBeingRendered.end())
-            {
-                // avoid getting a delta instead of a keyframe at the bottom.
-                LOG_TRC("skip cleaning tile we are waiting on: " << it->first.serialize() <<
-                        " which has " << rit->second->getSubscribers().size() << " waiting");
-                ++it;
-            }
-            else
-            {
-                LOG_TRC("cleaned out tile: " << it->first.serialize());
-                _cacheSize -= itemCacheSize(it->second);
-                it = _cache.erase(it);
-            }
-        }
-        else
-        {
-            ++it;
+            // avoid getting a delta instead of a keyframe at the bottom.
+            LOG_TRC("skip cleaning tile we are waiting on: " << oldest->serialize() <<
+                    " which has " << rit->second->getSubscribers().size() << " waiting");
+            _lru.splice(_lru.begin(), _lru, oldest);
+            continue;
         }
+
+        LOG_TRC("cleaned out tile: " << oldest->serialize());
+        const auto it = _cache.find(*oldest);
+        assert(it != _cache.end());
+        adjustCacheSize(-static_cast<ssize_t>(itemCacheSize(it->second._tile)));
+        removeFromGrid(*it);
+        _cache.erase(it);
+        _lru.erase(oldest);
+        ++_stats._evictions;
     }
 
     LOG_TRC("Cache is now of size " << _cacheSize << " and " <<
@@ -669,16 +737,22 @@ void TileCache::dumpState(std::ostream& os)
 {
     os << "\n  TileCache:";
     os << "\n    num: " << _cache.size() << ", size: " << _cacheSize << " (" << _maxCacheSize
-       << ") bytes\n";
+       << ") bytes, limit: " << getCacheSizeLimit() << " bytes";
+    os << "\n    all caches: " << GlobalCacheSize << " (" << GlobalMaxCacheSize << ") bytes in "
+       << CacheCount << " caches" << (LowMemory ? ", low memory" : "");
+    os << "\n    hits: " << _stats._hits << ", misses: " << _stats._misses
+       << ", evictions: " << _stats._evictions << '\n';
     size_t totalSize = 0;
     size_t totalCapacity = 0;
-    for (const auto& it : _cache)
+    // Most recently used first.
+    for (const TileDesc& desc : _lru)
     {
-        totalSize += it.second->size();
-        totalCapacity += it.second->data().capacity();
-        os << "    " << std::setw(4) << it.first.getWireId() << '\t' << std::setw(6)
-           << it.second->size() << " bytes" << "\t'" << it.first.serialize() << " ";
-        it.second->dumpState(os);
+        const Tile& tile = _cache.at(desc)._tile;
+        totalSize += tile->size();
+        totalCapacity += tile->data().capacity();
+        os << "    " << std::setw(4) << desc.getWireId() << '\t' << std::setw(6)
+           << tile->size() << " bytes" << "\t'" << desc.serialize() << " ";
+        tile->dumpState(os);
         os << '\n';
     }
 
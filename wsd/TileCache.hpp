@@ -11,10 +11,15 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <iosfwd>
+#include <list>
+#include <map>
 #include <memory>
 #include <string>
 #include <thread>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -66,6 +71,7 @@ struct TileDescCacheHasher final
 struct TileData
 {
     TileData(TileWireId start, const char *data, const size_t size)
+        : _deltas(std::make_shared<BlobData>())
     {
         appendBlob(start, data, size);
     }
@@ -81,7 +87,11 @@ struct TileData
             LOG_TRC("received key-frame - clearing tile");
             _wids.clear();
             _offsets.clear();
-            _deltas.clear();
+            // Leave the old frames to any pending send.
+            if (_deltas.use_count() > 1)
+                _deltas = std::make_shared<BlobData>();
+            else
+                _deltas->clear();
         }
         else
         {
@@ -102,7 +112,7 @@ struct TileData
         // an empty delta twice.x
         if (dataSize == 1 && // just a 'D'
             _offsets.size() > 1 &&
-            _offsets.back() == _deltas.size())
+            _offsets.back() == _deltas->size())
         {
             LOG_TRC("received empty delta - bumping wid from " << _wids.back() << " to " << id);
             _wids.back() = id;
@@ -110,11 +120,20 @@ struct TileData
         else
         {
             _wids.push_back(id);
-            _offsets.push_back(_deltas.size());
+            _offsets.push_back(_deltas->size());
             if (dataSize > 1)
             {
-                _deltas.resize(oldSize + dataSize - 1);
-                std::memcpy(_deltas.data() + oldSize, data + 1, dataSize - 1);
+                // Copy on write, the data is shared with pending sends.
+                if (_deltas.use_count() > 1)
+                {
+                    auto deltas = std::make_shared<BlobData>();
+                    deltas->reserve(oldSize + dataSize - 1);
+                    deltas->assign(_deltas->begin(), _deltas->end());
+                    _deltas = std::move(deltas);
+                }
+
+                _deltas->resize(oldSize + dataSize - 1);
+                std::memcpy(_deltas->data() + oldSize, data + 1, dataSize - 1);
             }
         }
 
@@ -134,8 +153,8 @@ struct TileData
         return deltaSize > 128 * 1024; // deltas should be cumulatively small.
     }
 
-    bool isPng() const { return (_deltas.size() > 1 &&
-                                 _deltas[0] == (char)0x89); }
+    bool isPng() const { return (_deltas->size() > 1 &&
+                                 (*_deltas)[0] == (char)0x89); }
 
     static bool isKeyframe(const char *data, size_t dataSize)
     {
@@ -148,17 +167,19 @@ struct TileData
 
     std::vector<TileWireId> _wids;
     std::vector<size_t> _offsets; // offset of the start of data
-    BlobData _deltas; // first item is a key-frame, followed by deltas at _offsets
+    /// First item is a key-frame, followed by deltas at _offsets.
+    /// Never modified once shared, see getChangesSince.
+    std::shared_ptr<BlobData> _deltas;
     bool _valid; // not true - waiting for a new tile if in view.
 
     size_t size() const
     {
-        return _deltas.size();
+        return _deltas->size();
     }
 
     const BlobData &data() const
     {
-        return _deltas;
+        return *_deltas;
     }
 
     /// if we send changes since this seq - do we need to first send the keyframe ?
@@ -167,7 +188,8 @@ struct TileData
         return since < _wids[0];
     }
 
-    bool appendChangesSince(std::vector<char> &output, TileWireId since)
+    /// Returns the offset in data() of the changes since @since, or npos if there are none.
+    size_t findChangesSince(TileWireId since) const
     {
         size_t i;
         for (i = 0; since != 0 && i < _wids.size() && _wids[i] <= since; ++i);
@@ -178,23 +200,40 @@ struct TileData
             // We just send all the deltas we have on top of the keyframe.
             // LOG_WRN("odd outcome - requested for a later id " << since <<
             //        " than the last known: " << ((_wids.size() > 0) ? _wids.back() : -1));
-            return false;
-        }
-        else
-        {
-            size_t offset = _offsets[i];
-            if (i != _offsets.size() - 1)
-                LOG_TRC("appending from " << i << " to " << (_offsets.size() - 1) <<
-                        " from wid: " << _wids[i] << " to wid: " << since <<
-                        " from offset: " << offset << " to " << _deltas.size());
-
-            size_t extra = _deltas.size() - offset;
-            size_t dest = output.size();
-            output.resize(output.size() + extra);
-
-            std::memcpy(output.data() + dest, _deltas.data() + offset, extra);
-            return true;
+            return std::string::npos;
         }
+
+        const size_t offset = _offsets[i];
+        if (i != _offsets.size() - 1)
+            LOG_TRC("appending from " << i << " to " << (_offsets.size() - 1) <<
+                    " from wid: " << _wids[i] << " to wid: " << since <<
+                    " from offset: " << offset << " to " << _deltas->size());
+        return offset;
+    }
+
+    bool appendChangesSince(std::vector<char> &output, TileWireId since) const
+    {
+        const size_t offset = findChangesSince(since);
+        if (offset == std::string::npos)
+            return false;
+
+        size_t extra = _deltas->size() - offset;
+        size_t dest = output.size();
+        output.resize(output.size() + extra);
+
+        std::memcpy(output.data() + dest, _deltas->data() + offset, extra);
+        return true;
+    }
+
+    /// Returns the data holding the changes since @since, from @offset to its end,
+    /// or nullptr if there are none. Sharing it avoids copying, as we copy on write.
+    std::shared_ptr<const BlobData> getChangesSince(TileWireId since, size_t& offset) const
+    {
+        offset = findChangesSince(since);
+        if (offset == std::string::npos)
+            return nullptr;
+
+        return _deltas;
     }
 
     void dumpState(std::ostream& os)
@@ -293,15 +332,61 @@ public:
     /// Get the current memory use.
     size_t getMemorySize() const { return _cacheSize; }
 
+    /// How well the cache is doing.
+    struct Stats
+    {
+        uint64_t _hits = 0;
+        uint64_t _misses = 0;
+        uint64_t _evictions = 0;
+        size_t _bytes = 0;
+    };
+
+    Stats getStats() const
+    {
+        Stats stats = _stats;
+        stats._bytes = _cacheSize;
+        return stats;
+    }
+
+    /// Set the memory budget shared by the tile caches of all the documents,
+    /// or 0 to leave each cache to its own high watermark.
+    static void setGlobalMaxCacheSize(size_t cacheSize) { GlobalMaxCacheSize = cacheSize; }
+    static size_t getGlobalMaxCacheSize() { return GlobalMaxCacheSize; }
+
+    /// Get the share of the global budget of each tile cache.
+    static size_t getGlobalCacheShare()
+    {
+        return GlobalMaxCacheSize / std::max<size_t>(CacheCount, 1);
+    }
+
+    /// Get the memory use of the tile caches of all the documents.
+    static size_t getGlobalCacheSize() { return GlobalCacheSize; }
+
+    /// Under memory pressure, every cache keeps to a quarter of its budget.
+    /// Each cache trims to it on its next ensureCacheSize().
+    static void setLowMemory(bool lowMemory) { LowMemory = lowMemory; }
+
+    /// Evicts the least recently used tiles beyond our limit.
+    void ensureCacheSize();
+
     // Debugging bits ...
     void dumpState(std::ostream& os);
     void setThreadOwner(const std::thread::id& id) { _owner = id; }
     void assertCacheSize();
 
 private:
-    void ensureCacheSize();
     static size_t itemCacheSize(const Tile &tile);
 
+    /// The size we should keep to, given our share of the global budget.
+    size_t getCacheSizeLimit() const;
+
+    /// Accounts for a change in the size of our tiles.
+    void adjustCacheSize(ssize_t delta)
+    {
+        _cacheSize += delta;
+        GlobalCacheSize += delta;
+    }
+
     /// Removes the invalid tiles from the cache
     /// returns true if cache wasn't empty
     bool invalidateTiles(int part, int mode, int x, int y, int width, int height, CanonicalViewId canonicalViewId);
@@ -325,10 +410,36 @@ private:
     // old-style file-name to data grab-bag.
     std::map<std::string, Blob> _streamCache[static_cast<int>(StreamType::Last)];
 
+    /// Cached tiles, the most recently used first.
+    using LruList = std::list<TileDesc>;
+    LruList _lru;
+
+    struct CacheEntry
+    {
+        Tile _tile;
+        LruList::iterator _lru;
+    };
+
     // FIXME: should we have a tile-desc to WID map instead and a simpler lookup ?
-    std::unordered_map<TileDesc, Tile,
-                       TileDescCacheHasher,
-                       TileDescCacheCompareEq> _cache;
+    using CacheMap = std::unordered_map<TileDesc, CacheEntry,
+                                        TileDescCacheHasher,
+                                        TileDescCacheCompareEq>;
+    CacheMap _cache;
+
+    /// The tiles of the same part, mode, view and size: a grid.
+    using GridKey = std::tuple<int, int, CanonicalViewId, int, int>;
+    /// The cached tiles by (row, column) in their grid. Points into _cache,
+    /// whose elements stay put as it grows.
+    using Grid = std::multimap<std::pair<int, int>, CacheMap::value_type*>;
+
+    /// Cached tiles by grid, so an invalidation looks only at the tiles it may hit.
+    std::map<GridKey, Grid> _grids;
+
+    static GridKey getGridKey(const TileDesc& desc);
+    static std::pair<int, int> getGridCell(const TileDesc& desc);
+    void addToGrid(CacheMap::value_type& entry);
+    void removeFromGrid(const CacheMap::value_type& entry);
+
     // FIXME: TileBeingRendered contains TileDesc too ...
     std::unordered_map<TileDesc, std::shared_ptr<TileBeingRendered>,
                        TileDescCacheHasher,
@@ -344,7 +455,18 @@ private:
     /// Maximum (high watermark) size of the tilecache in bytes
     size_t _maxCacheSize;
 
+    Stats _stats;
+
     const bool _dontCache;
+
+    /// Approximate size of all the tilecaches in bytes.
+    static inline std::atomic<size_t> GlobalCacheSize = 0;
+    /// Maximum size of all the tilecaches in bytes, or 0 for no limit.
+    static inline std::atomic<size_t> GlobalMaxCacheSize = 0;
+    /// Number of tilecaches sharing the budget, those that store tiles.
+    static inline std::atomic<size_t> CacheCount = 0;
+    /// Whether the system is under memory pressure.
+    static inline std::atomic<bool> LowMemory = false;
 };
 
 /// Tracks view-port area tiles to track which we last
@@ -71,6 +71,137 @@ inline std::ostream& operator<<(std::ostream& os, const CanonicalViewId e)
     return os;
 }
 
+/// The binary header of the tile messages, negotiated in place of the text
+/// line of tile:, delta:, update: and tilecombine:, which is costly to format
+/// and to parse at the rate tiles go. The message is a "tilebin:" line,
+/// followed by this fixed layout, all little-endian:
+///   u8 version, u8 kind, u16 count,
+///   i32 nviewid, part, mode, width, height, tilewidth, tileheight,
+/// then, for each of the count tiles:
+///   i32 tileposx, tileposy, ver, id, u32 oldwid, wid, imgsize,
+/// then the images of the tiles, back to back, if any.
+namespace TileBinary
+{
+    /// The first line of the binary tile messages.
+    constexpr std::string_view Token = "tilebin:";
+
+    constexpr uint8_t Version = 1;
+
+    /// What the message carries, as the first token of the text protocol would say.
+    enum class Kind : uint8_t
+    {
+        Tile, ///< Keyframes or PNGs, and the rendered tiles from the Kit.
+        Delta, ///< The changes since oldwid.
+        Update ///< No image: the tile is unchanged, at a new wid.
+    };
+
+    constexpr std::size_t HeaderSize = 32;
+    constexpr std::size_t TileSize = 28;
+
+    /// The offset of the header, after the first line.
+    constexpr std::size_t HeaderOffset = Token.size() + 1;
+
+    /// The offset of the fields of the tile at @index.
+    constexpr std::size_t getTileOffset(std::size_t index)
+    {
+        return HeaderOffset + HeaderSize + index * TileSize;
+    }
+
+    inline void put32(std::string& out, uint32_t value)
+    {
+        const char bytes[4] = { static_cast<char>(value), static_cast<char>(value >> 8),
+                                static_cast<char>(value >> 16), static_cast<char>(value >> 24) };
+        out.append(bytes, sizeof(bytes));
+    }
+
+    inline uint32_t get32(const char* p)
+    {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(p);
+        return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+    }
+
+    /// The fields common to all the tiles of a message.
+    struct Header
+    {
+        Kind kind;
+        uint16_t count;
+        CanonicalViewId canonicalViewId;
+        int part;
+        int mode;
+        int width;
+        int height;
+        int tileWidth;
+        int tileHeight;
+
+        /// Appends the first line and the header to @out.
+        void serialize(std::string& out) const
+        {
+            out.reserve(out.size() + getTileOffset(count));
+            out.append(Token);
+            out.push_back('\n');
+            out.push_back(static_cast<char>(Version));
+            out.push_back(static_cast<char>(kind));
+            out.push_back(static_cast<char>(count));
+            out.push_back(static_cast<char>(count >> 8));
+            put32(out, to_underlying(canonicalViewId));
+            put32(out, part);
+            put32(out, mode);
+            put32(out, width);
+            put32(out, height);
+            put32(out, tileWidth);
+            put32(out, tileHeight);
+        }
+
+        /// Parses the header of the message of @size bytes at @data,
+        /// checking that the tiles are all there, though not their images.
+        /// Returns false, leaving @header as it was, when the message is invalid.
+        /// Doesn't throw, so it's safe on the paths that send tiles.
+        static bool tryParse(const char* data, std::size_t size, Header& header)
+        {
+            if (size < HeaderOffset + HeaderSize ||
+                std::string_view(data, Token.size()) != Token || data[Token.size()] != '\n')
+            {
+                return false;
+            }
+
+            const char* p = data + HeaderOffset;
+            if (static_cast<uint8_t>(p[0]) != Version ||
+                static_cast<uint8_t>(p[1]) > static_cast<uint8_t>(Kind::Update))
+            {
+                return false;
+            }
+
+            const uint16_t count = static_cast<uint8_t>(p[2]) | (static_cast<uint8_t>(p[3]) << 8);
+            if (size < getTileOffset(count))
+                return false;
+
+            header.kind = static_cast<Kind>(p[1]);
+            header.count = count;
+            header.canonicalViewId = static_cast<CanonicalViewId>(get32(p + 4));
+            header.part = get32(p + 8);
+            header.mode = get32(p + 12);
+            header.width = get32(p + 16);
+            header.height = get32(p + 20);
+            header.tileWidth = get32(p + 24);
+            header.tileHeight = get32(p + 28);
+            return true;
+        }
+
+        /// As tryParse(), but throws BadArgumentException when the message is invalid.
+        static Header parse(const char* data, std::size_t size)
+        {
+            Header header;
+            if (!tryParse(data, size, header))
+                throw BadArgumentException("Invalid binary tile message.");
+
+            return header;
+        }
+
+        /// The offset of the images, after the header and the tiles.
+        std::size_t getImagesOffset() const { return getTileOffset(count); }
+    };
+}
+
 /// Tile Descriptor
 /// Represents a tile's coordinates and dimensions.
 class TileDesc final
@@ -398,6 +529,51 @@ public:
         return parse(StringVector::tokenize(message.data(), message.size()));
     }
 
+    /// Serialize this instance as a binary message of @kind, without the image.
+    std::string serializeBinary(TileBinary::Kind kind) const
+    {
+        std::string out;
+        const TileBinary::Header header{ kind,   1,       _canonicalViewId, _part,      _mode,
+                                         _width, _height, _tileWidth,       _tileHeight };
+        header.serialize(out);
+        serializeBinaryTile(out);
+        return out;
+    }
+
+    /// Appends the fields specific to this tile, as in the binary messages.
+    void serializeBinaryTile(std::string& out) const
+    {
+        TileBinary::put32(out, _tilePosX);
+        TileBinary::put32(out, _tilePosY);
+        TileBinary::put32(out, _ver);
+        TileBinary::put32(out, _id);
+        TileBinary::put32(out, _oldWireId);
+        TileBinary::put32(out, _wireId);
+        TileBinary::put32(out, _imgSize);
+    }
+
+    /// Deserialize the tile at @p, of the binary message with @header.
+    static TileDesc parseBinaryTile(const TileBinary::Header& header, const char* p)
+    {
+        TileDesc result(header.canonicalViewId, header.part, header.mode, header.width,
+                        header.height, TileBinary::get32(p), TileBinary::get32(p + 4),
+                        header.tileWidth, header.tileHeight, TileBinary::get32(p + 8),
+                        TileBinary::get32(p + 24), TileBinary::get32(p + 12));
+        result.setOldWireId(TileBinary::get32(p + 16));
+        result.setWireId(TileBinary::get32(p + 20));
+        return result;
+    }
+
+    /// Deserialize a TileDesc from the binary message of @size bytes at @data.
+    static TileDesc parseBinary(const char* data, std::size_t size)
+    {
+        const TileBinary::Header header = TileBinary::Header::parse(data, size);
+        if (header.count != 1)
+            throw BadArgumentException("Expected a single tile in the binary tile message.");
+
+        return parseBinaryTile(header, data + TileBinary::getTileOffset(0));
+    }
+
     std::string generateID() const
     {
         std::ostringstream tileID;
@@ -762,6 +938,62 @@ public:
         return parse(StringVector::tokenize(message.data(), message.size()));
     }
 
+    /// Serialize this instance as a binary message of @kind, without the images.
+    std::string serializeBinary(TileBinary::Kind kind) const
+    {
+        assert(_tiles.size() <= std::numeric_limits<uint16_t>::max());
+
+        std::string out;
+        const TileBinary::Header header{ kind,
+                                         static_cast<uint16_t>(_tiles.size()),
+                                         _canonicalViewId,
+                                         _part,
+                                         _mode,
+                                         _width,
+                                         _height,
+                                         _tileWidth,
+                                         _tileHeight };
+        header.serialize(out);
+        for (const auto& tile : _tiles)
+            tile.serializeBinaryTile(out);
+
+        return out;
+    }
+
+    /// Deserialize a TileCombined from the binary message of @size bytes at @data.
+    /// Sets @imagesOffset to that of the images, which follow the header.
+    static TileCombined parseBinary(const char* data, std::size_t size, std::size_t& imagesOffset)
+    {
+        const TileBinary::Header header = TileBinary::Header::parse(data, size);
+        if (header.count == 0)
+            throw BadArgumentException("No tiles in the binary tile message.");
+
+        TileCombined result;
+        result._canonicalViewId = header.canonicalViewId;
+        result._part = header.part;
+        result._mode = header.mode;
+        result._width = header.width;
+        result._height = header.height;
+        result._tileWidth = header.tileWidth;
+        result._tileHeight = header.tileHeight;
+        result._isCombined = header.count > 1;
+
+        result._tiles.reserve(header.count);
+        for (std::size_t i = 0; i < header.count; ++i)
+        {
+            result._tiles.push_back(
+                TileDesc::parseBinaryTile(header, data + TileBinary::getTileOffset(i)));
+            const TileDesc& tile = result._tiles.back();
+            result._hasWids = result._hasWids || tile.getWireId() != 0;
+            result._hasOldWids = result._hasOldWids || tile.getOldWireId() != 0;
+            result._hasImgSizes = result._hasImgSizes || tile.getImgSize() != 0;
+            result._aabbox.extend(tile.toAABBox());
+        }
+
+        imagesOffset = header.getImagesOffset();
+        return result;
+    }
+
     static TileCombined create(const std::vector<TileDesc>& tiles)
     {
         assert(!tiles.empty());
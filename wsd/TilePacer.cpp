@@ -0,0 +1,149 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "TilePacer.hpp"
+
+#include <common/Log.hpp>
+#include <common/Util.hpp>
+
+#include <algorithm>
+
+namespace
+{
+/// Until we send some, assume tiles are this big.
+constexpr std::size_t DefaultTileBytes = 16 * 1024;
+} // namespace
+
+TilePacer::TilePacer()
+    : _bytesOnFly(0)
+    , _averageTileBytes(DefaultTileBytes)
+    , _delivered(0)
+{
+}
+
+void TilePacer::sent(TileWireId wireId, std::size_t bytes,
+                     std::chrono::steady_clock::time_point now)
+{
+    // Nothing was on the fly: the rate of delivery is measured from now.
+    if (_onFly.empty())
+        _deliveredTime = now;
+
+    _onFly.push_back({ wireId, bytes, now, _delivered, _deliveredTime });
+    _bytesOnFly += bytes;
+    _averageTileBytes = (_averageTileBytes * 7 + bytes) / 8;
+}
+
+bool TilePacer::acknowledged(TileWireId wireId, std::chrono::steady_clock::time_point now)
+{
+    const auto it = std::find_if(_onFly.begin(), _onFly.end(),
+                                 [wireId](const Tile& tile) { return tile.wireId == wireId; });
+    if (it == _onFly.end())
+        return false;
+
+    _bytesOnFly -= it->bytes;
+    _delivered += it->bytes;
+    _deliveredTime = now;
+
+    const auto oldest = now - FilterWindow;
+
+    const auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(now - it->sent);
+    while (!_rtt.empty() && _rtt.back().second >= rtt)
+        _rtt.pop_back();
+    _rtt.emplace_back(now, rtt);
+    while (_rtt.front().first < oldest)
+        _rtt.pop_front();
+
+    // All that was delivered since this tile was sent, over the time it took.
+    const double secs = std::chrono::duration<double>(now - it->deliveredTime).count();
+    if (secs > 0)
+    {
+        const double rate = (_delivered - it->delivered) / secs;
+        while (!_bandwidth.empty() && _bandwidth.back().second <= rate)
+            _bandwidth.pop_back();
+        _bandwidth.emplace_back(now, rate);
+        while (_bandwidth.front().first < oldest)
+            _bandwidth.pop_front();
+    }
+
+    _onFly.erase(it);
+    return true;
+}
+
+std::size_t TilePacer::expire(std::chrono::steady_clock::time_point now,
+                              std::chrono::milliseconds highTimeout,
+                              std::chrono::milliseconds lowTimeout)
+{
+    std::size_t dropped = 0;
+
+    // Check only the beginning of the list, tiles are ordered by timestamp.
+    while (!_onFly.empty())
+    {
+        const Tile& tile = _onFly.front();
+        const auto elapsed = now - tile.sent;
+        if (elapsed <= highTimeout && (dropped == 0 || elapsed <= lowTimeout))
+            break;
+
+        LOG_TRC("Tracker tileID " << tile.wireId << " was dropped because of time out ("
+                                  << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)
+                                  << "). Tileprocessed message did not arrive in time.");
+        _bytesOnFly -= tile.bytes;
+        _onFly.pop_front();
+        ++dropped;
+    }
+
+    return dropped;
+}
+
+double TilePacer::getBandwidth() const
+{
+    return _bandwidth.empty() ? 0 : _bandwidth.front().second;
+}
+
+std::chrono::microseconds TilePacer::getMinRtt() const
+{
+    return _rtt.empty() ? std::chrono::microseconds::zero() : _rtt.front().second;
+}
+
+std::size_t TilePacer::getWindowBytes() const
+{
+    if (_bandwidth.empty() || _rtt.empty())
+        return InitialWindowBytes;
+
+    const double bdp = getBandwidth() * std::chrono::duration<double>(getMinRtt()).count();
+    return std::clamp<std::size_t>(WindowGain * bdp, MinWindowBytes, MaxWindowBytes);
+}
+
+bool TilePacer::canSend(std::size_t pendingBytes, bool priority) const
+{
+    const std::size_t window = getWindowBytes();
+    return _bytesOnFly + pendingBytes < (priority ? window + MinWindowBytes : window);
+}
+
+void TilePacer::dumpState(std::ostream& os) const
+{
+    os << "\n\t\tonFlyCount: " << _onFly.size() << ", " << _bytesOnFly << " bytes";
+    if (!_onFly.empty())
+    {
+        const auto now = std::chrono::steady_clock::now();
+        os << " between wid: " << _onFly.front().wireId << " as of "
+           << std::chrono::duration_cast<std::chrono::milliseconds>(now - _onFly.front().sent)
+           << " and wid: " << _onFly.back().wireId << " as of "
+           << std::chrono::duration_cast<std::chrono::milliseconds>(now - _onFly.back().sent);
+    }
+
+    os << "\n\t\tonFlyWindow: " << getWindowBytes() << " bytes, bandwidth: "
+       << static_cast<uint64_t>(getBandwidth()) << " bytes/s, min rtt: "
+       << std::chrono::duration_cast<std::chrono::milliseconds>(getMinRtt());
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,105 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <wsd/TileDesc.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+
+/// Paces the tiles sent to a client, much like TCP congestion control.
+/// From the tileprocessed acknowledgements, it estimates the bandwidth to
+/// the client and the round-trip time, and keeps about the bytes the link
+/// holds, their product, on the fly. A client on a LAN then gets tiles as
+/// fast as it takes them, while one on 3G or a VPN no longer builds a
+/// queue of tiles that are stale by the time they arrive.
+/// Not thread-safe: owned by a ClientSession, in the DocumentBroker thread.
+class TilePacer
+{
+public:
+    /// Until we have estimates: about a screenful of tiles.
+    static constexpr std::size_t InitialWindowBytes = 1024 * 1024;
+    /// A couple of tiles, however slow the link.
+    static constexpr std::size_t MinWindowBytes = 64 * 1024;
+    static constexpr std::size_t MaxWindowBytes = 64 * 1024 * 1024;
+    /// The window is this many times the bandwidth-delay product, to keep the link busy.
+    static constexpr double WindowGain = 2;
+    /// How far back the max bandwidth and min round-trip time are taken from.
+    static constexpr std::chrono::seconds FilterWindow = std::chrono::seconds(10);
+
+    TilePacer();
+
+    /// A tile of @bytes, with @wireId, was handed to the socket at @now.
+    void sent(TileWireId wireId, std::size_t bytes, std::chrono::steady_clock::time_point now);
+
+    /// The client has processed the tile with @wireId at @now.
+    /// Returns false if we are not waiting for it.
+    bool acknowledged(TileWireId wireId, std::chrono::steady_clock::time_point now);
+
+    /// Gives up on the tiles sent @highTimeout before @now; once we do, also
+    /// on those sent @lowTimeout before, to drop a stalled batch in one go.
+    /// Returns the number of tiles given up on.
+    std::size_t expire(std::chrono::steady_clock::time_point now,
+                       std::chrono::milliseconds highTimeout,
+                       std::chrono::milliseconds lowTimeout);
+
+    /// True if we may send a tile with @pendingBytes about to be sent already,
+    /// i.e. queued or being rendered. Those @priority get a reserve beyond the window.
+    bool canSend(std::size_t pendingBytes, bool priority) const;
+
+    /// The bytes we aim to have on the fly.
+    std::size_t getWindowBytes() const;
+
+    std::size_t getBytesOnFly() const { return _bytesOnFly; }
+    std::size_t getTilesOnFly() const { return _onFly.size(); }
+
+    /// The average size of the tiles we send, to estimate those not rendered yet.
+    std::size_t getAverageTileBytes() const { return _averageTileBytes; }
+
+    /// The max delivery rate seen recently, in bytes per second, 0 if unknown.
+    double getBandwidth() const;
+
+    /// The min round-trip time seen recently, zero if unknown.
+    std::chrono::microseconds getMinRtt() const;
+
+    void dumpState(std::ostream& os) const;
+
+private:
+    struct Tile
+    {
+        TileWireId wireId;
+        std::size_t bytes;
+        std::chrono::steady_clock::time_point sent;
+        /// What had been delivered when sent, to find the rate of delivery since.
+        uint64_t delivered;
+        std::chrono::steady_clock::time_point deliveredTime;
+    };
+
+    /// The tiles on the fly, in the order sent.
+    std::deque<Tile> _onFly;
+    std::size_t _bytesOnFly;
+    std::size_t _averageTileBytes;
+
+    /// The bytes acknowledged so far, and when last.
+    uint64_t _delivered;
+    std::chrono::steady_clock::time_point _deliveredTime;
+
+    /// Decreasing rates and increasing round-trip times, oldest first: the
+    /// front is the max, or the min, of the FilterWindow.
+    std::deque<std::pair<std::chrono::steady_clock::time_point, double>> _bandwidth;
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::chrono::microseconds>> _rtt;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
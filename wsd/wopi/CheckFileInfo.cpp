@@ -29,7 +29,7 @@ bool CheckFileInfo::checkFileInfo(int redirectLimit)
     std::string uriAnonym = COOLWSD::anonymizeUrl(_url.toString());
 
     LOG_DBG("Getting info for wopi uri [" << uriAnonym << ']');
-    _httpSession = StorageConnectionManager::getHttpSession(_url);
+    _httpSession = StorageConnectionManager::getHttpSession(_url, _poll);
     Authorization auth = Authorization::create(_url);
     const http::Request httpRequest = StorageConnectionManager::createHttpRequest(_url, auth);
 
@@ -39,9 +39,12 @@ bool CheckFileInfo::checkFileInfo(int redirectLimit)
                                                            << httpRequest.header());
 
     http::Session::FinishedCallback finishedCallback =
-        [selfWeak = weak_from_this(), this, startTime,
+        [selfWeak = weak_from_this(), this, startTime, poll = std::weak_ptr<SocketPoll>(_poll),
          uriAnonym = std::move(uriAnonym), redirectLimit](const std::shared_ptr<http::Session>& session)
     {
+        // Keep the connection for the next request, GetFile typically.
+        StorageConnectionManager::returnHttpSession(session, poll);
+
         std::shared_ptr<CheckFileInfo> selfLifecycle = selfWeak.lock();
         if (!selfLifecycle)
             return;
@@ -168,7 +171,7 @@ bool CheckFileInfo::checkFileInfo(int redirectLimit)
     _state = State::Active;
 
     // Run the CheckFileInfo request on the WebServer Poll.
-    return _httpSession->asyncRequest(httpRequest, _poll);
+    return _httpSession->asyncRequest(httpRequest, _poll, /*asyncShutdownOnFinish=*/false);
 }
 
 void CheckFileInfo::checkFileInfoSync(int redirectionLimit)
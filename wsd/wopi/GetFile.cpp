@@ -0,0 +1,221 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "GetFile.hpp"
+
+#include <COOLWSD.hpp>
+#include <JailUtil.hpp>
+#include <common/ConfigUtil.hpp>
+#include <Log.hpp>
+#include <common/SigUtil.hpp>
+#include <wopi/StorageConnectionManager.hpp>
+
+GetFile::GetFile(const std::shared_ptr<TerminatingPoll>& poll, const Poco::URI& url,
+                 Authorization auth)
+    : _url(url)
+    , _auth(std::move(auth))
+    , _uriAnonym(COOLWSD::anonymizeUrl(url.toString()))
+    , _startTime(std::chrono::steady_clock::now())
+    , _poll(poll)
+    , _downloadedBytes(0)
+    , _totalBytes(0)
+    , _duration(std::chrono::milliseconds::zero())
+    , _state(State::None)
+{
+}
+
+bool GetFile::openFile()
+{
+    if (!_dir)
+    {
+        // Under the child-root, so it can be linked into the jail, rather than copied.
+        _dir = std::make_unique<FileUtil::OwnedFile>(
+            FileUtil::createRandomTmpDir(COOLWSD::ChildRoot +
+                                         JailUtil::CHILDROOT_TMP_INCOMING_PATH) +
+                '/',
+            /*recursive=*/true);
+        _filePath = _dir->_file + "contents";
+    }
+
+    // Truncate whatever a redirected request might have left.
+    _file.close();
+    _file.open(_filePath, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!_file.good())
+    {
+        LOG_ERR("Unable to open [" << _filePath << "] for WOPI::GetFile");
+        return false;
+    }
+
+    _downloadedBytes = 0;
+    _totalBytes = 0;
+    return true;
+}
+
+bool GetFile::getFile(int redirectLimit)
+{
+    LOG_DBG("Starting WOPI::GetFile ahead of loading from [" << _uriAnonym << ']');
+
+    if (!FileUtil::checkDiskSpace(COOLWSD::ChildRoot) || !openFile())
+    {
+        finish(State::Fail);
+        return false;
+    }
+
+    // Give up after a while; the DocumentBroker then downloads it again, and reports errors.
+    CONFIG_STATIC const std::chrono::seconds timeout =
+        ConfigUtil::getConfigValue<std::chrono::seconds>("storage.wopi.download_timeout_secs", 60);
+    _httpSession = StorageConnectionManager::getHttpSession(_url, _poll, timeout);
+    const http::Request httpRequest = StorageConnectionManager::createHttpRequest(_url, _auth);
+
+    LOG_TRC("WOPI::GetFile request header for URI [" << _uriAnonym << "]:\n"
+                                                     << httpRequest.header());
+
+    http::Session::FinishedCallback finishedCallback =
+        [selfWeak = weak_from_this(), this, poll = std::weak_ptr<SocketPoll>(_poll),
+         redirectLimit](const std::shared_ptr<http::Session>& session)
+    {
+        StorageConnectionManager::returnHttpSession(session, poll);
+
+        std::shared_ptr<GetFile> selfLifecycle = selfWeak.lock();
+        if (!selfLifecycle)
+            return;
+
+        if (SigUtil::getShutdownRequestFlag())
+        {
+            LOG_DBG("Shutdown flagged, giving up on in-flight requests");
+            finish(State::Fail);
+            return;
+        }
+
+        const std::shared_ptr<const http::Response> httpResponse = session->response();
+        const http::StatusCode statusCode = httpResponse->statusLine().statusCode();
+        if (statusCode == http::StatusCode::MovedPermanently ||
+            statusCode == http::StatusCode::Found ||
+            statusCode == http::StatusCode::TemporaryRedirect ||
+            statusCode == http::StatusCode::PermanentRedirect)
+        {
+            if (redirectLimit != 0)
+            {
+                const std::string location = httpResponse->get("Location");
+                LOG_TRC("WOPI::GetFile redirect to URI [" << COOLWSD::anonymizeUrl(location)
+                                                          << ']');
+
+                _url = Poco::URI(location);
+                getFile(redirectLimit - 1);
+                return;
+            }
+
+            LOG_WRN("WOPI::GetFile redirected too many times. Giving up on URI [" << _uriAnonym
+                                                                                  << ']');
+        }
+
+        _file.close();
+        if (httpResponse->state() != http::Response::State::Complete ||
+            statusCode != http::StatusCode::OK)
+        {
+            // Leave it to the DocumentBroker to retry and report the error.
+            LOG_WRN("WOPI::GetFile ahead of loading from ["
+                    << _uriAnonym << "] failed with " << http::Response::name(httpResponse->state())
+                    << ", status code: " << statusCode);
+            finish(State::Fail);
+            return;
+        }
+
+        _wopiCert = session->getSslCert(_subjectHash);
+        finish(State::Pass);
+
+        LOG_INF("WOPI::GetFile downloaded " << _downloadedBytes << " bytes from [" << _uriAnonym
+                                            << "] ahead of loading in " << _duration);
+    };
+
+    _httpSession->setFinishedHandler(std::move(finishedCallback));
+
+    http::Session::ConnectFailCallback connectFailCallback =
+        [selfWeak = weak_from_this(), this](const std::shared_ptr<http::Session>& /* httpSession */)
+    {
+        std::shared_ptr<GetFile> selfLifecycle = selfWeak.lock();
+        if (!selfLifecycle)
+            return;
+
+        LOG_ERR("Failed to start an async WOPI::GetFile request");
+        finish(State::Fail);
+    };
+
+    _httpSession->setConnectFailHandler(std::move(connectFailCallback));
+
+    // Stream straight to disk, counting as we go, for the progress.
+    IoWriteFunc onBodyWrite = [selfWeak = weak_from_this(), this](const char* p, int64_t len)
+    {
+        std::shared_ptr<GetFile> selfLifecycle = selfWeak.lock();
+        if (!selfLifecycle)
+            return static_cast<int64_t>(-1); // Abandoned; stop the transfer.
+
+        if (_downloadedBytes == 0 && _httpSession && _httpSession->response())
+        {
+            const int64_t contentLength = _httpSession->response()->header().getContentLength();
+            _totalBytes = contentLength > 0 ? contentLength : 0;
+        }
+
+        _file.write(p, len);
+        if (!_file.good())
+            return static_cast<int64_t>(-1);
+
+        _downloadedBytes += len;
+        if (_onProgress)
+            _onProgress(*this);
+
+        return len;
+    };
+
+    // We're in business.
+    _state = State::Active;
+
+    // Run the GetFile request on the same poll as CheckFileInfo.
+    if (!_httpSession->asyncDownload(httpRequest, std::move(onBodyWrite), _poll,
+                                     /*asyncShutdownOnFinish=*/false))
+    {
+        // The connect-fail handler might have finished us already.
+        if (!completed())
+            finish(State::Fail);
+        return false;
+    }
+
+    return true;
+}
+
+void GetFile::setCompletionCallback(Callback callback)
+{
+    if (completed())
+    {
+        callback(*this);
+        return;
+    }
+
+    _onComplete = std::move(callback);
+}
+
+void GetFile::finish(State state)
+{
+    _duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - _startTime);
+    _state = state;
+
+    // Only once, and without holding on to what the callbacks captured.
+    _onProgress = nullptr;
+    Callback onComplete = std::move(_onComplete);
+    _onComplete = nullptr;
+    if (onComplete)
+        onComplete(*this);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
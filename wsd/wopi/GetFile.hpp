@@ -0,0 +1,112 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#if MOBILEAPP
+#error This file should be excluded from Mobile App builds
+#endif // MOBILEAPP
+
+#include <FileUtil.hpp>
+#include <common/Authorization.hpp>
+#include <HttpRequest.hpp>
+#include <Socket.hpp>
+#include <StateEnum.hpp>
+
+#include <Poco/URI.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+
+/// Downloads a document from WOPI storage (GetFile) asynchronously,
+/// streaming it into a temporary file outside of any jail.
+/// Started as soon as CheckFileInfo succeeds, so the transfer overlaps
+/// with getting a Kit process and setting up the DocumentBroker, which
+/// takes over the file once it has completed.
+class GetFile : public std::enable_shared_from_this<GetFile>
+{
+public:
+    /// The GetFile State.
+    STATE_ENUM(State, None, Active, Fail, Pass);
+
+    /// Called on the poll as the download progresses, and once it completes.
+    using Callback = std::function<void(const GetFile&)>;
+
+    /// Create an instance to download @url with the given authorization.
+    GetFile(const std::shared_ptr<TerminatingPoll>& poll, const Poco::URI& url,
+            Authorization auth);
+
+    /// Returns the state of the request.
+    State state() const { return _state; }
+
+    bool completed() const { return _state != State::None && _state != State::Active; }
+
+    /// Start the request on the poll.
+    /// Return false if we couldn't start it.
+    bool getFile(int redirectLimit);
+
+    /// Called after each chunk of the document is written.
+    void setProgressCallback(Callback callback) { _onProgress = std::move(callback); }
+
+    /// Called once the download has completed, successfully or not.
+    /// Called right away when it already has. Must be set on the poll thread.
+    void setCompletionCallback(Callback callback);
+
+    /// The path of the downloaded file, once in the Pass state.
+    const std::string& filePath() const { return _filePath; }
+
+    /// The number of bytes downloaded so far.
+    uint64_t downloadedBytes() const { return _downloadedBytes; }
+
+    /// The size of the document, or 0 when the server didn't tell.
+    uint64_t totalBytes() const { return _totalBytes; }
+
+    /// How long the download took, once completed.
+    std::chrono::milliseconds duration() const { return _duration; }
+
+    /// The certificate of the WOPI host, and its subject hash, if any.
+    const std::string& wopiCert() const { return _wopiCert; }
+    const std::string& subjectHash() const { return _subjectHash; }
+
+private:
+    /// Creates the temporary directory and opens the file to download into.
+    bool openFile();
+
+    /// Sets the final state, and invokes the completion callback.
+    void finish(State state);
+
+    Poco::URI _url; ///< The URL to download. Can change through redirection.
+    const Authorization _auth;
+    const std::string _uriAnonym;
+    const std::chrono::steady_clock::time_point _startTime;
+    std::shared_ptr<http::Session> _httpSession;
+    std::shared_ptr<TerminatingPoll> _poll;
+    /// The temporary directory we download into, removed with us,
+    /// unless the file has been linked into the jail by then.
+    std::unique_ptr<FileUtil::OwnedFile> _dir;
+    std::string _filePath;
+    std::ofstream _file;
+    std::string _wopiCert;
+    std::string _subjectHash;
+    std::atomic<uint64_t> _downloadedBytes;
+    std::atomic<uint64_t> _totalBytes;
+    std::chrono::milliseconds _duration;
+    Callback _onProgress;
+    Callback _onComplete;
+    std::atomic<State> _state;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -45,6 +45,7 @@
 #include <Poco/Net/NameValueCollection.h>
 #include <Poco/Net/SSLManager.h>
 
+#include <algorithm>
 #include <cassert>
 
 #include <Poco/Exception.h>
@@ -54,6 +55,12 @@
 
 bool StorageConnectionManager::SSLAsScheme = true;
 bool StorageConnectionManager::SSLEnabled = false;
+bool StorageConnectionManager::KeepAlive = true;
+std::size_t StorageConnectionManager::MaxIdlePerHost = 4;
+std::size_t StorageConnectionManager::MaxIdle = 64;
+std::chrono::seconds StorageConnectionManager::IdleTimeout = std::chrono::seconds(15);
+std::mutex StorageConnectionManager::IdleSessionsMutex;
+std::vector<StorageConnectionManager::IdleSession> StorageConnectionManager::IdleSessions;
 
 namespace
 {
@@ -169,8 +176,133 @@ StorageConnectionManager::getHttpSession(const Poco::URI& uri, std::chrono::seco
     return httpSession;
 }
 
+std::shared_ptr<http::Session>
+StorageConnectionManager::getHttpSession(const Poco::URI& uri,
+                                         const std::shared_ptr<SocketPoll>& poll,
+                                         std::chrono::seconds timeout)
+{
+    std::shared_ptr<http::Session> httpSession = getHttpSession(uri, timeout);
+    if (!KeepAlive || !poll)
+        return httpSession;
+
+    const std::string key = getIdleKey(*httpSession);
+
+    std::lock_guard<std::mutex> lock(IdleSessionsMutex);
+    pruneIdleSessions(std::chrono::steady_clock::now());
+
+    // The most recently used is the least likely to have been closed by the server.
+    for (std::size_t i = IdleSessions.size(); i-- > 0;)
+    {
+        if (IdleSessions[i].key != key || IdleSessions[i].poll.lock() != poll)
+            continue;
+
+        // We are on the thread of its poll, so it can't change under us.
+        std::shared_ptr<http::Session> idleSession = std::move(IdleSessions[i].session);
+        IdleSessions.erase(IdleSessions.begin() + i);
+        if (idleSession->isConnected())
+        {
+            LOG_DBG("Reusing keep-alive connection #" << idleSession->getFD() << " to " << key
+                                                      << " on [" << poll->name() << ']');
+            idleSession->setTimeout(httpSession->getTimeout());
+            return idleSession;
+        }
+
+        // Otherwise, closed by the server in the meantime.
+    }
+
+    return httpSession;
+}
+
+void StorageConnectionManager::returnHttpSession(const std::shared_ptr<http::Session>& session,
+                                                 const std::weak_ptr<SocketPoll>& poll)
+{
+    std::shared_ptr<SocketPoll> socketPoll = poll.lock();
+    if (!session || !socketPoll)
+        return; // The socket goes with the poll.
+
+    // We are typically called from the finished handler of the session,
+    // so defer, as its handlers and response are still in use.
+    socketPoll->addCallback([session, poll]() { addIdleSession(session, poll); });
+}
+
+std::string StorageConnectionManager::getIdleKey(const http::Session& session)
+{
+    return std::string(session.getProtocolScheme()) + "://" + session.host() + ':' +
+           session.port();
+}
+
+void StorageConnectionManager::addIdleSession(const std::shared_ptr<http::Session>& session,
+                                              const std::weak_ptr<SocketPoll>& poll)
+{
+    // Don't keep our previous user alive, nor call it.
+    session->setFinishedHandler(nullptr);
+    session->setConnectFailHandler(nullptr);
+
+    if (!KeepAlive || !session->isReusable())
+    {
+        session->asyncShutdown();
+        return;
+    }
+
+    IdleSession idle{ getIdleKey(*session), poll, session, std::chrono::steady_clock::now() };
+
+    std::lock_guard<std::mutex> lock(IdleSessionsMutex);
+    pruneIdleSessions(idle.since);
+
+    const std::shared_ptr<SocketPoll> socketPoll = poll.lock();
+    const std::size_t count =
+        std::count_if(IdleSessions.begin(), IdleSessions.end(),
+                      [&](const IdleSession& other)
+                      { return other.key == idle.key && other.poll.lock() == socketPoll; });
+    if (count >= MaxIdlePerHost || IdleSessions.size() >= MaxIdle)
+    {
+        LOG_TRC("Too many idle connections, not keeping #" << session->getFD() << " to "
+                                                           << idle.key);
+        session->asyncShutdown();
+        return;
+    }
+
+    LOG_TRC("Keeping connection #" << session->getFD() << " to " << idle.key << " alive");
+    IdleSessions.push_back(std::move(idle));
+}
+
+void StorageConnectionManager::pruneIdleSessions(std::chrono::steady_clock::time_point now)
+{
+    IdleSessions.erase(std::remove_if(IdleSessions.begin(), IdleSessions.end(),
+                                      [now](const IdleSession& idle)
+                                      {
+                                          if (idle.poll.expired())
+                                              return true;
+
+                                          if (now - idle.since < IdleTimeout)
+                                              return false;
+
+                                          shutdownIdleSession(idle);
+                                          return true;
+                                      }),
+                       IdleSessions.end());
+}
+
+void StorageConnectionManager::shutdownIdleSession(const IdleSession& idle)
+{
+    std::shared_ptr<SocketPoll> socketPoll = idle.poll.lock();
+    if (socketPoll)
+    {
+        LOG_TRC("Shutting down idle connection to " << idle.key << " on [" << socketPoll->name()
+                                                     << ']');
+        socketPoll->addCallback([session = idle.session]() { session->asyncShutdown(); });
+    }
+}
+
 void StorageConnectionManager::initialize()
 {
+    KeepAlive = ConfigUtil::getConfigValue<bool>("storage.wopi.keepalive.enable", true);
+    MaxIdlePerHost =
+        ConfigUtil::getConfigValue<std::size_t>("storage.wopi.keepalive.max_idle_per_host", 4);
+    MaxIdle = ConfigUtil::getConfigValue<std::size_t>("storage.wopi.keepalive.max_idle", 64);
+    IdleTimeout = ConfigUtil::getConfigValue<std::chrono::seconds>(
+        "storage.wopi.keepalive.idle_timeout_secs", 15);
+
 #if ENABLE_SSL
     // FIXME: should use our own SSL socket implementation here.
     Poco::Crypto::initializeCrypto();
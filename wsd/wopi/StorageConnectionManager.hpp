@@ -16,8 +16,11 @@
 #include <net/HttpRequest.hpp>
 
 #include <chrono>
+#include <cstddef>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <Poco/URI.h>
 #include <Poco/Util/Application.h>
@@ -25,6 +28,12 @@
 /// A Storage Manager is responsible for the settings
 /// of Storage and the creation of http::Session and
 /// related objects.
+/// It also keeps idle keep-alive connections to the storage
+/// hosts, per SocketPoll, as a connection can't move between
+/// polls. The web-server poll does CheckFileInfo and GetFile
+/// of all new documents, so those reuse connections across
+/// documents, while each DocumentBroker reuses them for its
+/// lock refreshes and uploads.
 class StorageConnectionManager final
 {
 public:
@@ -47,6 +56,21 @@ public:
     getHttpSession(const Poco::URI& uri,
                    std::chrono::seconds timeout = std::chrono::seconds::zero());
 
+    /// Get an http::Session for a request on @poll, reusing an idle keep-alive
+    /// connection to the same host on that poll, if we have one, else a new one.
+    /// Must be called on the thread of @poll. To keep the connection alive, make
+    /// the request with asyncShutdownOnFinish of false and call returnHttpSession()
+    /// once it finishes.
+    static std::shared_ptr<http::Session>
+    getHttpSession(const Poco::URI& uri, const std::shared_ptr<SocketPoll>& poll,
+                   std::chrono::seconds timeout = std::chrono::seconds::zero());
+
+    /// Give back an http::Session from getHttpSession() once its request on
+    /// @poll finished, typically from its finished handler, to reuse it.
+    /// Connections that can't be reused, or that we don't want, are shut down.
+    static void returnHttpSession(const std::shared_ptr<http::Session>& session,
+                                  const std::weak_ptr<SocketPoll>& poll);
+
     /// Create an http::Request with the common headers.
     static http::Request createHttpRequest(const Poco::URI& uri, const Authorization& auth);
 
@@ -79,10 +103,46 @@ private:
     /// Saves new URI when resource was moved
     // void setUri(const Poco::URI& uri) { _uri = sanitizeUri(uri); }
 
+    /// An idle keep-alive connection.
+    struct IdleSession
+    {
+        std::string key; ///< The scheme, host and port.
+        std::weak_ptr<SocketPoll> poll; ///< Where the socket lives.
+        std::shared_ptr<http::Session> session;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    /// Returns the key of the idle connections that @session can share.
+    static std::string getIdleKey(const http::Session& session);
+
+    /// Adds @session to the idle connections, when it's reusable.
+    /// Called on the thread of @poll.
+    static void addIdleSession(const std::shared_ptr<http::Session>& session,
+                               const std::weak_ptr<SocketPoll>& poll);
+
+    /// Drops the idle connections of finished polls and shuts down the
+    /// ones idle for too long. Called with IdleSessionsMutex held.
+    static void pruneIdleSessions(std::chrono::steady_clock::time_point now);
+
+    /// Shuts down the connection of @idle on its poll.
+    static void shutdownIdleSession(const IdleSession& idle);
+
     /// If true, use only the WOPI URL for whether to use SSL to talk to storage server
     static bool SSLAsScheme;
     /// If true, force SSL communication with storage server
     static bool SSLEnabled;
+    /// If true, keep connections to the storage servers alive for reuse.
+    static bool KeepAlive;
+    /// The maximum number of idle connections to the same host on the same poll.
+    static std::size_t MaxIdlePerHost;
+    /// The maximum number of idle connections, in total.
+    static std::size_t MaxIdle;
+    /// How long to keep a connection idle before shutting it down.
+    static std::chrono::seconds IdleTimeout;
+
+    static std::mutex IdleSessionsMutex;
+    /// The idle connections, the most recently used last.
+    static std::vector<IdleSession> IdleSessions;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -12,6 +12,7 @@
 #include <config.h>
 
 #include "WopiStorage.hpp"
+#include "GetFile.hpp"
 
 #include <Auth.hpp>
 #include <CommandControl.hpp>
@@ -440,7 +441,7 @@ void WopiStorage::updateLockStateAsync(const Authorization& auth, LockContext& l
     const auto wopiLog = (lock == StorageBase::LockState::LOCK ? "WOPI::Lock" : "WOPI::Unlock");
     LOG_DBG(wopiLog << " requesting: " << uriAnonym);
 
-    _lockHttpSession = StorageConnectionManager::getHttpSession(uriObject);
+    _lockHttpSession = StorageConnectionManager::getHttpSession(uriObject, socketPoll);
 
     http::Request httpRequest = StorageConnectionManager::createHttpRequest(uriObject, auth);
     httpRequest.setVerb(http::Request::VERB_POST);
@@ -459,11 +460,14 @@ void WopiStorage::updateLockStateAsync(const Authorization& auth, LockContext& l
 
     http::Session::FinishedCallback finishedCallback =
         [this, startTime, lock, wopiLog, asyncLockStateCallback,
+         poll = std::weak_ptr<SocketPoll>(socketPoll),
          profileZone =
              std::move(profileZone)](const std::shared_ptr<http::Session>& httpSession)
     {
         profileZone->end();
 
+        StorageConnectionManager::returnHttpSession(httpSession, poll);
+
         // Retire.
         _lockHttpSession.reset();
 
@@ -517,7 +521,7 @@ void WopiStorage::updateLockStateAsync(const Authorization& auth, LockContext& l
         AsyncLockUpdate::State::Running, LockUpdateResult(LockUpdateResult::Status::OK, lock)));
 
     // Make the request.
-    _lockHttpSession->asyncRequest(httpRequest, socketPoll);
+    _lockHttpSession->asyncRequest(httpRequest, socketPoll, /*asyncShutdownOnFinish=*/false);
 }
 
 /// uri format: http://server/<...>/wopi*/files/<id>/content
@@ -528,6 +532,15 @@ std::string WopiStorage::downloadStorageFileToLocal(const Authorization& auth,
 {
     ProfileZone profileZone("WopiStorage::downloadStorageFileToLocal", { { "url", _fileUrl } });
 
+    if (_getFile && templateUri.empty())
+    {
+        const std::string path = adoptGetFile();
+        if (!path.empty())
+            return path;
+    }
+
+    _getFile.reset(); // We download it ourselves.
+
     if (!templateUri.empty())
     {
         // Download the template file and load it normally.
@@ -674,6 +687,40 @@ std::string WopiStorage::downloadDocument(const Poco::URI& uriObject, const std:
     LOG_INF("WOPI::GetFile downloaded " << filesize << " bytes from [" << uriAnonym << "] -> "
                                         << getRootFilePathAnonym() << " in " << diff);
 
+    return finishDownload(wopiCert, subjectHash);
+}
+
+std::string WopiStorage::adoptGetFile()
+{
+    std::shared_ptr<GetFile> getFile = std::move(_getFile);
+    if (getFile->state() != GetFile::State::Pass)
+    {
+        LOG_DBG("WOPI::GetFile ahead of loading " << GetFile::name(getFile->state())
+                                                  << ", will download again");
+        return std::string();
+    }
+
+    setRootFilePath(Poco::Path(getLocalRootPath(), getFileInfo().getFilename()).toString());
+    setRootFilePathAnonym(COOLWSD::anonymizeUrl(getRootFilePath()));
+
+    Poco::File(Poco::Path(getRootFilePath()).parent()).createDirectories();
+    if (!FileUtil::linkOrCopyFile(getFile->filePath(), getRootFilePath()))
+    {
+        LOG_ERR("Failed to move the document downloaded ahead of loading to ["
+                << getRootFilePathAnonym() << "], will download again");
+        return std::string();
+    }
+
+    LOG_INF("WOPI::GetFile took over " << getFile->downloadedBytes()
+                                       << " bytes downloaded ahead of loading in "
+                                       << getFile->duration() << " -> " << getRootFilePathAnonym());
+
+    return finishDownload(getFile->wopiCert(), getFile->subjectHash());
+}
+
+std::string WopiStorage::finishDownload(const std::string& wopiCert,
+                                        const std::string& subjectHash)
+{
     if (!wopiCert.empty() && !subjectHash.empty())
     {
         // Put the wopi server cert, which has been designated valid by 'online',
@@ -762,7 +809,7 @@ std::size_t WopiStorage::uploadLocalFileToStorageAsync(
     try
     {
         assert(!_uploadHttpSession && "Unexpected to have an upload http::session");
-        _uploadHttpSession = StorageConnectionManager::getHttpSession(uriObject);
+        _uploadHttpSession = StorageConnectionManager::getHttpSession(uriObject, socketPoll);
 
         http::Request httpRequest = StorageConnectionManager::createHttpRequest(uriObject, auth);
         httpRequest.setVerb(http::Request::VERB_POST);
@@ -841,11 +888,14 @@ std::size_t WopiStorage::uploadLocalFileToStorageAsync(
              filePathAnonym = std::move(filePathAnonym),
              uriAnonym = std::move(uriAnonym),
              size, isSaveAs, isRename, asyncUploadCallback,
+             poll = std::weak_ptr<SocketPoll>(socketPoll),
              profileZone = std::move(profileZone)](
                 const std::shared_ptr<http::Session>& httpSession)
         {
             profileZone->end();
 
+            StorageConnectionManager::returnHttpSession(httpSession, poll);
+
             // Retire.
             _uploadHttpSession.reset();
 
@@ -893,7 +943,8 @@ std::size_t WopiStorage::uploadLocalFileToStorageAsync(
             AsyncUpload(AsyncUpload::State::Running, UploadResult(UploadResult::Result::OK)));
 
         // Make the request.
-        _uploadHttpSession->asyncRequest(httpRequest, socketPoll);
+        _uploadHttpSession->asyncRequest(httpRequest, socketPoll,
+                                         /*asyncShutdownOnFinish=*/false);
 
         return size;
     }
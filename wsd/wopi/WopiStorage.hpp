@@ -28,6 +28,8 @@
 #include <optional>
 #include <string>
 
+class GetFile;
+
 /// WOPI protocol backed storage.
 class WopiStorage : public StorageBase
 {
@@ -221,6 +223,10 @@ public:
                               const Attributes& attribs, const std::shared_ptr<SocketPoll>& socketPoll,
                               const AsyncLockStateCallback& asyncLockStateCallback) override;
 
+    /// Use the document downloaded ahead of time by @getFile, when it
+    /// succeeded, instead of downloading it again.
+    void setGetFile(std::shared_ptr<GetFile> getFile) { _getFile = std::move(getFile); }
+
     /// uri format: http://server/<...>/wopi*/files/<id>/content
     std::string downloadStorageFileToLocal(const Authorization& auth, LockContext& lockCtx,
                                            const std::string& templateUri,
@@ -265,6 +271,14 @@ private:
     std::string downloadDocument(const Poco::URI& uriObject, const std::string& uriAnonym,
                                  const Authorization& auth, unsigned redirectLimit);
 
+    /// Takes over the document downloaded by _getFile.
+    /// Returns the jailed path, or empty if it couldn't be used.
+    std::string adoptGetFile();
+
+    /// Saves the certificate of the WOPI host for Core, marks the document
+    /// as downloaded, and returns its jailed path.
+    std::string finishDownload(const std::string& wopiCert, const std::string& subjectHash);
+
 private:
     /// A URl provided by the WOPI host to use for GetFile.
     std::string _fileUrl;
@@ -278,6 +292,9 @@ private:
     /// The http::Session used for locking asynchronously.
     std::shared_ptr<http::Session> _lockHttpSession;
 
+    /// The document downloaded ahead of time, if any.
+    std::shared_ptr<GetFile> _getFile;
+
     /// Filename converter to UTF-7.
     Util::CharacterConverter _utf7Converter;
 